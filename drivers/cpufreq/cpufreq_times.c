@@ -15,15 +15,33 @@
 
 #include <linux/cpufreq.h>
 #include <linux/cpufreq_times.h>
+#include <linux/cred.h>
+#include <linux/hashtable.h>
+#include <linux/init.h>
 #include <linux/jiffies.h>
+#include <linux/mutex.h>
+#include <linux/proc_fs.h>
 #include <linux/sched.h>
 #include <linux/seq_file.h>
+#include <linux/seqlock.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/task_work.h>
 #include <linux/threads.h>
+#include <linux/uaccess.h>
 #include <trace/hooks/cpufreq.h>
 
-static DEFINE_SPINLOCK(task_time_in_state_lock); /* task->time_in_state */
+#define UID_HASH_BITS 10
+
+/*
+ * Protects task->time_in_state against being reallocated or freed under a
+ * reader. The task itself updates the array without taking the lock, under
+ * task->time_in_state_seq, and only takes the lock when it has to grow it.
+ */
+static DEFINE_SPINLOCK(task_time_in_state_lock);
+static DEFINE_MUTEX(uid_lock); /* uid_hash_table updates */
+
+static DEFINE_HASHTABLE(uid_hash_table, UID_HASH_BITS);
 
 /**
  * struct cpu_freqs - per-cpu frequency information
@@ -39,10 +57,201 @@ struct cpu_freqs {
 	unsigned int freq_table[0];
 };
 
+/**
+ * struct uid_cpu_times - time in state of a uid on one cpu
+ * @seq: sequence count for readers folding the times of all the cpus
+ * @max_state: number of entries in @time_in_state
+ * @time_in_state: time spent at each frequency of the cpu, in ns
+ *
+ * Only updated by the cpu it belongs to, with interrupts disabled.
+ */
+struct uid_cpu_times {
+	seqcount_t seq;
+	unsigned int max_state;
+	u64 time_in_state[];
+};
+
+/**
+ * struct uid_entry - per-uid time in state statistics
+ * @uid: the uid
+ * @hash: node in uid_hash_table
+ * @rcu: frees the entry once removed
+ * @cpu_times: per-cpu accumulation buckets, allocated in process context for
+ *	       every cpu with a policy
+ *
+ * Entries are only looked up under RCU, as they may be removed by
+ * cpufreq_task_times_remove_uids().
+ */
+struct uid_entry {
+	uid_t uid;
+	struct hlist_node hash;
+	struct rcu_head rcu;
+	struct uid_cpu_times *cpu_times[];
+};
+
 static struct cpu_freqs *all_freqs[NR_CPUS];
 
 static unsigned int next_offset;
 
+static struct uid_entry *find_uid_entry(uid_t uid)
+{
+	struct uid_entry *uid_entry;
+
+	hash_for_each_possible_rcu(uid_hash_table, uid_entry, hash, uid) {
+		if (uid_entry->uid == uid)
+			return uid_entry;
+	}
+	return NULL;
+}
+
+/* Whether @uid_entry has a bucket for every cpu with a policy */
+static bool uid_entry_ready(struct uid_entry *uid_entry)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		if (all_freqs[cpu] && !READ_ONCE(uid_entry->cpu_times[cpu]))
+			return false;
+	}
+	return true;
+}
+
+/* Caller must hold uid_lock */
+static void uid_entry_fill(struct uid_entry *uid_entry)
+{
+	struct uid_cpu_times *times;
+	struct cpu_freqs *freqs;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		freqs = all_freqs[cpu];
+		if (!freqs || uid_entry->cpu_times[cpu])
+			continue;
+
+		times = kzalloc(struct_size(times, time_in_state,
+					    freqs->max_state), GFP_KERNEL);
+		if (!times)
+			return;
+		seqcount_init(&times->seq);
+		times->max_state = freqs->max_state;
+		/*
+		 * Pairs with smp_load_acquire() in uid_account() and
+		 * uid_time_in_state_fold()
+		 */
+		smp_store_release(&uid_entry->cpu_times[cpu], times);
+	}
+}
+
+/*
+ * Make sure @uid has an entry with a bucket for every cpu with a policy, so
+ * that the tick never has to allocate. Process context.
+ */
+static void uid_prepare(uid_t uid)
+{
+	struct uid_entry *uid_entry;
+	bool ready;
+
+	rcu_read_lock();
+	uid_entry = find_uid_entry(uid);
+	ready = uid_entry && uid_entry_ready(uid_entry);
+	rcu_read_unlock();
+	if (ready)
+		return;
+
+	mutex_lock(&uid_lock);
+	rcu_read_lock();
+	uid_entry = find_uid_entry(uid);
+	rcu_read_unlock();
+	if (!uid_entry) {
+		uid_entry = kzalloc(struct_size(uid_entry, cpu_times,
+						nr_cpu_ids), GFP_KERNEL);
+		if (!uid_entry)
+			goto out;
+		uid_entry->uid = uid;
+		hash_add_rcu(uid_hash_table, &uid_entry->hash, uid);
+	}
+	uid_entry_fill(uid_entry);
+out:
+	mutex_unlock(&uid_lock);
+}
+
+/*
+ * Called with interrupts disabled. Returns false if @p's uid has no bucket
+ * for @cpu yet.
+ */
+static bool uid_account(struct task_struct *p, int cpu, unsigned int index,
+			u64 cputime)
+{
+	struct uid_entry *uid_entry;
+	struct uid_cpu_times *times = NULL;
+	uid_t uid;
+
+	rcu_read_lock();
+	uid = from_kuid_munged(&init_user_ns, task_uid(p));
+	uid_entry = find_uid_entry(uid);
+	if (uid_entry)
+		times = smp_load_acquire(&uid_entry->cpu_times[cpu]);
+	if (times) {
+		write_seqcount_begin(&times->seq);
+		times->time_in_state[index] += cputime;
+		write_seqcount_end(&times->seq);
+	}
+	rcu_read_unlock();
+
+	return times;
+}
+
+/*
+ * Queued by the tick when a policy was created after @p's array was sized,
+ * or when @p's uid lacks a bucket, to allocate them in process context. It
+ * runs as @p on return to userspace, so the tick of @p can't update the
+ * array while it is replaced with interrupts off.
+ */
+static void cpufreq_task_times_prepare(struct callback_head *work)
+{
+	struct task_struct *p = container_of(work, struct task_struct,
+					     time_in_state_work);
+	unsigned int max_state = READ_ONCE(next_offset);
+	unsigned long flags;
+	u64 *temp, *old;
+
+	/* Let the tick queue it again, see cpufreq_task_times_queue() */
+	work->next = work;
+
+	uid_prepare(from_kuid_munged(&init_user_ns, current_uid()));
+
+	if (p->time_in_state && p->max_state >= max_state)
+		return;
+
+	temp = kcalloc(max_state, sizeof(p->time_in_state[0]), GFP_KERNEL);
+	if (!temp)
+		return;
+
+	spin_lock_irqsave(&task_time_in_state_lock, flags);
+	old = p->time_in_state;
+	if (old)
+		memcpy(temp, old, p->max_state * sizeof(u64));
+	p->time_in_state = temp;
+	p->max_state = max_state;
+	spin_unlock_irqrestore(&task_time_in_state_lock, flags);
+	kfree(old);
+}
+
+/*
+ * Kernel threads never return to userspace, so they only get the states of
+ * the policies that existed when they were forked.
+ */
+static void cpufreq_task_times_queue(struct task_struct *p)
+{
+	struct callback_head *work = &p->time_in_state_work;
+
+	/* Protect against double add, see cpufreq_task_times_prepare() */
+	if (work->next != work || p->flags & PF_KTHREAD)
+		return;
+
+	task_work_add(p, work, TWA_RESUME);
+}
+
 void cpufreq_task_times_init(struct task_struct *p)
 {
 	unsigned long flags;
@@ -51,6 +260,9 @@ void cpufreq_task_times_init(struct task_struct *p)
 	p->time_in_state = NULL;
 	spin_unlock_irqrestore(&task_time_in_state_lock, flags);
 	p->max_state = 0;
+	seqcount_init(&p->time_in_state_seq);
+	init_task_work(&p->time_in_state_work, cpufreq_task_times_prepare);
+	p->time_in_state_work.next = &p->time_in_state_work;
 }
 
 void cpufreq_task_times_alloc(struct task_struct *p)
@@ -58,9 +270,15 @@ void cpufreq_task_times_alloc(struct task_struct *p)
 	void *temp;
 	unsigned long flags;
 	unsigned int max_state = READ_ONCE(next_offset);
+	uid_t uid;
+
+	rcu_read_lock();
+	uid = from_kuid_munged(&init_user_ns, task_uid(p));
+	rcu_read_unlock();
+	uid_prepare(uid);
 
 	/* We use one array to avoid multiple allocs per task */
-	temp = kcalloc(max_state, sizeof(p->time_in_state[0]), GFP_ATOMIC);
+	temp = kcalloc(max_state, sizeof(p->time_in_state[0]), GFP_KERNEL);
 	if (!temp)
 		return;
 
@@ -70,22 +288,6 @@ void cpufreq_task_times_alloc(struct task_struct *p)
 	p->max_state = max_state;
 }
 
-/* Caller must hold task_time_in_state_lock */
-static int cpufreq_task_times_realloc_locked(struct task_struct *p)
-{
-	void *temp;
-	unsigned int max_state = READ_ONCE(next_offset);
-
-	temp = krealloc(p->time_in_state, max_state * sizeof(u64), GFP_ATOMIC);
-	if (!temp)
-		return -ENOMEM;
-	p->time_in_state = temp;
-	memset(p->time_in_state + p->max_state, 0,
-	       (max_state - p->max_state) * sizeof(u64));
-	p->max_state = max_state;
-	return 0;
-}
-
 void cpufreq_task_times_exit(struct task_struct *p)
 {
 	unsigned long flags;
@@ -101,6 +303,20 @@ void cpufreq_task_times_exit(struct task_struct *p)
 	kfree(temp);
 }
 
+/* Caller must hold task_time_in_state_lock */
+static u64 task_time_in_state_read(struct task_struct *p, unsigned int state)
+{
+	unsigned int seq;
+	u64 cputime;
+
+	do {
+		seq = read_seqcount_begin(&p->time_in_state_seq);
+		cputime = p->time_in_state[state];
+	} while (read_seqcount_retry(&p->time_in_state_seq, seq));
+
+	return cputime;
+}
+
 int proc_time_in_state_show(struct seq_file *m, struct pid_namespace *ns,
 	struct pid *pid, struct task_struct *p)
 {
@@ -122,7 +338,8 @@ int proc_time_in_state_show(struct seq_file *m, struct pid_namespace *ns,
 			cputime = 0;
 			if (freqs->offset + i < p->max_state &&
 			    p->time_in_state)
-				cputime = p->time_in_state[freqs->offset + i];
+				cputime = task_time_in_state_read(p,
+							freqs->offset + i);
 			seq_printf(m, "%u %lu\n", freqs->freq_table[i],
 				   (unsigned long)nsec_to_clock_t(cputime));
 		}
@@ -131,22 +348,43 @@ int proc_time_in_state_show(struct seq_file *m, struct pid_namespace *ns,
 	return 0;
 }
 
+/*
+ * Called for the task running on the local cpu, so p->time_in_state and the
+ * per-cpu uid buckets have a single writer and are updated without locking.
+ * Whatever is missing is allocated later from process context.
+ */
 void cpufreq_acct_update_power(struct task_struct *p, u64 cputime)
 {
 	unsigned long flags;
-	unsigned int state;
-	struct cpu_freqs *freqs = all_freqs[task_cpu(p)];
+	unsigned int index, state;
+	struct cpu_freqs *freqs;
+	int cpu;
 
-	if (!freqs || is_idle_task(p) || p->flags & PF_EXITING)
+	if (is_idle_task(p) || p->flags & PF_EXITING)
 		return;
 
-	state = freqs->offset + READ_ONCE(freqs->last_index);
+	local_irq_save(flags);
+	cpu = smp_processor_id();
+	freqs = all_freqs[cpu];
+	if (!freqs) {
+		local_irq_restore(flags);
+		return;
+	}
 
-	spin_lock_irqsave(&task_time_in_state_lock, flags);
-	if ((state < p->max_state || !cpufreq_task_times_realloc_locked(p)) &&
-	    p->time_in_state)
+	index = READ_ONCE(freqs->last_index);
+	state = freqs->offset + index;
+
+	if (state < p->max_state && p->time_in_state) {
+		write_seqcount_begin(&p->time_in_state_seq);
 		p->time_in_state[state] += cputime;
-	spin_unlock_irqrestore(&task_time_in_state_lock, flags);
+		write_seqcount_end(&p->time_in_state_seq);
+	} else {
+		cpufreq_task_times_queue(p);
+	}
+
+	if (!uid_account(p, cpu, index, cputime))
+		cpufreq_task_times_queue(p);
+	local_irq_restore(flags);
 
 	trace_android_vh_cpufreq_acct_update_power(cputime, p, state);
 }
@@ -212,3 +450,238 @@ void cpufreq_times_record_transition(struct cpufreq_policy *policy,
 	if (index >= 0)
 		WRITE_ONCE(freqs->last_index, index);
 }
+
+/*
+ * Fold the per-cpu buckets of @uid_entry into @times, indexed by offset.
+ * @times and @snapshot hold @max_state entries, policies past that are
+ * skipped.
+ */
+static void uid_time_in_state_fold(struct uid_entry *uid_entry, u64 *times,
+				   u64 *snapshot, unsigned int max_state)
+{
+	struct uid_cpu_times *cpu_times;
+	struct cpu_freqs *freqs;
+	unsigned int i, seq;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		freqs = all_freqs[cpu];
+		cpu_times = smp_load_acquire(&uid_entry->cpu_times[cpu]);
+		if (!freqs || !cpu_times ||
+		    freqs->offset + cpu_times->max_state > max_state)
+			continue;
+
+		do {
+			seq = read_seqcount_begin(&cpu_times->seq);
+			memcpy(snapshot, cpu_times->time_in_state,
+			       cpu_times->max_state * sizeof(u64));
+		} while (read_seqcount_retry(&cpu_times->seq, seq));
+
+		for (i = 0; i < cpu_times->max_state; i++)
+			times[freqs->offset + i] += snapshot[i];
+	}
+}
+
+static void *uid_seq_start(struct seq_file *seq, loff_t *pos)
+{
+	if (*pos >= HASH_SIZE(uid_hash_table))
+		return NULL;
+
+	return &uid_hash_table[*pos];
+}
+
+static void *uid_seq_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	do {
+		(*pos)++;
+
+		if (*pos >= HASH_SIZE(uid_hash_table))
+			return NULL;
+	} while (hlist_empty(&uid_hash_table[*pos]));
+
+	return &uid_hash_table[*pos];
+}
+
+static void uid_seq_stop(struct seq_file *seq, void *v) { }
+
+/**
+ * struct uid_seq_state - private data of a uid_time_in_state reader
+ * @max_state: number of entries in @times, at open time
+ * @times: folded time in state of the current uid
+ * @snapshot: copy of one per-cpu bucket, consistent with its sequence count
+ */
+struct uid_seq_state {
+	unsigned int max_state;
+	u64 *times;
+	u64 *snapshot;
+};
+
+static int uid_time_in_state_seq_show(struct seq_file *m, void *v)
+{
+	struct uid_seq_state *state = m->private;
+	struct cpu_freqs *freqs, *last_freqs = NULL;
+	struct uid_entry *uid_entry;
+	unsigned int i;
+	int cpu;
+
+	if (v == uid_hash_table) {
+		seq_puts(m, "uid:");
+		for_each_possible_cpu(cpu) {
+			freqs = all_freqs[cpu];
+			if (!freqs || freqs == last_freqs ||
+			    freqs->offset + freqs->max_state > state->max_state)
+				continue;
+			last_freqs = freqs;
+			for (i = 0; i < freqs->max_state; i++)
+				seq_put_decimal_ull(m, " ",
+						    freqs->freq_table[i]);
+		}
+		seq_putc(m, '\n');
+	}
+
+	rcu_read_lock();
+	hlist_for_each_entry_rcu(uid_entry, (struct hlist_head *)v, hash) {
+		memset(state->times, 0, state->max_state * sizeof(u64));
+		uid_time_in_state_fold(uid_entry, state->times,
+				       state->snapshot, state->max_state);
+
+		seq_put_decimal_ull(m, "", uid_entry->uid);
+		seq_putc(m, ':');
+		for (i = 0; i < state->max_state; i++)
+			seq_put_decimal_ull(m, " ",
+					    nsec_to_clock_t(state->times[i]));
+		seq_putc(m, '\n');
+	}
+	rcu_read_unlock();
+
+	return 0;
+}
+
+static const struct seq_operations uid_time_in_state_seq_ops = {
+	.start = uid_seq_start,
+	.next = uid_seq_next,
+	.stop = uid_seq_stop,
+	.show = uid_time_in_state_seq_show,
+};
+
+static int uid_time_in_state_open(struct inode *inode, struct file *file)
+{
+	unsigned int max_state = READ_ONCE(next_offset);
+	struct uid_seq_state *state;
+
+	state = __seq_open_private(file, &uid_time_in_state_seq_ops,
+				   sizeof(*state));
+	if (!state)
+		return -ENOMEM;
+
+	/*
+	 * Policies created later, by hotplug or a late cpufreq driver, are
+	 * left out until the file is opened again.
+	 */
+	state->max_state = max_state;
+	state->times = kcalloc(2 * max_state, sizeof(u64), GFP_KERNEL);
+	if (!state->times) {
+		seq_release_private(inode, file);
+		return -ENOMEM;
+	}
+	state->snapshot = state->times + max_state;
+
+	return 0;
+}
+
+static int uid_time_in_state_release(struct inode *inode, struct file *file)
+{
+	struct seq_file *m = file->private_data;
+	struct uid_seq_state *state = m->private;
+
+	kfree(state->times);
+
+	return seq_release_private(inode, file);
+}
+
+static void uid_entry_free_rcu(struct rcu_head *rcu)
+{
+	struct uid_entry *uid_entry = container_of(rcu, struct uid_entry, rcu);
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		kfree(uid_entry->cpu_times[cpu]);
+	kfree(uid_entry);
+}
+
+/**
+ * cpufreq_task_times_remove_uids - forget the time in state of some uids
+ * @uid_start: first uid to remove
+ * @uid_end: last uid to remove
+ *
+ * Like uid_sys_stats' remove_uid_range, for uids that are gone, e.g. the
+ * ones of uninstalled apps. A uid still running tasks gets a new entry.
+ */
+void cpufreq_task_times_remove_uids(uid_t uid_start, uid_t uid_end)
+{
+	struct uid_entry *uid_entry;
+	struct hlist_node *tmp;
+	int bkt;
+
+	mutex_lock(&uid_lock);
+	hash_for_each_safe(uid_hash_table, bkt, tmp, uid_entry, hash) {
+		if (uid_entry->uid < uid_start || uid_entry->uid > uid_end)
+			continue;
+
+		hash_del_rcu(&uid_entry->hash);
+		call_rcu(&uid_entry->rcu, uid_entry_free_rcu);
+	}
+	mutex_unlock(&uid_lock);
+}
+
+/* Writing "<start>-<end>" removes that uid range */
+static ssize_t uid_time_in_state_write(struct file *file,
+				       const char __user *buffer,
+				       size_t count, loff_t *ppos)
+{
+	char uids[128];
+	char *start_uid, *end_uid = NULL;
+	long int uid_start = 0, uid_end = 0;
+
+	if (count >= sizeof(uids))
+		count = sizeof(uids) - 1;
+
+	if (copy_from_user(uids, buffer, count))
+		return -EFAULT;
+
+	uids[count] = '\0';
+	end_uid = uids;
+	start_uid = strsep(&end_uid, "-");
+
+	if (!start_uid || !end_uid)
+		return -EINVAL;
+
+	if (kstrtol(start_uid, 10, &uid_start) != 0 ||
+	    kstrtol(end_uid, 10, &uid_end) != 0)
+		return -EINVAL;
+
+	if (uid_start < 0 || uid_end < uid_start)
+		return -EINVAL;
+
+	cpufreq_task_times_remove_uids(uid_start, uid_end);
+
+	return count;
+}
+
+static const struct proc_ops uid_time_in_state_proc_ops = {
+	.proc_open	= uid_time_in_state_open,
+	.proc_read	= seq_read,
+	.proc_write	= uid_time_in_state_write,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= uid_time_in_state_release,
+};
+
+static int __init cpufreq_times_init(void)
+{
+	proc_create("uid_time_in_state", 0644, NULL,
+		    &uid_time_in_state_proc_ops);
+
+	return 0;
+}
+
+early_initcall(cpufreq_times_init);
@@ -20,6 +20,7 @@
 #include <linux/cpuidle.h>
 #include <linux/ktime.h>
 #include <linux/hrtimer.h>
+#include <linux/interrupt.h>
 #include <linux/module.h>
 #include <linux/suspend.h>
 #include <linux/tick.h>
@@ -769,9 +770,17 @@ static int __init cpuidle_init(void)
 	if (cpuidle_disabled())
 		return -ENODEV;
 
+#ifdef CONFIG_CPU_IDLE_GOV_IRQ_TIMINGS
+	if (param_irq_timings)
+		irq_timings_enable();
+#endif
+
 	return cpuidle_add_interface(cpu_subsys.dev_root);
 }
 
 module_param(off, int, 0444);
 module_param_string(governor, param_governor, CPUIDLE_NAME_LEN, 0444);
+#ifdef CONFIG_CPU_IDLE_GOV_IRQ_TIMINGS
+module_param_named(irq_timings, param_irq_timings, bool, 0444);
+#endif
 core_initcall(cpuidle_init);
@@ -25,6 +25,9 @@ extern void cpuidle_uninstall_idle_handler(void);
 /* governors */
 extern struct cpuidle_governor *cpuidle_find_governor(const char *str);
 extern int cpuidle_switch_governor(struct cpuidle_governor *gov);
+#ifdef CONFIG_CPU_IDLE_GOV_IRQ_TIMINGS
+extern bool param_irq_timings;
+#endif
 
 /* sysfs */
 
@@ -10,13 +10,18 @@
 
 #include <linux/cpu.h>
 #include <linux/cpuidle.h>
+#include <linux/interrupt.h>
 #include <linux/mutex.h>
 #include <linux/module.h>
 #include <linux/pm_qos.h>
+#include <linux/sched/clock.h>
 
 #include "cpuidle.h"
 
 char param_governor[CPUIDLE_NAME_LEN];
+#ifdef CONFIG_CPU_IDLE_GOV_IRQ_TIMINGS
+bool param_irq_timings __read_mostly;
+#endif
 
 LIST_HEAD(cpuidle_governors);
 struct cpuidle_governor *cpuidle_curr_governor;
@@ -120,3 +125,29 @@ s64 cpuidle_governor_latency_req(unsigned int cpu)
 	return (s64)device_req * NSEC_PER_USEC;
 }
 EXPORT_SYMBOL_GPL(cpuidle_governor_latency_req);
+
+#ifdef CONFIG_CPU_IDLE_GOV_IRQ_TIMINGS
+/**
+ * cpuidle_governor_irq_next_ns - Time till the next predicted device interrupt
+ *
+ * Return the time in ns till the next interrupt expected on the local CPU
+ * according to the IRQ timings, or KTIME_MAX if there is no prediction or
+ * the prediction has not been enabled with cpuidle.irq_timings=1.
+ *
+ * Must be called with interrupts disabled.
+ */
+s64 cpuidle_governor_irq_next_ns(void)
+{
+	u64 now, next;
+
+	if (!param_irq_timings)
+		return KTIME_MAX;
+
+	now = local_clock();
+	next = irq_timings_next_event(now);
+	if (next == U64_MAX)
+		return KTIME_MAX;
+
+	return next > now ? min_t(u64, next - now, KTIME_MAX) : 0;
+}
+#endif
@@ -307,6 +307,8 @@ static int menu_select(struct cpuidle_driver *drv, struct cpuidle_device *dev,
 	predicted_ns = (u64)min(predicted_us,
 				get_typical_interval(data, predicted_us)) *
 				NSEC_PER_USEC;
+	/* A device interrupt may be predicted to wake the CPU up earlier. */
+	predicted_ns = min_t(u64, predicted_ns, cpuidle_governor_irq_next_ns());
 
 	if (tick_nohz_tick_stopped()) {
 		/*
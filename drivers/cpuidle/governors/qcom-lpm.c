@@ -30,11 +30,6 @@
 #define CREATE_TRACE_POINTS
 #include "trace-qcom-lpm.h"
 
-#define LPM_PRED_RESET				0
-#define LPM_PRED_RESIDENCY_PATTERN		1
-#define LPM_PRED_PREMATURE_EXITS		2
-#define LPM_PRED_IPI_PATTERN			3
-
 #define LPM_SELECT_STATE_DISABLED		0
 #define LPM_SELECT_STATE_QOS_UNMET		1
 #define LPM_SELECT_STATE_RESIDENCY_UNMET	2
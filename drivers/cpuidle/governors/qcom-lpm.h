@@ -15,6 +15,11 @@
 #define CLUST_SMPL_INVLD_TIME	40000
 #define MAX_CLUSTER_STATES	4
 
+#define LPM_PRED_RESET			0
+#define LPM_PRED_RESIDENCY_PATTERN	1
+#define LPM_PRED_PREMATURE_EXITS	2
+#define LPM_PRED_IPI_PATTERN		3
+
 extern bool sleep_disabled;
 extern bool prediction_disabled;
 
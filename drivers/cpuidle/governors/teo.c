@@ -390,6 +390,12 @@ static int teo_select(struct cpuidle_driver *drv, struct cpuidle_device *dev,
 	cpu_data->time_span_ns = local_clock();
 
 	duration_ns = tick_nohz_get_sleep_length(&delta_tick);
+	/*
+	 * If a device interrupt is predicted to occur before the closest timer,
+	 * treat it like a timer, so that the wakeups it causes are counted as
+	 * "hits" instead of inflating the "intercepts" metrics.
+	 */
+	duration_ns = min_t(s64, duration_ns, cpuidle_governor_irq_next_ns());
 	cpu_data->sleep_length_ns = duration_ns;
 
 	/* Check if there is any choice in the first place. */
@@ -6,7 +6,31 @@
 #include "allowedips.h"
 #include "peer.h"
 
-enum { MAX_ALLOWEDIPS_DEPTH = 129 };
+enum { MAX_ALLOWEDIPS_DEPTH = 129, MNODE_SLOTS = 256 };
+
+/* A level of the multibit trie, indexed by one byte of the address. Leaves
+ * hold, for every slot, the longest prefix ending in this level, expanded to
+ * whole bytes and stored as runs, so that a /1 costs as much as a /8. Which
+ * array entry belongs to a slot is the popcount of the bitmaps up to it, and
+ * both bitmaps together fill exactly the first cache line. Nodes are never
+ * modified once published, except for swapping in a new child.
+ */
+struct allowedips_mnode {
+	u64 child_map[MNODE_SLOTS / 64];
+	u64 leaf_map[MNODE_SLOTS / 64];
+	struct rcu_head rcu;
+	u16 children;
+	union {
+		struct allowedips_mnode __rcu *child;
+		struct wg_peer __rcu *peer;
+	} slot[]; /* children first, then one peer per run of leaves */
+};
+
+/* Scratch space for building a node from the binary trie */
+struct mnode_build {
+	struct wg_peer *leaf[MNODE_SLOTS];
+	u64 child_map[MNODE_SLOTS / 64];
+};
 
 static struct kmem_cache *node_cache;
 
@@ -146,6 +170,303 @@ static struct wg_peer *lookup(struct allowedips_node __rcu *root, u8 bits,
 	return peer;
 }
 
+static inline unsigned int mnode_rank(const u64 *map, u8 slot)
+{
+	unsigned int i, rank = hweight64(map[slot / 64] & (~0ULL >> (63 - slot % 64)));
+
+	for (i = 0; i < slot / 64; ++i)
+		rank += hweight64(map[i]);
+	return rank;
+}
+
+static inline bool mnode_has_child(const struct allowedips_mnode *node, u8 slot)
+{
+	return node->child_map[slot / 64] & BIT_ULL(slot % 64);
+}
+
+static struct wg_peer *mnode_find(struct allowedips_mnode *node, u8 bits,
+				  const u8 *be_key)
+{
+	struct wg_peer *found = NULL, *peer;
+	unsigned int i;
+	u8 slot;
+
+	for (i = 0; node && i < bits / 8U; ++i) {
+		slot = be_key[i];
+		peer = rcu_dereference_bh(node->slot[node->children +
+				mnode_rank(node->leaf_map, slot) - 1].peer);
+		if (peer)
+			found = peer;
+		if (!mnode_has_child(node, slot))
+			break;
+		node = rcu_dereference_bh(node->slot[mnode_rank(node->child_map, slot) - 1].child);
+	}
+	return found;
+}
+
+/* Returns a strong reference to a peer */
+static struct wg_peer *lookup_mnode(struct allowedips_mnode __rcu *root, u8 bits,
+				    const void *be_ip)
+{
+	struct wg_peer *peer;
+
+	rcu_read_lock_bh();
+retry:
+	peer = mnode_find(rcu_dereference_bh(root), bits, be_ip);
+	if (peer) {
+		peer = wg_peer_get_maybe_zero(peer);
+		if (!peer)
+			goto retry;
+	}
+	rcu_read_unlock_bh();
+	return peer;
+}
+
+static bool be_prefix_matches(const u8 *a, const u8 *b, u8 cidr)
+{
+	if (memcmp(a, b, cidr / 8U))
+		return false;
+	return !(cidr % 8U) || !((a[cidr / 8U] ^ b[cidr / 8U]) & (0xff00U >> (cidr % 8U)));
+}
+
+/* Collects, from the binary trie, the leaves and children of the node at
+ * @depth on the path of @key. The prefixes ending in a level are those with
+ * a cidr in (8 * depth, 8 * depth + 8], plus /0 for the first one.
+ */
+static void mnode_scan(struct allowedips_node *root, u8 bits, const u8 *key,
+		       u8 depth, struct mnode_build *build, struct mutex *lock)
+{
+	struct allowedips_node *node, *stack[MAX_ALLOWEDIPS_DEPTH] = { root };
+	u8 ip[16] __aligned(__alignof(u64)), cidr, lo = depth * 8U, fixed;
+	unsigned int len = 1, i;
+	struct wg_peer *peer;
+
+	memset(build, 0, sizeof(*build));
+	while (len > 0 && (node = stack[--len])) {
+		wg_allowedips_read_node(node, ip, &cidr);
+		if (!be_prefix_matches(ip, key, min(cidr, lo)))
+			continue;
+		if (cidr > lo + 8U) {
+			build->child_map[ip[depth] / 64] |= BIT_ULL(ip[depth] % 64);
+			continue;
+		}
+		peer = rcu_dereference_protected(node->peer, lockdep_is_held(lock));
+		if (peer && (cidr > lo || !depth)) {
+			/* Parents are visited before their children, so the
+			 * longest prefix is the one left in each slot.
+			 */
+			fixed = cidr - lo;
+			for (i = 0; i < 1U << (8U - fixed); ++i)
+				build->leaf[ip[depth] + i] = peer;
+		}
+		push_rcu(stack, node->bit[0], &len);
+		push_rcu(stack, node->bit[1], &len);
+	}
+}
+
+/* Returns NULL if the node would be empty, with the child slots unset. */
+static struct allowedips_mnode *mnode_alloc(const struct mnode_build *build)
+{
+	unsigned int children = 0, leaves = 0, i, j;
+	struct allowedips_mnode *node;
+
+	for (i = 0; i < MNODE_SLOTS / 64; ++i)
+		children += hweight64(build->child_map[i]);
+	for (i = 0; i < MNODE_SLOTS; ++i)
+		leaves += !i || build->leaf[i] != build->leaf[i - 1];
+	if (!children && leaves == 1 && !build->leaf[0])
+		return NULL;
+
+	node = kzalloc(L1_CACHE_ALIGN(struct_size(node, slot, children + leaves)),
+		       GFP_KERNEL);
+	if (unlikely(!node))
+		return ERR_PTR(-ENOMEM);
+	memcpy(node->child_map, build->child_map, sizeof(node->child_map));
+	node->children = children;
+	for (i = 0, j = children; i < MNODE_SLOTS; ++i) {
+		if (i && build->leaf[i] == build->leaf[i - 1])
+			continue;
+		node->leaf_map[i / 64] |= BIT_ULL(i % 64);
+		RCU_INIT_POINTER(node->slot[j++].peer, build->leaf[i]);
+	}
+	return node;
+}
+
+static struct allowedips_mnode __rcu **mnode_child(struct allowedips_mnode *node,
+						   u8 slot)
+{
+	if (!node || !mnode_has_child(node, slot))
+		return NULL;
+	return &node->slot[mnode_rank(node->child_map, slot) - 1].child;
+}
+
+static void mnode_free_tree(struct allowedips_mnode *node)
+{
+	struct allowedips_mnode *child;
+	unsigned int i;
+
+	/* At most 16 levels deep, so recursing is fine. */
+	for (i = 0; i < node->children; ++i) {
+		child = rcu_dereference_raw(node->slot[i].child);
+		if (child)
+			mnode_free_tree(child);
+	}
+	kfree(node);
+}
+
+static void mnode_free_rcu(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct allowedips_mnode, rcu));
+}
+
+static void mnode_free_tree_rcu(struct rcu_head *rcu)
+{
+	mnode_free_tree(container_of(rcu, struct allowedips_mnode, rcu));
+}
+
+static struct allowedips_mnode *mnode_build_tree(struct allowedips_node *root,
+						 u8 bits, u8 *key, u8 depth,
+						 struct mnode_build *build,
+						 struct mutex *lock)
+{
+	struct allowedips_mnode *node, *child;
+	unsigned int slot, i = 0;
+
+	mnode_scan(root, bits, key, depth, build, lock);
+	node = mnode_alloc(build);
+	if (IS_ERR_OR_NULL(node))
+		return node;
+	for (slot = 0; slot < MNODE_SLOTS; ++slot) {
+		if (!mnode_has_child(node, slot))
+			continue;
+		key[depth] = slot;
+		child = mnode_build_tree(root, bits, key, depth + 1, build, lock);
+		if (IS_ERR(child)) {
+			mnode_free_tree(node);
+			return child;
+		}
+		RCU_INIT_POINTER(node->slot[i++].child, child);
+	}
+	return node;
+}
+
+/* Builds a replacement for @old, sharing its children but the one at
+ * key[depth], which becomes @child if @replace is set.
+ */
+static struct allowedips_mnode *
+mnode_rebuild(struct allowedips_node *root, u8 bits, const u8 *key, u8 depth,
+	      struct allowedips_mnode *old, struct allowedips_mnode *child,
+	      bool replace, struct mnode_build *build, struct mutex *lock)
+{
+	struct allowedips_mnode __rcu **old_child;
+	struct allowedips_mnode *node, *src;
+	unsigned int slot, i = 0;
+
+	mnode_scan(root, bits, key, depth, build, lock);
+	node = mnode_alloc(build);
+	if (IS_ERR_OR_NULL(node))
+		return node;
+	for (slot = 0; slot < MNODE_SLOTS; ++slot) {
+		if (!mnode_has_child(node, slot))
+			continue;
+		if (replace && slot == key[depth]) {
+			src = child;
+		} else {
+			old_child = mnode_child(old, slot);
+			src = old_child ? rcu_dereference_protected(*old_child,
+						lockdep_is_held(lock)) : NULL;
+		}
+		if (WARN_ON_ONCE(!src)) {
+			kfree(node);
+			return ERR_PTR(-EINVAL);
+		}
+		RCU_INIT_POINTER(node->slot[i++].child, src);
+	}
+	return node;
+}
+
+/* Brings the multibit trie in line with the binary one, after the prefix
+ * @be_key/@cidr was added to or removed from it. Only the level the prefix
+ * ends in is rebuilt, and its parent swaps in the new copy, unless the level
+ * appeared or went away, in which case the parent is rebuilt too, and so on.
+ * If memory runs out, lookups fall back to the binary trie until the next
+ * update manages to build the whole thing again.
+ */
+static void mnode_update(struct allowedips *table, u8 bits, const u8 *be_key,
+			 u8 cidr, struct mutex *lock)
+{
+	struct allowedips_mnode __rcu **mroot = bits == 32 ? &table->mroot4 : &table->mroot6;
+	bool *valid = bits == 32 ? &table->mroot4_valid : &table->mroot6_valid;
+	struct allowedips_mnode *old[16] = { NULL }, *built[16] = { NULL };
+	struct allowedips_mnode __rcu **ptr;
+	struct allowedips_mnode *node;
+	struct allowedips_node *root;
+	struct mnode_build *build;
+	u8 key[16], depth = cidr ? (cidr - 1U) / 8U : 0;
+	int i, j;
+
+	root = rcu_dereference_protected(bits == 32 ? table->root4 : table->root6,
+					 lockdep_is_held(lock));
+	memcpy(key, be_key, bits / 8U);
+	build = kmalloc(sizeof(*build), GFP_KERNEL);
+	if (unlikely(!build))
+		goto invalidate;
+
+	if (!*valid) {
+		node = mnode_build_tree(root, bits, key, 0, build, lock);
+		if (!IS_ERR(node)) {
+			rcu_assign_pointer(*mroot, node);
+			smp_store_release(valid, true);
+		}
+		goto out;
+	}
+
+	node = rcu_dereference_protected(*mroot, lockdep_is_held(lock));
+	for (i = 0; node && i <= depth; ++i) {
+		old[i] = node;
+		ptr = mnode_child(node, key[i]);
+		node = ptr ? rcu_dereference_protected(*ptr, lockdep_is_held(lock)) : NULL;
+	}
+
+	node = NULL;
+	for (i = depth; i >= 0; --i) {
+		node = mnode_rebuild(root, bits, key, i, old[i], node, i < depth,
+				     build, lock);
+		if (IS_ERR(node))
+			goto free_built;
+		built[i] = node;
+		if (!i) {
+			rcu_assign_pointer(*mroot, node);
+			break;
+		}
+		if (old[i] && node) {
+			ptr = mnode_child(old[i - 1], key[i - 1]);
+			rcu_assign_pointer(*ptr, node);
+			break;
+		}
+		if (!old[i] && !node)
+			break;
+	}
+	for (j = i; j <= depth; ++j) {
+		if (old[j])
+			call_rcu(&old[j]->rcu, mnode_free_rcu);
+	}
+	goto out;
+
+free_built:
+	/* Children of these were either shared or are in this array too. */
+	for (j = i + 1; j <= depth; ++j)
+		kfree(built[j]);
+invalidate:
+	WRITE_ONCE(*valid, false);
+	node = rcu_dereference_protected(*mroot, lockdep_is_held(lock));
+	RCU_INIT_POINTER(*mroot, NULL);
+	if (node)
+		call_rcu(&node->rcu, mnode_free_tree_rcu);
+out:
+	kfree(build);
+}
+
 static bool node_placement(struct allowedips_node __rcu *trie, const u8 *key,
 			   u8 cidr, u8 bits, struct allowedips_node **rnode,
 			   struct mutex *lock)
@@ -252,16 +573,28 @@ static int add(struct allowedips_node __rcu **trie, u8 bits, const u8 *key,
 void wg_allowedips_init(struct allowedips *table)
 {
 	table->root4 = table->root6 = NULL;
+	table->mroot4 = table->mroot6 = NULL;
+	table->mroot4_valid = table->mroot6_valid = true;
 	table->seq = 1;
 }
 
 void wg_allowedips_free(struct allowedips *table, struct mutex *lock)
 {
 	struct allowedips_node __rcu *old4 = table->root4, *old6 = table->root6;
+	struct allowedips_mnode __rcu *mold4 = table->mroot4, *mold6 = table->mroot6;
 
 	++table->seq;
 	RCU_INIT_POINTER(table->root4, NULL);
 	RCU_INIT_POINTER(table->root6, NULL);
+	RCU_INIT_POINTER(table->mroot4, NULL);
+	RCU_INIT_POINTER(table->mroot6, NULL);
+	table->mroot4_valid = table->mroot6_valid = true;
+	if (rcu_access_pointer(mold4))
+		call_rcu(&rcu_dereference_protected(mold4, lockdep_is_held(lock))->rcu,
+			 mnode_free_tree_rcu);
+	if (rcu_access_pointer(mold6))
+		call_rcu(&rcu_dereference_protected(mold6, lockdep_is_held(lock))->rcu,
+			 mnode_free_tree_rcu);
 	if (rcu_access_pointer(old4)) {
 		struct allowedips_node *node = rcu_dereference_protected(old4,
 							lockdep_is_held(lock));
@@ -283,10 +616,14 @@ int wg_allowedips_insert_v4(struct allowedips *table, const struct in_addr *ip,
 {
 	/* Aligned so it can be passed to fls */
 	u8 key[4] __aligned(__alignof(u32));
+	int ret;
 
 	++table->seq;
 	swap_endian(key, (const u8 *)ip, 32);
-	return add(&table->root4, 32, key, cidr, peer, lock);
+	ret = add(&table->root4, 32, key, cidr, peer, lock);
+	if (!ret)
+		mnode_update(table, 32, (const u8 *)ip, cidr, lock);
+	return ret;
 }
 
 int wg_allowedips_insert_v6(struct allowedips *table, const struct in6_addr *ip,
@@ -294,49 +631,64 @@ int wg_allowedips_insert_v6(struct allowedips *table, const struct in6_addr *ip,
 {
 	/* Aligned so it can be passed to fls64 */
 	u8 key[16] __aligned(__alignof(u64));
+	int ret;
 
 	++table->seq;
 	swap_endian(key, (const u8 *)ip, 128);
-	return add(&table->root6, 128, key, cidr, peer, lock);
+	ret = add(&table->root6, 128, key, cidr, peer, lock);
+	if (!ret)
+		mnode_update(table, 128, (const u8 *)ip, cidr, lock);
+	return ret;
+}
+
+static void remove_node(struct allowedips_node *node, struct mutex *lock)
+{
+	struct allowedips_node *child, **parent_bit, *parent;
+	bool free_parent;
+
+	list_del_init(&node->peer_list);
+	RCU_INIT_POINTER(node->peer, NULL);
+	if (node->bit[0] && node->bit[1])
+		return;
+	child = rcu_dereference_protected(node->bit[!rcu_access_pointer(node->bit[0])],
+					  lockdep_is_held(lock));
+	if (child)
+		child->parent_bit_packed = node->parent_bit_packed;
+	parent_bit = (struct allowedips_node **)(node->parent_bit_packed & ~3UL);
+	*parent_bit = child;
+	parent = (void *)parent_bit -
+		 offsetof(struct allowedips_node, bit[node->parent_bit_packed & 1]);
+	free_parent = !rcu_access_pointer(node->bit[0]) &&
+		      !rcu_access_pointer(node->bit[1]) &&
+		      (node->parent_bit_packed & 3) <= 1 &&
+		      !rcu_access_pointer(parent->peer);
+	if (free_parent)
+		child = rcu_dereference_protected(
+				parent->bit[!(node->parent_bit_packed & 1)],
+				lockdep_is_held(lock));
+	call_rcu(&node->rcu, node_free_rcu);
+	if (!free_parent)
+		return;
+	if (child)
+		child->parent_bit_packed = parent->parent_bit_packed;
+	*(struct allowedips_node **)(parent->parent_bit_packed & ~3UL) = child;
+	call_rcu(&parent->rcu, node_free_rcu);
 }
 
 void wg_allowedips_remove_by_peer(struct allowedips *table,
 				  struct wg_peer *peer, struct mutex *lock)
 {
-	struct allowedips_node *node, *child, **parent_bit, *parent, *tmp;
-	bool free_parent;
+	u8 ip[16] __aligned(__alignof(u64)), cidr, bits;
+	struct allowedips_node *node, *tmp;
 
 	if (list_empty(&peer->allowedips_list))
 		return;
 	++table->seq;
 	list_for_each_entry_safe(node, tmp, &peer->allowedips_list, peer_list) {
-		list_del_init(&node->peer_list);
-		RCU_INIT_POINTER(node->peer, NULL);
-		if (node->bit[0] && node->bit[1])
-			continue;
-		child = rcu_dereference_protected(node->bit[!rcu_access_pointer(node->bit[0])],
-						  lockdep_is_held(lock));
-		if (child)
-			child->parent_bit_packed = node->parent_bit_packed;
-		parent_bit = (struct allowedips_node **)(node->parent_bit_packed & ~3UL);
-		*parent_bit = child;
-		parent = (void *)parent_bit -
-			 offsetof(struct allowedips_node, bit[node->parent_bit_packed & 1]);
-		free_parent = !rcu_access_pointer(node->bit[0]) &&
-			      !rcu_access_pointer(node->bit[1]) &&
-			      (node->parent_bit_packed & 3) <= 1 &&
-			      !rcu_access_pointer(parent->peer);
-		if (free_parent)
-			child = rcu_dereference_protected(
-					parent->bit[!(node->parent_bit_packed & 1)],
-					lockdep_is_held(lock));
-		call_rcu(&node->rcu, node_free_rcu);
-		if (!free_parent)
-			continue;
-		if (child)
-			child->parent_bit_packed = parent->parent_bit_packed;
-		*(struct allowedips_node **)(parent->parent_bit_packed & ~3UL) = child;
-		call_rcu(&parent->rcu, node_free_rcu);
+		bits = node->bitlen;
+		wg_allowedips_read_node(node, ip, &cidr);
+		remove_node(node, lock);
+		mnode_update(table, bits, ip, cidr, lock);
 	}
 }
 
@@ -352,14 +704,28 @@ int wg_allowedips_read_node(struct allowedips_node *node, u8 ip[16], u8 *cidr)
 	return node->bitlen == 32 ? AF_INET : AF_INET6;
 }
 
+/* Returns a strong reference to a peer */
+static struct wg_peer *lookup_table(struct allowedips *table, u8 bits,
+				    const void *be_ip)
+{
+	if (bits == 32) {
+		if (likely(smp_load_acquire(&table->mroot4_valid)))
+			return lookup_mnode(table->mroot4, 32, be_ip);
+		return lookup(table->root4, 32, be_ip);
+	}
+	if (likely(smp_load_acquire(&table->mroot6_valid)))
+		return lookup_mnode(table->mroot6, 128, be_ip);
+	return lookup(table->root6, 128, be_ip);
+}
+
 /* Returns a strong reference to a peer */
 struct wg_peer *wg_allowedips_lookup_dst(struct allowedips *table,
 					 struct sk_buff *skb)
 {
 	if (skb->protocol == htons(ETH_P_IP))
-		return lookup(table->root4, 32, &ip_hdr(skb)->daddr);
+		return lookup_table(table, 32, &ip_hdr(skb)->daddr);
 	else if (skb->protocol == htons(ETH_P_IPV6))
-		return lookup(table->root6, 128, &ipv6_hdr(skb)->daddr);
+		return lookup_table(table, 128, &ipv6_hdr(skb)->daddr);
 	return NULL;
 }
 
@@ -368,9 +734,9 @@ struct wg_peer *wg_allowedips_lookup_src(struct allowedips *table,
 					 struct sk_buff *skb)
 {
 	if (skb->protocol == htons(ETH_P_IP))
-		return lookup(table->root4, 32, &ip_hdr(skb)->saddr);
+		return lookup_table(table, 32, &ip_hdr(skb)->saddr);
 	else if (skb->protocol == htons(ETH_P_IPV6))
-		return lookup(table->root6, 128, &ipv6_hdr(skb)->saddr);
+		return lookup_table(table, 128, &ipv6_hdr(skb)->saddr);
 	return NULL;
 }
 
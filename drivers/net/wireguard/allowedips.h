@@ -11,6 +11,7 @@
 #include <linux/ipv6.h>
 
 struct wg_peer;
+struct allowedips_mnode;
 
 struct allowedips_node {
 	struct wg_peer __rcu *peer;
@@ -29,6 +30,10 @@ struct allowedips_node {
 struct allowedips {
 	struct allowedips_node __rcu *root4;
 	struct allowedips_node __rcu *root6;
+	/* Stride 8 copies of the above, which is what lookups walk. */
+	struct allowedips_mnode __rcu *mroot4;
+	struct allowedips_mnode __rcu *mroot6;
+	bool mroot4_valid, mroot6_valid;
 	u64 seq;
 } __aligned(4); /* We pack the lower 2 bits of &root, but m68k only gives 16-bit alignment. */
 
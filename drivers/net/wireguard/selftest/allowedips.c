@@ -10,9 +10,12 @@
  * to graphviz (the dot command) to visualize it. If you define the macro
  * DEBUG_RANDOM_TRIE to be 1, then there will be an extremely costly set of
  * randomized tests done against a trivial implementation, which may take
- * upwards of a half-hour to complete. There's no set of users who should be
- * enabling these, and the only developers that should go anywhere near these
- * nobs are the ones who are reading this comment.
+ * upwards of a half-hour to complete. If you define the macro
+ * DEBUG_BENCHMARK_TRIE to be 1, then lookups of random addresses in a large
+ * random table are timed, both walking the binary trie and the multibit one,
+ * and printed out. There's no set of users who should be enabling these, and
+ * the only developers that should go anywhere near these nobs are the ones
+ * who are reading this comment.
  */
 
 #ifdef DEBUG
@@ -72,7 +75,9 @@ enum {
 	NUM_PEERS = 2000,
 	NUM_RAND_ROUTES = 400,
 	NUM_MUTATED_ROUTES = 100,
-	NUM_QUERIES = NUM_RAND_ROUTES * NUM_MUTATED_ROUTES * 30
+	NUM_QUERIES = NUM_RAND_ROUTES * NUM_MUTATED_ROUTES * 30,
+	NUM_BENCH_ADDRS = 4096,
+	NUM_BENCH_ROUNDS = 256
 };
 
 struct horrible_allowedips {
@@ -382,13 +387,16 @@ static __init bool randomized_test(void)
 	for (j = 0;; ++j) {
 		for (i = 0; i < NUM_QUERIES; ++i) {
 			prandom_bytes(ip, 4);
-			if (lookup(t.root4, 32, ip) != horrible_allowedips_lookup_v4(&h, (struct in_addr *)ip)) {
-				horrible_allowedips_lookup_v4(&h, (struct in_addr *)ip);
+			peer = horrible_allowedips_lookup_v4(&h, (struct in_addr *)ip);
+			if (lookup(t.root4, 32, ip) != peer ||
+			    lookup_mnode(t.mroot4, 32, ip) != peer) {
 				pr_err("allowedips random v4 self-test: FAIL\n");
 				goto free;
 			}
 			prandom_bytes(ip, 16);
-			if (lookup(t.root6, 128, ip) != horrible_allowedips_lookup_v6(&h, (struct in6_addr *)ip)) {
+			peer = horrible_allowedips_lookup_v6(&h, (struct in6_addr *)ip);
+			if (lookup(t.root6, 128, ip) != peer ||
+			    lookup_mnode(t.mroot6, 128, ip) != peer) {
 				pr_err("allowedips random v6 self-test: FAIL\n");
 				goto free;
 			}
@@ -401,7 +409,7 @@ static __init bool randomized_test(void)
 		horrible_allowedips_remove_by_value(&h, peers[j]);
 	}
 
-	if (t.root4 || t.root6) {
+	if (t.root4 || t.root6 || t.mroot4 || t.mroot6) {
 		pr_err("allowedips random self-test removal: FAIL\n");
 		goto free;
 	}
@@ -422,6 +430,91 @@ static __init bool randomized_test(void)
 	return ret;
 }
 
+static __init void benchmark_lookups(struct allowedips *t, u8 bits, const u8 *addrs)
+{
+	u64 binary, multibit;
+	unsigned int i, j;
+
+	binary = ktime_get_ns();
+	for (j = 0; j < NUM_BENCH_ROUNDS; ++j) {
+		for (i = 0; i < NUM_BENCH_ADDRS; ++i)
+			lookup(bits == 32 ? t->root4 : t->root6, bits, addrs + i * 16);
+	}
+	binary = ktime_get_ns() - binary;
+
+	multibit = ktime_get_ns();
+	for (j = 0; j < NUM_BENCH_ROUNDS; ++j) {
+		for (i = 0; i < NUM_BENCH_ADDRS; ++i)
+			lookup_mnode(bits == 32 ? t->mroot4 : t->mroot6, bits, addrs + i * 16);
+	}
+	multibit = ktime_get_ns() - multibit;
+
+	pr_info("allowedips benchmark v%d: %llu ns per binary lookup, %llu ns per multibit lookup\n",
+		bits == 32 ? 4 : 6, div_u64(binary, NUM_BENCH_ADDRS * NUM_BENCH_ROUNDS),
+		div_u64(multibit, NUM_BENCH_ADDRS * NUM_BENCH_ROUNDS));
+}
+
+static __init bool benchmark_test(void)
+{
+	struct wg_peer **peers = NULL;
+	unsigned int i, cidr;
+	DEFINE_MUTEX(mutex);
+	struct allowedips t;
+	bool ret = false;
+	u8 *addrs, ip[16];
+
+	mutex_init(&mutex);
+	wg_allowedips_init(&t);
+
+	addrs = kmalloc_array(NUM_BENCH_ADDRS, 16, GFP_KERNEL);
+	peers = kcalloc(NUM_PEERS, sizeof(*peers), GFP_KERNEL);
+	if (unlikely(!addrs || !peers))
+		goto free;
+	for (i = 0; i < NUM_PEERS; ++i) {
+		peers[i] = kzalloc(sizeof(*peers[i]), GFP_KERNEL);
+		if (unlikely(!peers[i]))
+			goto free;
+		kref_init(&peers[i]->refcount);
+		INIT_LIST_HEAD(&peers[i]->allowedips_list);
+	}
+
+	mutex_lock(&mutex);
+	for (i = 0; i < NUM_RAND_ROUTES * NUM_MUTATED_ROUTES; ++i) {
+		prandom_bytes(ip, 16);
+		cidr = prandom_u32_max(32) + 1;
+		if (wg_allowedips_insert_v4(&t, (struct in_addr *)ip, cidr,
+					    peers[prandom_u32_max(NUM_PEERS)],
+					    &mutex) < 0)
+			goto free_locked;
+		cidr = prandom_u32_max(128) + 1;
+		if (wg_allowedips_insert_v6(&t, (struct in6_addr *)ip, cidr,
+					    peers[prandom_u32_max(NUM_PEERS)],
+					    &mutex) < 0)
+			goto free_locked;
+	}
+	mutex_unlock(&mutex);
+
+	prandom_bytes(addrs, NUM_BENCH_ADDRS * 16);
+	benchmark_lookups(&t, 32, addrs);
+	benchmark_lookups(&t, 128, addrs);
+	ret = true;
+
+	mutex_lock(&mutex);
+free_locked:
+	wg_allowedips_free(&t, &mutex);
+	mutex_unlock(&mutex);
+free:
+	if (!ret)
+		pr_err("allowedips benchmark malloc: FAIL\n");
+	if (peers) {
+		for (i = 0; i < NUM_PEERS; ++i)
+			kfree(peers[i]);
+	}
+	kfree(peers);
+	kfree(addrs);
+	return ret;
+}
+
 static __init inline struct in_addr *ip4(u8 a, u8 b, u8 c, u8 d)
 {
 	static struct in_addr ip;
@@ -469,16 +562,22 @@ static __init struct wg_peer *init_peer(void)
 		}                                                       \
 	} while (0)
 
-#define test(version, mem, ipa, ipb, ipc, ipd) do {                          \
-		bool _s = lookup(t.root##version, (version) == 4 ? 32 : 128, \
-				 ip##version(ipa, ipb, ipc, ipd)) == (mem);  \
-		maybe_fail();                                                \
+#define test(version, mem, ipa, ipb, ipc, ipd) do {                           \
+		bool _s = lookup(t.root##version, (version) == 4 ? 32 : 128,  \
+				 ip##version(ipa, ipb, ipc, ipd)) == (mem) && \
+			  lookup_mnode(t.mroot##version,                      \
+				       (version) == 4 ? 32 : 128,             \
+				       ip##version(ipa, ipb, ipc, ipd)) == (mem); \
+		maybe_fail();                                                 \
 	} while (0)
 
-#define test_negative(version, mem, ipa, ipb, ipc, ipd) do {                 \
-		bool _s = lookup(t.root##version, (version) == 4 ? 32 : 128, \
-				 ip##version(ipa, ipb, ipc, ipd)) != (mem);  \
-		maybe_fail();                                                \
+#define test_negative(version, mem, ipa, ipb, ipc, ipd) do {                  \
+		bool _s = lookup(t.root##version, (version) == 4 ? 32 : 128,  \
+				 ip##version(ipa, ipb, ipc, ipd)) != (mem) && \
+			  lookup_mnode(t.mroot##version,                      \
+				       (version) == 4 ? 32 : 128,             \
+				       ip##version(ipa, ipb, ipc, ipd)) != (mem); \
+		maybe_fail();                                                 \
 	} while (0)
 
 #define test_boolean(cond) do {   \
@@ -653,6 +752,9 @@ bool __init wg_allowedips_selftest(void)
 	if (IS_ENABLED(DEBUG_RANDOM_TRIE) && success)
 		success = randomized_test();
 
+	if (IS_ENABLED(DEBUG_BENCHMARK_TRIE) && success)
+		success = benchmark_test();
+
 	if (success)
 		pr_info("allowedips self-tests: pass\n");
 
@@ -239,6 +239,56 @@ void wg_packet_send_keepalive(struct wg_peer *peer)
 	wg_packet_send_staged_packets(peer);
 }
 
+/* Chains the ciphertexts following @first that have the same length and outer
+ * DS field onto its frag_list, so that they go through the outer UDP and IP
+ * stack once, as a single UDP GSO packet, and only get segmented by the stack
+ * or the NIC right before hitting the wire. Segments keep the order of the
+ * list, and therefore their nonce order. Returns the first packet that could
+ * not be chained.
+ */
+static struct sk_buff *coalesce_packets(struct sk_buff *first)
+{
+	struct sk_buff *skb = first->next, *tail = NULL;
+	unsigned int mss = first->len, segs = 1;
+
+	if (skb_is_nonlinear(first))
+		return skb;
+
+	for (; skb; skb = skb->next) {
+		if (skb->len != mss || skb_is_nonlinear(skb) ||
+		    PACKET_CB(skb)->ds != PACKET_CB(first)->ds ||
+		    segs == UDP_MAX_SEGMENTS ||
+		    first->len + mss > GSO_MAX_SIZE - SKB_HEADER_LEN)
+			break;
+
+		if (tail)
+			tail->next = skb;
+		else
+			skb_shinfo(first)->frag_list = skb;
+		tail = skb;
+		first->data_len += mss;
+		first->len += mss;
+		first->truesize += skb->truesize;
+		++segs;
+	}
+	if (!tail)
+		return skb;
+	tail->next = NULL;
+
+	skb_shinfo(first)->gso_size = mss;
+	skb_shinfo(first)->gso_type = SKB_GSO_UDP_L4;
+	skb_shinfo(first)->gso_segs = segs;
+
+	/* The UDP header is yet to be pushed in front of the data by the tunnel
+	 * xmit helpers, which, for a GSO packet, only seed the checksum with
+	 * the pseudo header, and leave the rest to be done per segment.
+	 */
+	first->ip_summed = CHECKSUM_PARTIAL;
+	first->csum_start = skb_headroom(first) - sizeof(struct udphdr);
+	first->csum_offset = offsetof(struct udphdr, check);
+	return skb;
+}
+
 static void wg_packet_create_data_done(struct wg_peer *peer, struct sk_buff *first)
 {
 	struct sk_buff *skb, *next;
@@ -246,8 +296,9 @@ static void wg_packet_create_data_done(struct wg_peer *peer, struct sk_buff *fir
 
 	wg_timers_any_authenticated_packet_traversal(peer);
 	wg_timers_any_authenticated_packet_sent(peer);
-	skb_list_walk_safe(first, skb, next) {
+	for (skb = first; skb; skb = next) {
 		is_keepalive = skb->len == message_data_len(0);
+		next = coalesce_packets(skb);
 		if (likely(!wg_socket_send_skb_to_peer(peer, skb,
 				PACKET_CB(skb)->ds) && !is_keepalive))
 			data_sent = true;
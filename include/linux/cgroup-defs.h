@@ -460,6 +460,14 @@ struct cgroup {
 	struct cgroup_rstat_cpu __percpu *rstat_cpu;
 	struct list_head rstat_css_list;
 
+	/*
+	 * Serialization of rstat flushes of overlapping subtrees and of
+	 * updates of ->bstat by flushes of sibling subtrees, see rstat.c.
+	 */
+	rwlock_t rstat_flush_lock;
+	spinlock_t rstat_bstat_lock;
+	u64 rstat_flush_time;		/* end of the last flush of the subtree */
+
 	/* cgroup basic resource statistics */
 	struct cgroup_base_stat last_bstat;
 	struct cgroup_base_stat bstat;
@@ -278,6 +278,14 @@ struct cpuidle_governor {
 
 extern int cpuidle_register_governor(struct cpuidle_governor *gov);
 extern s64 cpuidle_governor_latency_req(unsigned int cpu);
+#ifdef CONFIG_CPU_IDLE_GOV_IRQ_TIMINGS
+extern s64 cpuidle_governor_irq_next_ns(void);
+#else
+static inline s64 cpuidle_governor_irq_next_ns(void)
+{
+	return KTIME_MAX;
+}
+#endif
 
 #define __CPU_PM_CPU_IDLE_ENTER(low_level_idle_enter,			\
 				idx,					\
@@ -274,6 +274,12 @@ static inline void destroy_delayed_work_on_stack(struct delayed_work *work) { }
 static inline unsigned int work_static(struct work_struct *work) { return 0; }
 #endif
 
+#ifdef CONFIG_WQ_LATENCY_STATS
+#define __init_work_queued_at(_work)	((_work)->queued_at = 0)
+#else
+#define __init_work_queued_at(_work)	do { } while (0)
+#endif
+
 /*
  * initialize all of a work item in one go
  *
@@ -289,6 +295,7 @@ static inline unsigned int work_static(struct work_struct *work) { return 0; }
 		lockdep_init_map(&(_work)->lockdep_map, "(work_completion)"#_work, (_key), 0); \
 		INIT_LIST_HEAD(&(_work)->entry);			\
 		(_work)->func = (_func);				\
+		__init_work_queued_at(_work);				\
 	} while (0)
 #else
 #define __INIT_WORK_KEY(_work, _func, _onstack, _key)			\
@@ -297,6 +304,7 @@ static inline unsigned int work_static(struct work_struct *work) { return 0; }
 		(_work)->data = (atomic_long_t) WORK_DATA_INIT();	\
 		INIT_LIST_HEAD(&(_work)->entry);			\
 		(_work)->func = (_func);				\
+		__init_work_queued_at(_work);				\
 	} while (0)
 #endif
 
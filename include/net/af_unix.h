@@ -8,13 +8,22 @@
 #include <linux/refcount.h>
 #include <net/sock.h>
 
+struct scm_fp_list;
+struct seq_file;
+struct unix_sock;
+
 void unix_inflight(struct user_struct *user, struct file *fp);
 void unix_notinflight(struct user_struct *user, struct file *fp);
+void unix_add_edges(struct scm_fp_list *fpl, struct unix_sock *receiver);
+void unix_update_edges(struct unix_sock *receiver);
 void unix_destruct_scm(struct sk_buff *skb);
 void unix_gc(void);
-void wait_for_unix_gc(void);
+void wait_for_unix_gc(struct scm_fp_list *fpl);
 struct sock *unix_get_socket(struct file *filp);
 struct sock *unix_peer_get(struct sock *sk);
+#ifdef CONFIG_PROC_FS
+int unix_gc_seq_show(struct seq_file *seq, void *v);
+#endif
 
 #define UNIX_HASH_SIZE	256
 #define UNIX_HASH_BITS	8
@@ -47,6 +56,24 @@ struct scm_stat {
 
 #define UNIXCB(skb)	(*(struct unix_skb_parms *)&((skb)->cb))
 
+/* An in-flight AF_UNIX socket, as seen by the garbage collector */
+struct unix_vertex {
+	struct list_head	edges;		/* Queued copies of our fd */
+	struct list_head	entry;
+	struct list_head	scc_entry;	/* Ring of our SCC */
+	unsigned long		out_degree;
+	u64			index;
+	u64			scc_index;	/* Unique id of our SCC */
+};
+
+/* An fd of @predecessor queued on @successor's receive queue */
+struct unix_edge {
+	struct unix_sock	*predecessor;
+	struct unix_sock	*successor;
+	struct list_head	vertex_entry;
+	struct list_head	stack_entry;
+};
+
 /* The AF_UNIX socket */
 struct unix_sock {
 	/* WARNING: sk has to be the first member */
@@ -55,12 +82,9 @@ struct unix_sock {
 	struct path		path;
 	struct mutex		iolock, bindlock;
 	struct sock		*peer;
-	struct list_head	link;
-	unsigned long		inflight;
+	struct sock		*listener;	/* Until accept()ed */
+	struct unix_vertex	vertex;
 	spinlock_t		lock;
-	unsigned long		gc_flags;
-#define UNIX_GC_CANDIDATE	0
-#define UNIX_GC_MAYBE_CYCLE	1
 	struct socket_wq	peer_wq;
 	wait_queue_entry_t	peer_wake;
 	struct scm_stat		scm_stat;
@@ -77,9 +101,6 @@ enum unix_socket_lock_class {
 	U_LOCK_NORMAL,
 	U_LOCK_SECOND,	/* for double locking, see unix_state_double_lock(). */
 	U_LOCK_DIAG, /* used while dumping icons, see sk_diag_dump_icons(). */
-	U_LOCK_GC_LISTENER, /* used for listening socket while determining gc
-			     * candidates to close a small race window.
-			     */
 };
 
 static inline void unix_state_lock_nested(struct sock *sk,
@@ -18,6 +18,7 @@
 
 #include <linux/compiler.h>
 #include <linux/timer.h>
+#include <linux/cpumask.h>
 #include <linux/bug.h>
 
 #include <net/checksum.h>
@@ -366,6 +367,7 @@ struct ip_vs_cpu_stats {
 /* IPVS statistics objects */
 struct ip_vs_estimator {
 	struct list_head	list;
+	int			ktrow;		/* tick of the period */
 
 	u64			last_inbytes;
 	u64			last_outbytes;
@@ -819,6 +821,10 @@ struct ip_vs_sync_thread_data;
 /* How much time to keep dests in trash */
 #define IP_VS_DEST_TRASH_PERIOD		(120 * HZ)
 
+/* Rate estimation period, spread over IPVS_EST_NTICKS ticks */
+#define IPVS_EST_PERIOD			(2 * HZ)
+#define IPVS_EST_NTICKS			50
+
 struct ipvs_sync_daemon_cfg {
 	union nf_inet_addr	mcast_group;
 	int			syncid;
@@ -943,9 +949,11 @@ struct netns_ipvs {
 	struct ctl_table_header	*lblcr_ctl_header;
 	struct ctl_table	*lblcr_ctl_table;
 	/* ip_vs_est */
-	struct list_head	est_list;	/* estimator list */
-	spinlock_t		est_lock;
-	struct timer_list	est_timer;	/* Estimation timer */
+	struct list_head	est_chains[IPVS_EST_NTICKS]; /* per tick */
+	int			est_chain_len[IPVS_EST_NTICKS];
+	struct mutex		est_mutex;	/* protects est_chains, est_kt */
+	struct task_struct	*est_kt;	/* Estimation kthread */
+	cpumask_var_t		est_cpulist;	/* CPUs allowed for est_kt */
 	/* ip_vs_sync */
 	spinlock_t		sync_lock;
 	struct ipvs_master_sync_state *ms;
@@ -1470,6 +1478,7 @@ void ip_vs_start_estimator(struct netns_ipvs *ipvs, struct ip_vs_stats *stats);
 void ip_vs_stop_estimator(struct netns_ipvs *ipvs, struct ip_vs_stats *stats);
 void ip_vs_zero_estimator(struct ip_vs_stats *stats);
 void ip_vs_read_estimator(struct ip_vs_kstats *dst, struct ip_vs_stats *stats);
+int ip_vs_est_set_cpulist(struct netns_ipvs *ipvs, const struct cpumask *mask);
 
 /* Various IPVS packet transmitters (from ip_vs_xmit.c) */
 int ip_vs_null_xmit(struct sk_buff *skb, struct ip_vs_conn *cp,
@@ -57,6 +57,43 @@ struct mptcp_out_options {
 #endif
 };
 
+struct mptcp_sock;
+struct mptcp_subflow_context;
+
+#define MPTCP_SCHED_NAME_MAX	16
+#define MPTCP_SUBFLOWS_MAX	8
+
+/* Packet scheduler input and output.
+ *
+ * contexts[] holds the subflows that can currently take data, the
+ * scheduler sets the bit of each one it wants to send on in @scheduled.
+ * The first one gets the data, any other one a redundant copy of it.
+ */
+struct mptcp_sched_data {
+	bool	reinject;	/* MPTCP-level retransmission */
+	u8	subflows;	/* valid entries in contexts[] */
+	u32	scheduled;
+	struct mptcp_subflow_context *contexts[MPTCP_SUBFLOWS_MAX];
+};
+
+struct mptcp_sched_ops {
+	struct list_head	list;
+
+	/* pick the subflows to send on (required) */
+	int (*get_subflow)(struct mptcp_sock *msk,
+			   struct mptcp_sched_data *data);
+	/* set up per-connection state (optional) */
+	void (*init)(struct mptcp_sock *msk);
+	/* release per-connection state (optional) */
+	void (*release)(struct mptcp_sock *msk);
+
+	char			name[MPTCP_SCHED_NAME_MAX];
+	struct module		*owner;
+};
+
+int mptcp_register_scheduler(struct mptcp_sched_ops *sched);
+void mptcp_unregister_scheduler(struct mptcp_sched_ops *sched);
+
 #ifdef CONFIG_MPTCP
 void mptcp_init(void);
 
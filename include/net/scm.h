@@ -21,9 +21,16 @@ struct scm_creds {
 	kgid_t	gid;
 };
 
+struct unix_edge;
+
 struct scm_fp_list {
 	short			count;
 	short			max;
+#if IS_ENABLED(CONFIG_UNIX)
+	short			count_unix;	/* AF_UNIX sockets in fp[] */
+	bool			inflight;	/* Edges are in the GC graph */
+	struct unix_edge	*edges;
+#endif
 	struct user_struct	*user;
 	struct file		*fp[SCM_MAX_FD];
 };
@@ -65,6 +65,7 @@
 #define TLS_AAD_SPACE_SIZE		13
 
 #define MAX_IV_SIZE			16
+#define TLS_TX_ASYNC_DEPTH_MAX		64
 #define TLS_MAX_REC_SEQ_SIZE		8
 
 /* For AES-CCM, the full 16-bytes of IV is made of '4' fields of given sizes.
@@ -141,6 +142,7 @@ struct tls_sw_context_tx {
 	atomic_t encrypt_pending;
 	/* protect crypto_wait with encrypt_pending */
 	spinlock_t encrypt_compl_lock;
+	/* complete async_wait once encrypt_pending drops below this */
 	int async_notify;
 	u8 async_capable:1;
 
@@ -251,6 +253,7 @@ struct tls_context {
 
 	u8 tx_conf:3;
 	u8 rx_conf:3;
+	u8 rx_no_pad:1;
 
 	int (*push_pending_record)(struct sock *sk, int flags);
 	void (*sk_write_space)(struct sock *sk);
@@ -269,6 +272,7 @@ struct tls_context {
 
 	bool in_tcp_sendpages;
 	bool pending_open_record_frags;
+	u8 tx_async_depth;
 
 	struct mutex tx_lock; /* protects partially_sent_* fields and
 			       * per-type TX fields
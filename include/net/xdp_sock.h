@@ -50,6 +50,7 @@ struct xdp_sock {
 	struct xsk_buff_pool *pool;
 	u16 queue_id;
 	bool zc;
+	bool sg;
 	enum {
 		XSK_READY = 0,
 		XSK_BOUND,
@@ -64,6 +65,11 @@ struct xdp_sock {
 	/* Statistics */
 	u64 rx_dropped;
 	u64 rx_queue_full;
+	u64 tx_batches;
+	u64 tx_batch_pkts;
+	u64 tx_batch_cq_full;
+	u64 tx_batch_busy;
+	u32 tx_batch_max;
 
 	struct list_head map_list;
 	/* Protects map_list */
@@ -59,6 +59,11 @@ struct sockaddr_ll {
 #define PACKET_ROLLOVER_STATS		21
 #define PACKET_FANOUT_DATA		22
 #define PACKET_IGNORE_OUTGOING		23
+/* Split a TPACKET_V3 rx ring into one block queue per CPU. tp_block_nr must
+ * be a multiple of the value getsockopt() returns for this option once set;
+ * the blocks of CPU n start at block n * (tp_block_nr / value) of the mmap.
+ */
+#define PACKET_RX_RING_PERCPU		24
 
 #define PACKET_FANOUT_HASH		0
 #define PACKET_FANOUT_LB		1
@@ -14,6 +14,7 @@
 #define MPTCP_SUBFLOW_FLAG_FULLY_ESTABLISHED	_BITUL(6)
 #define MPTCP_SUBFLOW_FLAG_CONNECTED		_BITUL(7)
 #define MPTCP_SUBFLOW_FLAG_MAPVALID		_BITUL(8)
+#define MPTCP_SUBFLOW_FLAG_DEMOTED		_BITUL(9)
 
 enum {
 	MPTCP_SUBFLOW_ATTR_UNSPEC,
@@ -28,6 +29,10 @@ enum {
 	MPTCP_SUBFLOW_ATTR_ID_REM,
 	MPTCP_SUBFLOW_ATTR_ID_LOC,
 	MPTCP_SUBFLOW_ATTR_PAD,
+	MPTCP_SUBFLOW_ATTR_HEALTH_SCORE,
+	MPTCP_SUBFLOW_ATTR_HEALTH_SRTT,
+	MPTCP_SUBFLOW_ATTR_HEALTH_LOSS,
+	MPTCP_SUBFLOW_ATTR_HEALTH_STALL,
 	__MPTCP_SUBFLOW_ATTR_MAX
 };
 
@@ -103,4 +108,7 @@ struct mptcp_info {
 	__u64	mptcpi_rcv_nxt;
 };
 
+/* MPTCP socket options */
+#define MPTCP_SCHEDULER		1	/* Name of the packet scheduler */
+
 #endif /* _UAPI_MPTCP_H */
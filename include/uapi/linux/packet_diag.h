@@ -58,6 +58,7 @@ struct packet_diag_info {
 #define PDI_ORIGDEV	0x4
 #define PDI_VNETHDR	0x8
 #define PDI_LOSS	0x10
+#define PDI_RX_PERCPU	0x20
 };
 
 struct packet_diag_mclist {
@@ -39,6 +39,8 @@
 /* TLS socket options */
 #define TLS_TX			1	/* Set transmit parameters */
 #define TLS_RX			2	/* Set receive parameters */
+#define TLS_RX_EXPECT_NO_PAD	4	/* TLS 1.3 records are not padded */
+#define TLS_TX_ASYNC_DEPTH	16	/* Max records in async encryption */
 
 /* Supported versions */
 #define TLS_VERSION_MINOR(ver)	((ver) & 0xFF)
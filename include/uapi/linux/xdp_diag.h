@@ -43,6 +43,7 @@ enum {
 	XDP_DIAG_UMEM_COMPLETION_RING,
 	XDP_DIAG_MEMINFO,
 	XDP_DIAG_STATS,
+	XDP_DIAG_TX_BATCH_STATS,
 	__XDP_DIAG_MAX,
 };
 
@@ -80,4 +81,14 @@ struct xdp_diag_stats {
 	__u64	n_tx_ring_empty;
 };
 
+/* Copy-mode Tx batching */
+struct xdp_diag_tx_batch_stats {
+	__u64	n_batches;	/* batches handed to the driver */
+	__u64	n_batch_pkts;	/* packets sent in these batches */
+	__u64	n_cq_full;	/* batches cut short by a full completion ring */
+	__u64	n_tx_busy;	/* batches cut short by a busy Tx queue */
+	__u32	max_batch_pkts;	/* largest batch sent */
+	__u32	pad;
+};
+
 #endif /* _LINUX_XDP_DIAG_H */
@@ -1,12 +1,18 @@
 // SPDX-License-Identifier: GPL-2.0-only
 #include "cgroup-internal.h"
 
+#include <linux/sched/clock.h>
 #include <linux/sched/cputime.h>
 
-static DEFINE_SPINLOCK(cgroup_rstat_lock);
+/*
+ * A reader of the stats of a cgroup reuses a flush of its subtree which
+ * completed less than this long ago.
+ */
+#define CGROUP_RSTAT_FLUSH_COALESCE_NS	(2 * NSEC_PER_MSEC)
+
 static DEFINE_PER_CPU(raw_spinlock_t, cgroup_rstat_cpu_lock);
 
-static void cgroup_base_stat_flush(struct cgroup *cgrp, int cpu);
+static void cgroup_base_stat_flush(struct cgroup *cgrp, int cpu, bool root);
 
 static struct cgroup_rstat_cpu *cgroup_rstat_cpu(struct cgroup *cgrp, int cpu)
 {
@@ -137,13 +143,47 @@ static struct cgroup *cgroup_rstat_cpu_pop_updated(struct cgroup *pos,
 	return NULL;
 }
 
+/*
+ * Flushes of disjoint subtrees run concurrently.  Flushing @cgrp's subtree
+ * takes @cgrp->rstat_flush_lock for writing and the flush locks of all its
+ * ancestors for reading, top-down, which excludes the flushes of all the
+ * subtrees overlapping with it.  Flushes of sibling subtrees both propagate
+ * into their common parent, whose ->bstat is protected by ->rstat_bstat_lock
+ * for that.
+ *
+ * As a flush may also be done from irq context, interrupts are disabled
+ * while holding any of these locks.
+ */
+static void cgroup_rstat_lock(struct cgroup *cgrp)
+{
+	int level;
+
+	for (level = 0; level < cgrp->level; level++) {
+		struct cgroup *ancestor = cgrp;
+
+		while (ancestor->level > level)
+			ancestor = cgroup_parent(ancestor);
+		read_lock(&ancestor->rstat_flush_lock);
+	}
+	write_lock(&cgrp->rstat_flush_lock);
+}
+
+static void cgroup_rstat_unlock(struct cgroup *cgrp)
+{
+	struct cgroup *parent;
+
+	write_unlock(&cgrp->rstat_flush_lock);
+	for (parent = cgroup_parent(cgrp); parent;
+	     parent = cgroup_parent(parent))
+		read_unlock(&parent->rstat_flush_lock);
+}
+
 /* see cgroup_rstat_flush() */
 static void cgroup_rstat_flush_locked(struct cgroup *cgrp, bool may_sleep)
-	__releases(&cgroup_rstat_lock) __acquires(&cgroup_rstat_lock)
 {
 	int cpu;
 
-	lockdep_assert_held(&cgroup_rstat_lock);
+	lockdep_assert_held_write(&cgrp->rstat_flush_lock);
 
 	for_each_possible_cpu(cpu) {
 		raw_spinlock_t *cpu_lock = per_cpu_ptr(&cgroup_rstat_cpu_lock,
@@ -154,7 +194,7 @@ static void cgroup_rstat_flush_locked(struct cgroup *cgrp, bool may_sleep)
 		while ((pos = cgroup_rstat_cpu_pop_updated(pos, cgrp, cpu))) {
 			struct cgroup_subsys_state *css;
 
-			cgroup_base_stat_flush(pos, cpu);
+			cgroup_base_stat_flush(pos, cpu, pos == cgrp);
 
 			rcu_read_lock();
 			list_for_each_entry_rcu(css, &pos->rstat_css_list,
@@ -165,14 +205,16 @@ static void cgroup_rstat_flush_locked(struct cgroup *cgrp, bool may_sleep)
 		raw_spin_unlock(cpu_lock);
 
 		/* if @may_sleep, play nice and yield if necessary */
-		if (may_sleep && (need_resched() ||
-				  spin_needbreak(&cgroup_rstat_lock))) {
-			spin_unlock_irq(&cgroup_rstat_lock);
-			if (!cond_resched())
-				cpu_relax();
-			spin_lock_irq(&cgroup_rstat_lock);
+		if (may_sleep && need_resched()) {
+			cgroup_rstat_unlock(cgrp);
+			local_irq_enable();
+			cond_resched();
+			local_irq_disable();
+			cgroup_rstat_lock(cgrp);
 		}
 	}
+
+	WRITE_ONCE(cgrp->rstat_flush_time, local_clock());
 }
 
 /**
@@ -192,9 +234,11 @@ void cgroup_rstat_flush(struct cgroup *cgrp)
 {
 	might_sleep();
 
-	spin_lock_irq(&cgroup_rstat_lock);
+	local_irq_disable();
+	cgroup_rstat_lock(cgrp);
 	cgroup_rstat_flush_locked(cgrp, true);
-	spin_unlock_irq(&cgroup_rstat_lock);
+	cgroup_rstat_unlock(cgrp);
+	local_irq_enable();
 }
 
 /**
@@ -207,41 +251,59 @@ void cgroup_rstat_flush_irqsafe(struct cgroup *cgrp)
 {
 	unsigned long flags;
 
-	spin_lock_irqsave(&cgroup_rstat_lock, flags);
+	local_irq_save(flags);
+	cgroup_rstat_lock(cgrp);
 	cgroup_rstat_flush_locked(cgrp, false);
-	spin_unlock_irqrestore(&cgroup_rstat_lock, flags);
+	cgroup_rstat_unlock(cgrp);
+	local_irq_restore(flags);
 }
 
 /**
- * cgroup_rstat_flush_begin - flush stats in @cgrp's subtree and hold
+ * cgroup_rstat_flush_hold - flush stats in @cgrp's subtree and hold
  * @cgrp: target cgroup
  *
- * Flush stats in @cgrp's subtree and prevent further flushes.  Must be
- * paired with cgroup_rstat_flush_release().
+ * Flush stats in @cgrp's subtree and prevent further flushes of any
+ * overlapping subtree.  Must be paired with cgroup_rstat_flush_release().
+ *
+ * This is meant for readers of the stats, so the flush is skipped if the
+ * previous flush of @cgrp's subtree completed very recently, e.g. while
+ * waiting for the flush locks behind another reader.
  *
  * This function may block.
  */
 void cgroup_rstat_flush_hold(struct cgroup *cgrp)
-	__acquires(&cgroup_rstat_lock)
 {
 	might_sleep();
-	spin_lock_irq(&cgroup_rstat_lock);
-	cgroup_rstat_flush_locked(cgrp, true);
+
+	local_irq_disable();
+	cgroup_rstat_lock(cgrp);
+	if (local_clock() - cgrp->rstat_flush_time >=
+	    CGROUP_RSTAT_FLUSH_COALESCE_NS)
+		cgroup_rstat_flush_locked(cgrp, true);
 }
 
 /**
  * cgroup_rstat_flush_release - release cgroup_rstat_flush_hold()
+ * @cgrp: target cgroup
  */
-void cgroup_rstat_flush_release(void)
-	__releases(&cgroup_rstat_lock)
+void cgroup_rstat_flush_release(struct cgroup *cgrp)
 {
-	spin_unlock_irq(&cgroup_rstat_lock);
+	cgroup_rstat_unlock(cgrp);
+	local_irq_enable();
 }
 
 int cgroup_rstat_init(struct cgroup *cgrp)
 {
 	int cpu;
 
+	rwlock_init(&cgrp->rstat_flush_lock);
+	/*
+	 * The flush locks of a cgroup and its ancestors nest in strict
+	 * hierarchy order, which lockdep can't express for a single class.
+	 */
+	lockdep_set_novalidate_class(&cgrp->rstat_flush_lock);
+	spin_lock_init(&cgrp->rstat_bstat_lock);
+
 	/* the root cgrp has rstat_cpu preallocated */
 	if (!cgrp->rstat_cpu) {
 		cgrp->rstat_cpu = alloc_percpu(struct cgroup_rstat_cpu);
@@ -309,7 +371,11 @@ static void cgroup_base_stat_sub(struct cgroup_base_stat *dst_bstat,
 	dst_bstat->cputime.sum_exec_runtime -= src_bstat->cputime.sum_exec_runtime;
 }
 
-static void cgroup_base_stat_flush(struct cgroup *cgrp, int cpu)
+/*
+ * @root tells whether @cgrp is the root of the subtree being flushed, in which
+ * case its parent may be concurrently updated by flushes of sibling subtrees.
+ */
+static void cgroup_base_stat_flush(struct cgroup *cgrp, int cpu, bool root)
 {
 	struct cgroup *parent = cgroup_parent(cgrp);
 	struct cgroup_rstat_cpu *rstatc = cgroup_rstat_cpu(cgrp, cpu);
@@ -332,7 +398,11 @@ static void cgroup_base_stat_flush(struct cgroup *cgrp, int cpu)
 	if (parent) {
 		delta = cgrp->bstat;
 		cgroup_base_stat_sub(&delta, &cgrp->last_bstat);
+		if (root)
+			spin_lock(&parent->rstat_bstat_lock);
 		cgroup_base_stat_add(&parent->bstat, &delta);
+		if (root)
+			spin_unlock(&parent->rstat_bstat_lock);
 		cgroup_base_stat_add(&cgrp->last_bstat, &delta);
 	}
 }
@@ -435,7 +505,7 @@ void cgroup_base_stat_cputime_show(struct seq_file *seq)
 		usage = cgrp->bstat.cputime.sum_exec_runtime;
 		cputime_adjust(&cgrp->bstat.cputime, &cgrp->prev_cputime,
 			       &utime, &stime);
-		cgroup_rstat_flush_release();
+		cgroup_rstat_flush_release(cgrp);
 	} else {
 		root_cgroup_cputime(&cputime);
 		usage = cputime.sum_exec_runtime;
@@ -12,6 +12,7 @@
 #include <linux/irq.h>
 #include <linux/math64.h>
 #include <linux/log2.h>
+#include <linux/sched/clock.h>
 
 #include <trace/events/irq.h>
 
@@ -924,6 +925,111 @@ static int __init irq_timings_irqts_selftest(void)
 	return ret;
 }
 
+/*
+ * Target residencies of a typical set of arm64 idle states: WFI, core
+ * retention, core power collapse and cluster power collapse.
+ */
+static const u64 replay_residency_ns[] __initconst = {
+	0, 100000, 500000, 3000000,
+};
+
+static int __init irq_timings_replay_state(u64 duration_ns)
+{
+	int i;
+
+	for (i = ARRAY_SIZE(replay_residency_ns) - 1; i > 0; i--)
+		if (replay_residency_ns[i] <= duration_ns)
+			break;
+
+	return i;
+}
+
+/*
+ * Replay a trace of interrupt intervals the way the idle governors see
+ * it: predict the next event after each interrupt, pick the deepest idle
+ * state fitting the prediction and compare it with the state the actual
+ * interval would have allowed. With no timer in the trace, a governor
+ * without the prediction always picks the deepest state, which gives the
+ * baseline to compare against.
+ */
+static int __init irq_timings_test_replay(struct timings_intervals *ti)
+{
+	int deepest = ARRAY_SIZE(replay_residency_ns) - 1;
+	unsigned int match = 0, shallow = 0, deep = 0, none = 0, timer = 0;
+	struct irqt_stat __percpu *s;
+	struct irqt_stat *irqs;
+	u64 ts = NSEC_PER_SEC, cost = 0, start, next;
+	int i, ret, state, ideal, irq = 0xACE5;
+
+	ret = irq_timings_alloc(irq);
+	if (ret) {
+		pr_err("Failed to allocate irq timings\n");
+		return ret;
+	}
+
+	s = idr_find(&irqt_stats, irq);
+	if (!s) {
+		ret = -EIDRM;
+		goto out;
+	}
+
+	irqs = this_cpu_ptr(s);
+
+	/* The first timestamp only starts the sequence. */
+	irq_timings_store(irq, irqs, ts);
+
+	for (i = 0; i < ti->count; i++) {
+
+		ideal = irq_timings_replay_state(ti->intervals[i]);
+		if (ideal == deepest)
+			timer++;
+
+		start = local_clock();
+		next = __irq_timings_next_event(irqs, irq, ts);
+		cost += local_clock() - start;
+
+		if (next == U64_MAX) {
+			none++;
+			state = deepest;
+		} else {
+			state = irq_timings_replay_state(next - ts);
+		}
+
+		if (state == ideal)
+			match++;
+		else if (state < ideal)
+			shallow++;
+		else
+			deep++;
+
+		ts += ti->intervals[i];
+		irq_timings_store(irq, irqs, ts);
+	}
+
+	pr_info("state matched %u/%zd (timer only %u), too shallow %u, too deep %u, unpredicted %u, %llu ns/prediction\n",
+		match, ti->count, timer, shallow, deep, none,
+		div_u64(cost, ti->count));
+out:
+	irq_timings_free(irq);
+
+	return ret;
+}
+
+static int __init irq_timings_replay_selftest(void)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < ARRAY_SIZE(tis); i++) {
+		pr_info("---> Replaying intervals number #%d (count=%zd)\n",
+			i, tis[i].count);
+		ret = irq_timings_test_replay(&tis[i]);
+		if (ret)
+			break;
+	}
+
+	return ret;
+}
+
 static int __init irq_timings_selftest(void)
 {
 	int ret;
@@ -948,6 +1054,10 @@ static int __init irq_timings_selftest(void)
 		goto out;
 
 	ret = irq_timings_next_index_selftest();
+	if (ret)
+		goto out;
+
+	ret = irq_timings_replay_selftest();
 out:
 	pr_info("---------- selftest end with %s -----------\n",
 		ret ? "failure" : "success");
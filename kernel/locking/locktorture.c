@@ -29,6 +29,7 @@
 #include <linux/slab.h>
 #include <linux/percpu-rwsem.h>
 #include <linux/torture.h>
+#include <linux/sched/clock.h>
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Paul E. McKenney <paulmck@linux.ibm.com>");
@@ -64,6 +65,8 @@ static bool lock_is_read_held;
 struct lock_stress_stats {
 	long n_lock_fail;
 	long n_lock_acquired;
+	u64 lock_latency_sum;	/* ns waited in ->writelock() */
+	u64 lock_latency_max;
 };
 
 /* Forward reference. */
@@ -613,6 +616,7 @@ static int lock_torture_writer(void *arg)
 {
 	struct lock_stress_stats *lwsp = arg;
 	DEFINE_TORTURE_RANDOM(rand);
+	u64 start, latency;
 
 	VERBOSE_TOROUT_STRING("lock_torture_writer task started");
 	set_user_nice(current, MAX_NICE);
@@ -622,7 +626,9 @@ static int lock_torture_writer(void *arg)
 			schedule_timeout_uninterruptible(1);
 
 		cxt.cur_ops->task_boost(&rand);
+		start = local_clock();
 		cxt.cur_ops->writelock();
+		latency = local_clock() - start;
 		if (WARN_ON_ONCE(lock_is_write_held))
 			lwsp->n_lock_fail++;
 		lock_is_write_held = true;
@@ -630,6 +636,9 @@ static int lock_torture_writer(void *arg)
 			lwsp->n_lock_fail++; /* rare, but... */
 
 		lwsp->n_lock_acquired++;
+		lwsp->lock_latency_sum += latency;
+		if (lwsp->lock_latency_max < latency)
+			lwsp->lock_latency_max = latency;
 		cxt.cur_ops->write_delay(&rand);
 		lock_is_write_held = false;
 		cxt.cur_ops->writeunlock();
@@ -684,12 +693,16 @@ static void __torture_print_stats(char *page,
 	int i, n_stress;
 	long max = 0, min = statp ? statp[0].n_lock_acquired : 0;
 	long long sum = 0;
+	u64 latency_sum = 0, latency_max = 0;
 
 	n_stress = write ? cxt.nrealwriters_stress : cxt.nrealreaders_stress;
 	for (i = 0; i < n_stress; i++) {
 		if (statp[i].n_lock_fail)
 			fail = true;
 		sum += statp[i].n_lock_acquired;
+		latency_sum += statp[i].lock_latency_sum;
+		if (latency_max < statp[i].lock_latency_max)
+			latency_max = statp[i].lock_latency_max;
 		if (max < statp[i].n_lock_acquired)
 			max = statp[i].n_lock_acquired;
 		if (min > statp[i].n_lock_acquired)
@@ -701,6 +714,9 @@ static void __torture_print_stats(char *page,
 			sum, max, min,
 			!onoff_interval && max / 2 > min ? "???" : "",
 			fail, fail ? "!!!" : "");
+	if (write && sum)
+		page += sprintf(page, "Write latency avg/max: %llu/%llu ns\n",
+				div64_u64(latency_sum, sum), latency_max);
 	if (fail)
 		atomic_inc(&cxt.n_lock_torture_errors);
 }
@@ -911,6 +927,8 @@ static int __init lock_torture_init(void)
 		for (i = 0; i < cxt.nrealwriters_stress; i++) {
 			cxt.lwsa[i].n_lock_fail = 0;
 			cxt.lwsa[i].n_lock_acquired = 0;
+			cxt.lwsa[i].lock_latency_sum = 0;
+			cxt.lwsa[i].lock_latency_max = 0;
 		}
 	}
 
@@ -1152,6 +1152,67 @@ void rt_mutex_init_waiter(struct rt_mutex_waiter *waiter)
 	waiter->task = NULL;
 }
 
+#ifdef CONFIG_RT_MUTEX_SPIN_ON_OWNER
+static inline bool rt_mutex_waiter_is_top_waiter(struct rt_mutex *lock,
+						 struct rt_mutex_waiter *waiter)
+{
+	struct rb_node *leftmost = rb_first_cached(&lock->waiters);
+
+	return rb_entry(leftmost, struct rt_mutex_waiter, tree_entry) == waiter;
+}
+
+/*
+ * Spin instead of sleeping while the owner of the lock runs on another CPU,
+ * as it is likely to release the lock before a sleep/wakeup round trip would
+ * complete.  Only the top waiter spins, which is the one the lock is handed
+ * to on release, so there is no need for an MCS queue as with mutexes.
+ *
+ * Returns true when the owner changed and the lock should be tried again,
+ * false when the caller should go to sleep.
+ */
+static bool rt_mutex_spin_on_owner(struct rt_mutex *lock,
+				   struct rt_mutex_waiter *waiter,
+				   struct task_struct *owner)
+{
+	bool ret = true;
+
+	rcu_read_lock();
+	for (;;) {
+		/* If the owner changed, try to take the lock again. */
+		if (owner != rt_mutex_owner(lock))
+			break;
+		/*
+		 * Ensure that @owner is dereferenced after checking that
+		 * the lock owner still matches @owner.  If that fails,
+		 * @owner might point to freed memory.  If it still matches,
+		 * the rcu_read_lock() ensures the memory stays valid.
+		 */
+		barrier();
+		/*
+		 * Stop spinning when the owner was scheduled out, when
+		 * we are no longer the top waiter or when we need to
+		 * reschedule.
+		 */
+		if (!owner_on_cpu(owner) || need_resched() ||
+		    !rt_mutex_waiter_is_top_waiter(lock, waiter)) {
+			ret = false;
+			break;
+		}
+		cpu_relax();
+	}
+	rcu_read_unlock();
+
+	return ret;
+}
+#else
+static inline bool rt_mutex_spin_on_owner(struct rt_mutex *lock,
+					  struct rt_mutex_waiter *waiter,
+					  struct task_struct *owner)
+{
+	return false;
+}
+#endif
+
 /**
  * __rt_mutex_slowlock() - Perform the wait-wake-try-to-take loop
  * @lock:		 the rt_mutex to take
@@ -1167,6 +1228,7 @@ __rt_mutex_slowlock(struct rt_mutex *lock, int state,
 		    struct hrtimer_sleeper *timeout,
 		    struct rt_mutex_waiter *waiter)
 {
+	struct task_struct *owner;
 	int ret = 0;
 
 	trace_android_vh_rtmutex_wait_start(lock);
@@ -1189,11 +1251,16 @@ __rt_mutex_slowlock(struct rt_mutex *lock, int state,
 				break;
 		}
 
+		if (waiter == rt_mutex_top_waiter(lock))
+			owner = rt_mutex_owner(lock);
+		else
+			owner = NULL;
 		raw_spin_unlock_irq(&lock->wait_lock);
 
 		debug_rt_mutex_print_deadlock(waiter);
 
-		schedule();
+		if (!owner || !rt_mutex_spin_on_owner(lock, waiter, owner))
+			schedule();
 
 		raw_spin_lock_irq(&lock->wait_lock);
 		set_current_state(state);
@@ -165,6 +165,23 @@ DECLARE_PER_CPU(struct hrtimer_cpu_base, hrtimer_bases);
 
 extern u64 get_next_timer_interrupt(unsigned long basej, u64 basem);
 void timer_clear_idle(void);
+extern u64 get_jiffies_update(unsigned long *basej);
+
+#if defined(CONFIG_SMP) && defined(CONFIG_NO_HZ_COMMON)
+extern void timer_expire_remote(unsigned int cpu);
+extern void timer_lock_remote_base(unsigned int cpu);
+extern void timer_unlock_remote_base(unsigned int cpu);
+extern u64 timer_next_remote(unsigned int cpu);
+extern void tmigr_cpu_activate(void);
+extern u64 tmigr_cpu_deactivate(u64 nextevt);
+extern bool tmigr_requires_handle_remote(void);
+extern void tmigr_handle_remote(void);
+#else
+static inline void tmigr_cpu_activate(void) { }
+static inline u64 tmigr_cpu_deactivate(u64 nextevt) { return nextevt; }
+static inline bool tmigr_requires_handle_remote(void) { return false; }
+static inline void tmigr_handle_remote(void) { }
+#endif
 
 void clock_was_set(void);
 void clock_was_set_delayed(void);
@@ -185,18 +185,22 @@ EXPORT_SYMBOL(jiffies_64);
 #define WHEEL_TIMEOUT_MAX	(WHEEL_TIMEOUT_CUTOFF - LVL_GRAN(LVL_DEPTH - 1))
 
 /*
- * The resulting wheel size. If NOHZ is configured we allocate two
- * wheels so we have a separate storage for the deferrable timers.
+ * The resulting wheel size. If NOHZ is configured we allocate three
+ * wheels: the pinned timers, the global timers which can be expired by
+ * another CPU while this one is idle (see timer_migration.c), and the
+ * deferrable timers.
  */
 #define WHEEL_SIZE	(LVL_SIZE * LVL_DEPTH)
 
 #ifdef CONFIG_NO_HZ_COMMON
-# define NR_BASES	2
-# define BASE_STD	0
-# define BASE_DEF	1
+# define NR_BASES	3
+# define BASE_LOCAL	0
+# define BASE_GLOBAL	1
+# define BASE_DEF	2
 #else
 # define NR_BASES	1
-# define BASE_STD	0
+# define BASE_LOCAL	0
+# define BASE_GLOBAL	0
 # define BASE_DEF	0
 #endif
 
@@ -567,6 +571,15 @@ trigger_dyntick_cpu(struct timer_base *base, struct timer_list *timer)
 		return;
 	}
 
+	/*
+	 * A global timer is only queued on the base of another CPU while it
+	 * is running there. If that CPU is idle, the timer migration
+	 * hierarchy expires the timer on its behalf and reports the next
+	 * expiry of the base afterwards, so no IPI is required.
+	 */
+	if (!(timer->flags & TIMER_PINNED) && base->running_timer == timer)
+		return;
+
 	/*
 	 * We might have to IPI the remote CPU if the base is idle and the
 	 * timer is not deferrable. If the other CPU is on the way to idle
@@ -853,30 +866,26 @@ static int detach_if_pending(struct timer_list *timer, struct timer_base *base,
 	return 1;
 }
 
-static inline struct timer_base *get_timer_cpu_base(u32 tflags, u32 cpu)
+static inline unsigned int timer_base_index(u32 tflags)
 {
-	struct timer_base *base = per_cpu_ptr(&timer_bases[BASE_STD], cpu);
-
 	/*
 	 * If the timer is deferrable and NO_HZ_COMMON is set then we need
-	 * to use the deferrable base.
+	 * to use the deferrable base. Otherwise pinned timers go to the
+	 * local base and the others to the global base.
 	 */
 	if (IS_ENABLED(CONFIG_NO_HZ_COMMON) && (tflags & TIMER_DEFERRABLE))
-		base = per_cpu_ptr(&timer_bases[BASE_DEF], cpu);
-	return base;
+		return BASE_DEF;
+	return (tflags & TIMER_PINNED) ? BASE_LOCAL : BASE_GLOBAL;
 }
 
-static inline struct timer_base *get_timer_this_cpu_base(u32 tflags)
+static inline struct timer_base *get_timer_cpu_base(u32 tflags, u32 cpu)
 {
-	struct timer_base *base = this_cpu_ptr(&timer_bases[BASE_STD]);
+	return per_cpu_ptr(&timer_bases[timer_base_index(tflags)], cpu);
+}
 
-	/*
-	 * If the timer is deferrable and NO_HZ_COMMON is set then we need
-	 * to use the deferrable base.
-	 */
-	if (IS_ENABLED(CONFIG_NO_HZ_COMMON) && (tflags & TIMER_DEFERRABLE))
-		base = this_cpu_ptr(&timer_bases[BASE_DEF]);
-	return base;
+static inline struct timer_base *get_timer_this_cpu_base(u32 tflags)
+{
+	return this_cpu_ptr(&timer_bases[timer_base_index(tflags)]);
 }
 
 static inline struct timer_base *get_timer_base(u32 tflags)
@@ -884,14 +893,14 @@ static inline struct timer_base *get_timer_base(u32 tflags)
 	return get_timer_cpu_base(tflags, tflags & TIMER_CPUMASK);
 }
 
+/*
+ * Timers are always queued on the local CPU. Instead of being pushed to a
+ * busy CPU at enqueue time, the global timers of an idle CPU are pulled by
+ * the timer migration hierarchy when they expire.
+ */
 static inline struct timer_base *
 get_target_base(struct timer_base *base, unsigned tflags)
 {
-#if defined(CONFIG_SMP) && defined(CONFIG_NO_HZ_COMMON)
-	if (static_branch_likely(&timers_migration_enabled) &&
-	    !(tflags & TIMER_PINNED))
-		return get_timer_cpu_base(tflags, get_nohz_timer_target());
-#endif
 	return get_timer_this_cpu_base(tflags);
 }
 
@@ -1205,7 +1214,8 @@ EXPORT_SYMBOL(add_timer_global);
  * @timer:	The timer to be started
  * @cpu:	The CPU to start it on
  *
- * Same as add_timer() except that it starts the timer on the given CPU.
+ * Same as add_timer() except that it starts the timer on the given CPU and
+ * the timer flag TIMER_PINNED is set.
  *
  * See add_timer() for further details.
  */
@@ -1216,6 +1226,12 @@ void add_timer_on(struct timer_list *timer, int cpu)
 
 	BUG_ON(timer_pending(timer) || !timer->function);
 
+	/*
+	 * The timer must stay on @cpu, and a CPU which is idle only wakes
+	 * up for timers queued remotely on its local base.
+	 */
+	timer->flags |= TIMER_PINNED;
+
 	new_base = get_timer_cpu_base(timer->flags, cpu);
 
 	/*
@@ -1688,28 +1704,17 @@ static u64 cmp_next_hrtimer_event(u64 basem, u64 expires)
 	return DIV_ROUND_UP_ULL(nextevt, TICK_NSEC) * TICK_NSEC;
 }
 
-/**
- * get_next_timer_interrupt - return the time (clock mono) of the next timer
- * @basej:	base time jiffies
- * @basem:	base time clock monotonic
+/*
+ * Return the time (clock mono) of the next pending timer of @base, @basem
+ * if it is already expired or KTIME_MAX if no timer is pending.
  *
- * Returns the tick aligned clock monotonic time of the next pending
- * timer or KTIME_MAX if no timer is pending.
+ * Must be called with @base->lock held.
  */
-u64 get_next_timer_interrupt(unsigned long basej, u64 basem)
+static u64 next_timer_event(struct timer_base *base, unsigned long basej,
+			    u64 basem)
 {
-	struct timer_base *base = this_cpu_ptr(&timer_bases[BASE_STD]);
-	u64 expires = KTIME_MAX;
 	unsigned long nextevt;
 
-	/*
-	 * Pretend that there is no timer pending if the cpu is offline.
-	 * Possible pending timers will be migrated later to an active cpu.
-	 */
-	if (cpu_is_offline(smp_processor_id()))
-		return expires;
-
-	raw_spin_lock(&base->lock);
 	if (base->next_expiry_recalc)
 		base->next_expiry = __next_timer_interrupt(base);
 	nextevt = base->next_expiry;
@@ -1726,23 +1731,66 @@ u64 get_next_timer_interrupt(unsigned long basej, u64 basem)
 			base->clk = nextevt;
 	}
 
-	if (time_before_eq(nextevt, basej)) {
-		expires = basem;
-		base->is_idle = false;
-	} else {
-		if (base->timers_pending)
-			expires = basem + (u64)(nextevt - basej) * TICK_NSEC;
+	if (time_before_eq(nextevt, basej))
+		return basem;
+	if (!base->timers_pending)
+		return KTIME_MAX;
+	return basem + (u64)(nextevt - basej) * TICK_NSEC;
+}
+
+/**
+ * get_next_timer_interrupt - return the time (clock mono) of the next timer
+ * @basej:	base time jiffies
+ * @basem:	base time clock monotonic
+ *
+ * Returns the tick aligned clock monotonic time of the next pending
+ * timer or KTIME_MAX if no timer is pending.
+ */
+u64 get_next_timer_interrupt(unsigned long basej, u64 basem)
+{
+	struct timer_base *base_local, *base_global;
+	u64 expires, local_evt, global_evt;
+
+	/*
+	 * Pretend that there is no timer pending if the cpu is offline.
+	 * Possible pending timers will be migrated later to an active cpu.
+	 */
+	if (cpu_is_offline(smp_processor_id()))
+		return KTIME_MAX;
+
+	base_local = this_cpu_ptr(&timer_bases[BASE_LOCAL]);
+	base_global = this_cpu_ptr(&timer_bases[BASE_GLOBAL]);
+
+	raw_spin_lock(&base_local->lock);
+	raw_spin_lock_nested(&base_global->lock, SINGLE_DEPTH_NESTING);
+
+	local_evt = next_timer_event(base_local, basej, basem);
+	global_evt = next_timer_event(base_global, basej, basem);
+	expires = min(local_evt, global_evt);
+
+	if (expires == basem) {
+		base_local->is_idle = false;
+		base_global->is_idle = false;
+	} else if ((expires - basem) > TICK_NSEC) {
 		/*
-		 * If we expect to sleep more than a tick, mark the base idle.
-		 * Also the tick is stopped so any added timer must forward
-		 * the base clk itself to keep granularity small. This idle
-		 * logic is only maintained for the BASE_STD base, deferrable
-		 * timers may still see large granularity skew (by design).
+		 * If we expect to sleep more than a tick, mark the bases
+		 * idle. Also the tick is stopped so any added timer must
+		 * forward the base clk itself to keep granularity small.
+		 * This idle logic is not maintained for the BASE_DEF base,
+		 * deferrable timers may still see large granularity skew
+		 * (by design).
+		 *
+		 * The global timers are handed over to the timer migration
+		 * hierarchy, and this CPU only has to wake up for them when
+		 * it is the last active CPU.
 		 */
-		if ((expires - basem) > TICK_NSEC)
-			base->is_idle = true;
+		base_local->is_idle = true;
+		base_global->is_idle = true;
+		expires = min(local_evt, tmigr_cpu_deactivate(global_evt));
 	}
-	raw_spin_unlock(&base->lock);
+
+	raw_spin_unlock(&base_global->lock);
+	raw_spin_unlock(&base_local->lock);
 
 	return cmp_next_hrtimer_event(basem, expires);
 }
@@ -1754,15 +1802,16 @@ u64 get_next_timer_interrupt(unsigned long basej, u64 basem)
  */
 void timer_clear_idle(void)
 {
-	struct timer_base *base = this_cpu_ptr(&timer_bases[BASE_STD]);
-
 	/*
 	 * We do this unlocked. The worst outcome is a remote enqueue sending
 	 * a pointless IPI, but taking the lock would just make the window for
 	 * sending the IPI a few instructions smaller for the cost of taking
 	 * the lock in the exit from idle path.
 	 */
-	base->is_idle = false;
+	__this_cpu_write(timer_bases[BASE_LOCAL].is_idle, false);
+	__this_cpu_write(timer_bases[BASE_GLOBAL].is_idle, false);
+
+	tmigr_cpu_activate();
 }
 #endif
 
@@ -1804,6 +1853,14 @@ static inline void __run_timers(struct timer_base *base)
 	timer_base_lock_expiry(base);
 	raw_spin_lock_irq(&base->lock);
 
+	/*
+	 * The global timers of an idle CPU may be expired remotely. If
+	 * another CPU is already running the timers of this base, it takes
+	 * care of all the expired ones.
+	 */
+	if (base->running_timer)
+		goto out;
+
 	while (time_after_eq(jiffies, base->clk) &&
 	       time_after_eq(jiffies, base->next_expiry)) {
 		levels = collect_expired_timers(base, heads);
@@ -1822,20 +1879,72 @@ static inline void __run_timers(struct timer_base *base)
 		while (levels--)
 			expire_timers(base, heads + levels);
 	}
+out:
 	raw_spin_unlock_irq(&base->lock);
 	timer_base_unlock_expiry(base);
 }
 
+#if defined(CONFIG_SMP) && defined(CONFIG_NO_HZ_COMMON)
+/**
+ * timer_expire_remote - expire the global timers of an idle CPU
+ * @cpu:	The idle CPU
+ *
+ * Called by the timer migration hierarchy on behalf of @cpu.
+ */
+void timer_expire_remote(unsigned int cpu)
+{
+	__run_timers(per_cpu_ptr(&timer_bases[BASE_GLOBAL], cpu));
+}
+
+/*
+ * The global base of an idle CPU is locked by the timer migration hierarchy
+ * while it reports the next expiry of the base, so that no timer can be
+ * queued or reported in between. As in get_next_timer_interrupt(), the base
+ * lock is taken before the locks of the hierarchy.
+ */
+void timer_lock_remote_base(unsigned int cpu)
+{
+	raw_spin_lock_irq(&per_cpu_ptr(&timer_bases[BASE_GLOBAL], cpu)->lock);
+}
+
+void timer_unlock_remote_base(unsigned int cpu)
+{
+	raw_spin_unlock_irq(&per_cpu_ptr(&timer_bases[BASE_GLOBAL], cpu)->lock);
+}
+
+/**
+ * timer_next_remote - next global timer expiry of an idle CPU
+ * @cpu:	The idle CPU, whose base is locked by timer_lock_remote_base()
+ *
+ * Returns the tick aligned clock monotonic time of the next pending
+ * global timer of @cpu or KTIME_MAX if no timer is pending.
+ */
+u64 timer_next_remote(unsigned int cpu)
+{
+	struct timer_base *base = per_cpu_ptr(&timer_bases[BASE_GLOBAL], cpu);
+	unsigned long basej;
+	u64 basem;
+
+	lockdep_assert_held(&base->lock);
+
+	basem = get_jiffies_update(&basej);
+	return next_timer_event(base, basej, basem);
+}
+#endif
+
 /*
  * This function runs timers and the timer-tq in bottom half context.
  */
 static __latent_entropy void run_timer_softirq(struct softirq_action *h)
 {
-	struct timer_base *base = this_cpu_ptr(&timer_bases[BASE_STD]);
+	struct timer_base *base = this_cpu_ptr(&timer_bases[BASE_LOCAL]);
 
 	__run_timers(base);
-	if (IS_ENABLED(CONFIG_NO_HZ_COMMON))
+	if (IS_ENABLED(CONFIG_NO_HZ_COMMON)) {
+		__run_timers(this_cpu_ptr(&timer_bases[BASE_GLOBAL]));
 		__run_timers(this_cpu_ptr(&timer_bases[BASE_DEF]));
+		tmigr_handle_remote();
+	}
 }
 
 /*
@@ -1843,16 +1952,20 @@ static __latent_entropy void run_timer_softirq(struct softirq_action *h)
  */
 void run_local_timers(void)
 {
-	struct timer_base *base = this_cpu_ptr(&timer_bases[BASE_STD]);
+	struct timer_base *base = this_cpu_ptr(&timer_bases[BASE_LOCAL]);
 
 	hrtimer_run_queues();
 	/* Raise the softirq only if required. */
-	if (time_before(jiffies, base->next_expiry)) {
+	if (time_before(jiffies, base[BASE_LOCAL].next_expiry)) {
 		if (!IS_ENABLED(CONFIG_NO_HZ_COMMON))
 			return;
-		/* CPU is awake, so check the deferrable base. */
-		base++;
-		if (time_before(jiffies, base->next_expiry))
+		/*
+		 * CPU is awake, so check the global and deferrable bases,
+		 * and the global timers of idle CPUs it is responsible for.
+		 */
+		if (time_before(jiffies, base[BASE_GLOBAL].next_expiry) &&
+		    time_before(jiffies, base[BASE_DEF].next_expiry) &&
+		    !tmigr_requires_handle_remote())
 			return;
 	}
 	raise_softirq(TIMER_SOFTIRQ);
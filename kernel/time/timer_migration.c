@@ -0,0 +1,490 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Infrastructure for migratable timers
+ *
+ * The global (non pinned) timers of a CPU are queued on the CPU which starts
+ * them. When the CPU goes idle, it does not wake up for them anymore but
+ * hands them over to a hierarchy which follows the CPU topology: the CPUs
+ * of a cluster form a level 0 group, clusters are grouped at the next level
+ * and so on up to a single top level group.
+ *
+ * Each group tracks which of its children are active and the earliest
+ * global timer of its idle children. One active child of a group, the
+ * migrator, expires the global timers of the idle children from the timer
+ * softirq. A group whose children all went idle becomes idle in its parent
+ * and reports its earliest timer there, so the global timers of a whole
+ * cluster are expired by an active CPU of another cluster. When the last
+ * CPU goes idle, it is the only one which has to wake up for the earliest
+ * global timer of the system.
+ *
+ * The state of a group is changed with its lock held, and a change is
+ * propagated to the parent with the lock of the child still held, so the
+ * locks are always taken bottom up.
+ */
+
+#include <linux/cpuhotplug.h>
+#include <linux/cpumask.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/topology.h>
+
+#include "tick-internal.h"
+#include "timer_migration.h"
+
+static struct tmigr_group *tmigr_root;
+
+static DEFINE_PER_CPU(struct tmigr_cpu, tmigr_cpu);
+
+/*
+ * Update the state of child @idx of @group and walk up the hierarchy as
+ * long as the change is visible to the parent. An active group hides the
+ * state of its children.
+ *
+ * Must be called with @group->lock held.
+ *
+ * Return: the earliest global timer expiry if the whole hierarchy is idle,
+ * KTIME_MAX otherwise.
+ */
+static u64 tmigr_update_child(struct tmigr_group *group, unsigned int idx,
+			      bool active, u64 expiry)
+{
+	struct tmigr_group *parent = group->parent;
+	bool was_active = group->active;
+	u64 next_expiry = KTIME_MAX;
+	unsigned int i;
+	u64 ret;
+
+	lockdep_assert_held(&group->lock);
+
+	if (active) {
+		__set_bit(idx, &group->active);
+		if (group->migrator == TMIGR_NONE)
+			WRITE_ONCE(group->migrator, idx);
+		expiry = KTIME_MAX;
+	} else {
+		__clear_bit(idx, &group->active);
+		if (group->migrator == idx)
+			WRITE_ONCE(group->migrator, group->active ?
+				   __ffs(group->active) : TMIGR_NONE);
+	}
+	group->expiry[idx] = expiry;
+
+	for (i = 0; i < group->num_children; i++)
+		next_expiry = min(next_expiry, group->expiry[i]);
+	WRITE_ONCE(group->next_expiry, next_expiry);
+
+	if (was_active && group->active)
+		return KTIME_MAX;
+
+	if (!parent)
+		return group->active ? KTIME_MAX : next_expiry;
+
+	raw_spin_lock_nested(&parent->lock, parent->level);
+	ret = tmigr_update_child(parent, group->childidx, group->active,
+				 next_expiry);
+	raw_spin_unlock(&parent->lock);
+
+	return ret;
+}
+
+static void __tmigr_cpu_activate(struct tmigr_cpu *tmc)
+{
+	raw_spin_lock(&tmc->group->lock);
+	tmc->idle = false;
+	tmc->wakeup = KTIME_MAX;
+	tmigr_update_child(tmc->group, tmc->childidx, true, KTIME_MAX);
+	raw_spin_unlock(&tmc->group->lock);
+}
+
+/**
+ * tmigr_cpu_activate() - Take the global timers of this CPU back
+ *
+ * Called with interrupts disabled when the CPU leaves idle.
+ */
+void tmigr_cpu_activate(void)
+{
+	struct tmigr_cpu *tmc = this_cpu_ptr(&tmigr_cpu);
+
+	/* Only this CPU sets @idle, so the unlocked check is fine */
+	if (!tmc->idle || !tmc->online)
+		return;
+
+	__tmigr_cpu_activate(tmc);
+}
+
+/**
+ * tmigr_cpu_deactivate() - Hand the global timers of this CPU over
+ * @nextexp:	Expiry of the first global timer of this CPU, KTIME_MAX if none
+ *
+ * Called with interrupts disabled when the CPU goes idle, or updates its
+ * next global timer expiry while idle.
+ *
+ * Return: the expiry the CPU has to wake up for on behalf of its global
+ * timers: KTIME_MAX when another CPU takes care of them, the earliest
+ * global timer of the system when this CPU was the last active one, or
+ * @nextexp when the hierarchy is not in use.
+ */
+u64 tmigr_cpu_deactivate(u64 nextexp)
+{
+	struct tmigr_cpu *tmc = this_cpu_ptr(&tmigr_cpu);
+	u64 ret;
+
+	if (!tmc->online)
+		return nextexp;
+
+	if (!static_branch_likely(&timers_migration_enabled)) {
+		if (tmc->idle)
+			__tmigr_cpu_activate(tmc);
+		return nextexp;
+	}
+
+	raw_spin_lock(&tmc->group->lock);
+	tmc->idle = true;
+	ret = tmigr_update_child(tmc->group, tmc->childidx, false, nextexp);
+	tmc->wakeup = ret;
+	raw_spin_unlock(&tmc->group->lock);
+
+	return ret;
+}
+
+/*
+ * Expire the global timers of an idle CPU and report its next global timer
+ * expiry. Only one CPU at a time does so, see @remote.
+ *
+ * A timer callback which re-arms its timer queues it on the idle CPU again
+ * without waking it up, see trigger_dyntick_cpu(), so the next expiry is
+ * always reported if the CPU is still idle. It is read with the base locked,
+ * which also serializes against the CPU updating its state from
+ * get_next_timer_interrupt(), so no fresher expiry can be overwritten.
+ */
+static void tmigr_expire_cpu(unsigned int cpu)
+{
+	struct tmigr_cpu *tmc = per_cpu_ptr(&tmigr_cpu, cpu);
+	struct tmigr_group *group = tmc->group;
+
+	raw_spin_lock_irq(&group->lock);
+	if (!tmc->online || !tmc->idle || tmc->remote) {
+		raw_spin_unlock_irq(&group->lock);
+		return;
+	}
+	tmc->remote = true;
+	raw_spin_unlock_irq(&group->lock);
+
+	timer_expire_remote(cpu);
+
+	timer_lock_remote_base(cpu);
+	raw_spin_lock(&group->lock);
+	tmc->remote = false;
+	if (tmc->online && tmc->idle)
+		tmigr_update_child(group, tmc->childidx, false,
+				   timer_next_remote(cpu));
+	raw_spin_unlock(&group->lock);
+	timer_unlock_remote_base(cpu);
+}
+
+static void tmigr_handle_group(struct tmigr_group *group, u64 now)
+{
+	unsigned long expired = 0;
+	unsigned int i;
+
+	raw_spin_lock_irq(&group->lock);
+	for (i = 0; i < group->num_children; i++) {
+		if (!test_bit(i, &group->active) && group->expiry[i] <= now)
+			__set_bit(i, &expired);
+	}
+	raw_spin_unlock_irq(&group->lock);
+
+	for_each_set_bit(i, &expired, group->num_children) {
+		if (group->level)
+			tmigr_handle_group(group->child[i], now);
+		else
+			tmigr_expire_cpu(group->cpu[i]);
+	}
+}
+
+/*
+ * Walk up the groups this CPU is the migrator of, and look for expired
+ * timers of idle children. An idle CPU which woke up on behalf of the
+ * hierarchy looks at the top level group.
+ */
+static bool tmigr_check_remote(bool handle)
+{
+	struct tmigr_cpu *tmc = this_cpu_ptr(&tmigr_cpu);
+	struct tmigr_group *group = tmc->group;
+	unsigned int idx = tmc->childidx;
+	bool expired = false;
+	u64 now;
+
+	if (!tmc->online)
+		return false;
+
+	now = ktime_get();
+
+	if (READ_ONCE(tmc->idle)) {
+		if (READ_ONCE(tmc->wakeup) > now)
+			return false;
+		if (handle) {
+			tmigr_handle_group(tmigr_root, now);
+			/*
+			 * The CPU takes over the next expiry of the hierarchy
+			 * in tmigr_cpu_deactivate() before it goes back to
+			 * sleep. Only this CPU writes @wakeup.
+			 */
+			WRITE_ONCE(tmc->wakeup, KTIME_MAX);
+		}
+		return true;
+	}
+
+	while (group && READ_ONCE(group->migrator) == idx) {
+		if (READ_ONCE(group->next_expiry) <= now) {
+			if (!handle)
+				return true;
+			tmigr_handle_group(group, now);
+			expired = true;
+		}
+		idx = group->childidx;
+		group = group->parent;
+	}
+
+	return expired;
+}
+
+/**
+ * tmigr_requires_handle_remote() - Check for expired timers of idle CPUs
+ *
+ * Called from the tick to decide whether the timer softirq has to be
+ * raised on behalf of idle CPUs.
+ */
+bool tmigr_requires_handle_remote(void)
+{
+	return tmigr_check_remote(false);
+}
+
+/**
+ * tmigr_handle_remote() - Expire the global timers of idle CPUs
+ *
+ * Called from the timer softirq.
+ */
+void tmigr_handle_remote(void)
+{
+	tmigr_check_remote(true);
+}
+
+static int tmigr_cpu_online(unsigned int cpu)
+{
+	struct tmigr_cpu *tmc = this_cpu_ptr(&tmigr_cpu);
+
+	raw_spin_lock_irq(&tmc->group->lock);
+	tmc->online = true;
+	tmc->idle = false;
+	tmc->wakeup = KTIME_MAX;
+	tmigr_update_child(tmc->group, tmc->childidx, true, KTIME_MAX);
+	raw_spin_unlock_irq(&tmc->group->lock);
+
+	return 0;
+}
+
+/*
+ * The timers of an outgoing CPU are moved to another CPU by
+ * timers_dead_cpu(), so it leaves the hierarchy without any timer.
+ */
+static int tmigr_cpu_offline(unsigned int cpu)
+{
+	struct tmigr_cpu *tmc = this_cpu_ptr(&tmigr_cpu);
+
+	raw_spin_lock_irq(&tmc->group->lock);
+	tmc->online = false;
+	tmc->idle = true;
+	tmc->wakeup = KTIME_MAX;
+	tmigr_update_child(tmc->group, tmc->childidx, false, KTIME_MAX);
+	raw_spin_unlock_irq(&tmc->group->lock);
+
+	return 0;
+}
+
+static struct tmigr_group * __init tmigr_group_alloc(unsigned int level)
+{
+	struct tmigr_group *group;
+	unsigned int i;
+
+	group = kzalloc(sizeof(*group), GFP_KERNEL);
+	if (!group)
+		return NULL;
+
+	raw_spin_lock_init(&group->lock);
+	group->level = level;
+	group->migrator = TMIGR_NONE;
+	group->next_expiry = KTIME_MAX;
+	for (i = 0; i < TMIGR_CHILDREN_MAX; i++)
+		group->expiry[i] = KTIME_MAX;
+
+	return group;
+}
+
+/*
+ * CPUs sharing the last level cache form a cluster. CPUs which were not
+ * online at boot have no topology information yet and get a group of
+ * their own.
+ */
+static const struct cpumask * __init tmigr_cluster_mask(unsigned int cpu)
+{
+	if (!cpu_online(cpu))
+		return cpumask_of(cpu);
+#ifdef CONFIG_GENERIC_ARCH_TOPOLOGY
+	return cpu_coregroup_mask(cpu);
+#else
+	return topology_core_cpumask(cpu);
+#endif
+}
+
+static int __init tmigr_build_level0(struct tmigr_group **groups)
+{
+	struct tmigr_group *group;
+	cpumask_var_t done;
+	unsigned int cpu, sibling;
+	int n = 0;
+
+	if (!zalloc_cpumask_var(&done, GFP_KERNEL))
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		if (cpumask_test_cpu(cpu, done))
+			continue;
+
+		group = NULL;
+		for_each_cpu_and(sibling, tmigr_cluster_mask(cpu),
+				 cpu_possible_mask) {
+			struct tmigr_cpu *tmc = per_cpu_ptr(&tmigr_cpu, sibling);
+
+			if (cpumask_test_cpu(sibling, done))
+				continue;
+
+			if (!group || group->num_children == TMIGR_CHILDREN_MAX) {
+				group = tmigr_group_alloc(0);
+				if (!group) {
+					n = -ENOMEM;
+					goto out;
+				}
+				groups[n++] = group;
+			}
+
+			tmc->group = group;
+			tmc->childidx = group->num_children;
+			tmc->wakeup = KTIME_MAX;
+			group->cpu[group->num_children++] = sibling;
+			cpumask_set_cpu(sibling, done);
+		}
+	}
+out:
+	free_cpumask_var(done);
+	return n;
+}
+
+/*
+ * Every CPU must reach the root through groups of increasing level, each
+ * of them being linked to a parent other than itself.
+ */
+static bool __init tmigr_hierarchy_valid(void)
+{
+	unsigned int cpu;
+
+	if (tmigr_root->parent)
+		return false;
+
+	for_each_possible_cpu(cpu) {
+		struct tmigr_group *group = per_cpu_ptr(&tmigr_cpu, cpu)->group;
+
+		if (!group || group->level)
+			return false;
+
+		while (group != tmigr_root) {
+			struct tmigr_group *parent = group->parent;
+
+			if (!parent || parent == group ||
+			    parent->level != group->level + 1 ||
+			    parent->child[group->childidx] != group)
+				return false;
+			group = parent;
+		}
+	}
+
+	return true;
+}
+
+static int __init tmigr_build_hierarchy(void)
+{
+	struct tmigr_group **groups, **parents, *parent = NULL;
+	unsigned int level = 0;
+	int i, n, ret = 0;
+
+	groups = kcalloc(nr_cpu_ids, sizeof(*groups), GFP_KERNEL);
+	parents = kcalloc(nr_cpu_ids, sizeof(*parents), GFP_KERNEL);
+	if (!groups || !parents) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	n = tmigr_build_level0(groups);
+	if (n < 0) {
+		ret = n;
+		goto out;
+	}
+
+	/* Group the groups of each level until a single group is left */
+	while (n > 1) {
+		int m = 0;
+
+		level++;
+		for (i = 0; i < n; i++) {
+			if (i % TMIGR_CHILDREN_MAX == 0) {
+				parent = tmigr_group_alloc(level);
+				if (!parent) {
+					ret = -ENOMEM;
+					goto out;
+				}
+				parents[m++] = parent;
+			}
+			groups[i]->parent = parent;
+			groups[i]->childidx = parent->num_children;
+			parent->child[parent->num_children++] = groups[i];
+		}
+		swap(groups, parents);
+		n = m;
+	}
+
+	tmigr_root = groups[0];
+	if (WARN_ON_ONCE(!tmigr_hierarchy_valid())) {
+		tmigr_root = NULL;
+		ret = -EINVAL;
+	}
+out:
+	/* A partially built hierarchy is never used, so it is not freed */
+	kfree(parents);
+	kfree(groups);
+	return ret;
+}
+
+static int __init tmigr_init(void)
+{
+	int ret;
+
+	if (num_possible_cpus() == 1)
+		return 0;
+
+	ret = tmigr_build_hierarchy();
+	if (ret)
+		goto err;
+
+	ret = cpuhp_setup_state(CPUHP_AP_ONLINE_DYN, "tmigr:online",
+				tmigr_cpu_online, tmigr_cpu_offline);
+	if (ret < 0)
+		goto err;
+
+	return 0;
+
+err:
+	pr_err("Timer migration setup failed\n");
+	return ret;
+}
+core_initcall(tmigr_init);
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#ifndef _KERNEL_TIME_MIGRATION_H
+#define _KERNEL_TIME_MIGRATION_H
+
+/* Per group capacity. Must be <= BITS_PER_LONG */
+#define TMIGR_CHILDREN_MAX	8
+#define TMIGR_NONE		UINT_MAX
+
+/**
+ * struct tmigr_group - timer migration hierarchy group
+ * @lock:		Lock protecting the group and the state of its children;
+ *			the lock of a parent is always taken with the lock of
+ *			the child held
+ * @parent:		Pointer to the parent group, NULL for the top level group
+ * @level:		Hierarchy level of the group; the children of a level 0
+ *			group are CPUs
+ * @childidx:		Index of the group in its parent
+ * @num_children:	Number of children
+ * @active:		Bitmask of the active children
+ * @migrator:		Index of the active child which expires the global timers
+ *			of the idle children, TMIGR_NONE if the group is idle
+ * @next_expiry:	Earliest expiry of the global timers of the idle children
+ * @expiry:		Expiry of the global timers of each child, KTIME_MAX when
+ *			the child is active
+ * @child:		Child groups (level > 0)
+ * @cpu:		Child CPUs (level 0)
+ */
+struct tmigr_group {
+	raw_spinlock_t		lock;
+	struct tmigr_group	*parent;
+	unsigned int		level;
+	unsigned int		childidx;
+	unsigned int		num_children;
+	unsigned long		active;
+	unsigned int		migrator;
+	u64			next_expiry;
+	u64			expiry[TMIGR_CHILDREN_MAX];
+	union {
+		struct tmigr_group	*child[TMIGR_CHILDREN_MAX];
+		unsigned int		cpu[TMIGR_CHILDREN_MAX];
+	};
+};
+
+/**
+ * struct tmigr_cpu - timer migration per CPU state
+ * @group:	Level 0 group of the CPU
+ * @childidx:	Index of the CPU in @group
+ * @online:	The CPU is part of the hierarchy
+ * @idle:	The CPU handed its global timers over to the hierarchy
+ * @remote:	The global timers of the CPU are being expired by another CPU
+ * @wakeup:	Expiry the CPU has to wake up for on behalf of the hierarchy,
+ *		KTIME_MAX unless it is the last CPU which went idle
+ *
+ * All the fields but @group and @childidx are protected by @group->lock.
+ */
+struct tmigr_cpu {
+	struct tmigr_group	*group;
+	unsigned int		childidx;
+	bool			online;
+	bool			idle;
+	bool			remote;
+	u64			wakeup;
+};
+
+#endif
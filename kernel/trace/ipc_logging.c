@@ -20,6 +20,8 @@
 #include <linux/delay.h>
 #include <linux/completion.h>
 #include <linux/sched/clock.h>
+#include <linux/percpu.h>
+#include <linux/reboot.h>
 #include <linux/ipc_logging.h>
 #include <soc/qcom/minidump.h>
 
@@ -31,6 +33,26 @@
 /*16th bit is used for minidump feature*/
 #define FEATURE_MASK 0x10000
 
+#ifdef CONFIG_IPC_LOG_CPU_BUF
+#define IPC_LOG_CPU_BUF_SIZE	(1U << CONFIG_IPC_LOG_CPU_BUF_SHIFT)
+#else
+#define IPC_LOG_CPU_BUF_SIZE	0U
+#endif
+#define IPC_LOG_DRAIN_DELAY	msecs_to_jiffies(10)
+
+/*
+ * Header of a message staged in a per-CPU buffer.  The timestamp is used
+ * to merge the messages of all CPUs back into a single ordered stream.
+ */
+struct ipc_log_stage_hdr {
+	uint64_t ts;
+	uint32_t size;
+	uint32_t reserved;
+};
+
+#define IPC_LOG_STAGE_SIZE(size) \
+	ALIGN(sizeof(struct ipc_log_stage_hdr) + (size), sizeof(uint64_t))
+
 static int minidump_buf_cnt;
 static LIST_HEAD(ipc_log_context_list);
 static DEFINE_RWLOCK(context_list_lock_lha1);
@@ -304,55 +326,209 @@ static void msg_drop(struct ipc_log_context *ilctxt)
 }
 
 /*
- * Commits messages to the FIFO.  If the FIFO is full, then enough
+ * Commits a message to the log pages.  If they are full, then enough
  * messages are dropped to create space for the new message.
+ *
+ * Must be called with context_lock_lhb1 held.
  */
-void ipc_log_write(void *ctxt, struct encode_context *ectxt)
+static void msg_commit(struct ipc_log_context *ilctxt, char *buff, int size)
 {
-	struct ipc_log_context *ilctxt = (struct ipc_log_context *)ctxt;
 	int bytes_to_write;
-	unsigned long flags;
 
-	if (!ilctxt || !ectxt) {
-		pr_err("%s: Invalid ipc_log or encode context\n", __func__);
-		return;
-	}
-
-	read_lock_irqsave(&context_list_lock_lha1, flags);
-	spin_lock(&ilctxt->context_lock_lhb1);
-	while (ilctxt->write_avail <= ectxt->offset)
+	while (ilctxt->write_avail <= size)
 		msg_drop(ilctxt);
 
 	bytes_to_write = MIN(LOG_PAGE_DATA_SIZE
 				- ilctxt->write_page->hdr.write_offset,
-				ectxt->offset);
+				size);
 	memcpy((ilctxt->write_page->data +
 		ilctxt->write_page->hdr.write_offset),
-		ectxt->buff, bytes_to_write);
+		buff, bytes_to_write);
 
-	if (bytes_to_write != ectxt->offset) {
+	if (bytes_to_write != size) {
 		uint64_t t_now = sched_clock();
 
 		ilctxt->write_page->hdr.write_offset += bytes_to_write;
 		ilctxt->write_page->hdr.end_time = t_now;
 
 		ilctxt->write_page = get_next_page(ilctxt, ilctxt->write_page);
-		if (WARN_ON(ilctxt->write_page == NULL)) {
-			spin_unlock(&ilctxt->context_lock_lhb1);
-			read_unlock_irqrestore(&context_list_lock_lha1, flags);
+		if (WARN_ON(ilctxt->write_page == NULL))
 			return;
-		}
 		ilctxt->write_page->hdr.write_offset = 0;
 		ilctxt->write_page->hdr.start_time = t_now;
 		memcpy((ilctxt->write_page->data +
 			ilctxt->write_page->hdr.write_offset),
-		       (ectxt->buff + bytes_to_write),
-		       (ectxt->offset - bytes_to_write));
-		bytes_to_write = (ectxt->offset - bytes_to_write);
+		       (buff + bytes_to_write),
+		       (size - bytes_to_write));
+		bytes_to_write = (size - bytes_to_write);
 	}
 	ilctxt->write_page->hdr.write_offset += bytes_to_write;
-	ilctxt->write_avail -= ectxt->offset;
+	ilctxt->write_avail -= size;
 	complete(&ilctxt->read_avail);
+}
+
+static void cpu_buf_copy_in(struct ipc_log_cpu_buf *cb, unsigned int pos,
+			    const void *src, unsigned int size)
+{
+	unsigned int off = pos & (IPC_LOG_CPU_BUF_SIZE - 1);
+	unsigned int n = min(size, IPC_LOG_CPU_BUF_SIZE - off);
+
+	memcpy(cb->data + off, src, n);
+	memcpy(cb->data, src + n, size - n);
+}
+
+static void cpu_buf_copy_out(struct ipc_log_cpu_buf *cb, unsigned int pos,
+			     void *dst, unsigned int size)
+{
+	unsigned int off = pos & (IPC_LOG_CPU_BUF_SIZE - 1);
+	unsigned int n = min(size, IPC_LOG_CPU_BUF_SIZE - off);
+
+	memcpy(dst, cb->data + off, n);
+	memcpy(dst + n, cb->data, size - n);
+}
+
+/**
+ * ipc_log_drain - move the staged messages to the log pages
+ *
+ * @ilctxt:  Logging context
+ *
+ * Messages staged on all CPUs up to this point are committed in timestamp
+ * order.  Each per-CPU buffer is already ordered, so this is a merge of
+ * the per-CPU streams.  Must be called with context_lock_lhb1 held.
+ */
+static void ipc_log_drain(struct ipc_log_context *ilctxt)
+{
+	struct ipc_log_stage_hdr hdr, next_hdr;
+	struct ipc_log_cpu_buf *cb, *next;
+	int cpu;
+
+	if (!ilctxt->cpu_bufs)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		cb = per_cpu_ptr(ilctxt->cpu_bufs, cpu);
+		/* pairs with the release in ipc_log_stage() */
+		cb->drain_head = smp_load_acquire(&cb->head);
+	}
+
+	for (;;) {
+		next = NULL;
+		for_each_possible_cpu(cpu) {
+			cb = per_cpu_ptr(ilctxt->cpu_bufs, cpu);
+			if (cb->tail == cb->drain_head)
+				continue;
+
+			cpu_buf_copy_out(cb, cb->tail, &hdr, sizeof(hdr));
+			if (!next || hdr.ts < next_hdr.ts) {
+				next = cb;
+				next_hdr = hdr;
+			}
+		}
+		if (!next)
+			break;
+
+		cpu_buf_copy_out(next, next->tail + sizeof(next_hdr),
+				 ilctxt->drain_msg, next_hdr.size);
+		/* pairs with the acquire in ipc_log_stage() */
+		smp_store_release(&next->tail,
+				  next->tail + IPC_LOG_STAGE_SIZE(next_hdr.size));
+		msg_commit(ilctxt, ilctxt->drain_msg, next_hdr.size);
+	}
+}
+
+static void ipc_log_drain_work(struct work_struct *work)
+{
+	struct ipc_log_context *ilctxt = container_of(to_delayed_work(work),
+				struct ipc_log_context, drain_work);
+	unsigned long flags;
+
+	read_lock_irqsave(&context_list_lock_lha1, flags);
+	spin_lock(&ilctxt->context_lock_lhb1);
+	if (!ilctxt->destroyed)
+		ipc_log_drain(ilctxt);
+	spin_unlock(&ilctxt->context_lock_lhb1);
+	read_unlock_irqrestore(&context_list_lock_lha1, flags);
+}
+
+static bool cpu_buf_has_room(struct ipc_log_cpu_buf *cb, unsigned int size)
+{
+	/* pairs with the release in ipc_log_drain() */
+	return cb->head - smp_load_acquire(&cb->tail) + size <=
+		IPC_LOG_CPU_BUF_SIZE;
+}
+
+/*
+ * Stages a message in the buffer of the local CPU.  Only interrupts of
+ * the local CPU are disabled, no lock is taken unless the buffer is full,
+ * in which case the writer tries to drain it itself.  If the context
+ * lock is busy, the message is dropped and accounted in
+ * ipc_log_cpu_buf::drops.
+ */
+static void ipc_log_stage(struct ipc_log_context *ilctxt,
+			  struct encode_context *ectxt)
+{
+	unsigned int size = IPC_LOG_STAGE_SIZE(ectxt->offset);
+	struct ipc_log_stage_hdr hdr;
+	struct ipc_log_cpu_buf *cb;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	cb = this_cpu_ptr(ilctxt->cpu_bufs);
+
+	if (!cpu_buf_has_room(cb, size) &&
+	    spin_trylock(&ilctxt->context_lock_lhb1)) {
+		ipc_log_drain(ilctxt);
+		spin_unlock(&ilctxt->context_lock_lhb1);
+	}
+
+	if (!cpu_buf_has_room(cb, size)) {
+		WRITE_ONCE(cb->drops, cb->drops + 1);
+		local_irq_restore(flags);
+		return;
+	}
+
+	hdr.ts = sched_clock();
+	hdr.size = ectxt->offset;
+	hdr.reserved = 0;
+	cpu_buf_copy_in(cb, cb->head, &hdr, sizeof(hdr));
+	cpu_buf_copy_in(cb, cb->head + sizeof(hdr), ectxt->buff, ectxt->offset);
+	/* pairs with the acquire in ipc_log_drain() */
+	smp_store_release(&cb->head, cb->head + size);
+
+	/*
+	 * The work is queued with interrupts still disabled, which makes
+	 * this an RCU read-side section that ipc_log_context_destroy() waits
+	 * for before cancelling the work.
+	 */
+	if (!READ_ONCE(ilctxt->destroyed) &&
+	    !delayed_work_pending(&ilctxt->drain_work))
+		queue_delayed_work(system_unbound_wq, &ilctxt->drain_work,
+				   IPC_LOG_DRAIN_DELAY);
+	local_irq_restore(flags);
+}
+
+/*
+ * Commits messages to the FIFO.  If the FIFO is full, then enough
+ * messages are dropped to create space for the new message.
+ */
+void ipc_log_write(void *ctxt, struct encode_context *ectxt)
+{
+	struct ipc_log_context *ilctxt = (struct ipc_log_context *)ctxt;
+	unsigned long flags;
+
+	if (!ilctxt || !ectxt) {
+		pr_err("%s: Invalid ipc_log or encode context\n", __func__);
+		return;
+	}
+
+	if (ilctxt->cpu_bufs) {
+		ipc_log_stage(ilctxt, ectxt);
+		return;
+	}
+
+	read_lock_irqsave(&context_list_lock_lha1, flags);
+	spin_lock(&ilctxt->context_lock_lhb1);
+	msg_commit(ilctxt, ectxt->buff, ectxt->offset);
 	spin_unlock(&ilctxt->context_lock_lhb1);
 	read_unlock_irqrestore(&context_list_lock_lha1, flags);
 }
@@ -585,6 +761,7 @@ int ipc_log_extract(void *ctxt, char *buff, int size)
 		goto done;
 	}
 
+	ipc_log_drain(ilctxt);
 	while (dctxt.size >= MAX_MSG_DECODED_SIZE &&
 	       !is_nd_read_empty(ilctxt)) {
 		msg_read(ilctxt, &ectxt);
@@ -811,6 +988,47 @@ static void *get_deserialization_func(struct ipc_log_context *ilctxt,
 	return NULL;
 }
 
+static void free_cpu_bufs(struct ipc_log_context *ilctxt)
+{
+	int cpu;
+
+	if (!ilctxt->cpu_bufs)
+		return;
+
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(ilctxt->cpu_bufs, cpu)->data);
+	free_percpu(ilctxt->cpu_bufs);
+	ilctxt->cpu_bufs = NULL;
+}
+
+static int alloc_cpu_bufs(struct ipc_log_context *ilctxt)
+{
+	struct ipc_log_cpu_buf *cb;
+	int cpu;
+
+	BUILD_BUG_ON(IPC_LOG_CPU_BUF_SIZE &&
+		     IPC_LOG_CPU_BUF_SIZE < 2 * IPC_LOG_STAGE_SIZE(MAX_MSG_SIZE));
+
+	if (!IPC_LOG_CPU_BUF_SIZE)
+		return 0;
+
+	ilctxt->cpu_bufs = alloc_percpu(struct ipc_log_cpu_buf);
+	if (!ilctxt->cpu_bufs)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		cb = per_cpu_ptr(ilctxt->cpu_bufs, cpu);
+		cb->data = kzalloc_node(IPC_LOG_CPU_BUF_SIZE, GFP_KERNEL,
+					cpu_to_node(cpu));
+		if (!cb->data) {
+			free_cpu_bufs(ilctxt);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
 /**
  * ipc_log_context_create: Create a debug log context if context does not exist.
  *                         Should not be called from atomic context
@@ -851,6 +1069,12 @@ void *ipc_log_context_create(int max_num_pages,
 	INIT_LIST_HEAD(&ctxt->page_list);
 	INIT_LIST_HEAD(&ctxt->dfunc_info_list);
 	spin_lock_init(&ctxt->context_lock_lhb1);
+	INIT_DELAYED_WORK(&ctxt->drain_work, ipc_log_drain_work);
+
+	if (alloc_cpu_bufs(ctxt)) {
+		kfree(ctxt);
+		return 0;
+	}
 
 	enable_minidump = feature_version & FEATURE_MASK;
 
@@ -918,6 +1142,7 @@ void *ipc_log_context_create(int max_num_pages,
 		list_del(&pg->hdr.list);
 		kfree(pg);
 	}
+	free_cpu_bufs(ctxt);
 	kfree(ctxt);
 	return 0;
 }
@@ -935,6 +1160,7 @@ void ipc_log_context_free(struct kref *kref)
 		kfree(pg);
 	}
 
+	free_cpu_bufs(ilctxt);
 	kfree(ilctxt);
 }
 
@@ -955,7 +1181,7 @@ int ipc_log_context_destroy(void *ctxt)
 	debugfs_remove_recursive(ilctxt->dent);
 
 	spin_lock(&ilctxt->context_lock_lhb1);
-	ilctxt->destroyed = true;
+	WRITE_ONCE(ilctxt->destroyed, true);
 	complete_all(&ilctxt->read_avail);
 	list_for_each_entry_safe(df_info, tmp, &ilctxt->dfunc_info_list, list) {
 		list_del(&df_info->list);
@@ -963,6 +1189,12 @@ int ipc_log_context_destroy(void *ctxt)
 	}
 	spin_unlock(&ilctxt->context_lock_lhb1);
 
+	/* No writer can queue the drain work once it has seen @destroyed */
+	if (ilctxt->cpu_bufs) {
+		synchronize_rcu();
+		cancel_delayed_work_sync(&ilctxt->drain_work);
+	}
+
 	write_lock_irqsave(&context_list_lock_lha1, flags);
 	list_del(&ilctxt->list);
 	write_unlock_irqrestore(&context_list_lock_lha1, flags);
@@ -973,10 +1205,67 @@ int ipc_log_context_destroy(void *ctxt)
 }
 EXPORT_SYMBOL(ipc_log_context_destroy);
 
+/*
+ * Staged messages are not part of the log pages collected in a ram dump,
+ * so move whatever can be moved without waiting for a lock on panic.
+ * A reboot may still end in a ram dump and can wait for the locks.
+ */
+static int ipc_log_reboot_handler(struct notifier_block *nb,
+				  unsigned long event, void *unused)
+{
+	struct ipc_log_context *ilctxt;
+	unsigned long flags;
+
+	read_lock_irqsave(&context_list_lock_lha1, flags);
+	list_for_each_entry(ilctxt, &ipc_log_context_list, list) {
+		spin_lock(&ilctxt->context_lock_lhb1);
+		if (!ilctxt->destroyed)
+			ipc_log_drain(ilctxt);
+		spin_unlock(&ilctxt->context_lock_lhb1);
+	}
+	read_unlock_irqrestore(&context_list_lock_lha1, flags);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block ipc_log_reboot_nb = {
+	.notifier_call = ipc_log_reboot_handler,
+};
+
+static int ipc_log_panic_handler(struct notifier_block *nb,
+				 unsigned long event, void *unused)
+{
+	struct ipc_log_context *ilctxt;
+
+	if (!read_trylock(&context_list_lock_lha1))
+		return NOTIFY_DONE;
+
+	list_for_each_entry(ilctxt, &ipc_log_context_list, list) {
+		if (!spin_trylock(&ilctxt->context_lock_lhb1))
+			continue;
+		if (!ilctxt->destroyed)
+			ipc_log_drain(ilctxt);
+		spin_unlock(&ilctxt->context_lock_lhb1);
+	}
+	read_unlock(&context_list_lock_lha1);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block ipc_log_panic_nb = {
+	.notifier_call = ipc_log_panic_handler,
+};
+
 static int __init ipc_logging_init(void)
 {
 	check_and_create_debugfs();
 
+	if (IPC_LOG_CPU_BUF_SIZE) {
+		atomic_notifier_chain_register(&panic_notifier_list,
+					       &ipc_log_panic_nb);
+		register_reboot_notifier(&ipc_log_reboot_nb);
+	}
+
 	register_minidump((u64)&ipc_log_context_list, sizeof(struct list_head),
 			  "ipc_log_ctxt_list", minidump_buf_cnt);
 
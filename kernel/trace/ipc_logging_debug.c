@@ -18,6 +18,8 @@
 #include <linux/wait.h>
 #include <linux/delay.h>
 #include <linux/completion.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
 #include <linux/ipc_logging.h>
 
 #include "ipc_logging_private.h"
@@ -129,6 +131,26 @@ static const struct file_operations debug_ops_cont = {
 	.open = simple_open,
 };
 
+static int stats_show(struct seq_file *s, void *unused)
+{
+	struct ipc_log_context *ilctxt = s->private;
+	struct ipc_log_cpu_buf *cb;
+	uint64_t drops, total = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		cb = per_cpu_ptr(ilctxt->cpu_bufs, cpu);
+		drops = READ_ONCE(cb->drops);
+		seq_printf(s, "cpu%d: staged %u drops %llu\n", cpu,
+			   READ_ONCE(cb->head) - READ_ONCE(cb->tail), drops);
+		total += drops;
+	}
+	seq_printf(s, "total drops %llu\n", total);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
 static void debug_create(const char *name, mode_t mode,
 			 struct dentry *dent,
 			 struct ipc_log_context *ilctxt,
@@ -183,6 +205,9 @@ void create_ctx_debugfs(struct ipc_log_context *ctxt,
 				     ctxt, &debug_ops);
 			debug_create("log_cont", 0444, ctxt->dent,
 				     ctxt, &debug_ops_cont);
+			if (ctxt->cpu_bufs)
+				debugfs_create_file("stats", 0444, ctxt->dent,
+						    ctxt, &stats_fops);
 		}
 	}
 	add_deserialization_func((void *)ctxt,
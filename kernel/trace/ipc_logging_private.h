@@ -6,6 +6,7 @@
 #define _IPC_LOGGING_PRIVATE_H
 
 #include <linux/ipc_logging.h>
+#include <linux/workqueue.h>
 
 #define IPC_LOG_VERSION 0x0003
 #define IPC_LOG_MAX_CONTEXT_NAME_LEN 32
@@ -62,6 +63,25 @@ struct ipc_log_page {
 	char data[PAGE_SIZE - sizeof(struct ipc_log_page_header)];
 };
 
+/**
+ * struct ipc_log_cpu_buf - Per-CPU staging buffer
+ *
+ * @data:  Staged messages, each preceded by a struct ipc_log_stage_hdr
+ * @head:  Write position, only advanced by the owning CPU
+ * @tail:  Read position, only advanced by ipc_log_drain()
+ * @drain_head:  Snapshot of @head taken at the start of a drain
+ * @drops:  Number of messages dropped because the buffer was full
+ *
+ * @head and @tail are free-running and wrap within @data.
+ */
+struct ipc_log_cpu_buf {
+	char *data;
+	unsigned int head;
+	unsigned int tail;
+	unsigned int drain_head;
+	uint64_t drops;
+};
+
 /**
  * struct ipc_log_context - main logging context
  *
@@ -87,6 +107,9 @@ struct ipc_log_page {
  * @dfunc_info_list:  List of deserialization functions
  * @context_lock_lhb1:  Lock for entire structure
  * @read_avail:  Completed when new data is added to the log
+ * @cpu_bufs:  Per-CPU staging buffers (NULL if staging is disabled)
+ * @drain_work:  Moves staged messages to the log pages
+ * @drain_msg:  Scratch buffer used while draining
  */
 struct ipc_log_context {
 	uint32_t magic;
@@ -113,6 +136,9 @@ struct ipc_log_context {
 	struct completion read_avail;
 	struct kref refcount;
 	bool destroyed;
+	struct ipc_log_cpu_buf __percpu *cpu_bufs;
+	struct delayed_work drain_work;
+	char drain_msg[MAX_MSG_SIZE];
 };
 
 struct dfunc_info {
@@ -51,6 +51,8 @@
 #include <linux/workqueue.h>
 #include <trace/hooks/ftrace_dump.h>
 
+#include <uapi/linux/trace_mmap.h>
+
 #include "trace.h"
 #include "trace_output.h"
 
@@ -1220,6 +1222,9 @@ int tracing_alloc_snapshot_instance(struct trace_array *tr)
 	int ret;
 
 	if (!tr->allocated_snapshot) {
+		/* The pages of a mapped buffer can not be swapped out */
+		if (READ_ONCE(tr->mapped))
+			return -EBUSY;
 
 		/* allocate spare buffer */
 		ret = resize_buffer_duplicate_size(&tr->max_buffer,
@@ -1831,6 +1836,10 @@ update_max_tr(struct trace_array *tr, struct task_struct *tsk, int cpu,
 
 	arch_spin_lock(&tr->max_lock);
 
+	/* A user space mapping is bound to the current array_buffer */
+	if (tr->mapped)
+		goto out_unlock;
+
 	/* Inherit the recordable setting from array_buffer */
 	if (ring_buffer_record_is_set_on(tr->array_buffer.buffer))
 		ring_buffer_record_on(tr->max_buffer.buffer);
@@ -5302,7 +5311,7 @@ static const char readme_msg[] =
 	"\t            [:values=<field1[,field2,...]>]\n"
 	"\t            [:sort=<field1[,field2,...]>]\n"
 	"\t            [:size=#entries]\n"
-	"\t            [:pause][:continue][:clear]\n"
+	"\t            [:pause][:continue][:clear][:percpu]\n"
 	"\t            [:name=histname1]\n"
 	"\t            [:<handler>.<action>]\n"
 	"\t            [if <filter>]\n\n"
@@ -5357,6 +5366,14 @@ static const char readme_msg[] =
 	"\t    The 'clear' parameter will clear the contents of a running\n"
 	"\t    hist trigger and leave its current paused/active state\n"
 	"\t    unchanged.\n\n"
+	"\t    The 'percpu' parameter makes each CPU update its own hash\n"
+	"\t    table instead of contending on a shared one, which helps\n"
+	"\t    events hit from many CPUs at once.  The tables are merged\n"
+	"\t    when the 'hist' file is read, so the output looks the same\n"
+	"\t    as without it, except that the totals also report the\n"
+	"\t    entries dropped on each CPU.  'size' applies to every\n"
+	"\t    per-CPU table, each of which can fill up on its own.\n"
+	"\t    'percpu' can't be combined with variables or handlers.\n\n"
 	"\t    The enable_hist and disable_hist triggers can be used to\n"
 	"\t    have one event conditionally start and stop another event's\n"
 	"\t    already-attached hist trigger.  The syntax is analogous to\n"
@@ -7670,6 +7687,10 @@ tracing_buffers_read(struct file *filp, char __user *ubuf,
 	trace_access_unlock(iter->cpu_file);
 
 	if (ret < 0) {
+		/* The buffer is mapped and consumed through the mapping */
+		if (ret == -EBUSY)
+			return ret;
+
 		if (trace_empty(iter)) {
 			if ((filp->f_flags & O_NONBLOCK))
 				return -EAGAIN;
@@ -7845,6 +7866,8 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 			ring_buffer_free_read_page(ref->buffer, ref->cpu,
 						   ref->page);
 			kfree(ref);
+			if (r == -EBUSY)
+				ret = r;
 			break;
 		}
 
@@ -7886,12 +7909,118 @@ tracing_buffers_splice_read(struct file *file, loff_t *ppos,
 	return ret;
 }
 
+static long tracing_buffers_ioctl(struct file *file, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct ftrace_buffer_info *info = file->private_data;
+	struct trace_iterator *iter = &info->iter;
+	int err;
+
+	if (cmd != TRACE_MMAP_IOCTL_GET_READER)
+		return -ENOTTY;
+
+	if (!(file->f_flags & O_NONBLOCK)) {
+		err = ring_buffer_wait(iter->array_buffer->buffer,
+				       iter->cpu_file,
+				       iter->tr->buffer_percent);
+		if (err)
+			return err;
+	}
+
+	return ring_buffer_map_get_reader(iter->array_buffer->buffer,
+					  iter->cpu_file);
+}
+
+#ifdef CONFIG_TRACER_MAX_TRACE
+static int get_snapshot_map(struct trace_array *tr)
+{
+	int err = 0;
+
+	/*
+	 * Called with the mmap_lock held, trace_types_lock can't be taken.
+	 * The max_lock is what update_max_tr() swaps the buffers under.
+	 */
+	local_irq_disable();
+	arch_spin_lock(&tr->max_lock);
+
+	if (tr->allocated_snapshot || tr->mapped == UINT_MAX)
+		err = -EBUSY;
+	else
+		tr->mapped++;
+
+	arch_spin_unlock(&tr->max_lock);
+	local_irq_enable();
+
+	return err;
+}
+
+static void put_snapshot_map(struct trace_array *tr)
+{
+	local_irq_disable();
+	arch_spin_lock(&tr->max_lock);
+	if (!WARN_ON(!tr->mapped))
+		tr->mapped--;
+	arch_spin_unlock(&tr->max_lock);
+	local_irq_enable();
+}
+#else
+static inline int get_snapshot_map(struct trace_array *tr) { return 0; }
+static inline void put_snapshot_map(struct trace_array *tr) { }
+#endif
+
+static void tracing_buffers_mmap_close(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_file->private_data;
+	struct trace_iterator *iter = &info->iter;
+
+	WARN_ON(ring_buffer_unmap(iter->array_buffer->buffer, iter->cpu_file));
+	put_snapshot_map(iter->tr);
+}
+
+static int tracing_buffers_mmap_split(struct vm_area_struct *vma,
+				      unsigned long addr)
+{
+	/* The ring buffer accounts for whole mappings only */
+	return -EINVAL;
+}
+
+static const struct vm_operations_struct tracing_buffers_vmops = {
+	.close		= tracing_buffers_mmap_close,
+	.split		= tracing_buffers_mmap_split,
+};
+
+static int tracing_buffers_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+	struct trace_iterator *iter = &info->iter;
+	int ret;
+
+	if (iter->cpu_file == RING_BUFFER_ALL_CPUS)
+		return -EINVAL;
+
+	ret = get_snapshot_map(iter->tr);
+	if (ret)
+		return ret;
+
+	ret = ring_buffer_map(iter->array_buffer->buffer, iter->cpu_file, vma);
+	if (ret) {
+		put_snapshot_map(iter->tr);
+		return ret;
+	}
+
+	vma->vm_ops = &tracing_buffers_vmops;
+
+	return 0;
+}
+
 static const struct file_operations tracing_buffers_fops = {
 	.open		= tracing_buffers_open,
 	.read		= tracing_buffers_read,
 	.poll		= tracing_buffers_poll,
 	.release	= tracing_buffers_release,
 	.splice_read	= tracing_buffers_splice_read,
+	.unlocked_ioctl	= tracing_buffers_ioctl,
+	.mmap		= tracing_buffers_mmap,
 	.llseek		= no_llseek,
 };
 
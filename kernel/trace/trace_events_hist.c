@@ -69,7 +69,8 @@
 	C(INVALID_STR_OPERAND,	"String type can not be an operand in expression"), \
 	C(EXPECT_NUMBER,	"Expecting numeric literal"),		\
 	C(UNARY_MINUS_SUBEXPR,	"Unary minus not supported in sub-expressions"), \
-	C(DIVISION_BY_ZERO,	"Division by zero"),
+	C(DIVISION_BY_ZERO,	"Division by zero"),			\
+	C(PERCPU_VARS,		"Variables and actions not supported with percpu"),
 
 #undef C
 #define C(a, b)		HIST_ERR_##a
@@ -441,6 +442,7 @@ struct hist_trigger_attrs {
 	bool		pause;
 	bool		cont;
 	bool		clear;
+	bool		percpu;
 	bool		ts_in_usecs;
 	unsigned int	map_bits;
 
@@ -1454,6 +1456,8 @@ parse_hist_trigger_attrs(struct trace_array *tr, char *trigger_str)
 			attrs->cont = true;
 		else if (strcmp(str, "clear") == 0)
 			attrs->clear = true;
+		else if (strcmp(str, "percpu") == 0)
+			attrs->percpu = true;
 		else {
 			ret = parse_action(str, attrs);
 			if (ret)
@@ -1571,10 +1575,21 @@ static void hist_trigger_elt_data_init(struct tracing_map_elt *elt)
 		save_comm(elt_data->comm, current);
 }
 
+static void hist_trigger_elt_data_copy(struct tracing_map_elt *to,
+				       struct tracing_map_elt *from)
+{
+	struct hist_elt_data *to_data = to->private_data;
+	struct hist_elt_data *from_data = from->private_data;
+
+	if (to_data->comm && from_data->comm)
+		strncpy(to_data->comm, from_data->comm, TASK_COMM_LEN);
+}
+
 static const struct tracing_map_ops hist_trigger_elt_data_ops = {
 	.elt_alloc	= hist_trigger_elt_data_alloc,
 	.elt_free	= hist_trigger_elt_data_free,
 	.elt_init	= hist_trigger_elt_data_init,
+	.elt_copy	= hist_trigger_elt_data_copy,
 };
 
 static const char *get_hist_field_flags(struct hist_field *hist_field)
@@ -4774,6 +4789,13 @@ create_hist_data(unsigned int map_bits,
 	if (ret)
 		goto free;
 
+	if (attrs->percpu && (hist_data->n_vars || hist_data->n_var_refs ||
+			      hist_data->n_actions)) {
+		hist_err(file->tr, HIST_ERR_PERCPU_VARS, 0);
+		ret = -EINVAL;
+		goto free;
+	}
+
 	map_ops = &hist_trigger_elt_data_ops;
 
 	hist_data->map = tracing_map_create(map_bits, hist_data->key_size,
@@ -4787,6 +4809,12 @@ create_hist_data(unsigned int map_bits,
 	ret = create_tracing_map_fields(hist_data);
 	if (ret)
 		goto free;
+
+	if (attrs->percpu) {
+		ret = tracing_map_set_percpu(hist_data->map);
+		if (ret)
+			goto free;
+	}
  out:
 	return hist_data;
  free:
@@ -5123,8 +5151,16 @@ static void hist_trigger_show(struct seq_file *m,
 	track_data_snapshot_print(m, hist_data);
 
 	seq_printf(m, "\nTotals:\n    Hits: %llu\n    Entries: %u\n    Dropped: %llu\n",
-		   (u64)atomic64_read(&hist_data->map->hits),
-		   n_entries, (u64)atomic64_read(&hist_data->map->drops));
+		   tracing_map_read_hits(hist_data->map),
+		   n_entries, tracing_map_read_drops(hist_data->map));
+
+	if (hist_data->map->cpu_maps) {
+		int cpu;
+
+		for_each_possible_cpu(cpu)
+			seq_printf(m, "    Dropped on CPU %d: %llu\n", cpu,
+				   tracing_map_read_cpu_drops(hist_data->map, cpu));
+	}
 }
 
 static int hist_show(struct seq_file *m, void *v)
@@ -5569,6 +5605,8 @@ static int event_hist_trigger_print(struct seq_file *m,
 			seq_puts(m, ".descending");
 	}
 	seq_printf(m, ":size=%u", (1 << hist_data->map->map_bits));
+	if (hist_data->map->percpu)
+		seq_puts(m, ":percpu");
 	if (hist_data->enable_timestamps)
 		seq_printf(m, ":clock=%s", hist_data->attrs->clock);
 
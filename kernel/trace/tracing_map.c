@@ -125,6 +125,64 @@ u64 tracing_map_read_var_once(struct tracing_map_elt *elt, unsigned int i)
 	return (u64)atomic64_read(&elt->vars[i]);
 }
 
+/**
+ * tracing_map_read_hits - Return the number of hits of a tracing_map
+ * @map: The tracing_map
+ *
+ * For a per-CPU map, the hits of all the per-CPU maps are added up.
+ *
+ * Return: The number of successful insertions and lookups.
+ */
+u64 tracing_map_read_hits(struct tracing_map *map)
+{
+	u64 hits = atomic64_read(&map->hits);
+	int cpu;
+
+	if (map->cpu_maps) {
+		for_each_possible_cpu(cpu)
+			hits += atomic64_read(&map->cpu_maps[cpu]->hits);
+	}
+
+	return hits;
+}
+
+/**
+ * tracing_map_read_drops - Return the number of drops of a tracing_map
+ * @map: The tracing_map
+ *
+ * For a per-CPU map, the drops of all the per-CPU maps are added up.
+ *
+ * Return: The number of failed insertions.
+ */
+u64 tracing_map_read_drops(struct tracing_map *map)
+{
+	u64 drops = atomic64_read(&map->drops);
+	int cpu;
+
+	if (map->cpu_maps) {
+		for_each_possible_cpu(cpu)
+			drops += atomic64_read(&map->cpu_maps[cpu]->drops);
+	}
+
+	return drops;
+}
+
+/**
+ * tracing_map_read_cpu_drops - Return the number of drops on a CPU
+ * @map: The per-CPU tracing_map
+ * @cpu: The CPU
+ *
+ * Return: The number of failed insertions into the map of @cpu, 0 if
+ * @map isn't a per-CPU map.
+ */
+u64 tracing_map_read_cpu_drops(struct tracing_map *map, int cpu)
+{
+	if (!map->cpu_maps)
+		return 0;
+
+	return atomic64_read(&map->cpu_maps[cpu]->drops);
+}
+
 int tracing_map_cmp_string(void *val_a, void *val_b)
 {
 	char *a = val_a;
@@ -599,6 +657,17 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
 	return NULL;
 }
 
+static inline struct tracing_map *tracing_map_this_cpu(struct tracing_map *map)
+{
+	struct tracing_map **cpu_maps = READ_ONCE(map->cpu_maps);
+
+	/*
+	 * Callers normally run with preemption disabled.  If not, being
+	 * migrated only means updating another CPU's map, which is safe.
+	 */
+	return cpu_maps ? cpu_maps[raw_smp_processor_id()] : NULL;
+}
+
 /**
  * tracing_map_insert - Insert key and/or retrieve val from a tracing_map
  * @map: The tracing_map to insert into
@@ -630,6 +699,9 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
  * run out of entries.  Readers can at any point in time traverse the
  * tracing map and safely access the key/val pairs.
  *
+ * For a per-CPU map, the key is inserted into the map of the current
+ * CPU only, and 'hits' and 'drops' are those of that map.
+ *
  * Return: the tracing_map_elt pointer val associated with the key.
  * If this was a newly inserted key, the val will be a newly allocated
  * and associated tracing_map_elt pointer val.  If the key wasn't
@@ -638,6 +710,12 @@ __tracing_map_insert(struct tracing_map *map, void *key, bool lookup_only)
  */
 struct tracing_map_elt *tracing_map_insert(struct tracing_map *map, void *key)
 {
+	if (map->percpu) {
+		map = tracing_map_this_cpu(map);
+		if (unlikely(!map))
+			return NULL;
+	}
+
 	return __tracing_map_insert(map, key, false);
 }
 
@@ -655,14 +733,97 @@ struct tracing_map_elt *tracing_map_insert(struct tracing_map *map, void *key)
  * is successfully retrieved, the 'hits' value is incrememented.  The
  * 'drops' value is never updated by this function.
  *
+ * For a per-CPU map, only the map of the current CPU is looked up.
+ *
  * Return: the tracing_map_elt pointer val associated with the key.
  * If the key wasn't found, NULL is returned.
  */
 struct tracing_map_elt *tracing_map_lookup(struct tracing_map *map, void *key)
 {
+	if (map->percpu) {
+		map = tracing_map_this_cpu(map);
+		if (unlikely(!map))
+			return NULL;
+	}
+
 	return __tracing_map_insert(map, key, true);
 }
 
+/**
+ * tracing_map_set_percpu - Make a tracing_map per-CPU
+ * @map: The tracing_map, not yet initialized
+ *
+ * Makes tracing_map_init() create a private map for each possible CPU
+ * rather than a single map shared by all CPUs.  The per-CPU maps have
+ * the same size and fields as @map, and are merged when read with
+ * tracing_map_sort_entries().
+ *
+ * Return: 0 if successful, -EINVAL if the map has variables.
+ */
+int tracing_map_set_percpu(struct tracing_map *map)
+{
+	if (map->n_vars || map->cpu_maps)
+		return -EINVAL;
+
+	map->percpu = true;
+
+	return 0;
+}
+
+static void tracing_map_free_cpu_maps(struct tracing_map *map)
+{
+	int cpu;
+
+	if (!map->cpu_maps)
+		return;
+
+	for_each_possible_cpu(cpu)
+		tracing_map_destroy(map->cpu_maps[cpu]);
+
+	kfree(map->cpu_maps);
+	map->cpu_maps = NULL;
+}
+
+static int tracing_map_init_cpu_maps(struct tracing_map *map)
+{
+	struct tracing_map **cpu_maps, *cpu_map;
+	int cpu, err;
+
+	cpu_maps = kcalloc(nr_cpu_ids, sizeof(*cpu_maps), GFP_KERNEL);
+	if (!cpu_maps)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		cpu_map = tracing_map_create(map->map_bits, map->key_size,
+					     map->ops, map->private_data);
+		if (IS_ERR(cpu_map)) {
+			err = PTR_ERR(cpu_map);
+			goto free;
+		}
+		cpu_maps[cpu] = cpu_map;
+
+		memcpy(cpu_map->fields, map->fields, sizeof(map->fields));
+		cpu_map->n_fields = map->n_fields;
+		memcpy(cpu_map->key_idx, map->key_idx, sizeof(map->key_idx));
+		cpu_map->n_keys = map->n_keys;
+
+		err = tracing_map_init(cpu_map);
+		if (err)
+			goto free;
+	}
+
+	/* Publish the fully initialized maps to tracing_map_insert() */
+	smp_store_release(&map->cpu_maps, cpu_maps);
+
+	return 0;
+ free:
+	for_each_possible_cpu(cpu)
+		tracing_map_destroy(cpu_maps[cpu]);
+	kfree(cpu_maps);
+
+	return err;
+}
+
 /**
  * tracing_map_destroy - Destroy a tracing_map
  * @map: The tracing_map to destroy
@@ -678,6 +839,7 @@ void tracing_map_destroy(struct tracing_map *map)
 	if (!map)
 		return;
 
+	tracing_map_free_cpu_maps(map);
 	tracing_map_free_elts(map);
 
 	tracing_map_array_free(map->map);
@@ -698,6 +860,13 @@ void tracing_map_destroy(struct tracing_map *map)
 void tracing_map_clear(struct tracing_map *map)
 {
 	unsigned int i;
+	int cpu;
+
+	if (map->cpu_maps) {
+		for_each_possible_cpu(cpu)
+			tracing_map_clear(map->cpu_maps[cpu]);
+		return;
+	}
 
 	atomic_set(&map->next_elt, 0);
 	atomic64_set(&map->hits, 0);
@@ -833,6 +1002,9 @@ int tracing_map_init(struct tracing_map *map)
 	if (map->n_fields < 2)
 		return -EINVAL; /* need at least 1 key and 1 val */
 
+	if (map->percpu)
+		return tracing_map_init_cpu_maps(map);
+
 	err = tracing_map_alloc_elts(map);
 	if (err)
 		return err;
@@ -986,6 +1158,121 @@ static void detect_dups(struct tracing_map_sort_entry **sort_entries,
 		  "Duplicates detected: %d\n", total_dups);
 }
 
+static struct tracing_map_elt *
+tracing_map_merge_elts(struct tracing_map *map,
+		       struct tracing_map_sort_entry **entries,
+		       unsigned int n_entries)
+{
+	struct tracing_map_elt *elt, *from = entries[0]->elt;
+	unsigned int i, j;
+
+	elt = tracing_map_elt_alloc(map);
+	if (IS_ERR(elt))
+		return elt;
+
+	memcpy(elt->key, from->key, map->key_size);
+
+	for (i = 0; i < map->n_fields; i++) {
+		if (elt->fields[i].cmp_fn != tracing_map_cmp_atomic64)
+			continue;
+
+		for (j = 0; j < n_entries; j++)
+			atomic64_add(atomic64_read(&entries[j]->elt->fields[i].sum),
+				     &elt->fields[i].sum);
+	}
+
+	if (map->ops && map->ops->elt_copy)
+		map->ops->elt_copy(elt, from);
+
+	return elt;
+}
+
+/*
+ * Gather the elements of all the per-CPU maps, and merge the elements
+ * of each key into a single copied element holding the sums of all the
+ * CPUs.  The live per-CPU elements are left untouched.
+ */
+static int
+tracing_map_merge_cpu_entries(struct tracing_map *map,
+			      struct tracing_map_sort_entry ***merged_entries)
+{
+	struct tracing_map_sort_entry **entries, **merged;
+	unsigned int i, j, n_entries = 0, n_merged = 0;
+	struct tracing_map_elt *elt;
+	int cpu, ret = 0;
+
+	entries = vmalloc(array3_size(sizeof(*entries), map->max_elts,
+				      num_possible_cpus()));
+	if (!entries)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct tracing_map *cpu_map = map->cpu_maps[cpu];
+
+		for (i = 0; i < cpu_map->map_size; i++) {
+			struct tracing_map_entry *entry;
+
+			entry = TRACING_MAP_ENTRY(cpu_map->map, i);
+
+			if (!entry->key || !entry->val)
+				continue;
+
+			entries[n_entries] = create_sort_entry(entry->val->key,
+							       entry->val);
+			if (!entries[n_entries++]) {
+				ret = -ENOMEM;
+				goto free;
+			}
+		}
+	}
+
+	if (n_entries == 0)
+		goto free;
+
+	merged = vmalloc(array_size(sizeof(*merged), n_entries));
+	if (!merged) {
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	sort(entries, n_entries, sizeof(struct tracing_map_sort_entry *),
+	     (int (*)(const void *, const void *))cmp_entries_dup, NULL);
+
+	for (i = 0; i < n_entries; i = j) {
+		for (j = i + 1; j < n_entries; j++) {
+			if (!keys_match(entries[i]->key, entries[j]->key,
+					map->key_size))
+				break;
+		}
+
+		elt = tracing_map_merge_elts(map, &entries[i], j - i);
+		if (IS_ERR(elt)) {
+			ret = PTR_ERR(elt);
+			goto free_merged;
+		}
+
+		merged[n_merged] = create_sort_entry(elt->key, elt);
+		if (!merged[n_merged]) {
+			tracing_map_elt_free(elt);
+			ret = -ENOMEM;
+			goto free_merged;
+		}
+		merged[n_merged++]->elt_copied = true;
+	}
+
+	tracing_map_destroy_sort_entries(entries, n_entries);
+	*merged_entries = merged;
+
+	return n_merged;
+
+ free_merged:
+	tracing_map_destroy_sort_entries(merged, n_merged);
+ free:
+	tracing_map_destroy_sort_entries(entries, n_entries);
+
+	return ret;
+}
+
 static bool is_key(struct tracing_map *map, unsigned int field_idx)
 {
 	unsigned int i;
@@ -1076,6 +1363,13 @@ int tracing_map_sort_entries(struct tracing_map *map,
 	struct tracing_map_sort_entry *sort_entry, **entries;
 	int i, n_entries, ret;
 
+	if (map->cpu_maps) {
+		n_entries = tracing_map_merge_cpu_entries(map, &entries);
+		if (n_entries <= 0)
+			return n_entries;
+		goto merged;
+	}
+
 	entries = vmalloc(array_size(sizeof(sort_entry), map->max_elts));
 	if (!entries)
 		return -ENOMEM;
@@ -1100,7 +1394,7 @@ int tracing_map_sort_entries(struct tracing_map *map,
 		ret = 0;
 		goto free;
 	}
-
+ merged:
 	if (n_entries == 1) {
 		*sort_entries = entries;
 		return 1;
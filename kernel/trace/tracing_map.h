@@ -125,6 +125,18 @@ typedef int (*tracing_map_cmp_fn_t) (void *val_a, void *val_b);
  * user, tracing_map_sort_entry objects contain a number of additional
  * fields which are used for caching and internal purposes and can
  * safely be ignored.
+ *
+ * A tracing_map can also be made per-CPU, by calling
+ * tracing_map_set_percpu() before tracing_map_init().  In that case
+ * tracing_map_init() creates one private tracing_map per possible CPU
+ * (stored in the cpu_maps field), each with its own pool of max_elts
+ * tracing_map_elts, and tracing_map_insert() only ever touches the map
+ * of the CPU it runs on, so that hot events don't bounce the map cache
+ * lines between CPUs.  The per-CPU maps are merged when read:
+ * tracing_map_sort_entries() returns one copied tracing_map_elt per
+ * key, with the sums of all the CPUs added up.  Since a key can then
+ * have a different element on each CPU, variables are not supported in
+ * per-CPU mode.
 */
 
 struct tracing_map_field {
@@ -198,6 +210,8 @@ struct tracing_map {
 	unsigned int			n_vars;
 	atomic64_t			hits;
 	atomic64_t			drops;
+	bool				percpu;
+	struct tracing_map		**cpu_maps;
 };
 
 /**
@@ -229,12 +243,19 @@ struct tracing_map {
  *	be initialized when used i.e. when the element is actually
  *	claimed by tracing_map_insert() in the context of the map
  *	insertion.
+ *
+ * @elt_copy: When the elements of a per-CPU map are merged for
+ *	reading, this callback allows per-element client-defined data
+ *	to be copied from one of the per-CPU elements to the merged
+ *	element.
  */
 struct tracing_map_ops {
 	int			(*elt_alloc)(struct tracing_map_elt *elt);
 	void			(*elt_free)(struct tracing_map_elt *elt);
 	void			(*elt_clear)(struct tracing_map_elt *elt);
 	void			(*elt_init)(struct tracing_map_elt *elt);
+	void			(*elt_copy)(struct tracing_map_elt *to,
+					    struct tracing_map_elt *from);
 };
 
 extern struct tracing_map *
@@ -243,6 +264,7 @@ tracing_map_create(unsigned int map_bits,
 		   const struct tracing_map_ops *ops,
 		   void *private_data);
 extern int tracing_map_init(struct tracing_map *map);
+extern int tracing_map_set_percpu(struct tracing_map *map);
 
 extern int tracing_map_add_sum_field(struct tracing_map *map);
 extern int tracing_map_add_var(struct tracing_map *map);
@@ -272,6 +294,10 @@ extern u64 tracing_map_read_sum(struct tracing_map_elt *elt, unsigned int i);
 extern u64 tracing_map_read_var(struct tracing_map_elt *elt, unsigned int i);
 extern u64 tracing_map_read_var_once(struct tracing_map_elt *elt, unsigned int i);
 
+extern u64 tracing_map_read_hits(struct tracing_map *map);
+extern u64 tracing_map_read_drops(struct tracing_map *map);
+extern u64 tracing_map_read_cpu_drops(struct tracing_map *map, int cpu);
+
 extern void tracing_map_set_field_descr(struct tracing_map *map,
 					unsigned int i,
 					unsigned int key_offset,
@@ -54,6 +54,10 @@
 #include <linux/kvm_para.h>
 #include <linux/delay.h>
 #include <linux/irq_work.h>
+#include <linux/debugfs.h>
+#include <linux/jump_label.h>
+#include <linux/sched/clock.h>
+#include <linux/seq_file.h>
 
 #include "workqueue_internal.h"
 
@@ -220,6 +224,10 @@ struct worker_pool {
 
 	struct ida		worker_ida;	/* worker IDs for task name */
 
+#ifdef CONFIG_WQ_LATENCY_STATS
+	u64			cm_stalls;	/* K: ticks CM held back pending works */
+#endif
+
 	struct workqueue_attrs	*attrs;		/* I: worker attributes */
 	struct hlist_node	hash_node;	/* PL: unbound_pool_hash node */
 	int			refcnt;		/* PL: refcnt for unbound pools */
@@ -248,6 +256,21 @@ enum pool_workqueue_stats {
 	PWQ_NR_STATS,
 };
 
+#ifdef CONFIG_WQ_LATENCY_STATS
+/*
+ * Log2 histograms of the queueing delay and the execution time of the work
+ * items of a pwq. Bucket n counts durations of [2^n, 2^(n+1)) usecs, except
+ * for the first one which also counts shorter ones and the last one which
+ * counts all the longer ones.
+ */
+#define WQ_LAT_NR_BUCKETS	24
+
+struct wq_lat_hist {
+	u64			queue[WQ_LAT_NR_BUCKETS];	/* L: queue delay */
+	u64			exec[WQ_LAT_NR_BUCKETS];	/* execution time */
+};
+#endif
+
 /*
  * The per-pool workqueue.  While queued, bits below WORK_PWQ_SHIFT
  * of work_struct->data are used for flags and the remaining high bits
@@ -287,6 +310,9 @@ struct pool_workqueue {
 	struct list_head	mayday_node;	/* MD: node on wq->maydays */
 
 	u64			stats[PWQ_NR_STATS];
+#ifdef CONFIG_WQ_LATENCY_STATS
+	struct wq_lat_hist	lat_hist;
+#endif
 
 	/*
 	 * Release of unbound pwq is punted to a kthread_worker. See put_pwq()
@@ -1379,6 +1405,73 @@ static void wq_cpu_intensive_report(work_func_t func)
 static void wq_cpu_intensive_report(work_func_t func) {}
 #endif	/* CONFIG_WQ_CPU_INTENSIVE_REPORT */
 
+#ifdef CONFIG_WQ_LATENCY_STATS
+/*
+ * Latency statistics are collected only while enabled through debugfs, see
+ * wq_latency_debugfs_init(). Samples of work items queued before the last
+ * enablement are discarded.
+ */
+static DEFINE_STATIC_KEY_FALSE(wq_latency_stats);
+static u64 wq_latency_stats_since;
+
+static void wq_lat_record(u64 *hist, u64 ns)
+{
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+	int bucket = us ? min_t(int, ilog2(us), WQ_LAT_NR_BUCKETS - 1) : 0;
+
+	hist[bucket]++;
+}
+
+static void wq_lat_queued(struct work_struct *work)
+{
+	if (static_branch_unlikely(&wq_latency_stats))
+		work->queued_at = local_clock();
+}
+
+/* Must be called before @work is released to its function. Returns start. */
+static u64 wq_lat_started(struct pool_workqueue *pwq, struct work_struct *work)
+{
+	u64 now;
+
+	if (!static_branch_unlikely(&wq_latency_stats))
+		return 0;
+
+	now = local_clock();
+	if (work->queued_at > READ_ONCE(wq_latency_stats_since) &&
+	    now > work->queued_at)
+		wq_lat_record(pwq->lat_hist.queue, now - work->queued_at);
+	work->queued_at = 0;
+
+	return now;
+}
+
+static void wq_lat_completed(struct pool_workqueue *pwq, u64 start)
+{
+	if (static_branch_unlikely(&wq_latency_stats) && start)
+		wq_lat_record(pwq->lat_hist.exec, local_clock() - start);
+}
+
+static void wq_lat_tick(struct worker *worker, struct worker_pool *pool)
+{
+	/*
+	 * A concurrency-managed worker keeps running while there are pending
+	 * work items on its pool, which concurrency management holds back.
+	 */
+	if (static_branch_unlikely(&wq_latency_stats) &&
+	    !(worker->flags & WORKER_NOT_RUNNING) &&
+	    !list_empty(&pool->worklist))
+		pool->cm_stalls++;
+}
+#else	/* CONFIG_WQ_LATENCY_STATS */
+static void wq_lat_queued(struct work_struct *work) { }
+static u64 wq_lat_started(struct pool_workqueue *pwq, struct work_struct *work)
+{
+	return 0;
+}
+static void wq_lat_completed(struct pool_workqueue *pwq, u64 start) { }
+static void wq_lat_tick(struct worker *worker, struct worker_pool *pool) { }
+#endif	/* CONFIG_WQ_LATENCY_STATS */
+
 /**
  * wq_worker_running - a worker is running again
  * @task: task waking up
@@ -1475,6 +1568,7 @@ void wq_worker_tick(struct task_struct *task)
 		return;
 
 	pwq->stats[PWQ_STAT_CPU_TIME] += TICK_USEC;
+	wq_lat_tick(worker, pool);
 
 	if (!wq_cpu_intensive_thresh_us)
 		return;
@@ -2352,6 +2446,7 @@ static void __queue_work(int cpu, struct workqueue_struct *wq,
 
 	pwq->nr_in_flight[pwq->work_color]++;
 	work_flags = work_color_to_flags(pwq->work_color);
+	wq_lat_queued(work);
 
 	/*
 	 * Limit the number of concurrently active work items to max_active.
@@ -3150,6 +3245,7 @@ __acquires(&pool->lock)
 	unsigned long work_data;
 	int lockdep_start_depth, rcu_start_depth;
 	bool bh_draining = pool->flags & POOL_BH_DRAINING;
+	u64 start;
 #ifdef CONFIG_LOCKDEP
 	/*
 	 * It is permissible to free the struct work_struct from
@@ -3211,6 +3307,7 @@ __acquires(&pool->lock)
 	set_work_pool_and_clear_pending(work, pool->id, pool_offq_flags(pool));
 
 	pwq->stats[PWQ_STAT_STARTED]++;
+	start = wq_lat_started(pwq, work);
 	raw_spin_unlock_irq(&pool->lock);
 
 	rcu_start_depth = rcu_preempt_depth();
@@ -3249,6 +3346,7 @@ __acquires(&pool->lock)
 	 */
 	trace_workqueue_execute_end(work, worker->current_func);
 	pwq->stats[PWQ_STAT_COMPLETED]++;
+	wq_lat_completed(pwq, start);
 	lock_map_release(&lockdep_map);
 	if (!bh_draining)
 		lock_map_release(&pwq->wq->lockdep_map);
@@ -7586,6 +7684,110 @@ static inline void wq_watchdog_init(void) { }
 
 #endif	/* CONFIG_WQ_WATCHDOG */
 
+#ifdef CONFIG_WQ_LATENCY_STATS
+
+static int wq_latency_enable_get(void *data, u64 *val)
+{
+	*val = static_key_enabled(&wq_latency_stats);
+	return 0;
+}
+
+static int wq_latency_enable_set(void *data, u64 val)
+{
+	if (val && !static_key_enabled(&wq_latency_stats)) {
+		WRITE_ONCE(wq_latency_stats_since, local_clock());
+		static_branch_enable(&wq_latency_stats);
+	} else if (!val) {
+		static_branch_disable(&wq_latency_stats);
+	}
+	return 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(wq_latency_enable_fops, wq_latency_enable_get,
+			 wq_latency_enable_set, "%llu\n");
+
+/*
+ * Histograms of the pwqs which have been released, e.g. on an unbound
+ * workqueue attribute change, are lost.
+ */
+static int wq_latency_show(struct seq_file *m, void *v)
+{
+	struct workqueue_struct *wq;
+	struct pool_workqueue *pwq;
+	struct wq_lat_hist hist;
+	bool empty;
+	int i;
+
+	mutex_lock(&wq_pool_mutex);
+	list_for_each_entry(wq, &workqueues, list) {
+		memset(&hist, 0, sizeof(hist));
+		empty = true;
+
+		rcu_read_lock();
+		for_each_pwq(pwq, wq) {
+			for (i = 0; i < WQ_LAT_NR_BUCKETS; i++) {
+				hist.queue[i] += READ_ONCE(pwq->lat_hist.queue[i]);
+				hist.exec[i] += READ_ONCE(pwq->lat_hist.exec[i]);
+				if (hist.queue[i] || hist.exec[i])
+					empty = false;
+			}
+		}
+		rcu_read_unlock();
+
+		if (empty)
+			continue;
+
+		seq_printf(m, "%s\n", wq->name);
+		seq_printf(m, "  %10s %12s %12s\n", "usecs", "queued", "exec");
+		for (i = 0; i < WQ_LAT_NR_BUCKETS; i++) {
+			if (!hist.queue[i] && !hist.exec[i])
+				continue;
+			seq_printf(m, "  %10llu %12llu %12llu\n",
+				   i ? 1ULL << i : 0, hist.queue[i],
+				   hist.exec[i]);
+		}
+	}
+	mutex_unlock(&wq_pool_mutex);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(wq_latency);
+
+static int wq_pools_show(struct seq_file *m, void *v)
+{
+	struct worker_pool *pool;
+	int pi;
+
+	seq_printf(m, "%-6s %-5s %-6s %12s\n", "pool", "cpu", "nice",
+		   "cm_stalls");
+
+	mutex_lock(&wq_pool_mutex);
+	for_each_pool(pool, pi) {
+		seq_printf(m, "%-6d %-5d %-6d %12llu\n", pool->id, pool->cpu,
+			   pool->attrs->nice, READ_ONCE(pool->cm_stalls));
+	}
+	mutex_unlock(&wq_pool_mutex);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(wq_pools);
+
+static int __init wq_latency_debugfs_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("workqueue", NULL);
+	debugfs_create_file_unsafe("latency_enable", 0600, dir, NULL,
+				   &wq_latency_enable_fops);
+	debugfs_create_file("latency", 0400, dir, NULL, &wq_latency_fops);
+	debugfs_create_file("pools", 0400, dir, NULL, &wq_pools_fops);
+
+	return 0;
+}
+late_initcall(wq_latency_debugfs_init);
+
+#endif	/* CONFIG_WQ_LATENCY_STATS */
+
 static void bh_pool_kick_normal(struct irq_work *irq_work)
 {
 	raise_softirq_irqoff(TASKLET_SOFTIRQ);
@@ -52,6 +52,8 @@ static int subflow_get_info(const struct sock *sk, struct sk_buff *skb)
 		flags |= MPTCP_SUBFLOW_FLAG_CONNECTED;
 	if (sf->map_valid)
 		flags |= MPTCP_SUBFLOW_FLAG_MAPVALID;
+	if (sf->demoted)
+		flags |= MPTCP_SUBFLOW_FLAG_DEMOTED;
 
 	if (nla_put_u32(skb, MPTCP_SUBFLOW_ATTR_TOKEN_REM, sf->remote_token) ||
 	    nla_put_u32(skb, MPTCP_SUBFLOW_ATTR_TOKEN_LOC, sf->token) ||
@@ -66,7 +68,14 @@ static int subflow_get_info(const struct sock *sk, struct sk_buff *skb)
 			sf->map_data_len) ||
 	    nla_put_u32(skb, MPTCP_SUBFLOW_ATTR_FLAGS, flags) ||
 	    nla_put_u8(skb, MPTCP_SUBFLOW_ATTR_ID_REM, sf->remote_id) ||
-	    nla_put_u8(skb, MPTCP_SUBFLOW_ATTR_ID_LOC, sf->local_id)) {
+	    nla_put_u8(skb, MPTCP_SUBFLOW_ATTR_ID_LOC, sf->local_id) ||
+	    nla_put_u16(skb, MPTCP_SUBFLOW_ATTR_HEALTH_SCORE,
+			sf->health.score) ||
+	    nla_put_u32(skb, MPTCP_SUBFLOW_ATTR_HEALTH_SRTT,
+			sf->health.srtt_us) ||
+	    nla_put_u32(skb, MPTCP_SUBFLOW_ATTR_HEALTH_LOSS, sf->health.loss) ||
+	    nla_put_u32(skb, MPTCP_SUBFLOW_ATTR_HEALTH_STALL,
+			sf->health.stall_ms)) {
 		err = -EMSGSIZE;
 		goto nla_failure;
 	}
@@ -96,6 +105,10 @@ static size_t subflow_get_info_size(const struct sock *sk)
 		nla_total_size(4) +	/* MPTCP_SUBFLOW_ATTR_FLAGS */
 		nla_total_size(1) +	/* MPTCP_SUBFLOW_ATTR_ID_REM */
 		nla_total_size(1) +	/* MPTCP_SUBFLOW_ATTR_ID_LOC */
+		nla_total_size(2) +	/* MPTCP_SUBFLOW_ATTR_HEALTH_SCORE */
+		nla_total_size(4) +	/* MPTCP_SUBFLOW_ATTR_HEALTH_SRTT */
+		nla_total_size(4) +	/* MPTCP_SUBFLOW_ATTR_HEALTH_LOSS */
+		nla_total_size(4) +	/* MPTCP_SUBFLOW_ATTR_HEALTH_STALL */
 		0;
 	return size;
 }
@@ -35,6 +35,9 @@ static const struct snmp_mib mptcp_snmp_list[] = {
 	SNMP_MIB_ITEM("EchoAdd", MPTCP_MIB_ECHOADD),
 	SNMP_MIB_ITEM("RmAddr", MPTCP_MIB_RMADDR),
 	SNMP_MIB_ITEM("RmSubflow", MPTCP_MIB_RMSUBFLOW),
+	SNMP_MIB_ITEM("SubflowDemote", MPTCP_MIB_SUBFLOWDEMOTE),
+	SNMP_MIB_ITEM("SubflowPromote", MPTCP_MIB_SUBFLOWPROMOTE),
+	SNMP_MIB_ITEM("SubflowReplace", MPTCP_MIB_SUBFLOWREPLACE),
 	SNMP_MIB_SENTINEL
 };
 
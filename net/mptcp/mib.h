@@ -28,6 +28,9 @@ enum linux_mptcp_mib_field {
 	MPTCP_MIB_ECHOADD,		/* Received ADD_ADDR with echo-flag=1 */
 	MPTCP_MIB_RMADDR,		/* Received RM_ADDR */
 	MPTCP_MIB_RMSUBFLOW,		/* Remove a subflow */
+	MPTCP_MIB_SUBFLOWDEMOTE,	/* Subflow used as backup due to bad health */
+	MPTCP_MIB_SUBFLOWPROMOTE,	/* Demoted subflow recovered */
+	MPTCP_MIB_SUBFLOWREPLACE,	/* Subflow created to replace a demoted one */
 	__MPTCP_MIB_MAX
 };
 
@@ -94,12 +94,45 @@ static bool mptcp_pm_schedule_work(struct mptcp_sock *msk,
 	return true;
 }
 
+static void mptcp_pm_health_timer(struct timer_list *timer)
+{
+	struct mptcp_sock *msk = from_timer(msk, timer, pm.health_timer);
+	struct sock *sk = (struct sock *)msk;
+
+	if (inet_sk_state_load(sk) != TCP_CLOSE) {
+		spin_lock_bh(&msk->pm.lock);
+		mptcp_pm_schedule_work(msk, MPTCP_PM_HEALTH_CHECK);
+		spin_unlock_bh(&msk->pm.lock);
+	}
+
+	sock_put(sk);
+}
+
+/* (Re)arm the health timer. It holds a reference on the msk, so it is only
+ * armed while user space owns the socket: an msk that is never accept()ed
+ * would otherwise never get to mptcp_sock_destruct().
+ */
+void mptcp_pm_health_start(struct mptcp_sock *msk)
+{
+	struct sock *sk = (struct sock *)msk;
+
+	if (!sk->sk_socket || sock_flag(sk, SOCK_DEAD) ||
+	    inet_sk_state_load(sk) == TCP_CLOSE ||
+	    !mptcp_is_health_enabled(sock_net(sk)))
+		return;
+
+	sk_reset_timer(sk, &msk->pm.health_timer,
+		       jiffies + MPTCP_HEALTH_INTERVAL);
+}
+
 void mptcp_pm_fully_established(struct mptcp_sock *msk)
 {
 	struct mptcp_pm_data *pm = &msk->pm;
 
 	pr_debug("msk=%p\n", msk);
 
+	mptcp_pm_health_start(msk);
+
 	/* try to avoid acquiring the lock below */
 	if (!READ_ONCE(pm->work_pending))
 		return;
@@ -251,6 +284,7 @@ void mptcp_pm_data_init(struct mptcp_sock *msk)
 
 	spin_lock_init(&msk->pm.lock);
 	INIT_LIST_HEAD(&msk->pm.anno_list);
+	timer_setup(&msk->pm.health_timer, mptcp_pm_health_timer, 0);
 
 	mptcp_pm_nl_data_init(msk);
 }
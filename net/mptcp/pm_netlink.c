@@ -51,6 +51,13 @@ struct pm_nl_pernet {
 #define MPTCP_PM_ADDR_MAX	8
 #define ADD_ADDR_RETRANS_MAX	3
 
+/* A subflow scoring below MPTCP_HEALTH_DEMOTE is used only as a backup,
+ * until it gets back to MPTCP_HEALTH_PROMOTE.
+ */
+#define MPTCP_HEALTH_DEMOTE	500
+#define MPTCP_HEALTH_PROMOTE	800
+#define MPTCP_HEALTH_STALL_MIN	400	/* ms */
+
 static bool addresses_equal(const struct mptcp_addr_info *a,
 			    struct mptcp_addr_info *b, bool use_port)
 {
@@ -482,6 +489,180 @@ void mptcp_pm_nl_rm_subflow_received(struct mptcp_sock *msk, u8 rm_id)
 	}
 }
 
+static void subflow_health_sample(struct mptcp_subflow_context *subflow)
+{
+	const struct tcp_sock *tp = tcp_sk(mptcp_subflow_tcp_sock(subflow));
+	struct mptcp_subflow_health *health = &subflow->health;
+	u32 segs_out, retrans, snd_una;
+
+	segs_out = READ_ONCE(tp->segs_out);
+	retrans = READ_ONCE(tp->total_retrans);
+	if (segs_out != health->segs_out) {
+		u32 sent = segs_out - health->segs_out;
+		u32 sample;
+
+		sample = min(retrans - health->total_retrans, sent);
+		sample = div_u64((u64)sample << 10, sent);
+		health->loss = (health->loss * 3 + sample) / 4;
+	} else {
+		/* slowly forget the losses of a path no longer in use, so
+		 * that a demoted subflow gets probed again
+		 */
+		health->loss -= health->loss / 8;
+	}
+	health->segs_out = segs_out;
+	health->total_retrans = retrans;
+	health->srtt_us = READ_ONCE(tp->srtt_us) >> 3;
+
+	/* with nothing in flight the subflow is idle, not stalled */
+	snd_una = READ_ONCE(tp->snd_una);
+	if (!health->progress_stamp || snd_una != health->snd_una ||
+	    !READ_ONCE(tp->packets_out)) {
+		health->snd_una = snd_una;
+		health->progress_stamp = jiffies;
+		health->stall_ms = 0;
+	} else {
+		health->stall_ms = jiffies_to_msecs(jiffies -
+						    health->progress_stamp);
+	}
+}
+
+static u16 subflow_health_score(const struct mptcp_subflow_health *health,
+				u32 min_srtt_us)
+{
+	u32 stall_max, stall, penalty = 0;
+
+	/* up to 30% off for a path slower than the fastest one, ... */
+	if (health->srtt_us > min_srtt_us)
+		penalty += 300 * (health->srtt_us - min_srtt_us) /
+			   health->srtt_us;
+
+	/* ... up to 30% for losses, reached at 10% of the segments, ... */
+	penalty += min_t(u32, health->loss * 3000 / 1024, 300);
+
+	/* ... and up to 60% for a stall, reached after 8 RTTs */
+	stall_max = max_t(u32, 8 * health->srtt_us / USEC_PER_MSEC,
+			  MPTCP_HEALTH_STALL_MIN);
+	stall = min(health->stall_ms, stall_max);
+	penalty += stall * 600 / stall_max;
+
+	return MPTCP_HEALTH_SCORE_MAX - min_t(u32, penalty,
+					      MPTCP_HEALTH_SCORE_MAX);
+}
+
+/* Open a subflow from an endpoint not in use yet. The demoted subflows are
+ * kept around as backup, but do not count against the subflows limit.
+ */
+static void mptcp_pm_nl_replace_subflow(struct mptcp_sock *msk, int demoted)
+{
+	struct mptcp_addr_info remote = { 0 };
+	struct sock *sk = (struct sock *)msk;
+	struct mptcp_pm_addr_entry local;
+	struct pm_nl_pernet *pernet;
+	int err;
+
+	if (msk->pm.subflows >= msk->pm.subflows_max + demoted)
+		return;
+
+	pernet = net_generic(sock_net(sk), pm_nl_pernet_id);
+	if (!select_local_address(pernet, msk, &local))
+		return;
+
+	pr_debug("msk=%p replacement subflow from id=%d\n", msk,
+		 local.addr.id);
+
+	if (msk->pm.local_addr_used < msk->pm.local_addr_max)
+		msk->pm.local_addr_used++;
+	msk->pm.subflows++;
+	remote_address((struct sock_common *)sk, &remote);
+
+	spin_unlock_bh(&msk->pm.lock);
+	err = __mptcp_subflow_connect(sk, &local.addr, &remote);
+	spin_lock_bh(&msk->pm.lock);
+
+	if (!err)
+		MPTCP_INC_STATS(sock_net(sk), MPTCP_MIB_SUBFLOWREPLACE);
+}
+
+/* Called periodically from the PM worker, with the msk socket lock and
+ * msk->pm.lock held. The latter is dropped and retaken around
+ * __mptcp_subflow_connect() when a replacement is opened, so the pm state
+ * may change under us there. Score each subflow on its smoothed RTT,
+ * retransmission rate and stall time, move the bad ones to backup as long
+ * as some other subflow can take over, and look for a replacement.
+ */
+void mptcp_pm_nl_health_check(struct mptcp_sock *msk)
+{
+	struct mptcp_subflow_context *subflow;
+	struct sock *sk = (struct sock *)msk;
+	u32 min_srtt_us = U32_MAX;
+	int healthy = 0, demoted = 0;
+	bool replace = false;
+
+	if (inet_sk_state_load(sk) == TCP_CLOSE ||
+	    !mptcp_is_health_enabled(sock_net(sk)) ||
+	    __mptcp_check_fallback(msk))
+		return;
+
+	mptcp_for_each_subflow(msk, subflow) {
+		if (!mptcp_subflow_active(subflow))
+			continue;
+
+		subflow_health_sample(subflow);
+		if (subflow->health.srtt_us)
+			min_srtt_us = min(min_srtt_us, subflow->health.srtt_us);
+	}
+
+	mptcp_for_each_subflow(msk, subflow) {
+		if (!mptcp_subflow_active(subflow))
+			continue;
+
+		subflow->health.score = subflow_health_score(&subflow->health,
+							     min_srtt_us);
+		if (!mptcp_subflow_is_backup(subflow) &&
+		    subflow->health.score >= MPTCP_HEALTH_DEMOTE)
+			healthy++;
+	}
+
+	mptcp_for_each_subflow(msk, subflow) {
+		u16 score = subflow->health.score;
+
+		if (!mptcp_subflow_active(subflow))
+			continue;
+
+		if (subflow->demoted) {
+			if (score < MPTCP_HEALTH_PROMOTE) {
+				demoted++;
+				continue;
+			}
+
+			pr_debug("msk=%p subflow=%p promoted, score=%u\n",
+				 msk, subflow, score);
+			subflow->demoted = 0;
+			__MPTCP_INC_STATS(sock_net(sk), MPTCP_MIB_SUBFLOWPROMOTE);
+		} else if (!mptcp_subflow_is_backup(subflow) &&
+			   score < MPTCP_HEALTH_DEMOTE) {
+			/* even with nowhere to move the traffic to yet, a
+			 * replacement can be opened
+			 */
+			replace = true;
+			if (!healthy)
+				continue;
+
+			pr_debug("msk=%p subflow=%p demoted, score=%u\n",
+				 msk, subflow, score);
+			subflow->demoted = 1;
+			demoted++;
+			__MPTCP_INC_STATS(sock_net(sk), MPTCP_MIB_SUBFLOWDEMOTE);
+		}
+	}
+
+	if (replace || demoted)
+		mptcp_pm_nl_replace_subflow(msk, demoted);
+
+	mptcp_pm_health_start(msk);
+}
+
 static bool address_use_port(struct mptcp_pm_addr_entry *entry)
 {
 	return (entry->addr.flags &
@@ -21,6 +21,7 @@
 #include <net/transp_v6.h>
 #endif
 #include <net/mptcp.h>
+#include <uapi/linux/mptcp.h>
 #include "protocol.h"
 #include "mib.h"
 
@@ -1075,38 +1076,11 @@ static void mptcp_nospace(struct mptcp_sock *msk)
 	}
 }
 
-static bool mptcp_subflow_active(struct mptcp_subflow_context *subflow)
-{
-	struct sock *ssk = mptcp_subflow_tcp_sock(subflow);
-
-	/* can't send if JOIN hasn't completed yet (i.e. is usable for mptcp) */
-	if (subflow->request_join && !subflow->fully_established)
-		return false;
-
-	/* only send if our side has not closed yet */
-	return ((1 << ssk->sk_state) & (TCPF_ESTABLISHED | TCPF_CLOSE_WAIT));
-}
-
-#define MPTCP_SEND_BURST_SIZE		((1 << 16) - \
-					 sizeof(struct tcphdr) - \
-					 MAX_TCP_OPTION_SPACE - \
-					 sizeof(struct ipv6hdr) - \
-					 sizeof(struct frag_hdr))
-
-struct subflow_send_info {
-	struct sock *ssk;
-	u64 ratio;
-};
-
 static struct sock *mptcp_subflow_get_send(struct mptcp_sock *msk,
 					   u32 *sndbuf)
 {
-	struct subflow_send_info send_info[2];
 	struct mptcp_subflow_context *subflow;
-	int i, nr_active = 0;
 	struct sock *ssk;
-	u64 ratio;
-	u32 pace;
 
 	sock_owned_by_me((struct sock *)msk);
 
@@ -1121,61 +1095,85 @@ static struct sock *mptcp_subflow_get_send(struct mptcp_sock *msk,
 		return sk_stream_memory_free(msk->first) ? msk->first : NULL;
 	}
 
-	/* re-use last subflow, if the burst allow that */
-	if (msk->last_snd && msk->snd_burst > 0 &&
-	    sk_stream_memory_free(msk->last_snd) &&
-	    mptcp_subflow_active(mptcp_subflow_ctx(msk->last_snd))) {
-		mptcp_for_each_subflow(msk, subflow) {
-			ssk =  mptcp_subflow_tcp_sock(subflow);
+	mptcp_for_each_subflow(msk, subflow) {
+		ssk = mptcp_subflow_tcp_sock(subflow);
+		if (mptcp_subflow_active(subflow))
 			*sndbuf = max(tcp_sk(ssk)->snd_wnd, *sndbuf);
-		}
-		return msk->last_snd;
 	}
 
-	/* pick the subflow with the lower wmem/wspace ratio */
-	for (i = 0; i < 2; ++i) {
-		send_info[i].ssk = NULL;
-		send_info[i].ratio = -1;
-	}
-	mptcp_for_each_subflow(msk, subflow) {
-		bool backup = subflow->backup || subflow->request_bkup;
+	return mptcp_sched_get_send(msk);
+}
 
-		ssk =  mptcp_subflow_tcp_sock(subflow);
-		if (!mptcp_subflow_active(subflow))
-			continue;
+/* Send a copy of the data past @start_seq on each subflow the scheduler
+ * picked on top of the one that got it. This is best effort, what does
+ * not fit in the subflow send buffer right now is not duplicated.
+ */
+static void mptcp_push_redundant(struct sock *sk, u64 start_seq)
+{
+	struct mptcp_sock *msk = mptcp_sk(sk);
+	struct mptcp_subflow_context *subflow;
 
-		nr_active += !backup;
-		*sndbuf = max(tcp_sk(ssk)->snd_wnd, *sndbuf);
-		if (!sk_stream_memory_free(subflow->tcp_sock))
+	mptcp_for_each_subflow(msk, subflow) {
+		struct sock *ssk = mptcp_subflow_tcp_sock(subflow);
+		struct msghdr msg = {
+			.msg_flags = MSG_DONTWAIT,
+		};
+		int mss_now = 0, size_goal = 0;
+		struct mptcp_data_frag *dfrag;
+		size_t copied = 0;
+		long timeo = 0;
+
+		if (!subflow->scheduled)
 			continue;
 
-		pace = READ_ONCE(ssk->sk_pacing_rate);
-		if (!pace)
+		subflow->scheduled = 0;
+		if (!mptcp_subflow_active(subflow))
 			continue;
 
-		ratio = div_u64((u64)READ_ONCE(ssk->sk_wmem_queued) << 32,
-				pace);
-		if (ratio < send_info[backup].ratio) {
-			send_info[backup].ssk = ssk;
-			send_info[backup].ratio = ratio;
-		}
-	}
-
-	pr_debug("msk=%p nr_active=%d ssk=%p:%lld backup=%p:%lld\n",
-		 msk, nr_active, send_info[0].ssk, send_info[0].ratio,
-		 send_info[1].ssk, send_info[1].ratio);
+		lock_sock(ssk);
+		list_for_each_entry(dfrag, &msk->rtx_queue, list) {
+			int orig_len = dfrag->data_len;
+			int orig_offset = dfrag->offset;
+			u64 orig_seq = dfrag->data_seq;
+			bool done;
+			int skip;
+
+			if (!after64(dfrag->data_seq + dfrag->data_len,
+				     start_seq))
+				continue;
 
-	/* pick the best backup if no other subflow is active */
-	if (!nr_active)
-		send_info[0].ssk = send_info[1].ssk;
+			skip = before64(dfrag->data_seq, start_seq) ?
+			       start_seq - dfrag->data_seq : 0;
+			dfrag->data_seq += skip;
+			dfrag->offset += skip;
+			dfrag->data_len -= skip;
+
+			while (dfrag->data_len > 0 &&
+			       mptcp_ext_cache_refill(msk)) {
+				int ret = mptcp_sendmsg_frag(sk, ssk, &msg,
+							     dfrag, &timeo,
+							     &mss_now,
+							     &size_goal);
+				if (ret <= 0)
+					break;
+
+				copied += ret;
+				dfrag->data_len -= ret;
+				dfrag->offset += ret;
+			}
+			done = !dfrag->data_len;
 
-	if (send_info[0].ssk) {
-		msk->last_snd = send_info[0].ssk;
-		msk->snd_burst = min_t(int, MPTCP_SEND_BURST_SIZE,
-				       sk_stream_wspace(msk->last_snd));
-		return msk->last_snd;
+			dfrag->data_seq = orig_seq;
+			dfrag->offset = orig_offset;
+			dfrag->data_len = orig_len;
+			if (!done)
+				break;
+		}
+		if (copied)
+			tcp_push(ssk, msg.msg_flags, mss_now,
+				 tcp_sk(ssk)->nonagle, size_goal);
+		release_sock(ssk);
 	}
-	return NULL;
 }
 
 static void ssk_check_wmem(struct mptcp_sock *msk)
@@ -1191,6 +1189,7 @@ static int mptcp_sendmsg(struct sock *sk, struct msghdr *msg, size_t len)
 	struct page_frag *pfrag;
 	size_t copied = 0;
 	struct sock *ssk;
+	u64 start_seq;
 	u32 sndbuf;
 	bool tx_ok;
 	long timeo;
@@ -1199,6 +1198,7 @@ static int mptcp_sendmsg(struct sock *sk, struct msghdr *msg, size_t len)
 		return -EOPNOTSUPP;
 
 	lock_sock(sk);
+	start_seq = msk->write_seq;
 
 	timeo = sock_sndtimeo(sk, msg->msg_flags & MSG_DONTWAIT);
 
@@ -1332,6 +1332,8 @@ static int mptcp_sendmsg(struct sock *sk, struct msghdr *msg, size_t len)
 
 	release_sock(ssk);
 out:
+	if (copied)
+		mptcp_push_redundant(sk, start_seq);
 	ssk_check_wmem(msk);
 	release_sock(sk);
 	return copied ? : ret;
@@ -1650,44 +1652,14 @@ static void mptcp_retransmit_timer(struct timer_list *t)
 	sock_put(sk);
 }
 
-/* Find an idle subflow.  Return NULL if there is unacked data at tcp
- * level.
- *
- * A backup subflow is returned only if that is the only kind available.
- */
-static struct sock *mptcp_subflow_get_retrans(const struct mptcp_sock *msk)
+static struct sock *mptcp_subflow_get_retrans(struct mptcp_sock *msk)
 {
-	struct mptcp_subflow_context *subflow;
-	struct sock *backup = NULL;
-
 	sock_owned_by_me((const struct sock *)msk);
 
 	if (__mptcp_check_fallback(msk))
 		return msk->first;
 
-	mptcp_for_each_subflow(msk, subflow) {
-		struct sock *ssk = mptcp_subflow_tcp_sock(subflow);
-
-		if (!mptcp_subflow_active(subflow))
-			continue;
-
-		/* still data outstanding at TCP level?  Don't retransmit. */
-		if (!tcp_write_queue_empty(ssk)) {
-			if (inet_csk(ssk)->icsk_ca_state >= TCP_CA_Loss)
-				continue;
-			return NULL;
-		}
-
-		if (subflow->backup || subflow->request_bkup) {
-			if (!backup)
-				backup = ssk;
-			continue;
-		}
-
-		return ssk;
-	}
-
-	return backup;
+	return mptcp_sched_get_retrans(msk);
 }
 
 /* subflow sockets can be either outgoing (connect) or incoming
@@ -1743,6 +1715,10 @@ static void pm_work(struct mptcp_sock *msk)
 		pm->status &= ~BIT(MPTCP_PM_SUBFLOW_ESTABLISHED);
 		mptcp_pm_nl_subflow_established(msk);
 	}
+	if (pm->status & BIT(MPTCP_PM_HEALTH_CHECK)) {
+		pm->status &= ~BIT(MPTCP_PM_HEALTH_CHECK);
+		mptcp_pm_nl_health_check(msk);
+	}
 
 	spin_unlock_bh(&msk->pm.lock);
 }
@@ -1890,6 +1866,8 @@ static int mptcp_init_sock(struct sock *sk)
 	if (ret)
 		return ret;
 
+	mptcp_sched_init_sock(mptcp_sk(sk));
+
 	sk_sockets_allocated_inc(sk);
 	sk->sk_rcvbuf = READ_ONCE(sock_net(sk)->ipv4.sysctl_tcp_rmem[1]);
 	sk->sk_sndbuf = READ_ONCE(sock_net(sk)->ipv4.sysctl_tcp_wmem[1]);
@@ -1903,6 +1881,7 @@ static void __mptcp_clear_xmit(struct sock *sk)
 	struct mptcp_data_frag *dtmp, *dfrag;
 
 	sk_stop_timer(sk, &msk->sk.icsk_retransmit_timer);
+	sk_stop_timer(sk, &msk->pm.health_timer);
 
 	list_for_each_entry_safe(dfrag, dtmp, &msk->rtx_queue, list)
 		dfrag_clear(sk, dfrag);
@@ -2133,6 +2112,7 @@ struct sock *mptcp_sk_clone(const struct sock *sk,
 #endif
 
 	__mptcp_init_sock(nsk);
+	mptcp_sched_init_clone(mptcp_sk(nsk));
 
 #if IS_ENABLED(CONFIG_MPTCP_IPV6)
 	if (nsk->sk_family == AF_INET6)
@@ -2246,9 +2226,11 @@ static struct sock *mptcp_accept(struct sock *sk, int flags, int *err,
 
 void mptcp_destroy_common(struct mptcp_sock *msk)
 {
+	sk_stop_timer((struct sock *)msk, &msk->pm.health_timer);
 	skb_rbtree_purge(&msk->out_of_order_queue);
 	mptcp_token_destroy(msk);
 	mptcp_pm_free_anno_list(msk);
+	mptcp_sched_release(msk);
 }
 
 static void mptcp_destroy(struct sock *sk)
@@ -2320,6 +2302,64 @@ static int mptcp_setsockopt_v6(struct mptcp_sock *msk, int optname,
 	return ret;
 }
 
+static int mptcp_setsockopt_sol_mptcp(struct mptcp_sock *msk, int optname,
+				      sockptr_t optval, unsigned int optlen)
+{
+	struct sock *sk = (struct sock *)msk;
+	char name[MPTCP_SCHED_NAME_MAX];
+	int ret;
+
+	switch (optname) {
+	case MPTCP_SCHEDULER:
+		if (optlen < 1)
+			return -EINVAL;
+
+		ret = strncpy_from_sockptr(name, optval,
+					   min_t(long, MPTCP_SCHED_NAME_MAX - 1,
+						 optlen));
+		if (ret < 0)
+			return -EFAULT;
+		name[ret] = 0;
+
+		lock_sock(sk);
+		ret = mptcp_sched_set(msk, name);
+		release_sock(sk);
+		return ret;
+	}
+
+	return -ENOPROTOOPT;
+}
+
+static int mptcp_getsockopt_sol_mptcp(struct mptcp_sock *msk, int optname,
+				      char __user *optval, int __user *optlen)
+{
+	struct sock *sk = (struct sock *)msk;
+	char name[MPTCP_SCHED_NAME_MAX];
+	int len;
+
+	if (get_user(len, optlen))
+		return -EFAULT;
+
+	if (len < 0)
+		return -EINVAL;
+
+	switch (optname) {
+	case MPTCP_SCHEDULER:
+		lock_sock(sk);
+		strscpy(name, msk->sched->name, sizeof(name));
+		release_sock(sk);
+
+		len = min_t(unsigned int, len, sizeof(name));
+		if (put_user(len, optlen))
+			return -EFAULT;
+		if (copy_to_user(optval, name, len))
+			return -EFAULT;
+		return 0;
+	}
+
+	return -ENOPROTOOPT;
+}
+
 static bool mptcp_unsupported(int level, int optname)
 {
 	if (level == SOL_IP) {
@@ -2376,6 +2416,9 @@ static int mptcp_setsockopt(struct sock *sk, int level, int optname,
 	if (level == SOL_SOCKET)
 		return mptcp_setsockopt_sol_socket(msk, optname, optval, optlen);
 
+	if (level == SOL_MPTCP)
+		return mptcp_setsockopt_sol_mptcp(msk, optname, optval, optlen);
+
 	/* @@ the meaning of setsockopt() when the socket is connected and
 	 * there are multiple subflows is not yet defined. It is up to the
 	 * MPTCP-level socket to configure the subflows until the subflow
@@ -2402,6 +2445,9 @@ static int mptcp_getsockopt(struct sock *sk, int level, int optname,
 
 	pr_debug("msk=%p\n", msk);
 
+	if (level == SOL_MPTCP)
+		return mptcp_getsockopt_sol_mptcp(msk, optname, optval, option);
+
 	/* @@ the meaning of setsockopt() when the socket is connected and
 	 * there are multiple subflows is not yet defined. It is up to the
 	 * MPTCP-level socket to configure the subflows until the subflow
@@ -2750,6 +2796,10 @@ static int mptcp_stream_accept(struct socket *sock, struct socket *newsock,
 			if (!ssk->sk_socket)
 				mptcp_sock_graft(ssk, newsock);
 		}
+
+		/* not armed while the msk had no owner */
+		if (mptcp_is_fully_established(newsock->sk))
+			mptcp_pm_health_start(msk);
 	}
 
 	if (inet_csk_listen_poll(ssock->sk))
@@ -2894,6 +2944,7 @@ void __init mptcp_proto_init(void)
 
 	mptcp_subflow_init();
 	mptcp_pm_init();
+	mptcp_sched_init();
 	mptcp_token_init();
 
 	if (proto_register(&mptcp_prot, 1) != 0)
@@ -156,12 +156,14 @@ enum mptcp_pm_status {
 	MPTCP_PM_RM_ADDR_RECEIVED,
 	MPTCP_PM_ESTABLISHED,
 	MPTCP_PM_SUBFLOW_ESTABLISHED,
+	MPTCP_PM_HEALTH_CHECK,
 };
 
 struct mptcp_pm_data {
 	struct mptcp_addr_info local;
 	struct mptcp_addr_info remote;
 	struct list_head anno_list;
+	struct timer_list health_timer;
 
 	spinlock_t	lock;		/*protects the whole PM data */
 
@@ -225,6 +227,7 @@ struct mptcp_sock {
 	struct socket	*subflow; /* outgoing connect/listener/!mp_capable */
 	struct sock	*first;
 	struct mptcp_pm_data	pm;
+	struct mptcp_sched_ops	*sched;
 	struct {
 		u32	space;	/* bytes copied in last measurement window */
 		u32	copied; /* bytes copied in this measurement window */
@@ -290,6 +293,21 @@ enum mptcp_data_avail {
 };
 
 /* MPTCP subflow context */
+/* Path health, sampled by the in-kernel PM while the msk is established */
+struct mptcp_subflow_health {
+	unsigned long	progress_stamp;	/* jiffies, last time snd_una moved */
+	u32	snd_una;
+	u32	segs_out;
+	u32	total_retrans;
+	u32	srtt_us;	/* smoothed RTT of the TCP subflow */
+	u32	loss;		/* retransmitted segments per 1024 sent, EWMA */
+	u32	stall_ms;	/* time with data in flight and no progress */
+	u16	score;		/* 0 (unusable) to MPTCP_HEALTH_SCORE_MAX */
+};
+
+#define MPTCP_HEALTH_SCORE_MAX	1000
+#define MPTCP_HEALTH_INTERVAL	(HZ / 4)
+
 struct mptcp_subflow_context {
 	struct	list_head node;/* conn_list of subflows */
 	u64	local_key;
@@ -314,7 +332,9 @@ struct mptcp_subflow_context {
 		mpc_map : 1,
 		backup : 1,
 		rx_eof : 1,
-		can_ack : 1;	    /* only after processing the remote a key */
+		can_ack : 1,	    /* only after processing the remote a key */
+		scheduled : 1,	    /* gets a redundant copy of the data */
+		demoted : 1;	    /* used as backup, due to bad health */
 	enum mptcp_data_avail data_avail;
 	u32	remote_nonce;
 	u64	thmac;
@@ -323,6 +343,7 @@ struct mptcp_subflow_context {
 	u8	hmac[MPTCPOPT_HMAC_LEN];
 	u8	local_id;
 	u8	remote_id;
+	struct	mptcp_subflow_health health;
 
 	struct	sock *tcp_sock;	    /* tcp sk backpointer */
 	struct	sock *conn;	    /* parent mptcp_sock */
@@ -349,6 +370,30 @@ mptcp_subflow_tcp_sock(const struct mptcp_subflow_context *subflow)
 	return subflow->tcp_sock;
 }
 
+static inline bool mptcp_subflow_active(struct mptcp_subflow_context *subflow)
+{
+	struct sock *ssk = mptcp_subflow_tcp_sock(subflow);
+
+	/* can't send if JOIN hasn't completed yet (i.e. is usable for mptcp) */
+	if (subflow->request_join && !subflow->fully_established)
+		return false;
+
+	/* only send if our side has not closed yet */
+	return ((1 << ssk->sk_state) & (TCPF_ESTABLISHED | TCPF_CLOSE_WAIT));
+}
+
+static inline bool
+mptcp_subflow_is_backup(const struct mptcp_subflow_context *subflow)
+{
+	return subflow->backup || subflow->request_bkup || subflow->demoted;
+}
+
+#define MPTCP_SEND_BURST_SIZE		((1 << 16) - \
+					 sizeof(struct tcphdr) - \
+					 MAX_TCP_OPTION_SPACE - \
+					 sizeof(struct ipv6hdr) - \
+					 sizeof(struct frag_hdr))
+
 static inline u64
 mptcp_subflow_get_map_offset(const struct mptcp_subflow_context *subflow)
 {
@@ -364,6 +409,8 @@ mptcp_subflow_get_mapped_dsn(const struct mptcp_subflow_context *subflow)
 }
 
 int mptcp_is_enabled(struct net *net);
+const char *mptcp_get_scheduler(struct net *net);
+int mptcp_is_health_enabled(struct net *net);
 void mptcp_subflow_fully_established(struct mptcp_subflow_context *subflow,
 				     struct mptcp_options_received *mp_opt);
 bool mptcp_subflow_data_available(struct sock *sk);
@@ -436,10 +483,20 @@ void mptcp_crypto_key_sha(u64 key, u32 *token, u64 *idsn);
 
 void mptcp_crypto_hmac_sha(u64 key1, u64 key2, u8 *msg, int len, void *hmac);
 
+void __init mptcp_sched_init(void);
+struct mptcp_sched_ops *mptcp_sched_find(const char *name);
+void mptcp_sched_init_sock(struct mptcp_sock *msk);
+void mptcp_sched_init_clone(struct mptcp_sock *msk);
+void mptcp_sched_release(struct mptcp_sock *msk);
+int mptcp_sched_set(struct mptcp_sock *msk, const char *name);
+struct sock *mptcp_sched_get_send(struct mptcp_sock *msk);
+struct sock *mptcp_sched_get_retrans(struct mptcp_sock *msk);
+
 void __init mptcp_pm_init(void);
 void mptcp_pm_data_init(struct mptcp_sock *msk);
 void mptcp_pm_new_connection(struct mptcp_sock *msk, int server_side);
 void mptcp_pm_fully_established(struct mptcp_sock *msk);
+void mptcp_pm_health_start(struct mptcp_sock *msk);
 bool mptcp_pm_allow_new_subflow(struct mptcp_sock *msk);
 void mptcp_pm_connection_closed(struct mptcp_sock *msk);
 void mptcp_pm_subflow_established(struct mptcp_sock *msk,
@@ -494,6 +551,7 @@ void mptcp_pm_nl_subflow_established(struct mptcp_sock *msk);
 void mptcp_pm_nl_add_addr_received(struct mptcp_sock *msk);
 void mptcp_pm_nl_rm_addr_received(struct mptcp_sock *msk);
 void mptcp_pm_nl_rm_subflow_received(struct mptcp_sock *msk, u8 rm_id);
+void mptcp_pm_nl_health_check(struct mptcp_sock *msk);
 int mptcp_pm_nl_get_local_id(struct mptcp_sock *msk, struct sock_common *skc);
 bool mptcp_pm_nl_is_backup(struct mptcp_sock *msk, struct mptcp_addr_info *skc);
 
@@ -0,0 +1,348 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Multipath TCP
+ *
+ * Pluggable packet schedulers, registered and looked up the same way as
+ * TCP congestion control algorithms.
+ */
+
+#define pr_fmt(fmt) "MPTCP: " fmt
+
+#include <linux/bpf.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/rculist.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+
+#include "protocol.h"
+
+static DEFINE_SPINLOCK(mptcp_sched_list_lock);
+static LIST_HEAD(mptcp_sched_list);
+
+struct subflow_send_info {
+	int index;
+	u64 ratio;
+};
+
+/* Find an idle subflow, none if there is unacked data at TCP level.
+ *
+ * A backup subflow is used only if that is the only kind available.
+ */
+static int mptcp_sched_default_retrans(struct mptcp_sock *msk,
+				       struct mptcp_sched_data *data)
+{
+	int i, backup = -1;
+
+	for (i = 0; i < data->subflows; i++) {
+		struct mptcp_subflow_context *subflow = data->contexts[i];
+		struct sock *ssk = mptcp_subflow_tcp_sock(subflow);
+
+		/* still data outstanding at TCP level?  Don't retransmit. */
+		if (!tcp_write_queue_empty(ssk)) {
+			if (inet_csk(ssk)->icsk_ca_state >= TCP_CA_Loss)
+				continue;
+			return -EAGAIN;
+		}
+
+		if (mptcp_subflow_is_backup(subflow)) {
+			if (backup < 0)
+				backup = i;
+			continue;
+		}
+
+		data->scheduled = BIT(i);
+		return 0;
+	}
+
+	if (backup < 0)
+		return -EAGAIN;
+
+	data->scheduled = BIT(backup);
+	return 0;
+}
+
+static int mptcp_sched_default_get_subflow(struct mptcp_sock *msk,
+					   struct mptcp_sched_data *data)
+{
+	struct subflow_send_info send_info[2];
+	int i, nr_active = 0;
+	struct sock *ssk;
+	u64 ratio;
+	u32 pace;
+
+	if (data->reinject)
+		return mptcp_sched_default_retrans(msk, data);
+
+	/* re-use last subflow, if the burst allow that */
+	if (msk->last_snd && msk->snd_burst > 0 &&
+	    sk_stream_memory_free(msk->last_snd)) {
+		for (i = 0; i < data->subflows; i++) {
+			ssk = mptcp_subflow_tcp_sock(data->contexts[i]);
+			if (ssk == msk->last_snd) {
+				data->scheduled = BIT(i);
+				return 0;
+			}
+		}
+	}
+
+	/* pick the subflow with the lower wmem/wspace ratio */
+	for (i = 0; i < 2; ++i) {
+		send_info[i].index = -1;
+		send_info[i].ratio = -1;
+	}
+	for (i = 0; i < data->subflows; i++) {
+		struct mptcp_subflow_context *subflow = data->contexts[i];
+		bool backup = mptcp_subflow_is_backup(subflow);
+
+		ssk = mptcp_subflow_tcp_sock(subflow);
+		nr_active += !backup;
+		if (!sk_stream_memory_free(ssk))
+			continue;
+
+		pace = READ_ONCE(ssk->sk_pacing_rate);
+		if (!pace)
+			continue;
+
+		ratio = div_u64((u64)READ_ONCE(ssk->sk_wmem_queued) << 32,
+				pace);
+		if (ratio < send_info[backup].ratio) {
+			send_info[backup].index = i;
+			send_info[backup].ratio = ratio;
+		}
+	}
+
+	pr_debug("msk=%p nr_active=%d index=%d:%lld backup=%d:%lld\n",
+		 msk, nr_active, send_info[0].index, send_info[0].ratio,
+		 send_info[1].index, send_info[1].ratio);
+
+	/* pick the best backup if no other subflow is active */
+	if (!nr_active)
+		send_info[0] = send_info[1];
+
+	if (send_info[0].index < 0)
+		return -EAGAIN;
+
+	ssk = mptcp_subflow_tcp_sock(data->contexts[send_info[0].index]);
+	msk->last_snd = ssk;
+	msk->snd_burst = min_t(int, MPTCP_SEND_BURST_SIZE,
+			       sk_stream_wspace(ssk));
+	data->scheduled = BIT(send_info[0].index);
+	return 0;
+}
+
+static struct mptcp_sched_ops mptcp_sched_default = {
+	.get_subflow	= mptcp_sched_default_get_subflow,
+	.name		= "default",
+	.owner		= THIS_MODULE,
+};
+
+/* Send everything on every subflow with room for it, trading bandwidth
+ * for the latency of the fastest path.
+ */
+static int mptcp_sched_redundant_get_subflow(struct mptcp_sock *msk,
+					     struct mptcp_sched_data *data)
+{
+	int i;
+
+	if (data->reinject)
+		return mptcp_sched_default_retrans(msk, data);
+
+	for (i = 0; i < data->subflows; i++) {
+		struct sock *ssk = mptcp_subflow_tcp_sock(data->contexts[i]);
+
+		if (sk_stream_memory_free(ssk))
+			data->scheduled |= BIT(i);
+	}
+
+	return data->scheduled ? 0 : -EAGAIN;
+}
+
+static struct mptcp_sched_ops mptcp_sched_redundant = {
+	.get_subflow	= mptcp_sched_redundant_get_subflow,
+	.name		= "redundant",
+	.owner		= THIS_MODULE,
+};
+
+/* Simple linear search, don't expect many entries! */
+struct mptcp_sched_ops *mptcp_sched_find(const char *name)
+{
+	struct mptcp_sched_ops *sched;
+
+	list_for_each_entry_rcu(sched, &mptcp_sched_list, list) {
+		if (!strcmp(sched->name, name))
+			return sched;
+	}
+
+	return NULL;
+}
+
+int mptcp_register_scheduler(struct mptcp_sched_ops *sched)
+{
+	int ret = 0;
+
+	if (!sched->get_subflow) {
+		pr_err("%s does not implement required ops\n", sched->name);
+		return -EINVAL;
+	}
+
+	spin_lock(&mptcp_sched_list_lock);
+	if (mptcp_sched_find(sched->name)) {
+		pr_notice("%s already registered\n", sched->name);
+		ret = -EEXIST;
+	} else {
+		list_add_tail_rcu(&sched->list, &mptcp_sched_list);
+		pr_debug("%s registered\n", sched->name);
+	}
+	spin_unlock(&mptcp_sched_list_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(mptcp_register_scheduler);
+
+void mptcp_unregister_scheduler(struct mptcp_sched_ops *sched)
+{
+	spin_lock(&mptcp_sched_list_lock);
+	list_del_rcu(&sched->list);
+	spin_unlock(&mptcp_sched_list_lock);
+
+	/* Wait for outstanding readers to complete before the
+	 * module or struct_ops gets removed entirely.
+	 *
+	 * A bpf_try_module_get() should fail by now, as sockets already
+	 * using the scheduler hold a reference on its owner.
+	 */
+	synchronize_rcu();
+}
+EXPORT_SYMBOL_GPL(mptcp_unregister_scheduler);
+
+static void __mptcp_init_sched(struct mptcp_sock *msk,
+			       struct mptcp_sched_ops *sched)
+{
+	msk->sched = sched;
+	if (sched->init)
+		sched->init(msk);
+}
+
+/* Use the netns default for a new socket, falling back to the built-in
+ * one if that is gone.
+ */
+void mptcp_sched_init_sock(struct mptcp_sock *msk)
+{
+	struct net *net = sock_net((struct sock *)msk);
+	struct mptcp_sched_ops *sched;
+
+	rcu_read_lock();
+	sched = mptcp_sched_find(mptcp_get_scheduler(net));
+	if (!sched || !bpf_try_module_get(sched, sched->owner))
+		sched = &mptcp_sched_default;
+	rcu_read_unlock();
+
+	__mptcp_init_sched(msk, sched);
+}
+
+/* A socket cloned from a listener starts with the listener's scheduler.
+ * Called in atomic context.
+ */
+void mptcp_sched_init_clone(struct mptcp_sock *msk)
+{
+	struct mptcp_sched_ops *sched = msk->sched;
+
+	if (!sched || !bpf_try_module_get(sched, sched->owner))
+		sched = &mptcp_sched_default;
+
+	__mptcp_init_sched(msk, sched);
+}
+
+void mptcp_sched_release(struct mptcp_sock *msk)
+{
+	struct mptcp_sched_ops *sched = msk->sched;
+
+	if (!sched)
+		return;
+
+	msk->sched = NULL;
+	if (sched->release)
+		sched->release(msk);
+	bpf_module_put(sched, sched->owner);
+}
+
+/* Called with the msk socket lock held */
+int mptcp_sched_set(struct mptcp_sock *msk, const char *name)
+{
+	struct mptcp_sched_ops *sched;
+	int err = 0;
+
+	rcu_read_lock();
+	sched = mptcp_sched_find(name);
+	if (!sched)
+		err = -ENOENT;
+	else if (!bpf_try_module_get(sched, sched->owner))
+		err = -EBUSY;
+	rcu_read_unlock();
+	if (err)
+		return err;
+
+	mptcp_sched_release(msk);
+	__mptcp_init_sched(msk, sched);
+	return 0;
+}
+
+static struct sock *mptcp_sched_get(struct mptcp_sock *msk, bool reinject)
+{
+	struct mptcp_subflow_context *subflow;
+	struct mptcp_sched_data data;
+	struct sock *ssk = NULL;
+	int i = 0;
+
+	sock_owned_by_me((struct sock *)msk);
+
+	data.reinject = reinject;
+	data.scheduled = 0;
+	mptcp_for_each_subflow(msk, subflow) {
+		if (!reinject)
+			subflow->scheduled = 0;
+
+		/* more subflows than the PM allows for are not scheduled */
+		if (!mptcp_subflow_active(subflow) || i == MPTCP_SUBFLOWS_MAX)
+			continue;
+
+		data.contexts[i++] = subflow;
+	}
+	data.subflows = i;
+
+	if (!data.subflows || msk->sched->get_subflow(msk, &data))
+		return NULL;
+
+	for (i = 0; i < data.subflows; i++) {
+		if (!(data.scheduled & BIT(i)))
+			continue;
+
+		subflow = data.contexts[i];
+		if (!ssk)
+			ssk = mptcp_subflow_tcp_sock(subflow);
+		else if (!reinject)
+			subflow->scheduled = 1;
+	}
+
+	return ssk;
+}
+
+/* The subflow for new data. Any other subflow the scheduler picked is
+ * left marked as scheduled, for mptcp_push_redundant().
+ */
+struct sock *mptcp_sched_get_send(struct mptcp_sock *msk)
+{
+	return mptcp_sched_get(msk, false);
+}
+
+struct sock *mptcp_sched_get_retrans(struct mptcp_sock *msk)
+{
+	return mptcp_sched_get(msk, true);
+}
+
+void __init mptcp_sched_init(void)
+{
+	mptcp_register_scheduler(&mptcp_sched_default);
+	mptcp_register_scheduler(&mptcp_sched_redundant);
+}
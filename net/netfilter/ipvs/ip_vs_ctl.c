@@ -1850,6 +1850,42 @@ proc_do_sync_ports(struct ctl_table *table, int write,
 	return rc;
 }
 
+static int
+proc_do_est_cpulist(struct ctl_table *table, int write,
+		    void *buffer, size_t *lenp, loff_t *ppos)
+{
+	struct netns_ipvs *ipvs = table->extra2;
+	cpumask_var_t mask;
+	int ret;
+
+	if (!write) {
+		if (*ppos) {
+			*lenp = 0;
+			return 0;
+		}
+		mutex_lock(&ipvs->est_mutex);
+		ret = scnprintf(buffer, *lenp, "%*pbl\n",
+				cpumask_pr_args(ipvs->est_cpulist));
+		mutex_unlock(&ipvs->est_mutex);
+		*lenp = ret;
+		*ppos += ret;
+		return 0;
+	}
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	ret = cpulist_parse(buffer, mask);
+	if (!ret && (cpumask_empty(mask) ||
+		     !cpumask_subset(mask, cpu_possible_mask)))
+		ret = -EINVAL;
+	if (!ret)
+		ret = ip_vs_est_set_cpulist(ipvs, mask);
+
+	free_cpumask_var(mask);
+	return ret;
+}
+
 /*
  *	IPVS sysctl table (under the /proc/sys/net/ipv4/vs/)
  *	Do not change order or insert new entries without
@@ -2020,6 +2056,11 @@ static struct ctl_table vs_vars[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_dointvec,
 	},
+	{
+		.procname	= "est_cpulist",
+		.mode		= 0644,
+		.proc_handler	= proc_do_est_cpulist,
+	},
 #ifdef CONFIG_IP_VS_DEBUG
 	{
 		.procname	= "debug_level",
@@ -4094,6 +4135,7 @@ static int __net_init ip_vs_control_net_init_sysctl(struct netns_ipvs *ipvs)
 	tbl[idx++].data = &ipvs->sysctl_conn_reuse_mode;
 	tbl[idx++].data = &ipvs->sysctl_schedule_icmp;
 	tbl[idx++].data = &ipvs->sysctl_ignore_tunneled;
+	tbl[idx++].extra2 = ipvs;
 #ifdef CONFIG_IP_VS_DEBUG
 	/* Global sysctls must be ro in non-init netns */
 	if (!net_eq(net, &init_net))
@@ -10,6 +10,8 @@
  *              Affected data: est_list and est_lock.
  *              estimation_timer() runs with timer per netns.
  *              get_stats()) do the per cpu summing.
+ *              Estimation moved to a kthread per netns, with the
+ *              estimators spread over the ticks of the period.
  */
 
 #define KMSG_COMPONENT "IPVS"
@@ -21,6 +23,8 @@
 #include <linux/interrupt.h>
 #include <linux/sysctl.h>
 #include <linux/list.h>
+#include <linux/kthread.h>
+#include <linux/sched/isolation.h>
 
 #include <net/ip_vs.h>
 
@@ -30,8 +34,10 @@
   long interval, it is easy to implement a user level daemon which
   periodically reads those statistical counters and measure rate.
 
-  Currently, the measurement is activated by slow timer handler. Hope
-  this measurement will not introduce too much load.
+  The measurement is done by a kthread per netns. The estimators are
+  spread over IPVS_EST_NTICKS chains and one chain is walked every
+  tick, so the per cpu summing for thousands of real servers is done
+  in small steps instead of in one softirq burst every 2 seconds.
 
   We measure rate during the last 8 seconds every 2 seconds:
 
@@ -93,65 +99,140 @@ static void ip_vs_read_cpu_stats(struct ip_vs_kstats *sum,
 }
 
 
-static void estimation_timer(struct timer_list *t)
+/* Estimators walked between reschedule points */
+#define IPVS_EST_CHAIN_LEN	16
+
+/* Offset of the tick in the period */
+#define IPVS_EST_TICK_TIME(row)	((row) * IPVS_EST_PERIOD / IPVS_EST_NTICKS)
+
+static void ip_vs_estimate(struct ip_vs_estimator *e)
 {
-	struct ip_vs_estimator *e;
-	struct ip_vs_stats *s;
+	struct ip_vs_stats *s = container_of(e, struct ip_vs_stats, est);
 	u64 rate;
-	struct netns_ipvs *ipvs = from_timer(ipvs, t, est_timer);
 
-	spin_lock(&ipvs->est_lock);
-	list_for_each_entry(e, &ipvs->est_list, list) {
-		s = container_of(e, struct ip_vs_stats, est);
+	spin_lock_bh(&s->lock);
+	ip_vs_read_cpu_stats(&s->kstats, s->cpustats);
+
+	/* scaled by 2^10, but divided 2 seconds */
+	rate = (s->kstats.conns - e->last_conns) << 9;
+	e->last_conns = s->kstats.conns;
+	e->cps += ((s64)rate - (s64)e->cps) >> 2;
 
-		spin_lock(&s->lock);
-		ip_vs_read_cpu_stats(&s->kstats, s->cpustats);
+	rate = (s->kstats.inpkts - e->last_inpkts) << 9;
+	e->last_inpkts = s->kstats.inpkts;
+	e->inpps += ((s64)rate - (s64)e->inpps) >> 2;
 
-		/* scaled by 2^10, but divided 2 seconds */
-		rate = (s->kstats.conns - e->last_conns) << 9;
-		e->last_conns = s->kstats.conns;
-		e->cps += ((s64)rate - (s64)e->cps) >> 2;
+	rate = (s->kstats.outpkts - e->last_outpkts) << 9;
+	e->last_outpkts = s->kstats.outpkts;
+	e->outpps += ((s64)rate - (s64)e->outpps) >> 2;
 
-		rate = (s->kstats.inpkts - e->last_inpkts) << 9;
-		e->last_inpkts = s->kstats.inpkts;
-		e->inpps += ((s64)rate - (s64)e->inpps) >> 2;
+	/* scaled by 2^5, but divided 2 seconds */
+	rate = (s->kstats.inbytes - e->last_inbytes) << 4;
+	e->last_inbytes = s->kstats.inbytes;
+	e->inbps += ((s64)rate - (s64)e->inbps) >> 2;
 
-		rate = (s->kstats.outpkts - e->last_outpkts) << 9;
-		e->last_outpkts = s->kstats.outpkts;
-		e->outpps += ((s64)rate - (s64)e->outpps) >> 2;
+	rate = (s->kstats.outbytes - e->last_outbytes) << 4;
+	e->last_outbytes = s->kstats.outbytes;
+	e->outbps += ((s64)rate - (s64)e->outbps) >> 2;
+	spin_unlock_bh(&s->lock);
+}
 
-		/* scaled by 2^5, but divided 2 seconds */
-		rate = (s->kstats.inbytes - e->last_inbytes) << 4;
-		e->last_inbytes = s->kstats.inbytes;
-		e->inbps += ((s64)rate - (s64)e->inbps) >> 2;
+static void ip_vs_est_tick(struct netns_ipvs *ipvs, int row)
+{
+	struct ip_vs_estimator *e;
+	int n = 0;
 
-		rate = (s->kstats.outbytes - e->last_outbytes) << 4;
-		e->last_outbytes = s->kstats.outbytes;
-		e->outbps += ((s64)rate - (s64)e->outbps) >> 2;
-		spin_unlock(&s->lock);
+	mutex_lock(&ipvs->est_mutex);
+	list_for_each_entry(e, &ipvs->est_chains[row], list) {
+		ip_vs_estimate(e);
+		if (!(++n % IPVS_EST_CHAIN_LEN))
+			cond_resched();
+	}
+	mutex_unlock(&ipvs->est_mutex);
+}
+
+static int ip_vs_estimation_kthread(void *data)
+{
+	struct netns_ipvs *ipvs = data;
+	unsigned long start = jiffies;
+	unsigned long now, next;
+	int row = 0;
+
+	while (!kthread_should_stop()) {
+		next = start + IPVS_EST_TICK_TIME(row);
+		now = jiffies;
+		if (time_before(now, next)) {
+			schedule_timeout_idle(next - now);
+			continue;
+		}
+
+		ip_vs_est_tick(ipvs, row);
+
+		if (++row == IPVS_EST_NTICKS) {
+			row = 0;
+			start += IPVS_EST_PERIOD;
+			/* Don't try to catch up after a long stall */
+			if (time_after(jiffies, start + IPVS_EST_PERIOD))
+				start = jiffies;
+		}
 	}
-	spin_unlock(&ipvs->est_lock);
-	mod_timer(&ipvs->est_timer, jiffies + 2*HZ);
+
+	return 0;
+}
+
+/* Called with est_mutex held */
+static int ip_vs_est_kthread_start(struct netns_ipvs *ipvs)
+{
+	struct task_struct *kt;
+
+	kt = kthread_create(ip_vs_estimation_kthread, ipvs, "ipvs-e:%d",
+			    ipvs->gen);
+	if (IS_ERR(kt))
+		return PTR_ERR(kt);
+
+	set_cpus_allowed_ptr(kt, ipvs->est_cpulist);
+	ipvs->est_kt = kt;
+	wake_up_process(kt);
+	return 0;
 }
 
 void ip_vs_start_estimator(struct netns_ipvs *ipvs, struct ip_vs_stats *stats)
 {
 	struct ip_vs_estimator *est = &stats->est;
+	int row, best = 0, ret;
 
 	INIT_LIST_HEAD(&est->list);
 
-	spin_lock_bh(&ipvs->est_lock);
-	list_add(&est->list, &ipvs->est_list);
-	spin_unlock_bh(&ipvs->est_lock);
+	mutex_lock(&ipvs->est_mutex);
+	/* Keep the work done on each tick even */
+	for (row = 1; row < IPVS_EST_NTICKS; row++) {
+		if (ipvs->est_chain_len[row] < ipvs->est_chain_len[best])
+			best = row;
+	}
+	est->ktrow = best;
+	ipvs->est_chain_len[best]++;
+	list_add(&est->list, &ipvs->est_chains[best]);
+
+	/* The totals alone don't change until a service is added. If the
+	 * kthread can't be created, the next added estimator tries again.
+	 */
+	if (!ipvs->est_kt && stats != &ipvs->tot_stats) {
+		ret = ip_vs_est_kthread_start(ipvs);
+		if (ret)
+			pr_err_once("%s: kthread_create failed: %d\n",
+				    __func__, ret);
+	}
+	mutex_unlock(&ipvs->est_mutex);
 }
 
 void ip_vs_stop_estimator(struct netns_ipvs *ipvs, struct ip_vs_stats *stats)
 {
 	struct ip_vs_estimator *est = &stats->est;
 
-	spin_lock_bh(&ipvs->est_lock);
+	mutex_lock(&ipvs->est_mutex);
 	list_del(&est->list);
-	spin_unlock_bh(&ipvs->est_lock);
+	ipvs->est_chain_len[est->ktrow]--;
+	mutex_unlock(&ipvs->est_mutex);
 }
 
 void ip_vs_zero_estimator(struct ip_vs_stats *stats)
@@ -184,16 +265,37 @@ void ip_vs_read_estimator(struct ip_vs_kstats *dst, struct ip_vs_stats *stats)
 	dst->outbps = (e->outbps + 0xF) >> 5;
 }
 
+int ip_vs_est_set_cpulist(struct netns_ipvs *ipvs, const struct cpumask *mask)
+{
+	int ret = 0;
+
+	mutex_lock(&ipvs->est_mutex);
+	if (ipvs->est_kt)
+		ret = set_cpus_allowed_ptr(ipvs->est_kt, mask);
+	if (!ret)
+		cpumask_copy(ipvs->est_cpulist, mask);
+	mutex_unlock(&ipvs->est_mutex);
+	return ret;
+}
+
 int __net_init ip_vs_estimator_net_init(struct netns_ipvs *ipvs)
 {
-	INIT_LIST_HEAD(&ipvs->est_list);
-	spin_lock_init(&ipvs->est_lock);
-	timer_setup(&ipvs->est_timer, estimation_timer, 0);
-	mod_timer(&ipvs->est_timer, jiffies + 2 * HZ);
+	int row;
+
+	for (row = 0; row < IPVS_EST_NTICKS; row++)
+		INIT_LIST_HEAD(&ipvs->est_chains[row]);
+	mutex_init(&ipvs->est_mutex);
+
+	if (!alloc_cpumask_var(&ipvs->est_cpulist, GFP_KERNEL))
+		return -ENOMEM;
+	cpumask_copy(ipvs->est_cpulist, housekeeping_cpumask(HK_FLAG_KTHREAD));
 	return 0;
 }
 
 void __net_exit ip_vs_estimator_net_cleanup(struct netns_ipvs *ipvs)
 {
-	del_timer_sync(&ipvs->est_timer);
+	/* All estimators are stopped by now */
+	if (ipvs->est_kt)
+		kthread_stop(ipvs->est_kt);
+	free_cpumask_var(ipvs->est_cpulist);
 }
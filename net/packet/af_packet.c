@@ -549,27 +549,37 @@ static void prb_del_retire_blk_timer(struct tpacket_kbdq_core *pkc)
 	del_timer_sync(&pkc->retire_blk_timer);
 }
 
-static void prb_shutdown_retire_blk_timer(struct packet_sock *po,
-		struct sk_buff_head *rb_queue)
+static void prb_shutdown_retire_blk_timer(struct tpacket_kbdq_core *pkc)
 {
-	struct tpacket_kbdq_core *pkc;
-
-	pkc = GET_PBDQC_FROM_RB(&po->rx_ring);
-
-	spin_lock_bh(&rb_queue->lock);
+	spin_lock_bh(pkc->rx_lock);
 	pkc->delete_blk_timer = 1;
-	spin_unlock_bh(&rb_queue->lock);
+	spin_unlock_bh(pkc->rx_lock);
 
 	prb_del_retire_blk_timer(pkc);
 }
 
-static void prb_setup_retire_blk_timer(struct packet_sock *po)
+static void prb_shutdown_retire_blk_timers(struct packet_sock *po,
+		struct packet_ring_cpu __percpu *prb_cpu)
 {
-	struct tpacket_kbdq_core *pkc;
+	int cpu;
+
+	if (!prb_cpu) {
+		prb_shutdown_retire_blk_timer(GET_PBDQC_FROM_RB(&po->rx_ring));
+		return;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct packet_ring_cpu *rc = per_cpu_ptr(prb_cpu, cpu);
 
-	pkc = GET_PBDQC_FROM_RB(&po->rx_ring);
+		prb_shutdown_retire_blk_timer(&rc->prb_bdqc);
+	}
+}
+
+static void prb_setup_retire_blk_timer(struct tpacket_kbdq_core *pkc,
+		unsigned int flags)
+{
 	timer_setup(&pkc->retire_blk_timer, prb_retire_rx_blk_timer_expired,
-		    0);
+		    flags);
 	pkc->retire_blk_timer.expires = jiffies;
 }
 
@@ -616,12 +626,15 @@ static void prb_init_ft_ops(struct tpacket_kbdq_core *p1,
 	p1->feature_req_word = req_u->req3.tp_feature_req_word;
 }
 
-static void init_prb_bdqc(struct packet_sock *po,
-			struct packet_ring_buffer *rb,
+static void __init_prb_bdqc(struct packet_sock *po,
+			struct tpacket_kbdq_core *p1,
 			struct pgv *pg_vec,
+			unsigned int block_nr,
+			unsigned short retire_blk_tov,
+			spinlock_t *rx_lock,
+			int cpu,
 			union tpacket_req_u *req_u)
 {
-	struct tpacket_kbdq_core *p1 = GET_PBDQC_FROM_RB(rb);
 	struct tpacket_block_desc *pbd;
 
 	memset(p1, 0x0, sizeof(*p1));
@@ -631,33 +644,101 @@ static void init_prb_bdqc(struct packet_sock *po,
 	pbd = (struct tpacket_block_desc *)pg_vec[0].buffer;
 	p1->pkblk_start	= pg_vec[0].buffer;
 	p1->kblk_size = req_u->req3.tp_block_size;
-	p1->knum_blocks	= req_u->req3.tp_block_nr;
+	p1->knum_blocks	= block_nr;
 	p1->hdrlen = po->tp_hdrlen;
 	p1->version = po->tp_version;
 	p1->last_kactive_blk_num = 0;
-	po->stats.stats3.tp_freeze_q_cnt = 0;
-	if (req_u->req3.tp_retire_blk_tov)
-		p1->retire_blk_tov = req_u->req3.tp_retire_blk_tov;
-	else
-		p1->retire_blk_tov = prb_calc_retire_blk_tmo(po,
-						req_u->req3.tp_block_size);
+	p1->po = po;
+	p1->rx_lock = rx_lock;
+	p1->cpu = cpu;
+	p1->retire_blk_tov = retire_blk_tov;
 	p1->tov_in_jiffies = msecs_to_jiffies(p1->retire_blk_tov);
 	p1->blk_sizeof_priv = req_u->req3.tp_sizeof_priv;
 	rwlock_init(&p1->blk_fill_in_prog_lock);
 
 	p1->max_frame_len = p1->kblk_size - BLK_PLUS_PRIV(p1->blk_sizeof_priv);
 	prb_init_ft_ops(p1, req_u);
-	prb_setup_retire_blk_timer(po);
+	prb_setup_retire_blk_timer(p1, cpu < 0 ? 0 : TIMER_PINNED);
 	prb_open_block(p1, pbd);
 }
 
+/*
+ * With PACKET_RX_RING_PERCPU each possible CPU owns an equal, contiguous
+ * slice of pg_vec and runs its own block queue over it: CPU n fills blocks
+ * [n * block_nr, (n + 1) * block_nr) only, under its own lock and with its
+ * own retire timer. User-space still sees one mmap and one block array.
+ */
+static void init_prb_bdqc(struct packet_sock *po,
+			struct packet_ring_buffer *rb,
+			struct packet_ring_cpu __percpu *prb_cpu,
+			struct pgv *pg_vec,
+			union tpacket_req_u *req_u)
+{
+	unsigned int block_nr = req_u->req3.tp_block_nr;
+	unsigned short retire_blk_tov;
+	int cpu;
+
+	po->stats.stats3.tp_freeze_q_cnt = 0;
+	if (req_u->req3.tp_retire_blk_tov)
+		retire_blk_tov = req_u->req3.tp_retire_blk_tov;
+	else
+		retire_blk_tov = prb_calc_retire_blk_tmo(po,
+						req_u->req3.tp_block_size);
+
+	if (!prb_cpu) {
+		__init_prb_bdqc(po, GET_PBDQC_FROM_RB(rb), pg_vec, block_nr,
+				retire_blk_tov, &po->sk.sk_receive_queue.lock,
+				-1, req_u);
+		return;
+	}
+
+	block_nr /= nr_cpu_ids;
+	for_each_possible_cpu(cpu) {
+		struct packet_ring_cpu *rc = per_cpu_ptr(prb_cpu, cpu);
+
+		spin_lock_init(&rc->lock);
+		rc->tp_packets = 0;
+		rc->tp_freeze_q_cnt = 0;
+		__init_prb_bdqc(po, &rc->prb_bdqc, pg_vec + cpu * block_nr,
+				block_nr, retire_blk_tov, &rc->lock,
+				cpu, req_u);
+	}
+}
+
+static struct packet_ring_cpu *prb_ring_cpu(struct tpacket_kbdq_core *pkc)
+{
+	if (pkc->rx_lock == &pkc->po->sk.sk_receive_queue.lock)
+		return NULL;
+	return container_of(pkc, struct packet_ring_cpu, prb_bdqc);
+}
+
+/* Block queue the current CPU fills. */
+static struct tpacket_kbdq_core *prb_rx_core(struct packet_sock *po)
+{
+	if (po->rx_ring.prb_cpu)
+		return &this_cpu_ptr(po->rx_ring.prb_cpu)->prb_bdqc;
+	return GET_PBDQC_FROM_RB(&po->rx_ring);
+}
+
 /*  Do NOT update the last_blk_num first.
- *  Assumes sk_buff_head lock is held.
+ *  Assumes pkc->rx_lock is held.
+ *
+ *  The timer of a per-CPU queue is pinned to its CPU. The queue is only
+ *  refreshed from that CPU once it runs, but its first block is opened
+ *  from setsockopt() on any CPU, so an idle timer is queued on the owner.
+ *  The queue of an offline CPU receives nothing, its timer runs anywhere.
  */
 static void _prb_refresh_rx_retire_blk_timer(struct tpacket_kbdq_core *pkc)
 {
-	mod_timer(&pkc->retire_blk_timer,
-			jiffies + pkc->tov_in_jiffies);
+	unsigned long expires = jiffies + pkc->tov_in_jiffies;
+
+	if (pkc->cpu >= 0 && cpu_online(pkc->cpu) &&
+	    !timer_pending(&pkc->retire_blk_timer)) {
+		pkc->retire_blk_timer.expires = expires;
+		add_timer_on(&pkc->retire_blk_timer, pkc->cpu);
+	} else {
+		mod_timer(&pkc->retire_blk_timer, expires);
+	}
 	pkc->last_kactive_blk_num = pkc->kactive_blk_num;
 }
 
@@ -686,13 +767,12 @@ static void _prb_refresh_rx_retire_blk_timer(struct tpacket_kbdq_core *pkc)
  */
 static void prb_retire_rx_blk_timer_expired(struct timer_list *t)
 {
-	struct packet_sock *po =
-		from_timer(po, t, rx_ring.prb_bdqc.retire_blk_timer);
-	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(&po->rx_ring);
+	struct tpacket_kbdq_core *pkc = from_timer(pkc, t, retire_blk_timer);
+	struct packet_sock *po = pkc->po;
 	unsigned int frozen;
 	struct tpacket_block_desc *pbd;
 
-	spin_lock(&po->sk.sk_receive_queue.lock);
+	spin_lock(pkc->rx_lock);
 
 	frozen = prb_queue_frozen(pkc);
 	pbd = GET_CURR_PBLOCK_DESC_FROM_CORE(pkc);
@@ -754,7 +834,7 @@ static void prb_retire_rx_blk_timer_expired(struct timer_list *t)
 	_prb_refresh_rx_retire_blk_timer(pkc);
 
 out:
-	spin_unlock(&po->sk.sk_receive_queue.lock);
+	spin_unlock(pkc->rx_lock);
 }
 
 static void prb_flush_block(struct tpacket_kbdq_core *pkc1,
@@ -917,8 +997,13 @@ static void prb_open_block(struct tpacket_kbdq_core *pkc1,
 static void prb_freeze_queue(struct tpacket_kbdq_core *pkc,
 				  struct packet_sock *po)
 {
+	struct packet_ring_cpu *rc = prb_ring_cpu(pkc);
+
 	pkc->reset_pending_on_curr_blk = 1;
-	po->stats.stats3.tp_freeze_q_cnt++;
+	if (rc)
+		rc->tp_freeze_q_cnt++;
+	else
+		po->stats.stats3.tp_freeze_q_cnt++;
 }
 
 #define TOTAL_PKT_LEN_INCL_ALIGN(length) (ALIGN((length), V3_ALIGNMENT))
@@ -990,11 +1075,9 @@ static int prb_queue_frozen(struct tpacket_kbdq_core *pkc)
 	return pkc->reset_pending_on_curr_blk;
 }
 
-static void prb_clear_blk_fill_status(struct packet_ring_buffer *rb)
+static void prb_clear_blk_fill_status(struct tpacket_kbdq_core *pkc)
 	__releases(&pkc->blk_fill_in_prog_lock)
 {
-	struct tpacket_kbdq_core *pkc  = GET_PBDQC_FROM_RB(rb);
-
 	read_unlock(&pkc->blk_fill_in_prog_lock);
 }
 
@@ -1013,7 +1096,7 @@ static void prb_clear_rxhash(struct tpacket_kbdq_core *pkc,
 static void prb_fill_vlan_info(struct tpacket_kbdq_core *pkc,
 			struct tpacket3_hdr *ppd)
 {
-	struct packet_sock *po = container_of(pkc, struct packet_sock, rx_ring.prb_bdqc);
+	struct packet_sock *po = pkc->po;
 
 	if (skb_vlan_tag_present(pkc->skb)) {
 		ppd->hv1.tp_vlan_tci = skb_vlan_tag_get(pkc->skb);
@@ -1060,17 +1143,16 @@ static void prb_fill_curr_block(char *curr,
 	prb_run_all_ft_ops(pkc, ppd);
 }
 
-/* Assumes caller has the sk->rx_queue.lock */
+/* Assumes caller has the pkc->rx_lock */
 static void *__packet_lookup_frame_in_block(struct packet_sock *po,
+					    struct tpacket_kbdq_core *pkc,
 					    struct sk_buff *skb,
 					    unsigned int len
 					    )
 {
-	struct tpacket_kbdq_core *pkc;
 	struct tpacket_block_desc *pbd;
 	char *curr, *end;
 
-	pkc = GET_PBDQC_FROM_RB(&po->rx_ring);
 	pbd = GET_CURR_PBLOCK_DESC_FROM_CORE(pkc);
 
 	/* Queue is frozen when user space is lagging behind */
@@ -1123,6 +1205,7 @@ static void *__packet_lookup_frame_in_block(struct packet_sock *po,
 }
 
 static void *packet_current_rx_frame(struct packet_sock *po,
+					    struct tpacket_kbdq_core *pkc,
 					    struct sk_buff *skb,
 					    int status, unsigned int len)
 {
@@ -1134,7 +1217,7 @@ static void *packet_current_rx_frame(struct packet_sock *po,
 					po->rx_ring.head, status);
 		return curr;
 	case TPACKET_V3:
-		return __packet_lookup_frame_in_block(po, skb, len);
+		return __packet_lookup_frame_in_block(po, pkc, skb, len);
 	default:
 		WARN(1, "TPACKET version not supported\n");
 		BUG();
@@ -1142,12 +1225,10 @@ static void *packet_current_rx_frame(struct packet_sock *po,
 	}
 }
 
-static void *prb_lookup_block(const struct packet_sock *po,
-			      const struct packet_ring_buffer *rb,
+static void *prb_lookup_block(const struct tpacket_kbdq_core *pkc,
 			      unsigned int idx,
 			      int status)
 {
-	struct tpacket_kbdq_core *pkc  = GET_PBDQC_FROM_RB(rb);
 	struct tpacket_block_desc *pbd = GET_PBLOCK_DESC(pkc, idx);
 
 	if (status != BLOCK_STATUS(pbd))
@@ -1155,23 +1236,22 @@ static void *prb_lookup_block(const struct packet_sock *po,
 	return pbd;
 }
 
-static int prb_previous_blk_num(struct packet_ring_buffer *rb)
+static int prb_previous_blk_num(const struct tpacket_kbdq_core *pkc)
 {
 	unsigned int prev;
-	if (rb->prb_bdqc.kactive_blk_num)
-		prev = rb->prb_bdqc.kactive_blk_num-1;
+	if (pkc->kactive_blk_num)
+		prev = pkc->kactive_blk_num-1;
 	else
-		prev = rb->prb_bdqc.knum_blocks-1;
+		prev = pkc->knum_blocks-1;
 	return prev;
 }
 
-/* Assumes caller has held the rx_queue.lock */
-static void *__prb_previous_block(struct packet_sock *po,
-					 struct packet_ring_buffer *rb,
-					 int status)
+/* Assumes caller has held the pkc->rx_lock */
+static void *__prb_previous_block(const struct tpacket_kbdq_core *pkc,
+				  int status)
 {
-	unsigned int previous = prb_previous_blk_num(rb);
-	return prb_lookup_block(po, rb, previous, status);
+	unsigned int previous = prb_previous_blk_num(pkc);
+	return prb_lookup_block(pkc, previous, status);
 }
 
 static void *packet_previous_rx_frame(struct packet_sock *po,
@@ -1181,7 +1261,45 @@ static void *packet_previous_rx_frame(struct packet_sock *po,
 	if (po->tp_version <= TPACKET_V2)
 		return packet_previous_frame(po, rb, status);
 
-	return __prb_previous_block(po, rb, status);
+	return __prb_previous_block(GET_PBDQC_FROM_RB(rb), status);
+}
+
+/* Assumes caller has held the rx_queue.lock, which pins rx_ring.prb_cpu */
+static bool prb_cpu_rings_readable(struct packet_ring_cpu __percpu *prb_cpu)
+{
+	bool readable = false;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct packet_ring_cpu *rc = per_cpu_ptr(prb_cpu, cpu);
+
+		spin_lock(&rc->lock);
+		readable = !__prb_previous_block(&rc->prb_bdqc,
+						 TP_STATUS_KERNEL);
+		spin_unlock(&rc->lock);
+		if (readable)
+			break;
+	}
+
+	return readable;
+}
+
+/* Assumes caller has held the rx_queue.lock, which pins rx_ring.prb_cpu */
+static void prb_cpu_rings_fold_stats(struct packet_ring_cpu __percpu *prb_cpu,
+				     struct tpacket_stats_v3 *st)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct packet_ring_cpu *rc = per_cpu_ptr(prb_cpu, cpu);
+
+		spin_lock(&rc->lock);
+		st->tp_packets += rc->tp_packets;
+		st->tp_freeze_q_cnt += rc->tp_freeze_q_cnt;
+		rc->tp_packets = 0;
+		rc->tp_freeze_q_cnt = 0;
+		spin_unlock(&rc->lock);
+	}
 }
 
 static void packet_increment_rx_head(struct packet_sock *po,
@@ -1271,17 +1389,27 @@ static bool __tpacket_has_room(const struct packet_sock *po, int pow_off)
 	return packet_lookup_frame(po, &po->rx_ring, idx, TP_STATUS_KERNEL);
 }
 
-static bool __tpacket_v3_has_room(const struct packet_sock *po, int pow_off)
+static bool __tpacket_v3_has_room(const struct tpacket_kbdq_core *pkc,
+				  int pow_off)
 {
 	int idx, len;
 
-	len = READ_ONCE(po->rx_ring.prb_bdqc.knum_blocks);
-	idx = READ_ONCE(po->rx_ring.prb_bdqc.kactive_blk_num);
+	len = READ_ONCE(pkc->knum_blocks);
+	idx = READ_ONCE(pkc->kactive_blk_num);
 	if (pow_off)
 		idx += len >> pow_off;
 	if (idx >= len)
 		idx -= len;
-	return prb_lookup_block(po, &po->rx_ring, idx, TP_STATUS_KERNEL);
+	return prb_lookup_block(pkc, idx, TP_STATUS_KERNEL);
+}
+
+static int __tpacket_v3_rcv_has_room(const struct tpacket_kbdq_core *pkc)
+{
+	if (__tpacket_v3_has_room(pkc, ROOM_POW_OFF))
+		return ROOM_NORMAL;
+	else if (__tpacket_v3_has_room(pkc, 0))
+		return ROOM_LOW;
+	return ROOM_NONE;
 }
 
 static int __packet_rcv_has_room(const struct packet_sock *po,
@@ -1304,10 +1432,26 @@ static int __packet_rcv_has_room(const struct packet_sock *po,
 	}
 
 	if (po->tp_version == TPACKET_V3) {
-		if (__tpacket_v3_has_room(po, ROOM_POW_OFF))
-			ret = ROOM_NORMAL;
-		else if (__tpacket_v3_has_room(po, 0))
-			ret = ROOM_LOW;
+		struct packet_ring_cpu __percpu *prb_cpu;
+		int cpu;
+
+		prb_cpu = READ_ONCE(po->rx_ring.prb_cpu);
+		if (!prb_cpu)
+			return __tpacket_v3_rcv_has_room(&po->rx_ring.prb_bdqc);
+
+		/* The receive path only ever fills the ring of its own CPU,
+		 * but pressure is only cleared once every ring has room.
+		 */
+		if (skb)
+			return __tpacket_v3_rcv_has_room(
+					&this_cpu_ptr(prb_cpu)->prb_bdqc);
+
+		ret = ROOM_NORMAL;
+		for_each_possible_cpu(cpu) {
+			struct packet_ring_cpu *rc = per_cpu_ptr(prb_cpu, cpu);
+
+			ret = min(ret, __tpacket_v3_rcv_has_room(&rc->prb_bdqc));
+		}
 	} else {
 		if (__tpacket_has_room(po, ROOM_POW_OFF))
 			ret = ROOM_NORMAL;
@@ -2257,6 +2401,9 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	unsigned short macoff, hdrlen;
 	unsigned int netoff;
 	struct sk_buff *copy_skb = NULL;
+	struct tpacket_kbdq_core *pkc = NULL;
+	struct packet_ring_cpu *rc = NULL;
+	spinlock_t *rx_lock;
 	struct timespec64 ts;
 	__u32 ts_status;
 	bool is_drop_n_account = false;
@@ -2279,6 +2426,13 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	if (!net_eq(dev_net(dev), sock_net(sk)))
 		goto drop;
 
+	rx_lock = &sk->sk_receive_queue.lock;
+	if (po->tp_version == TPACKET_V3) {
+		pkc = prb_rx_core(po);
+		rc = prb_ring_cpu(pkc);
+		rx_lock = pkc->rx_lock;
+	}
+
 	if (dev_has_header(dev)) {
 		if (sk->sk_type != SOCK_DGRAM)
 			skb_push(skb, skb->data - skb_mac_header(skb));
@@ -2349,22 +2503,21 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 				do_vnet = false;
 			}
 		}
-	} else if (unlikely(macoff + snaplen >
-			    GET_PBDQC_FROM_RB(&po->rx_ring)->max_frame_len)) {
+	} else if (unlikely(macoff + snaplen > pkc->max_frame_len)) {
 		u32 nval;
 
-		nval = GET_PBDQC_FROM_RB(&po->rx_ring)->max_frame_len - macoff;
+		nval = pkc->max_frame_len - macoff;
 		pr_err_once("tpacket_rcv: packet too big, clamped from %u to %u. macoff=%u\n",
 			    snaplen, nval, macoff);
 		snaplen = nval;
 		if (unlikely((int)snaplen < 0)) {
 			snaplen = 0;
-			macoff = GET_PBDQC_FROM_RB(&po->rx_ring)->max_frame_len;
+			macoff = pkc->max_frame_len;
 			do_vnet = false;
 		}
 	}
-	spin_lock(&sk->sk_receive_queue.lock);
-	h.raw = packet_current_rx_frame(po, skb,
+	spin_lock(rx_lock);
+	h.raw = packet_current_rx_frame(po, pkc, skb,
 					TP_STATUS_KERNEL, (macoff+snaplen));
 	if (!h.raw)
 		goto drop_n_account;
@@ -2381,7 +2534,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 				    sizeof(struct virtio_net_hdr),
 				    vio_le(), true, 0)) {
 		if (po->tp_version == TPACKET_V3)
-			prb_clear_blk_fill_status(&po->rx_ring);
+			prb_clear_blk_fill_status(pkc);
 		goto drop_n_account;
 	}
 
@@ -2397,12 +2550,15 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 			status |= TP_STATUS_LOSING;
 	}
 
-	po->stats.stats1.tp_packets++;
+	if (rc)
+		rc->tp_packets++;
+	else
+		po->stats.stats1.tp_packets++;
 	if (copy_skb) {
 		status |= TP_STATUS_COPY;
 		__skb_queue_tail(&sk->sk_receive_queue, copy_skb);
 	}
-	spin_unlock(&sk->sk_receive_queue.lock);
+	spin_unlock(rx_lock);
 
 	skb_copy_bits(skb, 0, h.raw + macoff, snaplen);
 
@@ -2500,7 +2656,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		spin_unlock(&sk->sk_receive_queue.lock);
 		sk->sk_data_ready(sk);
 	} else if (po->tp_version == TPACKET_V3) {
-		prb_clear_blk_fill_status(&po->rx_ring);
+		prb_clear_blk_fill_status(pkc);
 	}
 
 drop_n_restore:
@@ -2516,7 +2672,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	return 0;
 
 drop_n_account:
-	spin_unlock(&sk->sk_receive_queue.lock);
+	spin_unlock(rx_lock);
 	atomic_inc(&po->tp_drops);
 	is_drop_n_account = true;
 
@@ -4055,6 +4211,25 @@ packet_setsockopt(struct socket *sock, int level, int optname, sockptr_t optval,
 		WRITE_ONCE(po->xmit, val ? packet_direct_xmit : dev_queue_xmit);
 		return 0;
 	}
+	case PACKET_RX_RING_PERCPU:
+	{
+		int val;
+
+		if (optlen != sizeof(val))
+			return -EINVAL;
+		if (copy_from_sockptr(&val, optval, sizeof(val)))
+			return -EFAULT;
+
+		lock_sock(sk);
+		if (po->rx_ring.pg_vec) {
+			ret = -EBUSY;
+		} else {
+			po->tp_rx_percpu = !!val;
+			ret = 0;
+		}
+		release_sock(sk);
+		return ret;
+	}
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -4086,6 +4261,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 		spin_lock_bh(&sk->sk_receive_queue.lock);
 		memcpy(&st, &po->stats, sizeof(st));
 		memset(&po->stats, 0, sizeof(po->stats));
+		if (po->rx_ring.prb_cpu)
+			prb_cpu_rings_fold_stats(po->rx_ring.prb_cpu,
+						 &st.stats3);
 		spin_unlock_bh(&sk->sk_receive_queue.lock);
 		drops = atomic_xchg(&po->tp_drops, 0);
 
@@ -4114,6 +4292,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 	case PACKET_VERSION:
 		val = po->tp_version;
 		break;
+	case PACKET_RX_RING_PERCPU:
+		val = po->tp_rx_percpu ? nr_cpu_ids : 0;
+		break;
 	case PACKET_HDRLEN:
 		if (len > sizeof(int))
 			len = sizeof(int);
@@ -4289,7 +4470,10 @@ static __poll_t packet_poll(struct file *file, struct socket *sock,
 	__poll_t mask = datagram_poll(file, sock, wait);
 
 	spin_lock_bh(&sk->sk_receive_queue.lock);
-	if (po->rx_ring.pg_vec) {
+	if (po->rx_ring.prb_cpu) {
+		if (prb_cpu_rings_readable(po->rx_ring.prb_cpu))
+			mask |= EPOLLIN | EPOLLRDNORM;
+	} else if (po->rx_ring.pg_vec) {
 		if (!packet_previous_rx_frame(po, &po->rx_ring,
 			TP_STATUS_KERNEL))
 			mask |= EPOLLIN | EPOLLRDNORM;
@@ -4409,6 +4593,7 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 	struct pgv *pg_vec = NULL;
 	struct packet_sock *po = pkt_sk(sk);
 	unsigned long *rx_owner_map = NULL;
+	struct packet_ring_cpu __percpu *prb_cpu = NULL;
 	int was_running, order = 0;
 	struct packet_ring_buffer *rb;
 	struct sk_buff_head *rb_queue;
@@ -4471,6 +4656,10 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		if (unlikely((rb->frames_per_block * req->tp_block_nr) !=
 					req->tp_frame_nr))
 			goto out;
+		if (po->tp_rx_percpu && !tx_ring &&
+		    (po->tp_version != TPACKET_V3 ||
+		     req->tp_block_nr % nr_cpu_ids))
+			goto out;
 
 		err = -ENOMEM;
 		order = get_order(req->tp_block_size);
@@ -4481,7 +4670,13 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		case TPACKET_V3:
 			/* Block transmit is not supported yet */
 			if (!tx_ring) {
-				init_prb_bdqc(po, rb, pg_vec, req_u);
+				if (po->tp_rx_percpu) {
+					prb_cpu = alloc_percpu(
+						struct packet_ring_cpu);
+					if (unlikely(!prb_cpu))
+						goto out_free_pg_vec;
+				}
+				init_prb_bdqc(po, rb, prb_cpu, pg_vec, req_u);
 			} else {
 				struct tpacket_req3 *req3 = &req_u->req3;
 
@@ -4531,6 +4726,8 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		swap(rb->pg_vec, pg_vec);
 		if (po->tp_version <= TPACKET_V2)
 			swap(rb->rx_owner_map, rx_owner_map);
+		else
+			swap(rb->prb_cpu, prb_cpu);
 		rb->frame_max = (req->tp_frame_nr - 1);
 		rb->head = 0;
 		rb->frame_size = req->tp_frame_size;
@@ -4558,11 +4755,12 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 	if (pg_vec && (po->tp_version > TPACKET_V2)) {
 		/* Because we don't support block-based V3 on tx-ring */
 		if (!tx_ring)
-			prb_shutdown_retire_blk_timer(po, rb_queue);
+			prb_shutdown_retire_blk_timers(po, prb_cpu);
 	}
 
 out_free_pg_vec:
 	if (pg_vec) {
+		free_percpu(prb_cpu);
 		bitmap_free(rx_owner_map);
 		free_pg_vec(pg_vec, order, req->tp_block_nr);
 	}
@@ -31,6 +31,8 @@ static int pdiag_put_info(const struct packet_sock *po, struct sk_buff *nlskb)
 		pinfo.pdi_flags |= PDI_VNETHDR;
 	if (po->tp_loss)
 		pinfo.pdi_flags |= PDI_LOSS;
+	if (po->tp_rx_percpu)
+		pinfo.pdi_flags |= PDI_RX_PERCPU;
 
 	return nla_put(nlskb, PACKET_DIAG_INFO, sizeof(pinfo), &pinfo);
 }
@@ -83,9 +85,16 @@ static int pdiag_put_ring(struct packet_ring_buffer *ring, int ver, int nl_type,
 	pdr.pdr_frame_nr = ring->frame_max + 1;
 
 	if (ver > TPACKET_V2) {
-		pdr.pdr_retire_tmo = ring->prb_bdqc.retire_blk_tov;
-		pdr.pdr_sizeof_priv = ring->prb_bdqc.blk_sizeof_priv;
-		pdr.pdr_features = ring->prb_bdqc.feature_req_word;
+		const struct tpacket_kbdq_core *pkc = &ring->prb_bdqc;
+		int cpu = cpumask_first(cpu_possible_mask);
+
+		/* All per-CPU block queues share the ring configuration */
+		if (ring->prb_cpu)
+			pkc = &per_cpu_ptr(ring->prb_cpu, cpu)->prb_bdqc;
+
+		pdr.pdr_retire_tmo = pkc->retire_blk_tov;
+		pdr.pdr_sizeof_priv = pkc->blk_sizeof_priv;
+		pdr.pdr_features = pkc->feature_req_word;
 	} else {
 		pdr.pdr_retire_tmo = 0;
 		pdr.pdr_sizeof_priv = 0;
@@ -39,6 +39,12 @@ struct tpacket_kbdq_core {
 	char		*nxt_offset;
 	struct sk_buff	*skb;
 
+	struct packet_sock *po;
+	/* sk_receive_queue.lock, or the lock of a per-CPU block queue */
+	spinlock_t	*rx_lock;
+	/* CPU owning a per-CPU block queue, -1 for the shared one */
+	int		cpu;
+
 	rwlock_t	blk_fill_in_prog_lock;
 
 	/* Default is set to 8ms */
@@ -56,6 +62,14 @@ struct pgv {
 	char *buffer;
 };
 
+/* PACKET_RX_RING_PERCPU: one block queue per CPU over a slice of pg_vec */
+struct packet_ring_cpu {
+	spinlock_t			lock;
+	unsigned int			tp_packets;
+	unsigned int			tp_freeze_q_cnt;
+	struct tpacket_kbdq_core	prb_bdqc;
+};
+
 struct packet_ring_buffer {
 	struct pgv		*pg_vec;
 
@@ -74,6 +88,7 @@ struct packet_ring_buffer {
 		unsigned long			*rx_owner_map;
 		struct tpacket_kbdq_core	prb_bdqc;
 	};
+	struct packet_ring_cpu __percpu	*prb_cpu;
 };
 
 extern struct mutex fanout_mutex;
@@ -120,7 +135,8 @@ struct packet_sock {
 	unsigned int		running;	/* bind_lock must be held */
 	unsigned int		has_vnet_hdr:1, /* writer must hold sock lock */
 				tp_loss:1,
-				tp_tx_has_off:1;
+				tp_tx_has_off:1,
+				tp_rx_percpu:1;
 	int			pressure;
 	int			ifindex;	/* bound device		*/
 	__be16			num;
@@ -2095,6 +2095,10 @@ static bool sock_use_custom_sol_socket(const struct socket *sock)
 {
 	const struct sock *sk = sock->sk;
 
+	/* Use sock->ops->setsockopt() for AF_UNIX stream sockets */
+	if (sk->sk_family == AF_UNIX)
+		return sk->sk_type == SOCK_STREAM;
+
 	/* Use sock->ops->setsockopt() for MPTCP */
 	return IS_ENABLED(CONFIG_MPTCP) &&
 	       sk->sk_protocol == IPPROTO_MPTCP &&
@@ -482,7 +482,7 @@ static void tls_encrypt_done(struct crypto_async_request *req, int err)
 	spin_lock_bh(&ctx->encrypt_compl_lock);
 	pending = atomic_dec_return(&ctx->encrypt_pending);
 
-	if (!pending && ctx->async_notify)
+	if (pending < ctx->async_notify)
 		complete(&ctx->async_wait.completion);
 	spin_unlock_bh(&ctx->encrypt_compl_lock);
 
@@ -494,6 +494,43 @@ static void tls_encrypt_done(struct crypto_async_request *req, int err)
 		schedule_delayed_work(&ctx->tx_work.work, 1);
 }
 
+/* Throttle the async TX pipeline to tx_async_depth records in flight.
+ * Records completed meanwhile are pushed out right away, so that the TCP
+ * socket keeps being fed while the next ones are still being encrypted.
+ */
+static int tls_encrypt_async_throttle(struct sock *sk,
+				      struct tls_context *tls_ctx,
+				      struct tls_sw_context_tx *ctx)
+{
+	int depth = tls_ctx->tx_async_depth;
+	int pending;
+
+	spin_lock_bh(&ctx->encrypt_compl_lock);
+	ctx->async_notify = depth;
+	pending = atomic_read(&ctx->encrypt_pending);
+	spin_unlock_bh(&ctx->encrypt_compl_lock);
+	if (pending >= depth)
+		wait_for_completion(&ctx->async_wait.completion);
+
+	/* Unlike a full drain, more completions can race with us here. Stop
+	 * them from signalling before rearming the completion.
+	 */
+	spin_lock_bh(&ctx->encrypt_compl_lock);
+	ctx->async_notify = 0;
+	spin_unlock_bh(&ctx->encrypt_compl_lock);
+	reinit_completion(&ctx->async_wait.completion);
+
+	if (ctx->async_wait.err)
+		return ctx->async_wait.err;
+
+	if (test_and_clear_bit(BIT_TX_SCHEDULED, &ctx->tx_bitmask)) {
+		cancel_delayed_work(&ctx->tx_work.work);
+		tls_tx_records(sk, -1);
+	}
+
+	return 0;
+}
+
 static int tls_do_encryption(struct sock *sk,
 			     struct tls_context *tls_ctx,
 			     struct tls_sw_context_tx *ctx,
@@ -506,6 +543,13 @@ static int tls_do_encryption(struct sock *sk,
 	struct scatterlist *sge = sk_msg_elem(msg_en, start);
 	int rc, iv_offset = 0;
 
+	if (tls_ctx->tx_async_depth &&
+	    atomic_read(&ctx->encrypt_pending) >= tls_ctx->tx_async_depth) {
+		rc = tls_encrypt_async_throttle(sk, tls_ctx, ctx);
+		if (rc)
+			return rc;
+	}
+
 	/* For CCM based ciphers, first byte of IV is a constant */
 	if (prot->cipher_type == TLS_CIPHER_AES_CCM_128) {
 		rec->iv_data[0] = TLS_AES_CCM_IV_B0_BYTE;
@@ -1405,12 +1449,38 @@ static int tls_setup_from_iter(struct sock *sk, struct iov_iter *from,
 	return rc;
 }
 
+/* Map the last tail_len bytes of the record's data after the zero-copy
+ * part of sgout: in place into the skb if the record was only partially
+ * read, or into the tail buffer if only the TLS 1.3 content type is left.
+ */
+static int tls_setup_rx_tail(struct tls_prot_info *prot, struct sk_buff *skb,
+			     struct scatterlist *sg, u8 *tail,
+			     int zc_len, int tail_len)
+{
+	struct strp_msg *rxm = strp_msg(skb);
+
+	if (tail_len > prot->tail_size)
+		return skb_to_sgvec(skb, sg,
+				    rxm->offset + prot->prepend_size + zc_len,
+				    tail_len);
+
+	sg_set_buf(sg, tail, tail_len);
+	sg_mark_end(sg);
+	return 0;
+}
+
 /* This function decrypts the input skb into either out_iov or in out_sg
  * or in skb buffers itself. The input parameter 'zc' indicates if
  * zero-copy mode needs to be tried or not. With zero-copy mode, either
  * out_iov or out_sg must be non-NULL. In case both out_iov and out_sg are
  * NULL, then the decryption happens inside skb buffers itself, i.e.
  * zero-copy gets disabled and 'zc' is updated.
+ *
+ * When out_iov is shorter than the record, the part that fits is decrypted
+ * into out_iov and the rest in place into the skb, to be read from there
+ * by the next recvmsg(). Such partial reads are always decrypted
+ * synchronously. For TLS 1.3 the trailing content type byte is decrypted
+ * into ctx->control, so out_iov must hold all of the record's data.
  */
 
 static int decrypt_internal(struct sock *sk, struct sk_buff *skb,
@@ -1425,20 +1495,47 @@ static int decrypt_internal(struct sock *sk, struct sk_buff *skb,
 	int n_sgin, n_sgout, nsg, mem_size, aead_size, err, pages = 0;
 	struct aead_request *aead_req;
 	struct sk_buff *unused;
-	u8 *aad, *iv, *mem = NULL;
+	u8 *aad, *iv, *tail, *mem = NULL;
 	struct scatterlist *sgin = NULL;
 	struct scatterlist *sgout = NULL;
 	const int data_len = rxm->full_len - prot->overhead_size +
 			     prot->tail_size;
+	int zc_len = data_len, tail_len = 0, n_sgtail = 0;
 	int iv_offset = 0;
 
+	if (*zc && out_iov) {
+		zc_len = min_t(int, data_len - prot->tail_size,
+			       iov_iter_count(out_iov));
+		tail_len = data_len - zc_len;
+		/* A TLS 1.3 record cannot be split, see above */
+		if (prot->version == TLS_1_3_VERSION &&
+		    tail_len != prot->tail_size)
+			*zc = false;
+		if (tail_len)
+			async = false;
+	}
+
 	if (*zc && (out_iov || out_sg)) {
-		if (out_iov)
-			n_sgout = iov_iter_npages(out_iov, INT_MAX) + 1;
-		else
+		if (out_iov) {
+			struct iov_iter iter = *out_iov;
+
+			/* Only size sgout for what this record consumes */
+			iov_iter_truncate(&iter, zc_len);
+			n_sgout = iov_iter_npages(&iter, INT_MAX) + 1;
+		} else {
 			n_sgout = sg_nents(out_sg);
-		n_sgin = skb_nsg(skb, rxm->offset + prot->prepend_size,
-				 rxm->full_len - prot->prepend_size);
+		}
+
+		if (tail_len > prot->tail_size) {
+			/* The rest of the record is decrypted in place */
+			n_sgin = skb_cow_data(skb, 0, &unused);
+			n_sgtail = n_sgin;
+		} else {
+			n_sgin = skb_nsg(skb, rxm->offset + prot->prepend_size,
+					 rxm->full_len - prot->prepend_size);
+			n_sgtail = !!tail_len;
+		}
+		n_sgout += n_sgtail;
 	} else {
 		n_sgout = 0;
 		*zc = false;
@@ -1457,9 +1554,10 @@ static int decrypt_internal(struct sock *sk, struct sk_buff *skb,
 	mem_size = aead_size + (nsg * sizeof(struct scatterlist));
 	mem_size = mem_size + prot->aad_size;
 	mem_size = mem_size + crypto_aead_ivsize(ctx->aead_recv);
+	mem_size = mem_size + prot->tail_size;
 
 	/* Allocate a single block of memory which contains
-	 * aead_req || sgin[] || sgout[] || aad || iv.
+	 * aead_req || sgin[] || sgout[] || aad || iv || tail.
 	 * This order achieves correct alignment for aead_req, sgin, sgout.
 	 */
 	mem = kmalloc(mem_size, sk->sk_allocation);
@@ -1472,6 +1570,7 @@ static int decrypt_internal(struct sock *sk, struct sk_buff *skb,
 	sgout = sgin + n_sgin;
 	aad = (u8 *)(sgout + n_sgout);
 	iv = aad + prot->aad_size;
+	tail = iv + crypto_aead_ivsize(ctx->aead_recv);
 
 	/* For CCM based ciphers, first byte of nonce+iv is always '2' */
 	if (prot->cipher_type == TLS_CIPHER_AES_CCM_128) {
@@ -1518,11 +1617,25 @@ static int decrypt_internal(struct sock *sk, struct sk_buff *skb,
 			sg_set_buf(&sgout[0], aad, prot->aad_size);
 
 			*chunk = 0;
-			err = tls_setup_from_iter(sk, out_iov, data_len,
+			err = tls_setup_from_iter(sk, out_iov, zc_len,
 						  &pages, chunk, &sgout[1],
-						  (n_sgout - 1));
+						  (n_sgout - 1 - n_sgtail));
 			if (err < 0)
 				goto fallback_to_reg_recv;
+
+			/* Whatever does not fit in out_iov follows it */
+			if (tail_len) {
+				sg_unmark_end(&sgout[pages]);
+				err = tls_setup_rx_tail(prot, skb,
+							&sgout[pages + 1], tail,
+							zc_len, tail_len);
+			}
+			if (err < 0) {
+				iov_iter_revert(out_iov, *chunk);
+				for (; pages > 0; pages--)
+					put_page(sg_page(&sgout[pages]));
+				goto fallback_to_reg_recv;
+			}
 		} else if (out_sg) {
 			memcpy(sgout, out_sg, n_sgout * sizeof(*sgout));
 		} else {
@@ -1542,6 +1655,9 @@ static int decrypt_internal(struct sock *sk, struct sk_buff *skb,
 	if (err == -EINPROGRESS)
 		return err;
 
+	if (!err && *zc && prot->version == TLS_1_3_VERSION)
+		ctx->control = *tail;
+
 	/* Release the pages in case iov was mapped to pages */
 	for (; pages > 0; pages--)
 		put_page(sg_page(&sgout[pages]));
@@ -1571,6 +1687,9 @@ static int decrypt_skb_update(struct sock *sk, struct sk_buff *skb,
 		if (!ctx->decrypted) {
 			err = decrypt_internal(sk, skb, dest, NULL, chunk, zc,
 					       async);
+			if (err == -EINPROGRESS && *zc)
+				TLS_INC_STATS(sock_net(sk),
+					      LINUX_MIB_TLSRXZEROCOPY);
 			if (err < 0) {
 				if (err == -EINPROGRESS)
 					tls_advance_record_sn(sk, prot,
@@ -1580,17 +1699,48 @@ static int decrypt_skb_update(struct sock *sk, struct sk_buff *skb,
 						      LINUX_MIB_TLSDECRYPTERROR);
 				return err;
 			}
+
+			/* The TLS 1.3 record turned out to be padded or not
+			 * to carry data, so its plaintext was not meant for
+			 * the user buffer. Decrypt it again in place.
+			 */
+			if (*zc && prot->version == TLS_1_3_VERSION &&
+			    ctx->control != TLS_RECORD_TYPE_DATA) {
+				if (!ctx->control)
+					TLS_INC_STATS(sock_net(sk),
+						      LINUX_MIB_TLSRXNOPADVIOL);
+				TLS_INC_STATS(sock_net(sk),
+					      LINUX_MIB_TLSDECRYPTRETRY);
+				iov_iter_revert(dest, *chunk);
+				*zc = false;
+				err = decrypt_internal(sk, skb, NULL, NULL,
+						       chunk, zc, false);
+				if (err < 0)
+					return err;
+			}
 		} else {
 			*zc = false;
 		}
 
-		pad = padding_length(ctx, prot, skb);
+		/* The content type of a zero-copied TLS 1.3 record was
+		 * already taken from its last byte, it has no padding.
+		 */
+		if (*zc && prot->version == TLS_1_3_VERSION)
+			pad = 0;
+		else
+			pad = padding_length(ctx, prot, skb);
 		if (pad < 0)
 			return pad;
 
 		rxm->full_len -= pad;
 		rxm->offset += prot->prepend_size;
 		rxm->full_len -= prot->overhead_size;
+		if (*zc) {
+			TLS_INC_STATS(sock_net(sk), LINUX_MIB_TLSRXZEROCOPY);
+			if (*chunk < rxm->full_len)
+				TLS_INC_STATS(sock_net(sk),
+					      LINUX_MIB_TLSRXZEROCOPYPARTIAL);
+		}
 		tls_advance_record_sn(sk, prot, &tls_ctx->rx);
 		ctx->decrypted = 1;
 		ctx->saved_data_ready(sk);
@@ -1828,18 +1978,28 @@ int tls_sw_recvmsg(struct sock *sk,
 
 		to_decrypt = rxm->full_len - prot->overhead_size;
 
-		if (to_decrypt <= len && !is_kvec && !is_peek &&
-		    ctx->control == TLS_RECORD_TYPE_DATA &&
-		    prot->version != TLS_1_3_VERSION &&
-		    !bpf_strp_enabled)
-			zc = true;
-
 		/* Do not use async mode if record is non-data */
 		if (ctx->control == TLS_RECORD_TYPE_DATA && !bpf_strp_enabled)
 			async_capable = ctx->async_capable;
 		else
 			async_capable = false;
 
+		/* TLS 1.3 records are only decrypted straight to the user
+		 * buffer if they fit and the user promised there is no
+		 * padding. A TLS 1.2 record which does not fit is split
+		 * between the user buffer and the skb, but only
+		 * synchronously.
+		 */
+		if (!is_kvec && !is_peek &&
+		    ctx->control == TLS_RECORD_TYPE_DATA && !bpf_strp_enabled) {
+			if (to_decrypt <= len)
+				zc = prot->version != TLS_1_3_VERSION ||
+				     tls_ctx->rx_no_pad;
+			else
+				zc = prot->version != TLS_1_3_VERSION &&
+				     !async_capable;
+		}
+
 		err = decrypt_skb_update(sk, skb, &msg->msg_iter,
 					 &chunk, &zc, async_capable);
 		if (err < 0 && err != -EINPROGRESS) {
@@ -2309,6 +2469,33 @@ void tls_sw_strparser_arm(struct sock *sk, struct tls_context *tls_ctx)
 	strp_check_rcv(&rx_ctx->strp);
 }
 
+/* With TLS_TX_ASYNC_DEPTH set, prefer an instance that encrypts on other
+ * CPUs: pcrypt spreads requests over CPUs and completes them in submission
+ * order, cryptd at least moves the work out of sendmsg(). Without either
+ * template fall back to whatever implementation the crypto API picks.
+ */
+static struct crypto_aead *tls_alloc_aead(const char *cipher_name,
+					  bool async)
+{
+	static const char * const templates[] = { "pcrypt", "cryptd" };
+	char name[CRYPTO_MAX_ALG_NAME];
+	struct crypto_aead *aead;
+	int i;
+
+	for (i = 0; async && i < ARRAY_SIZE(templates); i++) {
+		if (snprintf(name, sizeof(name), "%s(%s)", templates[i],
+			     cipher_name) >= sizeof(name))
+			continue;
+
+		aead = crypto_alloc_aead(name, CRYPTO_ALG_ASYNC,
+					 CRYPTO_ALG_ASYNC);
+		if (!IS_ERR(aead))
+			return aead;
+	}
+
+	return crypto_alloc_aead(cipher_name, 0, 0);
+}
+
 int tls_set_sw_offload(struct sock *sk, struct tls_context *ctx, int tx)
 {
 	struct tls_context *tls_ctx = tls_get_ctx(sk);
@@ -2474,7 +2661,7 @@ int tls_set_sw_offload(struct sock *sk, struct tls_context *ctx, int tx)
 	}
 
 	if (!*aead) {
-		*aead = crypto_alloc_aead(cipher_name, 0, 0);
+		*aead = tls_alloc_aead(cipher_name, tx && ctx->tx_async_depth);
 		if (IS_ERR(*aead)) {
 			rc = PTR_ERR(*aead);
 			*aead = NULL;
@@ -488,6 +488,7 @@ static void unix_sock_destructor(struct sock *sk)
 	struct unix_sock *u = unix_sk(sk);
 
 	skb_queue_purge(&sk->sk_receive_queue);
+	skb_queue_purge(&sk->sk_error_queue);
 
 	WARN_ON(refcount_read(&sk->sk_wmem_alloc));
 	WARN_ON(!sk_unhashed(sk));
@@ -662,6 +663,8 @@ static int unix_ioctl(struct socket *, unsigned int, unsigned long);
 static int unix_compat_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg);
 #endif
 static int unix_shutdown(struct socket *, int);
+static int unix_stream_setsockopt(struct socket *, int, int, sockptr_t,
+				  unsigned int);
 static int unix_stream_sendmsg(struct socket *, struct msghdr *, size_t);
 static int unix_stream_recvmsg(struct socket *, struct msghdr *, size_t, int);
 static ssize_t unix_stream_sendpage(struct socket *, struct page *, int offset,
@@ -722,6 +725,7 @@ static const struct proto_ops unix_stream_ops = {
 #endif
 	.listen =	unix_listen,
 	.shutdown =	unix_shutdown,
+	.setsockopt =	unix_stream_setsockopt,
 	.sendmsg =	unix_stream_sendmsg,
 	.recvmsg =	unix_stream_recvmsg,
 	.mmap =		sock_no_mmap,
@@ -805,11 +809,11 @@ static struct sock *unix_create1(struct net *net, struct socket *sock, int kern)
 	sk->sk_max_ack_backlog	= READ_ONCE(net->unx.sysctl_max_dgram_qlen);
 	sk->sk_destruct		= unix_sock_destructor;
 	u = unix_sk(sk);
-	u->inflight = 0;
+	u->listener = NULL;
+	u->vertex.out_degree = 0;
 	u->path.dentry = NULL;
 	u->path.mnt = NULL;
 	spin_lock_init(&u->lock);
-	INIT_LIST_HEAD(&u->link);
 	mutex_init(&u->iolock); /* single task reading lock */
 	mutex_init(&u->bindlock); /* single task binding lock */
 	init_waitqueue_head(&u->peer_wait);
@@ -1360,6 +1364,7 @@ static int unix_stream_connect(struct socket *sock, struct sockaddr *uaddr,
 	newsk->sk_type		= sk->sk_type;
 	init_peercred(newsk);
 	newu = unix_sk(newsk);
+	newu->listener = other;
 	RCU_INIT_POINTER(newsk->sk_wq, &newu->peer_wq);
 	otheru = unix_sk(other);
 
@@ -1485,6 +1490,7 @@ static int unix_accept(struct socket *sock, struct socket *newsock, int flags,
 
 	/* attach accepted sock to socket */
 	unix_state_lock(tsk);
+	unix_update_edges(unix_sk(tsk));
 	newsock->state = SS_CONNECTED;
 	unix_sock_inherit_flags(sock, newsock);
 	sock_graft(tsk, newsock);
@@ -1533,43 +1539,35 @@ static void unix_peek_fds(struct scm_cookie *scm, struct sk_buff *skb)
 	scm->fp = scm_fp_dup(UNIXCB(skb).fp);
 
 	/*
-	 * Garbage collection of unix sockets starts by selecting a set of
-	 * candidate sockets which have reference only from being in flight
-	 * (total_refs == inflight_refs).  This condition is checked once during
-	 * the candidate collection phase, and candidates are marked as such, so
-	 * that non-candidates can later be ignored.  While inflight_refs is
-	 * protected by unix_gc_lock, total_refs (file count) is not, hence this
-	 * is an instantaneous decision.
-	 *
-	 * Once a candidate, however, the socket must not be reinstalled into a
-	 * file descriptor while the garbage collection is in progress.
-	 *
-	 * If the above conditions are met, then the directed graph of
-	 * candidates (*) does not change while unix_gc_lock is held.
+	 * Garbage collection of unix sockets looks for strongly connected
+	 * components of the in-flight graph (*) whose sockets have
+	 * references only from being in flight (total_refs == out_degree).
+	 * While the graph is protected by unix_gc_lock, total_refs (file
+	 * count) is not, hence this is an instantaneous decision, which
+	 * must hold until the garbage has been taken off the queues.
 	 *
 	 * Any operations that changes the file count through file descriptors
-	 * (dup, close, sendmsg) does not change the graph since candidates are
-	 * not installed in fds.
+	 * (dup, close, sendmsg) cannot reach a socket which is only in flight.
 	 *
-	 * Dequeing a candidate via recvmsg would install it into an fd, but
-	 * that takes unix_gc_lock to decrement the inflight count, so it's
-	 * serialized with garbage collection.
+	 * Dequeing a socket via recvmsg would install it into an fd, but
+	 * that takes unix_gc_lock to delete its edge, so it's serialized
+	 * with garbage collection.
 	 *
-	 * MSG_PEEK is special in that it does not change the inflight count,
-	 * yet does install the socket into an fd.  The following lock/unlock
+	 * MSG_PEEK is special in that it does not change the graph, yet
+	 * does install the socket into an fd.  The following lock/unlock
 	 * pair is to ensure serialization with garbage collection.  It must be
 	 * done between incrementing the file count and installing the file into
 	 * an fd.
 	 *
 	 * If garbage collection starts after the barrier provided by the
-	 * lock/unlock, then it will see the elevated refcount and not mark this
-	 * as a candidate.  If a garbage collection is already in progress
+	 * lock/unlock, then it will see the elevated refcount and not consider
+	 * the socket garbage.  If a garbage collection is already in progress
 	 * before the file count was incremented, then the lock/unlock pair will
 	 * ensure that garbage collection is finished before progressing to
 	 * installing the fd.
 	 *
-	 * (*) A -> B where B is on the queue of A or B is on the queue of C
-	 * which is on the queue of listening socket A.
+	 * (*) A -> B where A is on the queue of B, or on the queue of an
+	 * embryo of listening socket B.
 	 */
 	spin_lock(&unix_gc_lock);
 	spin_unlock(&unix_gc_lock);
@@ -1649,8 +1647,10 @@ static void scm_stat_add(struct sock *sk, struct sk_buff *skb)
 	struct scm_fp_list *fp = UNIXCB(skb).fp;
 	struct unix_sock *u = unix_sk(sk);
 
-	if (unlikely(fp && fp->count))
+	if (unlikely(fp && fp->count)) {
 		atomic_add(fp->count, &u->scm_stat.nr_fds);
+		unix_add_edges(fp, u);
+	}
 }
 
 static void scm_stat_del(struct sock *sk, struct sk_buff *skb)
@@ -1683,11 +1683,12 @@ static int unix_dgram_sendmsg(struct socket *sock, struct msghdr *msg,
 	int data_len = 0;
 	int sk_locked;
 
-	wait_for_unix_gc();
 	err = scm_send(sock, msg, &scm, false);
 	if (err < 0)
 		return err;
 
+	wait_for_unix_gc(scm.fp);
+
 	err = -EOPNOTSUPP;
 	if (msg->msg_flags&MSG_OOB)
 		goto out;
@@ -1874,6 +1875,78 @@ static int unix_dgram_sendmsg(struct socket *sock, struct msghdr *msg,
  */
 #define UNIX_SKB_FRAGS_SZ (PAGE_SIZE << get_order(32768))
 
+/* SO_ZEROCOPY is refused for AF_UNIX by the generic code, everything
+ * else on SOL_SOCKET is passed on to it.
+ */
+static int unix_stream_setsockopt(struct socket *sock, int level, int optname,
+				  sockptr_t optval, unsigned int optlen)
+{
+	struct sock *sk = sock->sk;
+	int val;
+
+	if (level != SOL_SOCKET)
+		return -EOPNOTSUPP;
+
+	if (optname != SO_ZEROCOPY)
+		return sock_setsockopt(sock, level, optname, optval, optlen);
+
+	if (optlen < sizeof(int))
+		return -EINVAL;
+
+	if (copy_from_sockptr(&val, optval, sizeof(val)))
+		return -EFAULT;
+
+	if (val < 0 || val > 1)
+		return -EINVAL;
+
+	lock_sock(sk);
+	sock_valbool_flag(sk, SOCK_ZEROCOPY, val);
+	release_sock(sk);
+
+	return 0;
+}
+
+/* Pin the user pages backing the next @len bytes of @from into the
+ * frags of @skb, charging them to the sender like copied data.
+ */
+static int unix_zerocopy_sg_from_iter(struct sock *sk, struct sk_buff *skb,
+				      struct iov_iter *from, size_t len)
+{
+	int frag = skb_shinfo(skb)->nr_frags;
+
+	while (len && frag < MAX_SKB_FRAGS) {
+		struct page *pages[MAX_SKB_FRAGS];
+		unsigned int truesize;
+		ssize_t copied;
+		size_t start;
+		int n = 0;
+
+		copied = iov_iter_get_pages(from, pages, len,
+					    MAX_SKB_FRAGS - frag, &start);
+		if (copied < 0)
+			return -EFAULT;
+
+		iov_iter_advance(from, copied);
+		len -= copied;
+
+		truesize = PAGE_ALIGN(copied + start);
+		skb->data_len += copied;
+		skb->len += copied;
+		skb->truesize += truesize;
+		refcount_add(truesize, &sk->sk_wmem_alloc);
+
+		while (copied) {
+			int size = min_t(int, copied, PAGE_SIZE - start);
+
+			skb_fill_page_desc(skb, frag++, pages[n++], start, size);
+			start = 0;
+			copied -= size;
+		}
+	}
+
+	return 0;
+}
+
 static int unix_stream_sendmsg(struct socket *sock, struct msghdr *msg,
 			       size_t len)
 {
@@ -1883,14 +1956,16 @@ static int unix_stream_sendmsg(struct socket *sock, struct msghdr *msg,
 	struct sk_buff *skb;
 	int sent = 0;
 	struct scm_cookie scm;
+	struct ubuf_info *uarg = NULL;
 	bool fds_sent = false;
 	int data_len;
 
-	wait_for_unix_gc();
 	err = scm_send(sock, msg, &scm, false);
 	if (err < 0)
 		return err;
 
+	wait_for_unix_gc(scm.fp);
+
 	err = -EOPNOTSUPP;
 	if (msg->msg_flags&MSG_OOB)
 		goto out_err;
@@ -1908,22 +1983,42 @@ static int unix_stream_sendmsg(struct socket *sock, struct msghdr *msg,
 	if (READ_ONCE(sk->sk_shutdown) & SEND_SHUTDOWN)
 		goto pipe_err;
 
+	if ((msg->msg_flags & MSG_ZEROCOPY) && len &&
+	    sock_flag(sk, SOCK_ZEROCOPY)) {
+		uarg = sock_zerocopy_alloc(sk, len);
+		if (!uarg) {
+			err = -ENOBUFS;
+			goto out_err;
+		}
+	}
+
 	while (sent < len) {
 		size = len - sent;
 
 		/* Keep two messages in the pipe so it schedules better */
 		size = min_t(int, size, (sk->sk_sndbuf >> 1) - 64);
 
-		/* allow fallback to order-0 allocations */
-		size = min_t(int, size, SKB_MAX_HEAD(0) + UNIX_SKB_FRAGS_SZ);
+		if (uarg) {
+			/* The data goes into the frags, no linear part */
+			data_len = size;
+			skb = sock_alloc_send_pskb(sk, 0, 0,
+						   msg->msg_flags & MSG_DONTWAIT,
+						   &err, 0);
+		} else {
+			/* allow fallback to order-0 allocations */
+			size = min_t(int, size,
+				     SKB_MAX_HEAD(0) + UNIX_SKB_FRAGS_SZ);
 
-		data_len = max_t(int, 0, size - SKB_MAX_HEAD(0));
+			data_len = max_t(int, 0, size - SKB_MAX_HEAD(0));
 
-		data_len = min_t(size_t, size, PAGE_ALIGN(data_len));
+			data_len = min_t(size_t, size, PAGE_ALIGN(data_len));
 
-		skb = sock_alloc_send_pskb(sk, size - data_len, data_len,
-					   msg->msg_flags & MSG_DONTWAIT, &err,
-					   get_order(UNIX_SKB_FRAGS_SZ));
+			skb = sock_alloc_send_pskb(sk, size - data_len,
+						   data_len,
+						   msg->msg_flags & MSG_DONTWAIT,
+						   &err,
+						   get_order(UNIX_SKB_FRAGS_SZ));
+		}
 		if (!skb)
 			goto out_err;
 
@@ -1935,13 +2030,29 @@ static int unix_stream_sendmsg(struct socket *sock, struct msghdr *msg,
 		}
 		fds_sent = true;
 
-		skb_put(skb, size - data_len);
-		skb->data_len = data_len;
-		skb->len = size;
-		err = skb_copy_datagram_from_iter(skb, 0, &msg->msg_iter, size);
-		if (err) {
-			kfree_skb(skb);
-			goto out_err;
+		if (uarg) {
+			/* Whatever could be pinned is sent, short of frags or
+			 * on a fault the rest goes with the next skb.
+			 */
+			err = unix_zerocopy_sg_from_iter(sk, skb,
+							 &msg->msg_iter, size);
+			if (!skb->len) {
+				kfree_skb(skb);
+				goto out_err;
+			}
+			size = skb->len;
+			skb_zcopy_set(skb, uarg, NULL);
+		} else {
+			skb_put(skb, size - data_len);
+			skb->data_len = data_len;
+			skb->len = size;
+			err = skb_copy_datagram_from_iter(skb, 0,
+							  &msg->msg_iter,
+							  size);
+			if (err) {
+				kfree_skb(skb);
+				goto out_err;
+			}
 		}
 
 		unix_state_lock(other);
@@ -1958,6 +2069,7 @@ static int unix_stream_sendmsg(struct socket *sock, struct msghdr *msg,
 		sent += size;
 	}
 
+	sock_zerocopy_put(uarg);
 	scm_destroy(&scm);
 
 	return sent;
@@ -1970,6 +2082,10 @@ static int unix_stream_sendmsg(struct socket *sock, struct msghdr *msg,
 		send_sig(SIGPIPE, current, 0);
 	err = -EPIPE;
 out_err:
+	if (sent)
+		sock_zerocopy_put(uarg);
+	else
+		sock_zerocopy_put_abort(uarg, true);
 	scm_destroy(&scm);
 	return sent ? : err;
 }
@@ -2417,6 +2533,16 @@ static int unix_stream_read_generic(struct unix_stream_read_state *state,
 			sunaddr = NULL;
 		}
 
+		/* A pipe may hold on to the pages after the skb is gone,
+		 * so the sender must get its own pages back first.
+		 */
+		if (state->pipe && skb_zcopy(skb) &&
+		    skb_orphan_frags_rx(skb, GFP_KERNEL)) {
+			if (copied == 0)
+				copied = -ENOMEM;
+			break;
+		}
+
 		chunk = min_t(unsigned int, unix_skb_len(skb) - skip, size);
 		skb_get(skb);
 		chunk = state->recv_actor(skb, skip, chunk, state);
@@ -2516,6 +2642,11 @@ static int unix_stream_recvmsg(struct socket *sock, struct msghdr *msg,
 		.flags = flags
 	};
 
+	/* MSG_ZEROCOPY completions */
+	if (unlikely(flags & MSG_ERRQUEUE))
+		return sock_recv_errqueue(sock->sk, msg, size, SOL_SOCKET,
+					  SO_ZEROCOPY);
+
 	return unix_stream_read_generic(&state, true);
 }
 
@@ -2710,7 +2841,7 @@ static __poll_t unix_poll(struct file *file, struct socket *sock, poll_table *wa
 	state = READ_ONCE(sk->sk_state);
 
 	/* exceptional events? */
-	if (sk->sk_err)
+	if (sk->sk_err || !skb_queue_empty_lockless(&sk->sk_error_queue))
 		mask |= EPOLLERR;
 	if (shutdown == SHUTDOWN_MASK)
 		mask |= EPOLLHUP;
@@ -2945,6 +3076,15 @@ static int __net_init unix_net_init(struct net *net)
 		unix_sysctl_unregister(net);
 		goto out;
 	}
+
+	/* The collector is shared by all netns */
+	if (net_eq(net, &init_net) &&
+	    !proc_create_net_single("unix_gc", 0444, net->proc_net,
+				    unix_gc_seq_show, NULL)) {
+		remove_proc_entry("unix", net->proc_net);
+		unix_sysctl_unregister(net);
+		goto out;
+	}
 #endif
 	error = 0;
 out:
@@ -2954,6 +3094,8 @@ static int __net_init unix_net_init(struct net *net)
 static void __net_exit unix_net_exit(struct net *net)
 {
 	unix_sysctl_unregister(net);
+	if (net_eq(net, &init_net))
+		remove_proc_entry("unix_gc", net->proc_net);
 	remove_proc_entry("unix", net->proc_net);
 }
 
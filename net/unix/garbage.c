@@ -61,6 +61,14 @@
  *		Reimplement with a cycle collecting algorithm. This should
  *		solve several problems with the previous code, like being racy
  *		wrt receive and holding up unrelated socket operations.
+ *
+ *	Keep the in-flight sockets as a graph which is updated when fds
+ *	are queued and dequeued, and group it into strongly connected
+ *	components with Tarjan's algorithm.  Only the part of the graph
+ *	reachable from changed vertices is walked again, and only the SCCs
+ *	regrouped that way or without an edge leaving them are checked for
+ *	garbage.  Collection runs from a work item instead of stalling
+ *	senders.
  */
 
 #include <linux/kernel.h>
@@ -73,8 +81,10 @@
 #include <linux/netdevice.h>
 #include <linux/file.h>
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 #include <linux/mutex.h>
-#include <linux/wait.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 
 #include <net/sock.h>
 #include <net/af_unix.h>
@@ -85,232 +95,268 @@
 
 /* Internal data structures and random procedures: */
 
-static LIST_HEAD(gc_candidates);
-static DECLARE_WAIT_QUEUE_HEAD(unix_gc_wait);
-
-static void scan_inflight(struct sock *x, void (*func)(struct unix_sock *),
-			  struct sk_buff_head *hitlist)
+static struct {
+	unsigned long	runs;		/* Collections which walked the graph */
+	unsigned long	skipped;	/* Collections with nothing to look at */
+	unsigned long	regrouped;	/* Vertices whose SCC was recomputed */
+	unsigned long	checked;	/* Vertices checked by the last run */
+	unsigned long	purged;		/* Skbs dropped from garbage cycles */
+	u64		last_ns;
+	u64		max_ns;
+	u64		total_ns;
+} unix_gc_stats;
+
+#define unix_gc_stat_add(field, val)					\
+	WRITE_ONCE(unix_gc_stats.field, unix_gc_stats.field + (val))
+
+/* Make sure the SCC of every vertex reachable from a marked one is
+ * recomputed: new edges may have merged SCCs along any path from the
+ * vertex, and removed ones may have split its own SCC.
+ */
+static void unix_mark_reachable(void)
 {
-	struct sk_buff *skb;
-	struct sk_buff *next;
-
-	spin_lock(&x->sk_receive_queue.lock);
-	skb_queue_walk_safe(&x->sk_receive_queue, skb, next) {
-		/* Do we have file descriptors ? */
-		if (UNIXCB(skb).fp) {
-			bool hit = false;
-			/* Process the descriptors of this socket */
-			int nfd = UNIXCB(skb).fp->count;
-			struct file **fp = UNIXCB(skb).fp->fp;
-
-			while (nfd--) {
-				/* Get the socket the fd matches if it indeed does so */
-				struct sock *sk = unix_get_socket(*fp++);
-
-				if (sk) {
-					struct unix_sock *u = unix_sk(sk);
-
-					/* Ignore non-candidates, they could
-					 * have been added to the queues after
-					 * starting the garbage collection
-					 */
-					if (test_bit(UNIX_GC_CANDIDATE, &u->gc_flags)) {
-						hit = true;
-
-						func(u);
-					}
-				}
-			}
-			if (hit && hitlist != NULL) {
-				__skb_unlink(skb, &x->sk_receive_queue);
-				__skb_queue_tail(hitlist, skb);
-			}
+	struct unix_vertex *vertex;
+	struct unix_edge *edge;
+
+	/* Vertices marked here are appended, so they are walked as well */
+	list_for_each_entry(vertex, &unix_unvisited_vertices, entry) {
+		list_for_each_entry(edge, &vertex->edges, vertex_entry) {
+			struct unix_vertex *next = unix_edge_successor(edge);
+
+			if (next)
+				unix_vertex_mark(next);
 		}
 	}
-	spin_unlock(&x->sk_receive_queue.lock);
 }
 
-static void scan_children(struct sock *x, void (*func)(struct unix_sock *),
-			  struct sk_buff_head *hitlist)
+/* SCCs regrouped by the current collection */
+static LIST_HEAD(unix_visited_vertices);
+
+/* SCCs no edge leaves. Their members may only be held by file references
+ * the GC is not told about, so they are checked by every collection.
+ */
+static LIST_HEAD(unix_closed_vertices);
+
+/* Never reused, so SCCs from different walks never share an index */
+static u64 unix_vertex_last_index = UNIX_VERTEX_INDEX_START;
+
+static void __unix_walk_scc(struct unix_vertex *vertex)
 {
-	if (x->sk_state != TCP_LISTEN) {
-		scan_inflight(x, func, hitlist);
-	} else {
-		struct sk_buff *skb;
-		struct sk_buff *next;
-		struct unix_sock *u;
-		LIST_HEAD(embryos);
-
-		/* For a listening socket collect the queued embryos
-		 * and perform a scan on them as well.
-		 */
-		spin_lock(&x->sk_receive_queue.lock);
-		skb_queue_walk_safe(&x->sk_receive_queue, skb, next) {
-			u = unix_sk(skb->sk);
-
-			/* An embryo cannot be in-flight, so it's safe
-			 * to use the list link.
-			 */
-			BUG_ON(!list_empty(&u->link));
-			list_add_tail(&u->link, &embryos);
+	LIST_HEAD(vertex_stack);
+	struct unix_edge *edge;
+	LIST_HEAD(edge_stack);
+
+next_vertex:
+	/* Push the vertex, it stays on vertex_stack until its SCC is
+	 * complete.
+	 */
+	list_add(&vertex->scc_entry, &vertex_stack);
+
+	vertex->index = unix_vertex_last_index;
+	vertex->scc_index = unix_vertex_last_index;
+	unix_vertex_last_index++;
+
+	list_for_each_entry(edge, &vertex->edges, vertex_entry) {
+		struct unix_vertex *next_vertex = unix_edge_successor(edge);
+
+		if (!next_vertex)
+			continue;
+
+		if (next_vertex->index == UNIX_VERTEX_INDEX_UNVISITED) {
+			/* Descend, remembering the edge to come back. */
+			list_add(&edge->stack_entry, &edge_stack);
+
+			vertex = next_vertex;
+			goto next_vertex;
+
+prev_vertex:
+			edge = list_first_entry(&edge_stack, typeof(*edge),
+						stack_entry);
+			list_del_init(&edge->stack_entry);
+
+			next_vertex = vertex;
+			vertex = &edge->predecessor->vertex;
+
+			vertex->scc_index = min(vertex->scc_index,
+						next_vertex->scc_index);
+		} else if (next_vertex->index != UNIX_VERTEX_INDEX_GROUPED) {
+			/* Still on vertex_stack, so in our SCC */
+			vertex->scc_index = min(vertex->scc_index,
+						next_vertex->scc_index);
 		}
-		spin_unlock(&x->sk_receive_queue.lock);
+	}
+
+	if (vertex->index == vertex->scc_index) {
+		u64 scc_index = vertex->scc_index;
+		struct list_head scc;
+		struct unix_vertex *v;
 
-		while (!list_empty(&embryos)) {
-			u = list_entry(embryos.next, struct unix_sock, link);
-			scan_inflight(&u->sk, func, hitlist);
-			list_del_init(&u->link);
+		/* Everything pushed after the vertex is in its SCC. */
+		__list_cut_position(&scc, &vertex_stack, &vertex->scc_entry);
+
+		/* Members only have their lowlink so far, which need not be
+		 * the root's.  Give them all the root's as the SCC id.
+		 */
+		list_for_each_entry(v, &scc, scc_entry) {
+			list_move_tail(&v->entry, &unix_visited_vertices);
+			v->index = UNIX_VERTEX_INDEX_GROUPED;
+			v->scc_index = scc_index;
 		}
+
+		/* Leave the members linked as a ring. */
+		list_del(&scc);
 	}
+
+	if (!list_empty(&edge_stack))
+		goto prev_vertex;
 }
 
-static void dec_inflight(struct unix_sock *usk)
+/* Recompute the SCCs of the vertices touched since the last collection. */
+static void unix_walk_unvisited(void)
 {
-	usk->inflight--;
+	u64 first_index = unix_vertex_last_index;
+
+	unix_mark_reachable();
+
+	while (!list_empty(&unix_unvisited_vertices)) {
+		struct unix_vertex *vertex;
+
+		vertex = list_first_entry(&unix_unvisited_vertices,
+					  typeof(*vertex), entry);
+		__unix_walk_scc(vertex);
+	}
+
+	unix_gc_stat_add(regrouped, unix_vertex_last_index - first_index);
 }
 
-static void inc_inflight(struct unix_sock *usk)
+/* No fd of the SCC is queued on a socket outside of it.  Such an SCC is
+ * always cyclic: every member has an edge, and it leads into the SCC.
+ */
+static bool unix_scc_closed(struct list_head *scc)
 {
-	usk->inflight++;
+	struct unix_vertex *vertex;
+	struct unix_edge *edge;
+
+	list_for_each_entry(vertex, scc, scc_entry) {
+		list_for_each_entry(edge, &vertex->edges, vertex_entry) {
+			struct unix_vertex *next = unix_edge_successor(edge);
+
+			if (!next || next->scc_index != vertex->scc_index)
+				return false;
+		}
+	}
+
+	return true;
 }
 
-static void inc_inflight_move_tail(struct unix_sock *u)
+/* Unless close()d, there are references besides the queued ones. */
+static bool unix_scc_dead(struct list_head *scc)
 {
-	u->inflight++;
+	struct unix_vertex *vertex;
 
-	/* If this still might be part of a cycle, move it to the end
-	 * of the list, so that it's checked even if it was already
-	 * passed over
-	 */
-	if (test_bit(UNIX_GC_MAYBE_CYCLE, &u->gc_flags))
-		list_move_tail(&u->link, &gc_candidates);
-}
+	list_for_each_entry(vertex, scc, scc_entry) {
+		struct unix_sock *u = unix_vertex_sk(vertex);
 
-static bool gc_in_progress;
-#define UNIX_INFLIGHT_TRIGGER_GC 16000
+		if (file_count(u->sk.sk_socket->file) != vertex->out_degree)
+			return false;
+	}
 
-void wait_for_unix_gc(void)
-{
-	/* If number of inflight sockets is insane,
-	 * force a garbage collect right now.
-	 * Paired with the WRITE_ONCE() in unix_inflight(),
-	 * unix_notinflight() and gc_in_progress().
-	 */
-	if (READ_ONCE(unix_tot_inflight) > UNIX_INFLIGHT_TRIGGER_GC &&
-	    !READ_ONCE(gc_in_progress))
-		unix_gc();
-	wait_event(unix_gc_wait, !READ_ONCE(gc_in_progress));
+	return true;
 }
 
-/* The external entry point: unix_gc() */
-void unix_gc(void)
+static void unix_collect_skb(struct list_head *scc,
+			     struct sk_buff_head *hitlist)
 {
-	struct sk_buff *next_skb, *skb;
-	struct unix_sock *u;
-	struct unix_sock *next;
-	struct sk_buff_head hitlist;
-	struct list_head cursor;
-	LIST_HEAD(not_cycle_list);
+	struct unix_vertex *vertex;
 
-	spin_lock(&unix_gc_lock);
+	list_for_each_entry(vertex, scc, scc_entry) {
+		struct sock *sk = &unix_vertex_sk(vertex)->sk;
+		struct sk_buff_head *queue = &sk->sk_receive_queue;
 
-	/* Avoid a recursive GC. */
-	if (gc_in_progress)
-		goto out;
+		spin_lock(&queue->lock);
 
-	/* Paired with READ_ONCE() in wait_for_unix_gc(). */
-	WRITE_ONCE(gc_in_progress, true);
+		if (sk->sk_state == TCP_LISTEN) {
+			struct sk_buff *skb;
 
-	/* First, select candidates for garbage collection.  Only
-	 * in-flight sockets are considered, and from those only ones
-	 * which don't have any external reference.
-	 *
-	 * Holding unix_gc_lock will protect these candidates from
-	 * being detached, and hence from gaining an external
-	 * reference.  Since there are no possible receivers, all
-	 * buffers currently on the candidates' queues stay there
-	 * during the garbage collection.
-	 *
-	 * We also know that no new candidate can be added onto the
-	 * receive queues.  Other, non candidate sockets _can_ be
-	 * added to queue, so we must make sure only to touch
-	 * candidates.
-	 *
-	 * Embryos, though never candidates themselves, affect which
-	 * candidates are reachable by the garbage collector.  Before
-	 * being added to a listener's queue, an embryo may already
-	 * receive data carrying SCM_RIGHTS, potentially making the
-	 * passed socket a candidate that is not yet reachable by the
-	 * collector.  It becomes reachable once the embryo is
-	 * enqueued.  Therefore, we must ensure that no SCM-laden
-	 * embryo appears in a (candidate) listener's queue between
-	 * consecutive scan_children() calls.
-	 */
-	list_for_each_entry_safe(u, next, &gc_inflight_list, link) {
-		struct sock *sk = &u->sk;
-		long total_refs;
-
-		total_refs = file_count(sk->sk_socket->file);
-
-		BUG_ON(!u->inflight);
-		BUG_ON(total_refs < u->inflight);
-		if (total_refs == u->inflight) {
-			list_move_tail(&u->link, &gc_candidates);
-			__set_bit(UNIX_GC_CANDIDATE, &u->gc_flags);
-			__set_bit(UNIX_GC_MAYBE_CYCLE, &u->gc_flags);
-
-			if (sk->sk_state == TCP_LISTEN) {
-				unix_state_lock_nested(sk, U_LOCK_GC_LISTENER);
-				unix_state_unlock(sk);
+			/* The fds are queued on the embryos. */
+			skb_queue_walk(queue, skb) {
+				struct sk_buff_head *embryo_queue;
+
+				embryo_queue = &skb->sk->sk_receive_queue;
+				spin_lock_nested(&embryo_queue->lock,
+						 SINGLE_DEPTH_NESTING);
+				skb_queue_splice_init(embryo_queue, hitlist);
+				spin_unlock(&embryo_queue->lock);
 			}
+		} else {
+			skb_queue_splice_init(queue, hitlist);
 		}
+
+		spin_unlock(&queue->lock);
 	}
+}
 
-	/* Now remove all internal in-flight reference to children of
-	 * the candidates.
-	 */
-	list_for_each_entry(u, &gc_candidates, link)
-		scan_children(&u->sk, dec_inflight, NULL);
-
-	/* Restore the references for children of all candidates,
-	 * which have remaining references.  Do this recursively, so
-	 * only those remain, which form cyclic references.
-	 *
-	 * Use a "cursor" link, to make the list traversal safe, even
-	 * though elements might be moved about.
-	 */
-	list_add(&cursor, &gc_candidates);
-	while (cursor.next != &gc_candidates) {
-		u = list_entry(cursor.next, struct unix_sock, link);
+/* Find the SCCs nothing outside of them refers to.  Only the SCCs
+ * regrouped by this collection and the closed ones are looked at, the
+ * others still have an edge leaving them.
+ */
+static void unix_walk_scc(struct sk_buff_head *hitlist)
+{
+	unsigned long nr_vertices = 0;
+	struct unix_vertex *vertex, *v;
+
+	list_splice_init(&unix_closed_vertices, &unix_visited_vertices);
 
-		/* Move cursor to after the current position. */
-		list_move(&cursor, &u->link);
+	while (!list_empty(&unix_visited_vertices)) {
+		struct list_head *dst = &unix_grouped_vertices;
+		struct list_head scc;
+
+		vertex = list_first_entry(&unix_visited_vertices,
+					  typeof(*vertex), entry);
+		list_add(&scc, &vertex->scc_entry);
+
+		if (unix_scc_closed(&scc)) {
+			dst = &unix_closed_vertices;
+			if (unix_scc_dead(&scc))
+				unix_collect_skb(&scc, hitlist);
+		}
 
-		if (u->inflight) {
-			list_move_tail(&u->link, &not_cycle_list);
-			__clear_bit(UNIX_GC_MAYBE_CYCLE, &u->gc_flags);
-			scan_children(&u->sk, inc_inflight_move_tail, NULL);
+		list_for_each_entry(v, &scc, scc_entry) {
+			list_move_tail(&v->entry, dst);
+			nr_vertices++;
 		}
+		list_del(&scc);
 	}
-	list_del(&cursor);
 
-	/* Now gc_candidates contains only garbage.  Restore original
-	 * inflight counters for these as well, and remove the skbuffs
-	 * which are creating the cycle(s).
-	 */
-	skb_queue_head_init(&hitlist);
-	list_for_each_entry(u, &gc_candidates, link)
-		scan_children(&u->sk, inc_inflight, &hitlist);
+	/* Any other SCC has to be touched to become garbage */
+	unix_graph_maybe_cyclic = !list_empty(&unix_closed_vertices);
 
-	/* not_cycle_list contains those sockets which do not make up a
-	 * cycle.  Restore these to the inflight list.
-	 */
-	while (!list_empty(&not_cycle_list)) {
-		u = list_entry(not_cycle_list.next, struct unix_sock, link);
-		__clear_bit(UNIX_GC_CANDIDATE, &u->gc_flags);
-		list_move_tail(&u->link, &gc_inflight_list);
+	WRITE_ONCE(unix_gc_stats.checked, nr_vertices);
+}
+
+static bool gc_in_progress;
+
+static void __unix_gc(struct work_struct *work)
+{
+	struct sk_buff *next_skb, *skb;
+	struct sk_buff_head hitlist;
+	u64 start, delta;
+
+	spin_lock(&unix_gc_lock);
+
+	if (!unix_graph_maybe_cyclic &&
+	    list_empty(&unix_unvisited_vertices)) {
+		spin_unlock(&unix_gc_lock);
+		unix_gc_stat_add(skipped, 1);
+		goto skip_gc;
 	}
 
+	start = ktime_get_ns();
+
+	__skb_queue_head_init(&hitlist);
+	unix_walk_unvisited();
+	unix_walk_scc(&hitlist);
+
 	spin_unlock(&unix_gc_lock);
 
 	/* We need io_uring to clean its registered files, ignore all io_uring
@@ -326,25 +372,73 @@ void unix_gc(void)
 		}
 	}
 
+	unix_gc_stat_add(purged, skb_queue_len(&hitlist));
+
 	/* Here we are. Hitlist is filled. Die. */
 	__skb_queue_purge(&hitlist);
 
-	spin_lock(&unix_gc_lock);
+	delta = ktime_get_ns() - start;
+	unix_gc_stat_add(runs, 1);
+	unix_gc_stat_add(total_ns, delta);
+	WRITE_ONCE(unix_gc_stats.last_ns, delta);
+	if (delta > unix_gc_stats.max_ns)
+		WRITE_ONCE(unix_gc_stats.max_ns, delta);
 
-	/* There could be io_uring registered files, just push them back to
-	 * the inflight list
-	 */
-	list_for_each_entry_safe(u, next, &gc_candidates, link)
-		list_move_tail(&u->link, &gc_inflight_list);
+skip_gc:
+	/* Paired with READ_ONCE() in wait_for_unix_gc(). */
+	WRITE_ONCE(gc_in_progress, false);
+}
 
-	/* All candidates should have been detached by now. */
-	BUG_ON(!list_empty(&gc_candidates));
+static DECLARE_WORK(unix_gc_work, __unix_gc);
 
+/* The external entry point: unix_gc() */
+void unix_gc(void)
+{
 	/* Paired with READ_ONCE() in wait_for_unix_gc(). */
-	WRITE_ONCE(gc_in_progress, false);
+	WRITE_ONCE(gc_in_progress, true);
+	queue_work(system_unbound_wq, &unix_gc_work);
+}
 
-	wake_up(&unix_gc_wait);
+#define UNIX_INFLIGHT_TRIGGER_GC 16000
+#define UNIX_INFLIGHT_SANE_USER (SCM_MAX_FD * 8)
 
- out:
-	spin_unlock(&unix_gc_lock);
+void wait_for_unix_gc(struct scm_fp_list *fpl)
+{
+	/* If number of inflight sockets is insane,
+	 * force a garbage collect right now.
+	 * Paired with the WRITE_ONCE() in unix_inflight(),
+	 * unix_notinflight() and __unix_gc().
+	 */
+	if (READ_ONCE(unix_tot_inflight) > UNIX_INFLIGHT_TRIGGER_GC &&
+	    !READ_ONCE(gc_in_progress))
+		unix_gc();
+
+	/* Only senders with many fds which were not received yet wait
+	 * for the collection, everyone else carries on.
+	 */
+	if (!fpl || READ_ONCE(fpl->user->unix_inflight) <
+		    UNIX_INFLIGHT_SANE_USER)
+		return;
+
+	if (READ_ONCE(gc_in_progress))
+		flush_work(&unix_gc_work);
+}
+
+#ifdef CONFIG_PROC_FS
+int unix_gc_seq_show(struct seq_file *seq, void *v)
+{
+	seq_printf(seq, "runs %lu\n", READ_ONCE(unix_gc_stats.runs));
+	seq_printf(seq, "skipped %lu\n", READ_ONCE(unix_gc_stats.skipped));
+	seq_printf(seq, "regrouped %lu\n",
+		   READ_ONCE(unix_gc_stats.regrouped));
+	seq_printf(seq, "checked %lu\n", READ_ONCE(unix_gc_stats.checked));
+	seq_printf(seq, "purged %lu\n", READ_ONCE(unix_gc_stats.purged));
+	seq_printf(seq, "last_us %llu\n",
+		   div_u64(READ_ONCE(unix_gc_stats.last_ns), NSEC_PER_USEC));
+	seq_printf(seq, "max_us %llu\n",
+		   div_u64(READ_ONCE(unix_gc_stats.max_ns), NSEC_PER_USEC));
+	seq_printf(seq, "total_us %llu\n",
+		   div_u64(READ_ONCE(unix_gc_stats.total_ns), NSEC_PER_USEC));
+	return 0;
 }
+#endif
@@ -5,6 +5,7 @@
 #include <linux/socket.h>
 #include <linux/net.h>
 #include <linux/fs.h>
+#include <linux/mm.h>
 #include <net/af_unix.h>
 #include <net/scm.h>
 #include <linux/init.h>
@@ -15,8 +16,23 @@
 unsigned int unix_tot_inflight;
 EXPORT_SYMBOL(unix_tot_inflight);
 
-LIST_HEAD(gc_inflight_list);
-EXPORT_SYMBOL(gc_inflight_list);
+/* The in-flight graph. A vertex is an AF_UNIX socket whose fd is queued
+ * on some AF_UNIX socket, an edge is one such queued fd. Vertices whose
+ * strongly connected component (SCC) is known have their SCC linked by
+ * ->scc_entry. They are on the grouped list if an edge leaves the SCC,
+ * which keeps it alive until the next change, or else on the GC's list
+ * of SCCs to check on every run. The SCCs of vertices touched by an edge
+ * change are recomputed by the next garbage collection.
+ */
+LIST_HEAD(unix_unvisited_vertices);
+EXPORT_SYMBOL(unix_unvisited_vertices);
+
+LIST_HEAD(unix_grouped_vertices);
+EXPORT_SYMBOL(unix_grouped_vertices);
+
+/* Set once an edge may have closed a cycle, cleared by the GC if none */
+bool unix_graph_maybe_cyclic;
+EXPORT_SYMBOL(unix_graph_maybe_cyclic);
 
 DEFINE_SPINLOCK(unix_gc_lock);
 EXPORT_SYMBOL(unix_gc_lock);
@@ -50,15 +66,6 @@ void unix_inflight(struct user_struct *user, struct file *fp)
 	spin_lock(&unix_gc_lock);
 
 	if (s) {
-		struct unix_sock *u = unix_sk(s);
-
-		if (!u->inflight) {
-			BUG_ON(!list_empty(&u->link));
-			list_add_tail(&u->link, &gc_inflight_list);
-		} else {
-			BUG_ON(list_empty(&u->link));
-		}
-		u->inflight++;
 		/* Paired with READ_ONCE() in wait_for_unix_gc() */
 		WRITE_ONCE(unix_tot_inflight, unix_tot_inflight + 1);
 	}
@@ -73,14 +80,6 @@ void unix_notinflight(struct user_struct *user, struct file *fp)
 	spin_lock(&unix_gc_lock);
 
 	if (s) {
-		struct unix_sock *u = unix_sk(s);
-
-		BUG_ON(!u->inflight);
-		BUG_ON(list_empty(&u->link));
-
-		u->inflight--;
-		if (!u->inflight)
-			list_del_init(&u->link);
 		/* Paired with READ_ONCE() in wait_for_unix_gc() */
 		WRITE_ONCE(unix_tot_inflight, unix_tot_inflight - 1);
 	}
@@ -88,6 +87,132 @@ void unix_notinflight(struct user_struct *user, struct file *fp)
 	spin_unlock(&unix_gc_lock);
 }
 
+/* Queue the SCC of @vertex to be recomputed by the next collection. */
+void unix_vertex_mark(struct unix_vertex *vertex)
+{
+	struct unix_vertex *v = vertex;
+
+	if (vertex->index == UNIX_VERTEX_INDEX_UNVISITED)
+		return;
+
+	do {
+		v->index = UNIX_VERTEX_INDEX_UNVISITED;
+		list_move_tail(&v->entry, &unix_unvisited_vertices);
+		v = list_next_entry(v, scc_entry);
+	} while (v != vertex);
+}
+EXPORT_SYMBOL(unix_vertex_mark);
+
+static void unix_add_edge(struct unix_edge *edge)
+{
+	struct unix_vertex *vertex = &edge->predecessor->vertex;
+
+	/* A new vertex is an SCC of its own */
+	if (!vertex->out_degree) {
+		INIT_LIST_HEAD(&vertex->edges);
+		INIT_LIST_HEAD(&vertex->scc_entry);
+		vertex->index = UNIX_VERTEX_INDEX_GROUPED;
+		list_add_tail(&vertex->entry, &unix_grouped_vertices);
+	}
+
+	vertex->out_degree++;
+	list_add_tail(&edge->vertex_entry, &vertex->edges);
+
+	/* Only an fd queued on an in-flight socket can close a cycle */
+	if (unix_edge_successor(edge)) {
+		unix_vertex_mark(vertex);
+		unix_graph_maybe_cyclic = true;
+	}
+}
+
+static void unix_del_edge(struct unix_edge *edge)
+{
+	struct unix_vertex *vertex = &edge->predecessor->vertex;
+
+	/* Losing any edge may leave no edge out of the SCC */
+	unix_vertex_mark(vertex);
+
+	list_del(&edge->vertex_entry);
+	vertex->out_degree--;
+
+	if (!vertex->out_degree)
+		list_del(&vertex->entry);
+}
+
+/* Called once the skb carrying @fpl is queued on @receiver. */
+void unix_add_edges(struct scm_fp_list *fpl, struct unix_sock *receiver)
+{
+	int i = 0, j = 0;
+
+	if (!fpl->count_unix)
+		return;
+
+	spin_lock(&unix_gc_lock);
+
+	do {
+		struct sock *sk = unix_get_socket(fpl->fp[j++]);
+		struct unix_edge *edge;
+
+		if (!sk)
+			continue;
+
+		edge = fpl->edges + i++;
+		edge->predecessor = unix_sk(sk);
+		edge->successor = receiver;
+		unix_add_edge(edge);
+	} while (i < fpl->count_unix);
+
+	spin_unlock(&unix_gc_lock);
+
+	fpl->inflight = true;
+}
+EXPORT_SYMBOL(unix_add_edges);
+
+static void unix_del_edges(struct scm_fp_list *fpl)
+{
+	int i;
+
+	spin_lock(&unix_gc_lock);
+	for (i = 0; i < fpl->count_unix; i++)
+		unix_del_edge(fpl->edges + i);
+	spin_unlock(&unix_gc_lock);
+
+	fpl->inflight = false;
+}
+
+/* An embryo was accept()ed, fds queued on it are no longer held by the
+ * listener. The caller holds unix_state_lock() of @receiver, which
+ * serialises with unix_add_edges() for it.
+ */
+void unix_update_edges(struct unix_sock *receiver)
+{
+	if (!atomic_read(&receiver->scm_stat.nr_fds)) {
+		receiver->listener = NULL;
+		return;
+	}
+
+	spin_lock(&unix_gc_lock);
+
+	if (unix_sk(receiver->listener)->vertex.out_degree)
+		unix_vertex_mark(&unix_sk(receiver->listener)->vertex);
+	if (receiver->vertex.out_degree)
+		unix_vertex_mark(&receiver->vertex);
+	unix_graph_maybe_cyclic = true;
+	receiver->listener = NULL;
+
+	spin_unlock(&unix_gc_lock);
+}
+EXPORT_SYMBOL(unix_update_edges);
+
+static void unix_destroy_fpl(struct scm_fp_list *fpl)
+{
+	if (fpl->inflight)
+		unix_del_edges(fpl);
+
+	kvfree(fpl->edges);
+	fpl->edges = NULL;
+}
+
 /*
  * The "user->unix_inflight" variable is protected by the garbage
  * collection lock, and we just read it locklessly here. If you go
@@ -105,19 +230,38 @@ static inline bool too_many_unix_fds(struct task_struct *p)
 
 int unix_attach_fds(struct scm_cookie *scm, struct sk_buff *skb)
 {
-	int i;
+	struct unix_edge *edges = NULL;
+	int i, count_unix = 0;
 
 	if (too_many_unix_fds(current))
 		return -ETOOMANYREFS;
 
+	for (i = 0; i < scm->fp->count; i++)
+		if (unix_get_socket(scm->fp->fp[i]))
+			count_unix++;
+
+	/* The edges are added to the GC graph once the skb is queued */
+	if (count_unix) {
+		edges = kvmalloc_array(count_unix, sizeof(*edges),
+				       GFP_KERNEL_ACCOUNT);
+		if (!edges)
+			return -ENOMEM;
+	}
+
 	/*
 	 * Need to duplicate file references for the sake of garbage
 	 * collection.  Otherwise a socket in the fps might become a
 	 * candidate for GC while the skb is not yet queued.
 	 */
 	UNIXCB(skb).fp = scm_fp_dup(scm->fp);
-	if (!UNIXCB(skb).fp)
+	if (!UNIXCB(skb).fp) {
+		kvfree(edges);
 		return -ENOMEM;
+	}
+
+	UNIXCB(skb).fp->count_unix = count_unix;
+	UNIXCB(skb).fp->inflight = false;
+	UNIXCB(skb).fp->edges = edges;
 
 	for (i = scm->fp->count - 1; i >= 0; i--)
 		unix_inflight(scm->fp->user, scm->fp->fp[i]);
@@ -132,6 +276,8 @@ void unix_detach_fds(struct scm_cookie *scm, struct sk_buff *skb)
 	scm->fp = UNIXCB(skb).fp;
 	UNIXCB(skb).fp = NULL;
 
+	unix_destroy_fpl(scm->fp);
+
 	for (i = scm->fp->count-1; i >= 0; i--)
 		unix_notinflight(scm->fp->user, scm->fp->fp[i]);
 }
@@ -1,9 +1,34 @@
 #ifndef NET_UNIX_SCM_H
 #define NET_UNIX_SCM_H
 
-extern struct list_head gc_inflight_list;
+extern struct list_head unix_unvisited_vertices;
+extern struct list_head unix_grouped_vertices;
+extern bool unix_graph_maybe_cyclic;
 extern spinlock_t unix_gc_lock;
 
+enum unix_vertex_index {
+	UNIX_VERTEX_INDEX_UNVISITED,	/* SCC has to be recomputed */
+	UNIX_VERTEX_INDEX_GROUPED,	/* scc_entry links a valid SCC */
+	UNIX_VERTEX_INDEX_START,	/* On the DFS stack */
+};
+
+#define unix_vertex_sk(vertex)	container_of(vertex, struct unix_sock, vertex)
+
+/* The vertex the edge leads to, if the receiver is in flight itself.
+ * An fd queued on an embryo is only reachable through the listener.
+ */
+static inline struct unix_vertex *unix_edge_successor(struct unix_edge *edge)
+{
+	struct unix_sock *u = edge->successor;
+
+	if (u->listener)
+		u = unix_sk(u->listener);
+
+	return u->vertex.out_degree ? &u->vertex : NULL;
+}
+
+void unix_vertex_mark(struct unix_vertex *vertex);
+
 int unix_attach_fds(struct scm_cookie *scm, struct sk_buff *skb);
 void unix_detach_fds(struct scm_cookie *scm, struct sk_buff *skb);
 
@@ -30,6 +30,7 @@
 #include "xsk.h"
 
 #define TX_BATCH_SIZE 16
+#define XSK_MAX_PKT_DESCS (MAX_SKB_FRAGS + 1)
 
 static DEFINE_PER_CPU(struct list_head, xskmap_flush_list);
 
@@ -148,14 +149,15 @@ static u64 xp_get_handle(struct xdp_buff_xsk *xskb)
 	return xskb->orig_addr + (offset << XSK_UNALIGNED_BUF_OFFSET_SHIFT);
 }
 
-static int __xsk_rcv_zc(struct xdp_sock *xs, struct xdp_buff *xdp, u32 len)
+static int __xsk_rcv_zc(struct xdp_sock *xs, struct xdp_buff *xdp, u32 len,
+			u32 flags)
 {
 	struct xdp_buff_xsk *xskb = container_of(xdp, struct xdp_buff_xsk, xdp);
 	u64 addr;
 	int err;
 
 	addr = xp_get_handle(xskb);
-	err = xskq_prod_reserve_desc(xs->rx, addr, len);
+	err = xskq_prod_reserve_desc(xs->rx, addr, len, flags);
 	if (err) {
 		xs->rx_queue_full++;
 		return err;
@@ -183,16 +185,61 @@ static void xsk_copy_xdp(struct xdp_buff *to, struct xdp_buff *from, u32 len)
 	memcpy(to_buf, from_buf, len + metalen);
 }
 
+/* Copy a frame larger than the umem frames into a chain of buffers, the
+ * descriptors of all but the last one carrying XDP_PKT_CONTD.
+ */
+static int __xsk_rcv_mb(struct xdp_sock *xs, struct xdp_buff *xdp, u32 len,
+			bool explicit_free)
+{
+	u32 frame_size = xsk_pool_get_rx_frame_size(xs->pool);
+	struct xdp_buff *bufs[XSK_MAX_PKT_DESCS];
+	u32 i, nb_bufs, copied, chunk;
+
+	nb_bufs = DIV_ROUND_UP(len, frame_size);
+	if (!xs->sg || nb_bufs > XSK_MAX_PKT_DESCS) {
+		xs->rx_dropped++;
+		return -ENOSPC;
+	}
+
+	if (xskq_prod_nb_free(xs->rx, nb_bufs) < nb_bufs) {
+		xs->rx_queue_full++;
+		return -ENOSPC;
+	}
+
+	for (i = 0; i < nb_bufs; i++) {
+		bufs[i] = xsk_buff_alloc(xs->pool);
+		if (!bufs[i]) {
+			while (i--)
+				xsk_buff_free(bufs[i]);
+			xs->rx_dropped++;
+			return -ENOSPC;
+		}
+	}
+
+	/* Metadata, if any, goes in front of the first buffer only. */
+	xsk_copy_xdp(bufs[0], xdp, frame_size);
+	__xsk_rcv_zc(xs, bufs[0], frame_size, XDP_PKT_CONTD);
+
+	for (i = 1, copied = frame_size; i < nb_bufs; i++, copied += chunk) {
+		chunk = min(len - copied, frame_size);
+		memcpy(bufs[i]->data, xdp->data + copied, chunk);
+		__xsk_rcv_zc(xs, bufs[i], chunk,
+			     i < nb_bufs - 1 ? XDP_PKT_CONTD : 0);
+	}
+
+	if (explicit_free)
+		xdp_return_buff(xdp);
+	return 0;
+}
+
 static int __xsk_rcv(struct xdp_sock *xs, struct xdp_buff *xdp, u32 len,
 		     bool explicit_free)
 {
 	struct xdp_buff *xsk_xdp;
 	int err;
 
-	if (len > xsk_pool_get_rx_frame_size(xs->pool)) {
-		xs->rx_dropped++;
-		return -ENOSPC;
-	}
+	if (len > xsk_pool_get_rx_frame_size(xs->pool))
+		return __xsk_rcv_mb(xs, xdp, len, explicit_free);
 
 	xsk_xdp = xsk_buff_alloc(xs->pool);
 	if (!xsk_xdp) {
@@ -201,7 +248,7 @@ static int __xsk_rcv(struct xdp_sock *xs, struct xdp_buff *xdp, u32 len,
 	}
 
 	xsk_copy_xdp(xsk_xdp, xdp, len);
-	err = __xsk_rcv_zc(xs, xsk_xdp, len);
+	err = __xsk_rcv_zc(xs, xsk_xdp, len, 0);
 	if (err) {
 		xsk_buff_free(xsk_xdp);
 		return err;
@@ -243,7 +290,7 @@ static int xsk_rcv(struct xdp_sock *xs, struct xdp_buff *xdp,
 	len = xdp->data_end - xdp->data;
 
 	return xdp->rxq->mem.type == MEM_TYPE_XSK_BUFF_POOL ?
-		__xsk_rcv_zc(xs, xdp, len) :
+		__xsk_rcv_zc(xs, xdp, len, 0) :
 		__xsk_rcv(xs, xdp, len, explicit_free);
 }
 
@@ -322,6 +369,13 @@ bool xsk_tx_peek_desc(struct xsk_buff_pool *pool, struct xdp_desc *desc)
 			continue;
 		}
 
+		/* Zero-copy drivers only handle single buffer packets. */
+		if (unlikely(xp_mb_desc(desc))) {
+			xs->tx->invalid_descs++;
+			xskq_cons_release(xs->tx);
+			continue;
+		}
+
 		/* This is the backpressure mechanism for the Tx path.
 		 * Reserve space in the completion queue and only proceed
 		 * if there is space in it. This avoids having to implement
@@ -371,95 +425,333 @@ static void xsk_destruct_skb(struct sk_buff *skb)
 	sock_wfree(skb);
 }
 
+/* Umem addresses to complete for an skb built from several descriptors */
+struct xsk_tx_addrs {
+	u32 nb_addrs;
+	u64 addrs[];
+};
+
+static void xsk_destruct_skb_mb(struct sk_buff *skb)
+{
+	struct xsk_tx_addrs *tx_addrs = skb_shinfo(skb)->destructor_arg;
+	struct xdp_sock *xs = xdp_sk(skb->sk);
+	unsigned long flags;
+
+	spin_lock_irqsave(&xs->pool->cq_lock, flags);
+	xskq_prod_submit_addrs(xs->pool->cq, tx_addrs->addrs,
+			       tx_addrs->nb_addrs);
+	spin_unlock_irqrestore(&xs->pool->cq_lock, flags);
+
+	kfree(tx_addrs);
+	sock_wfree(skb);
+}
+
+/* Gather the remaining descriptors of a packet whose first descriptor
+ * @descs[0] carries XDP_PKT_CONTD. Returns the number of descriptors of
+ * the packet, 0 if user space has not produced all of them yet, or a
+ * negative error with the number of descriptors to drop in @nb_descs.
+ */
+static int xsk_tx_peek_mb(struct xdp_sock *xs, struct xdp_desc *descs,
+			  u32 *len, u32 *nb_descs)
+{
+	u32 n = 1;
+
+	*len = descs[0].len;
+	while (xp_mb_desc(&descs[n - 1])) {
+		if (n == XSK_MAX_PKT_DESCS) {
+			xs->tx->invalid_descs++;
+			*nb_descs = n;
+			return -EMSGSIZE;
+		}
+		if (!xskq_cons_read_desc_at(xs->tx, n, &descs[n]))
+			return 0;
+		if (!xskq_cons_is_valid_desc(xs->tx, &descs[n], xs->pool)) {
+			*nb_descs = n + 1;
+			return -EINVAL;
+		}
+		*len += descs[n++].len;
+	}
+
+	return n;
+}
+
+/* A packet of a generic Tx batch */
+struct xsk_tx_pkt {
+	struct sk_buff *skb;
+	u32 cons;	/* Tx ring position of its first descriptor */
+	u32 nb_descs;
+};
+
+static struct sk_buff *xsk_build_skb(struct xdp_sock *xs,
+				     struct xdp_desc *descs, u32 nb_descs,
+				     u32 len, int *err)
+{
+	struct xsk_tx_addrs *tx_addrs = NULL;
+	struct net_device *dev = xs->dev;
+	u32 i, hr, tr, linear, offset;
+	struct sk_buff *skb;
+	char *buffer;
+
+	hr = max(NET_SKB_PAD, L1_CACHE_ALIGN(dev->needed_headroom));
+	tr = dev->needed_tailroom;
+
+	if (nb_descs > 1) {
+		tx_addrs = kmalloc(struct_size(tx_addrs, addrs, nb_descs),
+				   GFP_KERNEL);
+		if (unlikely(!tx_addrs)) {
+			*err = -ENOMEM;
+			return NULL;
+		}
+		tx_addrs->nb_addrs = nb_descs;
+		for (i = 0; i < nb_descs; i++)
+			tx_addrs->addrs[i] = descs[i].addr;
+	}
+
+	/* Everything past the first buffer goes to page frags. */
+	linear = descs[0].len;
+	skb = sock_alloc_send_pskb(&xs->sk, hr + linear + tr, len - linear,
+				   1, err, 0);
+	if (unlikely(!skb))
+		goto out_free;
+
+	skb_reserve(skb, hr);
+	skb_put(skb, linear);
+	skb->data_len = len - linear;
+	skb->len += len - linear;
+
+	for (i = 0, offset = 0; i < nb_descs; offset += descs[i++].len) {
+		buffer = xsk_buff_raw_get_data(xs->pool, descs[i].addr);
+		*err = skb_store_bits(skb, offset, buffer, descs[i].len);
+		if (unlikely(*err)) {
+			kfree_skb(skb);
+			goto out_free;
+		}
+	}
+
+	skb->dev = dev;
+	skb->priority = xs->sk.sk_priority;
+	skb->mark = xs->sk.sk_mark;
+	/* The completion destructor is only set once the completion
+	 * ring slots of the packet are reserved.
+	 */
+	if (tx_addrs)
+		skb_shinfo(skb)->destructor_arg = tx_addrs;
+	else
+		skb_shinfo(skb)->destructor_arg = (void *)(long)descs[0].addr;
+	return skb;
+
+out_free:
+	kfree(tx_addrs);
+	return NULL;
+}
+
+/* Free an skb of a batch that was not handed to the device */
+static void xsk_free_unsent_skb(struct xsk_tx_pkt *pkt)
+{
+	struct sk_buff *skb = pkt->skb;
+
+	if (pkt->nb_descs > 1)
+		kfree(skb_shinfo(skb)->destructor_arg);
+	skb->destructor = sock_wfree;
+	/* Free skb without triggering the perf drop trace */
+	consume_skb(skb);
+}
+
+/* Hand a batch of skbs to the driver under a single Tx queue lock, with
+ * xmit_more set on all but the last one so that the driver only needs to
+ * ring its doorbell once. Returns the number of packets consumed, sent or
+ * dropped, from the start of the batch.
+ */
+static u32 xsk_direct_xmit_batch(struct xdp_sock *xs, struct xsk_tx_pkt *pkts,
+				 u32 nb_pkts, int *err)
+{
+	struct net_device *dev = xs->dev;
+	netdev_tx_t ret = NETDEV_TX_OK;
+	struct netdev_queue *txq;
+	u32 i, nb_valid = 0;
+	bool again = false;
+
+	if (unlikely(!netif_running(dev) || !netif_carrier_ok(dev))) {
+		for (i = 0; i < nb_pkts; i++)
+			kfree_skb(pkts[i].skb);
+		atomic_long_add(nb_pkts, &dev->tx_dropped);
+		/* SKB completed but not sent */
+		*err = -EBUSY;
+		return nb_pkts;
+	}
+
+	for (; nb_valid < nb_pkts; nb_valid++) {
+		struct sk_buff *skb = pkts[nb_valid].skb, *segs;
+
+		skb_set_queue_mapping(skb, xs->queue_id);
+		segs = validate_xmit_skb_list(skb, dev, &again);
+		if (unlikely(segs != skb)) {
+			/* @skb is gone and its completion posted */
+			kfree_skb_list(segs);
+			break;
+		}
+	}
+
+	txq = netdev_get_tx_queue(dev, xs->queue_id);
+
+	local_bh_disable();
+	dev_xmit_recursion_inc();
+	HARD_TX_LOCK(dev, txq, smp_processor_id());
+	for (i = 0; i < nb_valid; i++) {
+		if (netif_xmit_frozen_or_drv_stopped(txq)) {
+			ret = NETDEV_TX_BUSY;
+			break;
+		}
+		ret = netdev_start_xmit(pkts[i].skb, dev, txq,
+					i + 1 < nb_valid);
+		if (ret == NETDEV_TX_BUSY)
+			break;
+		/* Ignore NET_XMIT_CN as packet might have been sent */
+		if (ret == NET_XMIT_DROP)
+			/* SKB completed but not sent */
+			*err = -EBUSY;
+	}
+	HARD_TX_UNLOCK(dev, txq);
+	dev_xmit_recursion_dec();
+	local_bh_enable();
+
+	if (unlikely(nb_valid < nb_pkts)) {
+		/* The Tx ring is consumed in order, so the packets ahead of
+		 * the dropped one have to be completed as well.
+		 */
+		atomic_long_add(nb_valid - i, &dev->tx_dropped);
+		for (; i < nb_valid; i++)
+			kfree_skb(pkts[i].skb);
+		*err = -EBUSY;
+		return nb_valid + 1;
+	}
+
+	if (ret == NETDEV_TX_BUSY) {
+		/* Tell user-space to retry the send */
+		xs->tx_batch_busy++;
+		*err = -EAGAIN;
+	}
+
+	return i;
+}
+
 static int xsk_generic_xmit(struct sock *sk)
 {
 	struct xdp_sock *xs = xdp_sk(sk);
-	u32 max_batch = TX_BATCH_SIZE;
-	bool sent_frame = false;
-	struct xdp_desc desc;
-	struct sk_buff *skb;
+	struct xdp_desc descs[XSK_MAX_PKT_DESCS];
+	struct xsk_tx_pkt pkts[TX_BATCH_SIZE];
+	u32 i, nb_pkts = 0, nb_rsv, nb_sent = 0;
+	u32 nb_descs = 0, nb_free;
+	bool ring_empty = true;
 	unsigned long flags;
 	int err = 0;
-	u32 hr, tr;
 
 	mutex_lock(&xs->mutex);
 
 	if (xs->queue_id >= xs->dev->real_num_tx_queues)
 		goto out;
 
-	hr = max(NET_SKB_PAD, L1_CACHE_ALIGN(xs->dev->needed_headroom));
-	tr = xs->dev->needed_tailroom;
-
-	while (xskq_cons_peek_desc(xs->tx, &desc, xs->pool)) {
-		char *buffer;
-		u64 addr;
-		u32 len;
+	/* Gather a batch of packets. The consumer pointer is not published
+	 * meanwhile, so the descriptors of packets that end up not being
+	 * sent can be given back.
+	 */
+	while (xskq_cons_peek_desc_ahead(xs->tx, &descs[0], xs->pool)) {
+		struct xsk_tx_pkt *pkt = &pkts[nb_pkts];
+		u32 len = descs[0].len;
+		int ret = 1;
 
-		if (max_batch-- == 0) {
+		if (nb_pkts == TX_BATCH_SIZE) {
 			err = -EAGAIN;
-			goto out;
+			ring_empty = false;
+			break;
 		}
 
-		len = desc.len;
-		skb = sock_alloc_send_skb(sk, hr + len + tr, 1, &err);
-		if (unlikely(!skb))
-			goto out;
-
-		skb_reserve(skb, hr);
-		skb_put(skb, len);
+		if (unlikely(xp_mb_desc(&descs[0]))) {
+			if (!xs->sg) {
+				xs->tx->invalid_descs++;
+				xskq_cons_release(xs->tx);
+				continue;
+			}
 
-		addr = desc.addr;
-		buffer = xsk_buff_raw_get_data(xs->pool, addr);
-		err = skb_store_bits(skb, 0, buffer, len);
-		/* This is the backpressure mechanism for the Tx path.
-		 * Reserve space in the completion queue and only proceed
-		 * if there is space in it. This avoids having to implement
-		 * any buffering in the Tx path.
-		 */
-		spin_lock_irqsave(&xs->pool->cq_lock, flags);
-		if (unlikely(err) || xskq_prod_reserve(xs->pool->cq)) {
-			spin_unlock_irqrestore(&xs->pool->cq_lock, flags);
-			kfree_skb(skb);
-			goto out;
+			ret = xsk_tx_peek_mb(xs, descs, &len, &pkt->nb_descs);
+			if (ret < 0) {
+				xskq_cons_release_n(xs->tx, pkt->nb_descs);
+				continue;
+			}
+			/* Wait for the rest of the packet */
+			if (!ret) {
+				ring_empty = false;
+				break;
+			}
 		}
-		spin_unlock_irqrestore(&xs->pool->cq_lock, flags);
 
-		skb->dev = xs->dev;
-		skb->priority = sk->sk_priority;
-		skb->mark = sk->sk_mark;
-		skb_shinfo(skb)->destructor_arg = (void *)(long)desc.addr;
-		skb->destructor = xsk_destruct_skb;
-
-		err = __dev_direct_xmit(skb, xs->queue_id);
-		if  (err == NETDEV_TX_BUSY) {
-			/* Tell user-space to retry the send */
-			skb->destructor = sock_wfree;
-			spin_lock_irqsave(&xs->pool->cq_lock, flags);
-			xskq_prod_cancel(xs->pool->cq);
-			spin_unlock_irqrestore(&xs->pool->cq_lock, flags);
-			/* Free skb without triggering the perf drop trace */
-			consume_skb(skb);
-			err = -EAGAIN;
-			goto out;
+		pkt->skb = xsk_build_skb(xs, descs, ret, len, &err);
+		if (unlikely(!pkt->skb)) {
+			ring_empty = false;
+			break;
 		}
+		pkt->cons = xs->tx->cached_cons;
+		pkt->nb_descs = ret;
+		xskq_cons_release_n(xs->tx, ret);
+		nb_descs += ret;
+		nb_pkts++;
+	}
 
-		xskq_cons_release(xs->tx);
-		/* Ignore NET_XMIT_CN as packet might have been sent */
-		if (err == NET_XMIT_DROP) {
-			/* SKB completed but not sent */
-			err = -EBUSY;
-			goto out;
-		}
+	if (ring_empty)
+		xs->tx->queue_empty_descs++;
+	if (!nb_pkts)
+		goto out;
 
-		sent_frame = true;
+	/* This is the backpressure mechanism for the Tx path. Reserve space
+	 * in the completion queue for the whole batch and only proceed with
+	 * the packets that fit. This avoids having to implement any
+	 * buffering in the Tx path.
+	 */
+	spin_lock_irqsave(&xs->pool->cq_lock, flags);
+	nb_free = xskq_prod_nb_free(xs->pool->cq, nb_descs);
+	for (nb_rsv = 0, nb_descs = 0; nb_rsv < nb_pkts; nb_rsv++) {
+		if (nb_descs + pkts[nb_rsv].nb_descs > nb_free)
+			break;
+		nb_descs += pkts[nb_rsv].nb_descs;
 	}
+	xskq_prod_reserve_n(xs->pool->cq, nb_descs);
+	spin_unlock_irqrestore(&xs->pool->cq_lock, flags);
+
+	if (nb_rsv < nb_pkts)
+		xs->tx_batch_cq_full++;
+
+	for (i = 0; i < nb_rsv; i++)
+		pkts[i].skb->destructor = pkts[i].nb_descs > 1 ?
+			xsk_destruct_skb_mb : xsk_destruct_skb;
 
-	xs->tx->queue_empty_descs++;
+	nb_sent = nb_rsv ? xsk_direct_xmit_batch(xs, pkts, nb_rsv, &err) : 0;
+
+	if (nb_sent < nb_rsv) {
+		spin_lock_irqsave(&xs->pool->cq_lock, flags);
+		for (i = nb_sent; i < nb_rsv; i++)
+			xskq_prod_cancel_n(xs->pool->cq, pkts[i].nb_descs);
+		spin_unlock_irqrestore(&xs->pool->cq_lock, flags);
+	}
+
+	/* Give the descriptors of the packets not sent back to the ring */
+	if (nb_sent < nb_pkts) {
+		xs->tx->cached_cons = pkts[nb_sent].cons;
+		for (i = nb_sent; i < nb_pkts; i++)
+			xsk_free_unsent_skb(&pkts[i]);
+		if (!err)
+			err = -EAGAIN;
+	}
+
+	if (nb_sent) {
+		xs->tx_batches++;
+		xs->tx_batch_pkts += nb_sent;
+		xs->tx_batch_max = max_t(u32, xs->tx_batch_max, nb_sent);
+	}
 
 out:
-	if (sent_frame)
-		if (xsk_tx_writeable(xs))
-			sk->sk_write_space(sk);
+	__xskq_cons_release(xs->tx);
+	if (nb_sent && xsk_tx_writeable(xs))
+		sk->sk_write_space(sk);
 
 	mutex_unlock(&xs->mutex);
 	return err;
@@ -678,7 +970,7 @@ static int xsk_bind(struct socket *sock, struct sockaddr *addr, int addr_len)
 
 	flags = sxdp->sxdp_flags;
 	if (flags & ~(XDP_SHARED_UMEM | XDP_COPY | XDP_ZEROCOPY |
-		      XDP_USE_NEED_WAKEUP))
+		      XDP_USE_NEED_WAKEUP | XDP_USE_SG))
 		return -EINVAL;
 
 	bound_dev_if = READ_ONCE(sk->sk_bound_dev_if);
@@ -735,6 +1027,13 @@ static int xsk_bind(struct socket *sock, struct sockaddr *addr, int addr_len)
 			goto out_unlock;
 		}
 
+		if ((flags & XDP_USE_SG) && umem_xs->zc) {
+			/* Multi-buffer is only supported in copy mode. */
+			err = -EOPNOTSUPP;
+			sockfd_put(sock);
+			goto out_unlock;
+		}
+
 		if (umem_xs->queue_id != qid || umem_xs->dev != dev) {
 			/* Share the umem with another socket on another qid
 			 * and/or device.
@@ -796,6 +1095,7 @@ static int xsk_bind(struct socket *sock, struct sockaddr *addr, int addr_len)
 
 	xs->dev = dev;
 	xs->zc = xs->umem->zc;
+	xs->sg = !!(flags & XDP_USE_SG);
 	xs->queue_id = qid;
 	xp_add_xsk(xs->pool, xs);
 
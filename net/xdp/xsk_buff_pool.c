@@ -134,6 +134,12 @@ static int __xp_assign_dev(struct xsk_buff_pool *pool,
 	if (force_zc && force_copy)
 		return -EINVAL;
 
+	/* Multi-buffer packets are only supported in copy mode. */
+	if (force_zc && (flags & XDP_USE_SG))
+		return -EOPNOTSUPP;
+	if (flags & XDP_USE_SG)
+		force_copy = true;
+
 	if (xsk_get_pool_from_qid(netdev, queue_id))
 		return -EBUSY;
 
@@ -89,6 +89,19 @@ static int xsk_diag_put_stats(const struct xdp_sock *xs, struct sk_buff *nlskb)
 	return nla_put(nlskb, XDP_DIAG_STATS, sizeof(du), &du);
 }
 
+static int xsk_diag_put_tx_batch_stats(const struct xdp_sock *xs,
+				       struct sk_buff *nlskb)
+{
+	struct xdp_diag_tx_batch_stats bs = {};
+
+	bs.n_batches = xs->tx_batches;
+	bs.n_batch_pkts = xs->tx_batch_pkts;
+	bs.n_cq_full = xs->tx_batch_cq_full;
+	bs.n_tx_busy = xs->tx_batch_busy;
+	bs.max_batch_pkts = xs->tx_batch_max;
+	return nla_put(nlskb, XDP_DIAG_TX_BATCH_STATS, sizeof(bs), &bs);
+}
+
 static int xsk_diag_fill(struct sock *sk, struct sk_buff *nlskb,
 			 struct xdp_diag_req *req,
 			 struct user_namespace *user_ns,
@@ -135,6 +148,10 @@ static int xsk_diag_fill(struct sock *sk, struct sk_buff *nlskb,
 	    xsk_diag_put_stats(xs, nlskb))
 		goto out_nlmsg_trim;
 
+	if ((req->xdiag_show & XDP_SHOW_STATS) && xs->tx && !xs->zc &&
+	    xsk_diag_put_tx_batch_stats(xs, nlskb))
+		goto out_nlmsg_trim;
+
 	mutex_unlock(&xs->mutex);
 	nlmsg_end(nlskb, nlh);
 	return 0;
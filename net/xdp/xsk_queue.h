@@ -123,6 +123,16 @@ static inline bool xskq_cons_read_addr_unchecked(struct xsk_queue *q, u64 *addr)
 	return false;
 }
 
+static inline bool xp_mb_desc(struct xdp_desc *desc)
+{
+	return desc->options & XDP_PKT_CONTD;
+}
+
+static inline bool xp_unused_options_set(u32 options)
+{
+	return options & ~XDP_PKT_CONTD;
+}
+
 static inline bool xp_aligned_validate_desc(struct xsk_buff_pool *pool,
 					    struct xdp_desc *desc)
 {
@@ -138,7 +148,7 @@ static inline bool xp_aligned_validate_desc(struct xsk_buff_pool *pool,
 	if (chunk >= pool->addrs_cnt)
 		return false;
 
-	if (desc->options)
+	if (xp_unused_options_set(desc->options))
 		return false;
 	return true;
 }
@@ -159,7 +169,7 @@ static inline bool xp_unaligned_validate_desc(struct xsk_buff_pool *pool,
 	    xp_desc_crosses_non_contig_pg(pool, addr, desc->len))
 		return false;
 
-	if (desc->options)
+	if (xp_unused_options_set(desc->options))
 		return false;
 	return true;
 }
@@ -250,6 +260,38 @@ static inline bool xskq_cons_peek_desc(struct xsk_queue *q,
 	return xskq_cons_read_desc(q, desc, pool);
 }
 
+/* Same as xskq_cons_peek_desc(), but without publishing the consumer
+ * pointer when refreshing the producer pointer, for reading ahead of
+ * entries that might have to be given back.
+ */
+static inline bool xskq_cons_peek_desc_ahead(struct xsk_queue *q,
+					     struct xdp_desc *desc,
+					     struct xsk_buff_pool *pool)
+{
+	if (q->cached_prod == q->cached_cons)
+		__xskq_cons_peek(q);
+	return xskq_cons_read_desc(q, desc, pool);
+}
+
+/* Read the descriptor @n entries past the next one without consuming
+ * anything, for packets that span several descriptors. The consumer
+ * pointer is not published, so the caller can still back out.
+ */
+static inline bool xskq_cons_read_desc_at(struct xsk_queue *q, u32 n,
+					  struct xdp_desc *desc)
+{
+	struct xdp_rxtx_ring *ring = (struct xdp_rxtx_ring *)q->ring;
+
+	if (q->cached_prod - q->cached_cons <= n) {
+		__xskq_cons_peek(q);
+		if (q->cached_prod - q->cached_cons <= n)
+			return false;
+	}
+
+	*desc = ring->desc[(q->cached_cons + n) & q->ring_mask];
+	return true;
+}
+
 static inline void xskq_cons_release(struct xsk_queue *q)
 {
 	/* To improve performance, only update local state here.
@@ -260,6 +302,11 @@ static inline void xskq_cons_release(struct xsk_queue *q)
 	q->cached_cons++;
 }
 
+static inline void xskq_cons_release_n(struct xsk_queue *q, u32 cnt)
+{
+	q->cached_cons += cnt;
+}
+
 static inline bool xskq_cons_is_full(struct xsk_queue *q)
 {
 	/* No barriers needed since data is not accessed */
@@ -275,18 +322,23 @@ static inline u32 xskq_cons_present_entries(struct xsk_queue *q)
 
 /* Functions for producers */
 
-static inline bool xskq_prod_is_full(struct xsk_queue *q)
+static inline u32 xskq_prod_nb_free(struct xsk_queue *q, u32 max)
 {
 	u32 free_entries = q->nentries - (q->cached_prod - q->cached_cons);
 
-	if (free_entries)
-		return false;
+	if (free_entries >= max)
+		return max;
 
 	/* Refresh the local tail pointer */
 	q->cached_cons = READ_ONCE(q->ring->consumer);
 	free_entries = q->nentries - (q->cached_prod - q->cached_cons);
 
-	return !free_entries;
+	return min(free_entries, max);
+}
+
+static inline bool xskq_prod_is_full(struct xsk_queue *q)
+{
+	return !xskq_prod_nb_free(q, 1);
 }
 
 static inline void xskq_prod_cancel(struct xsk_queue *q)
@@ -294,6 +346,11 @@ static inline void xskq_prod_cancel(struct xsk_queue *q)
 	q->cached_prod--;
 }
 
+static inline void xskq_prod_cancel_n(struct xsk_queue *q, u32 cnt)
+{
+	q->cached_prod -= cnt;
+}
+
 static inline int xskq_prod_reserve(struct xsk_queue *q)
 {
 	if (xskq_prod_is_full(q))
@@ -304,6 +361,16 @@ static inline int xskq_prod_reserve(struct xsk_queue *q)
 	return 0;
 }
 
+static inline int xskq_prod_reserve_n(struct xsk_queue *q, u32 cnt)
+{
+	if (xskq_prod_nb_free(q, cnt) < cnt)
+		return -ENOSPC;
+
+	/* A, matches D */
+	q->cached_prod += cnt;
+	return 0;
+}
+
 static inline int xskq_prod_reserve_addr(struct xsk_queue *q, u64 addr)
 {
 	struct xdp_umem_ring *ring = (struct xdp_umem_ring *)q->ring;
@@ -317,7 +384,7 @@ static inline int xskq_prod_reserve_addr(struct xsk_queue *q, u64 addr)
 }
 
 static inline int xskq_prod_reserve_desc(struct xsk_queue *q,
-					 u64 addr, u32 len)
+					 u64 addr, u32 len, u32 flags)
 {
 	struct xdp_rxtx_ring *ring = (struct xdp_rxtx_ring *)q->ring;
 	u32 idx;
@@ -329,6 +396,7 @@ static inline int xskq_prod_reserve_desc(struct xsk_queue *q,
 	idx = q->cached_prod++ & q->ring_mask;
 	ring->desc[idx].addr = addr;
 	ring->desc[idx].len = len;
+	ring->desc[idx].options = flags;
 
 	return 0;
 }
@@ -355,6 +423,18 @@ static inline void xskq_prod_submit_addr(struct xsk_queue *q, u64 addr)
 	__xskq_prod_submit(q, idx);
 }
 
+static inline void xskq_prod_submit_addrs(struct xsk_queue *q, u64 *addrs,
+					  u32 nb_entries)
+{
+	struct xdp_umem_ring *ring = (struct xdp_umem_ring *)q->ring;
+	u32 i, idx = q->ring->producer;
+
+	for (i = 0; i < nb_entries; i++)
+		ring->desc[idx++ & q->ring_mask] = addrs[i];
+
+	__xskq_prod_submit(q, idx);
+}
+
 static inline void xskq_prod_submit_n(struct xsk_queue *q, u32 nb_entries)
 {
 	__xskq_prod_submit(q, q->ring->producer + nb_entries);
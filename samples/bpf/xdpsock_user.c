@@ -149,6 +149,7 @@ struct xsk_socket_info {
 	struct xsk_app_stats app_stats;
 	struct xsk_driver_stats drv_stats;
 	u32 outstanding_tx;
+	bool rx_contd;
 };
 
 static int num_socks;
@@ -911,6 +912,7 @@ static struct option long_options[] = {
 	{"quiet", no_argument, 0, 'Q'},
 	{"app-stats", no_argument, 0, 'a'},
 	{"irq-string", no_argument, 0, 'I'},
+	{"frags", no_argument, 0, 'G'},
 	{0, 0, 0, 0}
 };
 
@@ -949,6 +951,7 @@ static void usage(const char *prog)
 		"  -Q, --quiet          Do not display any stats.\n"
 		"  -a, --app-stats	Display application (syscall) statistics.\n"
 		"  -I, --irq-string	Display driver interrupt statistics for interface associated with irq-string.\n"
+		"  -G, --frags		Enable multi-buffer packets (XDP_USE_SG), copy mode only.\n"
 		"\n";
 	fprintf(stderr, str, prog, XSK_UMEM__DEFAULT_FRAME_SIZE,
 		opt_batch_size, MIN_PKT_SIZE, MIN_PKT_SIZE,
@@ -964,7 +967,7 @@ static void parse_command_line(int argc, char **argv)
 	opterr = 0;
 
 	for (;;) {
-		c = getopt_long(argc, argv, "Frtli:q:pSNn:czf:muMd:b:C:s:P:xQaI:",
+		c = getopt_long(argc, argv, "Frtli:q:pSNn:czf:muMd:b:C:s:P:xQaI:G",
 				long_options, &option_index);
 		if (c == -1)
 			break;
@@ -1063,6 +1066,9 @@ static void parse_command_line(int argc, char **argv)
 				usage(basename(argv[0]));
 			}
 
+			break;
+		case 'G':
+			opt_xdp_bind_flags |= XDP_USE_SG;
 			break;
 		default:
 			usage(basename(argv[0]));
@@ -1199,8 +1205,10 @@ static void rx_drop(struct xsk_socket_info *xsk, struct pollfd *fds)
 	}
 
 	for (i = 0; i < rcvd; i++) {
-		u64 addr = xsk_ring_cons__rx_desc(&xsk->rx, idx_rx)->addr;
-		u32 len = xsk_ring_cons__rx_desc(&xsk->rx, idx_rx++)->len;
+		const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&xsk->rx,
+								     idx_rx++);
+		u64 addr = desc->addr;
+		u32 len = desc->len;
 		u64 orig = xsk_umem__extract_addr(addr);
 
 		addr = xsk_umem__add_offset_to_addr(addr);
@@ -1208,11 +1216,13 @@ static void rx_drop(struct xsk_socket_info *xsk, struct pollfd *fds)
 
 		hex_dump(pkt, len, addr);
 		*xsk_ring_prod__fill_addr(&xsk->umem->fq, idx_fq++) = orig;
+		/* Count multi-buffer packets once, on their last buffer */
+		if (!(desc->options & XDP_PKT_CONTD))
+			xsk->ring_stats.rx_npkts++;
 	}
 
 	xsk_ring_prod__submit(&xsk->umem->fq, rcvd);
 	xsk_ring_cons__release(&xsk->rx, rcvd);
-	xsk->ring_stats.rx_npkts += rcvd;
 }
 
 static void rx_drop_all(void)
@@ -1364,24 +1374,33 @@ static void l2fwd(struct xsk_socket_info *xsk, struct pollfd *fds)
 	}
 
 	for (i = 0; i < rcvd; i++) {
-		u64 addr = xsk_ring_cons__rx_desc(&xsk->rx, idx_rx)->addr;
-		u32 len = xsk_ring_cons__rx_desc(&xsk->rx, idx_rx++)->len;
+		const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&xsk->rx,
+								     idx_rx++);
+		struct xdp_desc *tx_desc = xsk_ring_prod__tx_desc(&xsk->tx,
+								  idx_tx++);
+		u64 addr = desc->addr;
+		u32 len = desc->len;
 		u64 orig = addr;
 
 		addr = xsk_umem__add_offset_to_addr(addr);
 		char *pkt = xsk_umem__get_data(xsk->umem->buffer, addr);
 
-		swap_mac_addresses(pkt);
+		/* Only the first buffer of a packet holds the MACs */
+		if (!xsk->rx_contd)
+			swap_mac_addresses(pkt);
+		xsk->rx_contd = desc->options & XDP_PKT_CONTD;
+		if (!xsk->rx_contd)
+			xsk->ring_stats.rx_npkts++;
 
 		hex_dump(pkt, len, addr);
-		xsk_ring_prod__tx_desc(&xsk->tx, idx_tx)->addr = orig;
-		xsk_ring_prod__tx_desc(&xsk->tx, idx_tx++)->len = len;
+		tx_desc->addr = orig;
+		tx_desc->len = len;
+		tx_desc->options = desc->options;
 	}
 
 	xsk_ring_prod__submit(&xsk->tx, rcvd);
 	xsk_ring_cons__release(&xsk->rx, rcvd);
 
-	xsk->ring_stats.rx_npkts += rcvd;
 	xsk->outstanding_tx += rcvd;
 }
 
@@ -0,0 +1,838 @@
+/* Copyright (c) 2022 Qualcomm Innovation Center, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * RmNet synthetic traffic generator
+ *
+ * Registers a loopback physical device which RmNet can be attached to in
+ * place of the modem. Downlink MAP frames are generated in software and fed
+ * to the RmNet receive handler, and uplink MAP aggregates transmitted by
+ * RmNet are parsed and dropped, so that the deaggregation and aggregation
+ * paths can be benchmarked without any hardware:
+ *
+ *   insmod rmnet_bench.ko
+ *   ip link set rmnet_bench0 up
+ *   ip link add link rmnet_bench0 name rmnet_data0 type rmnet mux_id 1 \
+ *           ingress-deaggregation
+ *   ip link set rmnet_data0 up
+ *
+ *   cd /sys/kernel/debug/rmnet_bench
+ *   echo 100000 > dl_run
+ *   echo $(cat /sys/class/net/rmnet_data0/ifindex) > ul_ifindex
+ *   echo 100000 > ul_run
+ *   cat stats
+ *
+ * The remaining files in the directory configure the generated traffic.
+ * Frames are built with MAPv1 headers, MAPv5 checksum offload headers or
+ * MAPv5 coalescing headers, depending on map_version and coal, and the
+ * matching RmNet data format has to be set on the port.
+ */
+
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/if_arp.h>
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/timex.h>
+#include <net/ip.h>
+#include <net/ip6_checksum.h>
+#include "rmnet_map.h"
+
+#define RMNET_BENCH_MAX_FRAME		(60 * 1024)
+#define RMNET_BENCH_MAX_PKT_LEN		(9000)
+#define RMNET_BENCH_RESCHED		(64)
+
+enum {
+	RMNET_BENCH_STAGE_GEN,
+	RMNET_BENCH_STAGE_DL,
+	RMNET_BENCH_STAGE_UL,
+	RMNET_BENCH_STAGE_SINK,
+	RMNET_BENCH_STAGE_MAX,
+};
+
+static const char * const rmnet_bench_stage_names[] = {
+	[RMNET_BENCH_STAGE_GEN] = "gen",
+	[RMNET_BENCH_STAGE_DL] = "dl",
+	[RMNET_BENCH_STAGE_UL] = "ul",
+	[RMNET_BENCH_STAGE_SINK] = "sink",
+};
+
+/* Counters for one stage. Frames are MAP aggregates for gen, dl and sink,
+ * and IP packets for ul. The time is only accounted while a run is active,
+ * except for the sink, which is fed asynchronously and so uses the time
+ * between its first and last frame.
+ */
+struct rmnet_bench_stage {
+	u64 frames;
+	u64 pkts;
+	u64 bytes;
+	u64 cycles;
+	u64 ns;
+	u64 errs;
+};
+
+struct rmnet_bench_cfg {
+	u8 map_version;
+	bool coal;
+	u8 ip_version;
+	u8 proto;
+	u8 mux_id;
+	u16 pkt_len;
+	u16 pkts_per_frame;
+	u8 nlos;
+	u8 csum_err;
+	bool paged;
+	u32 ul_ifindex;
+};
+
+struct rmnet_bench {
+	struct net_device *dev;
+	struct dentry *dbgfs_dir;
+	/* Serializes the runs */
+	struct mutex lock;
+	struct rmnet_bench_cfg cfg;
+	struct rmnet_bench_stage stage[RMNET_BENCH_STAGE_MAX];
+	spinlock_t sink_lock;
+	ktime_t sink_first;
+	ktime_t sink_last;
+	u32 seq;
+	u16 ip_id;
+};
+
+static struct rmnet_bench rmnet_bench = {
+	.cfg = {
+		.map_version = 1,
+		.ip_version = 4,
+		.proto = IPPROTO_UDP,
+		.mux_id = 1,
+		.pkt_len = 1400,
+		.pkts_per_frame = 16,
+		.nlos = 1,
+		.paged = true,
+	},
+};
+
+static char *devname = "rmnet_bench%d";
+module_param(devname, charp, 0444);
+MODULE_PARM_DESC(devname, "Name of the loopback physical device");
+
+/* Packet building */
+
+/* 192.168.1.1 and 192.168.1.2 */
+static const __be32 rmnet_bench_saddr = __constant_htonl(0xC0A80101);
+static const __be32 rmnet_bench_daddr = __constant_htonl(0xC0A80102);
+static const struct in6_addr rmnet_bench_saddr6 = {
+	.s6_addr = { 0xfd, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+};
+static const struct in6_addr rmnet_bench_daddr6 = {
+	.s6_addr = { 0xfd, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2 },
+};
+
+static u32 rmnet_bench_hdr_len(const struct rmnet_bench_cfg *cfg)
+{
+	u32 len = (cfg->ip_version == 4) ? sizeof(struct iphdr) :
+					   sizeof(struct ipv6hdr);
+
+	return len + ((cfg->proto == IPPROTO_TCP) ? sizeof(struct tcphdr) :
+						    sizeof(struct udphdr));
+}
+
+/* Write an IP packet carrying data_len bytes of payload at buf and fill in
+ * the checksums. The payload of a coalesced frame covers several packets,
+ * in which case the sequence number advances by all of them.
+ */
+static u32 rmnet_bench_build_ip(struct rmnet_bench *bench,
+				const struct rmnet_bench_cfg *cfg, u8 *buf,
+				u32 data_len)
+{
+	u32 hdr_len = rmnet_bench_hdr_len(cfg);
+	u32 ip_len = (cfg->ip_version == 4) ? sizeof(struct iphdr) :
+					      sizeof(struct ipv6hdr);
+	u32 trans_len = hdr_len - ip_len + data_len;
+	u8 *trans = buf + ip_len;
+	__sum16 *check;
+	__wsum csum;
+
+	memset(buf, 0, hdr_len);
+	memset(buf + hdr_len, 0x5A, data_len);
+
+	if (cfg->proto == IPPROTO_TCP) {
+		struct tcphdr *th = (struct tcphdr *)trans;
+
+		th->source = htons(5000);
+		th->dest = htons(5001);
+		th->seq = htonl(bench->seq);
+		th->ack_seq = htonl(1);
+		th->doff = sizeof(*th) / 4;
+		th->ack = 1;
+		th->window = htons(0xFFFF);
+		check = &th->check;
+		bench->seq += data_len;
+	} else {
+		struct udphdr *uh = (struct udphdr *)trans;
+
+		uh->source = htons(5000);
+		uh->dest = htons(5001);
+		uh->len = htons(trans_len);
+		check = &uh->check;
+	}
+
+	csum = csum_partial(trans, trans_len, 0);
+	if (cfg->ip_version == 4) {
+		struct iphdr *iph = (struct iphdr *)buf;
+
+		iph->version = 4;
+		iph->ihl = sizeof(*iph) / 4;
+		iph->tot_len = htons(ip_len + trans_len);
+		iph->id = htons(bench->ip_id++);
+		iph->frag_off = htons(IP_DF);
+		iph->ttl = 64;
+		iph->protocol = cfg->proto;
+		iph->saddr = rmnet_bench_saddr;
+		iph->daddr = rmnet_bench_daddr;
+		iph->check = ip_fast_csum(iph, iph->ihl);
+		*check = csum_tcpudp_magic(iph->saddr, iph->daddr, trans_len,
+					   cfg->proto, csum);
+	} else {
+		struct ipv6hdr *ip6h = (struct ipv6hdr *)buf;
+
+		ip6h->version = 6;
+		ip6h->payload_len = htons(trans_len);
+		ip6h->nexthdr = cfg->proto;
+		ip6h->hop_limit = 64;
+		ip6h->saddr = rmnet_bench_saddr6;
+		ip6h->daddr = rmnet_bench_daddr6;
+		*check = csum_ipv6_magic(&ip6h->saddr, &ip6h->daddr, trans_len,
+					 cfg->proto, csum);
+	}
+
+	if (cfg->proto == IPPROTO_UDP && !*check)
+		*check = CSUM_MANGLED_0;
+
+	return ip_len + trans_len;
+}
+
+/* Write a MAP header for len bytes of data, padding it to 4 bytes */
+static u32 rmnet_bench_build_map(const struct rmnet_bench_cfg *cfg, u8 *buf,
+				 u32 len, bool next_hdr)
+{
+	struct rmnet_map_header *maph = (struct rmnet_map_header *)buf;
+	u32 pad = ALIGN(len, 4) - len;
+
+	memset(maph, 0, sizeof(*maph));
+	maph->mux_id = cfg->mux_id;
+	maph->next_hdr = next_hdr;
+	maph->pad_len = pad;
+	maph->pkt_len = htons(len + pad);
+
+	return pad;
+}
+
+/* A MAPv5 coalescing frame carries the headers of the first packet followed
+ * by the payload of all of them. The packets are split evenly over the NLOs,
+ * the payload halving from one NLO to the next, and the checksum error
+ * bitmap is applied to the first NLO.
+ */
+static u32 rmnet_bench_build_coal(struct rmnet_bench *bench,
+				  const struct rmnet_bench_cfg *cfg, u8 *buf)
+{
+	struct rmnet_map_v5_coal_header *coal;
+	u32 hdr_len = rmnet_bench_hdr_len(cfg);
+	u32 data_len = 0, len, pad;
+	u16 pkts = cfg->pkts_per_frame;
+	u8 nlo;
+
+	coal = (struct rmnet_map_v5_coal_header *)
+	       (buf + sizeof(struct rmnet_map_header));
+	memset(coal, 0, sizeof(*coal));
+	coal->header_type = RMNET_MAP_HEADER_TYPE_COALESCING;
+	coal->num_nlos = cfg->nlos;
+	coal->csum_valid = 1;
+	coal->close_type = RMNET_MAP_COAL_CLOSE_HW;
+	coal->close_value = RMNET_MAP_COAL_CLOSE_HW_NL;
+
+	for (nlo = 0; nlo < cfg->nlos; nlo++) {
+		struct rmnet_map_v5_nl_pair *nl_pair = &coal->nl_pairs[nlo];
+		u16 nlo_pkts = pkts / (cfg->nlos - nlo);
+		u16 pkt_len = max_t(u16, cfg->pkt_len >> nlo, 1);
+
+		nl_pair->pkt_len = htons(hdr_len + pkt_len);
+		nl_pair->num_packets = nlo_pkts;
+		if (!nlo)
+			nl_pair->csum_error_bitmap = cfg->csum_err;
+
+		data_len += pkt_len * nlo_pkts;
+		pkts -= nlo_pkts;
+	}
+
+	len = rmnet_bench_build_ip(bench, cfg, (u8 *)(coal + 1), data_len);
+	pad = rmnet_bench_build_map(cfg, buf, len, true);
+	memset((u8 *)(coal + 1) + len, 0, pad);
+
+	return sizeof(struct rmnet_map_header) + sizeof(*coal) + len + pad;
+}
+
+/* One MAP packet per IP packet. With MAPv5, each gets a checksum header,
+ * reporting the checksum as unvalidated if bit 0 of csum_err is set.
+ */
+static u32 rmnet_bench_build_agg(struct rmnet_bench *bench,
+				 const struct rmnet_bench_cfg *cfg, u8 *buf)
+{
+	u32 off = 0, len, pad, hlen;
+	u16 pkt;
+
+	for (pkt = 0; pkt < cfg->pkts_per_frame; pkt++) {
+		u8 *maph = buf + off;
+		u8 *data = maph + sizeof(struct rmnet_map_header);
+
+		if (cfg->map_version == 5) {
+			struct rmnet_map_v5_csum_header *csum;
+
+			csum = (struct rmnet_map_v5_csum_header *)data;
+			memset(csum, 0, sizeof(*csum));
+			csum->header_type = RMNET_MAP_HEADER_TYPE_CSUM_OFFLOAD;
+			csum->csum_valid_required = !(cfg->csum_err & 1);
+			data += sizeof(*csum);
+		}
+
+		len = rmnet_bench_build_ip(bench, cfg, data, cfg->pkt_len);
+		pad = rmnet_bench_build_map(cfg, maph, len,
+					    cfg->map_version == 5);
+		memset(data + len, 0, pad);
+
+		hlen = data - maph;
+		off += hlen + len + pad;
+	}
+
+	return off;
+}
+
+/* Upper bound for the size of a frame with the given config */
+static u32 rmnet_bench_frame_size(const struct rmnet_bench_cfg *cfg)
+{
+	u32 hdr_len = rmnet_bench_hdr_len(cfg);
+	u32 pkt;
+
+	if (cfg->map_version == 5 && cfg->coal)
+		return sizeof(struct rmnet_map_header) +
+		       sizeof(struct rmnet_map_v5_coal_header) +
+		       ALIGN(hdr_len + cfg->pkt_len * cfg->pkts_per_frame, 4);
+
+	pkt = sizeof(struct rmnet_map_header) +
+	      ALIGN(hdr_len + cfg->pkt_len, 4);
+	if (cfg->map_version == 5)
+		pkt += sizeof(struct rmnet_map_v5_csum_header);
+
+	return pkt * cfg->pkts_per_frame;
+}
+
+static int rmnet_bench_cfg_check(const struct rmnet_bench_cfg *cfg)
+{
+	if (cfg->map_version != 1 && cfg->map_version != 5)
+		return -EINVAL;
+
+	if (cfg->coal && cfg->map_version != 5)
+		return -EINVAL;
+
+	if (cfg->ip_version != 4 && cfg->ip_version != 6)
+		return -EINVAL;
+
+	if (cfg->proto != IPPROTO_TCP && cfg->proto != IPPROTO_UDP)
+		return -EINVAL;
+
+	if (!cfg->pkt_len || cfg->pkt_len > RMNET_BENCH_MAX_PKT_LEN ||
+	    !cfg->pkts_per_frame)
+		return -EINVAL;
+
+	if (cfg->coal &&
+	    (!cfg->nlos || cfg->nlos > RMNET_MAP_V5_MAX_NLOS ||
+	     cfg->pkts_per_frame < cfg->nlos ||
+	     cfg->pkts_per_frame > RMNET_MAP_V5_MAX_PACKETS))
+		return -EINVAL;
+
+	if (rmnet_bench_frame_size(cfg) > RMNET_BENCH_MAX_FRAME)
+		return -EMSGSIZE;
+
+	return 0;
+}
+
+/* Build the next downlink frame, either in a page fragment as the IPA driver
+ * hands them to RmNet, or in the linear area of the skb.
+ */
+static struct sk_buff *rmnet_bench_gen_frame(struct rmnet_bench *bench,
+					     const struct rmnet_bench_cfg *cfg,
+					     u32 size)
+{
+	struct sk_buff *skb;
+	struct page *page = NULL;
+	u8 *buf;
+	u32 len;
+
+	if (cfg->paged) {
+		skb = alloc_skb(0, GFP_KERNEL);
+		if (!skb)
+			return NULL;
+
+		page = alloc_pages(GFP_KERNEL | __GFP_COMP, get_order(size));
+		if (!page) {
+			kfree_skb(skb);
+			return NULL;
+		}
+
+		buf = page_address(page);
+	} else {
+		skb = alloc_skb(size, GFP_KERNEL);
+		if (!skb)
+			return NULL;
+
+		buf = skb->data;
+	}
+
+	if (cfg->map_version == 5 && cfg->coal)
+		len = rmnet_bench_build_coal(bench, cfg, buf);
+	else
+		len = rmnet_bench_build_agg(bench, cfg, buf);
+
+	if (page)
+		skb_add_rx_frag(skb, 0, page, 0, len, page_size(page));
+	else
+		skb_put(skb, len);
+
+	skb->dev = bench->dev;
+	skb->protocol = htons(ETH_P_MAP);
+	skb_reset_network_header(skb);
+	return skb;
+}
+
+static int rmnet_bench_dl_run(struct rmnet_bench *bench,
+			      const struct rmnet_bench_cfg *cfg, u32 count)
+{
+	struct rmnet_bench_stage *gen = &bench->stage[RMNET_BENCH_STAGE_GEN];
+	struct rmnet_bench_stage *dl = &bench->stage[RMNET_BENCH_STAGE_DL];
+	u32 pkts = cfg->pkts_per_frame;
+	struct sk_buff *skb;
+	ktime_t start;
+	cycles_t t0, t1, t2;
+	u32 i, len, size;
+	int rc;
+
+	rc = rmnet_bench_cfg_check(cfg);
+	if (rc)
+		return rc;
+
+	size = rmnet_bench_frame_size(cfg);
+
+	if (!netif_running(bench->dev))
+		return -ENETDOWN;
+
+	start = ktime_get();
+	for (i = 0; i < count; i++) {
+		t0 = get_cycles();
+		skb = rmnet_bench_gen_frame(bench, cfg, size);
+		if (!skb) {
+			gen->errs++;
+			rc = -ENOMEM;
+			break;
+		}
+
+		len = skb->len;
+		t1 = get_cycles();
+
+		/* Let the softirqs raised by the delivery run here, so that
+		 * the stack's share of the work is accounted to this stage.
+		 */
+		local_bh_disable();
+		netif_receive_skb(skb);
+		local_bh_enable();
+		t2 = get_cycles();
+
+		gen->frames++;
+		gen->pkts += pkts;
+		gen->bytes += len;
+		gen->cycles += t1 - t0;
+		dl->frames++;
+		dl->pkts += pkts;
+		dl->bytes += len;
+		dl->cycles += t2 - t1;
+
+		if (!(i % RMNET_BENCH_RESCHED))
+			cond_resched();
+	}
+
+	dl->ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	return rc;
+}
+
+/* Uplink packets are sent through an RmNet device stacked on the loopback
+ * one, so they take the full egress and aggregation path before they show
+ * up in the sink.
+ */
+static int rmnet_bench_ul_run(struct rmnet_bench *bench,
+			      const struct rmnet_bench_cfg *cfg, u32 count)
+{
+	struct rmnet_bench_stage *ul = &bench->stage[RMNET_BENCH_STAGE_UL];
+	u32 len = rmnet_bench_hdr_len(cfg) + cfg->pkt_len;
+	struct net_device *dev;
+	struct sk_buff *skb;
+	ktime_t start;
+	cycles_t t0;
+	u32 i, headroom;
+	int rc = 0;
+
+	if (cfg->ip_version != 4 && cfg->ip_version != 6)
+		return -EINVAL;
+
+	if ((cfg->proto != IPPROTO_TCP && cfg->proto != IPPROTO_UDP) ||
+	    !cfg->pkt_len || cfg->pkt_len > RMNET_BENCH_MAX_PKT_LEN)
+		return -EINVAL;
+
+	dev = dev_get_by_index(&init_net, cfg->ul_ifindex);
+	if (!dev)
+		return -ENODEV;
+
+	if (!netif_running(dev)) {
+		rc = -ENETDOWN;
+		goto out;
+	}
+
+	headroom = LL_RESERVED_SPACE(dev);
+	start = ktime_get();
+	for (i = 0; i < count; i++) {
+		skb = alloc_skb(headroom + len + dev->needed_tailroom,
+				GFP_KERNEL);
+		if (!skb) {
+			ul->errs++;
+			rc = -ENOMEM;
+			break;
+		}
+
+		skb_reserve(skb, headroom);
+		rmnet_bench_build_ip(bench, cfg, skb_put(skb, len),
+				     cfg->pkt_len);
+		skb_reset_network_header(skb);
+		skb->protocol = (cfg->ip_version == 4) ? htons(ETH_P_IP) :
+							 htons(ETH_P_IPV6);
+		skb->dev = dev;
+
+		t0 = get_cycles();
+		if (dev_queue_xmit(skb) != NET_XMIT_SUCCESS)
+			ul->errs++;
+		ul->cycles += get_cycles() - t0;
+		ul->frames++;
+		ul->pkts++;
+		ul->bytes += len;
+
+		if (!(i % RMNET_BENCH_RESCHED))
+			cond_resched();
+	}
+
+	ul->ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+out:
+	dev_put(dev);
+	return rc;
+}
+
+/* Uplink sink */
+
+/* Count the MAP packets in an uplink aggregate. MAPv5 headers are flagged in
+ * the MAP header. A MAPv4 checksum header is not, but it is recognized by not
+ * starting with an IP version nibble.
+ */
+static int rmnet_bench_sink_parse(struct sk_buff *skb, u64 *pkts)
+{
+	struct rmnet_map_header *maph, __maph;
+	u32 off = 0, len;
+	u8 *ver, __ver;
+
+	while (off < skb->len) {
+		maph = skb_header_pointer(skb, off, sizeof(*maph), &__maph);
+		if (!maph)
+			return -EINVAL;
+
+		off += sizeof(*maph);
+		len = ntohs(maph->pkt_len);
+		if (maph->next_hdr) {
+			off += sizeof(struct rmnet_map_v5_csum_header);
+		} else if (!maph->cd_bit) {
+			ver = skb_header_pointer(skb, off, sizeof(*ver),
+						 &__ver);
+			if (!ver)
+				return -EINVAL;
+
+			if ((*ver & 0xF0) != 0x40 && (*ver & 0xF0) != 0x60)
+				off += sizeof(struct rmnet_map_ul_csum_header);
+		}
+
+		off += len;
+		if (off > skb->len)
+			return -EINVAL;
+
+		if (!maph->cd_bit)
+			(*pkts)++;
+	}
+
+	return 0;
+}
+
+static netdev_tx_t rmnet_bench_xmit(struct sk_buff *skb,
+				    struct net_device *dev)
+{
+	struct rmnet_bench *bench = &rmnet_bench;
+	struct rmnet_bench_stage *sink;
+	cycles_t t0 = get_cycles();
+	ktime_t now = ktime_get();
+	u64 pkts = 0;
+	int rc;
+
+	rc = rmnet_bench_sink_parse(skb, &pkts);
+
+	spin_lock_bh(&bench->sink_lock);
+	sink = &bench->stage[RMNET_BENCH_STAGE_SINK];
+	if (!sink->frames)
+		bench->sink_first = now;
+	bench->sink_last = now;
+	sink->frames++;
+	sink->pkts += pkts;
+	sink->bytes += skb->len;
+	if (rc)
+		sink->errs++;
+	sink->cycles += get_cycles() - t0;
+	spin_unlock_bh(&bench->sink_lock);
+
+	dev->stats.tx_packets++;
+	dev->stats.tx_bytes += skb->len;
+	consume_skb(skb);
+	return NETDEV_TX_OK;
+}
+
+static const struct net_device_ops rmnet_bench_ops = {
+	.ndo_start_xmit = rmnet_bench_xmit,
+};
+
+static void rmnet_bench_setup(struct net_device *dev)
+{
+	dev->netdev_ops = &rmnet_bench_ops;
+	dev->mtu = RMNET_BENCH_MAX_FRAME;
+	dev->min_mtu = ETH_MIN_MTU;
+	dev->max_mtu = RMNET_BENCH_MAX_FRAME;
+	dev->tx_queue_len = 0;
+
+	/* Raw IP mode, like the IPA device RmNet normally sits on */
+	dev->header_ops = NULL;
+	dev->type = ARPHRD_RAWIP;
+	dev->hard_header_len = 0;
+	dev->flags = IFF_NOARP;
+	dev->features = NETIF_F_SG | NETIF_F_FRAGLIST | NETIF_F_HW_CSUM;
+	dev->hw_features = dev->features;
+	dev->priv_flags |= IFF_NO_QUEUE;
+	dev->needs_free_netdev = true;
+}
+
+/* debugfs */
+
+static void rmnet_bench_reset(struct rmnet_bench *bench)
+{
+	spin_lock_bh(&bench->sink_lock);
+	memset(bench->stage, 0, sizeof(bench->stage));
+	spin_unlock_bh(&bench->sink_lock);
+}
+
+static ssize_t rmnet_bench_run(const char __user *ubuf, size_t len,
+			       int (*run)(struct rmnet_bench *bench,
+					  const struct rmnet_bench_cfg *cfg,
+					  u32 count))
+{
+	struct rmnet_bench *bench = &rmnet_bench;
+	struct rmnet_bench_cfg cfg;
+	u32 count;
+	int rc;
+
+	rc = kstrtou32_from_user(ubuf, len, 0, &count);
+	if (rc)
+		return rc;
+
+	if (mutex_lock_interruptible(&bench->lock))
+		return -EINTR;
+
+	/* The config files can be written at any time, so a run only looks
+	 * at the copy it validated.
+	 */
+	cfg = bench->cfg;
+	rc = run(bench, &cfg, count);
+	mutex_unlock(&bench->lock);
+	return rc ?: len;
+}
+
+static ssize_t rmnet_bench_dl_run_write(struct file *file,
+					const char __user *ubuf, size_t len,
+					loff_t *ppos)
+{
+	return rmnet_bench_run(ubuf, len, rmnet_bench_dl_run);
+}
+
+static const struct file_operations rmnet_bench_dl_run_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = rmnet_bench_dl_run_write,
+	.llseek = noop_llseek,
+};
+
+static ssize_t rmnet_bench_ul_run_write(struct file *file,
+					const char __user *ubuf, size_t len,
+					loff_t *ppos)
+{
+	return rmnet_bench_run(ubuf, len, rmnet_bench_ul_run);
+}
+
+static const struct file_operations rmnet_bench_ul_run_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = rmnet_bench_ul_run_write,
+	.llseek = noop_llseek,
+};
+
+static ssize_t rmnet_bench_reset_write(struct file *file,
+				       const char __user *ubuf, size_t len,
+				       loff_t *ppos)
+{
+	struct rmnet_bench *bench = &rmnet_bench;
+
+	if (mutex_lock_interruptible(&bench->lock))
+		return -EINTR;
+
+	rmnet_bench_reset(bench);
+	mutex_unlock(&bench->lock);
+	return len;
+}
+
+static const struct file_operations rmnet_bench_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = rmnet_bench_reset_write,
+	.llseek = noop_llseek,
+};
+
+static int rmnet_bench_stats_show(struct seq_file *s, void *unused)
+{
+	struct rmnet_bench *bench = s->private;
+	struct rmnet_bench_stage stage[RMNET_BENCH_STAGE_MAX];
+	int i;
+
+	spin_lock_bh(&bench->sink_lock);
+	memcpy(stage, bench->stage, sizeof(stage));
+	stage[RMNET_BENCH_STAGE_SINK].ns =
+		ktime_to_ns(ktime_sub(bench->sink_last, bench->sink_first));
+	spin_unlock_bh(&bench->sink_lock);
+
+	/* Generation runs back to back with the delivery */
+	stage[RMNET_BENCH_STAGE_GEN].ns = stage[RMNET_BENCH_STAGE_DL].ns;
+
+	seq_printf(s, "%-6s %12s %12s %14s %12s %14s %10s %10s %8s\n",
+		   "stage", "frames", "pkts", "bytes", "pps", "bytes/s",
+		   "cyc/frame", "cyc/pkt", "errs");
+	for (i = 0; i < RMNET_BENCH_STAGE_MAX; i++) {
+		struct rmnet_bench_stage *st = &stage[i];
+		u64 pps = 0, bps = 0, cpf = 0, cpp = 0;
+
+		if (st->ns) {
+			pps = mul_u64_u64_div_u64(st->pkts, NSEC_PER_SEC,
+						  st->ns);
+			bps = mul_u64_u64_div_u64(st->bytes, NSEC_PER_SEC,
+						  st->ns);
+		}
+
+		if (st->frames)
+			cpf = div64_u64(st->cycles, st->frames);
+		if (st->pkts)
+			cpp = div64_u64(st->cycles, st->pkts);
+
+		seq_printf(s,
+			   "%-6s %12llu %12llu %14llu %12llu %14llu %10llu %10llu %8llu\n",
+			   rmnet_bench_stage_names[i], st->frames, st->pkts,
+			   st->bytes, pps, bps, cpf, cpp, st->errs);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(rmnet_bench_stats);
+
+static void rmnet_bench_dbgfs_init(struct rmnet_bench *bench)
+{
+	struct rmnet_bench_cfg *cfg = &bench->cfg;
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("rmnet_bench", NULL);
+	bench->dbgfs_dir = dir;
+
+	debugfs_create_u8("map_version", 0644, dir, &cfg->map_version);
+	debugfs_create_bool("coal", 0644, dir, &cfg->coal);
+	debugfs_create_u8("ip_version", 0644, dir, &cfg->ip_version);
+	debugfs_create_u8("proto", 0644, dir, &cfg->proto);
+	debugfs_create_u8("mux_id", 0644, dir, &cfg->mux_id);
+	debugfs_create_u16("pkt_len", 0644, dir, &cfg->pkt_len);
+	debugfs_create_u16("pkts_per_frame", 0644, dir, &cfg->pkts_per_frame);
+	debugfs_create_u8("nlos", 0644, dir, &cfg->nlos);
+	debugfs_create_x8("csum_err", 0644, dir, &cfg->csum_err);
+	debugfs_create_bool("paged", 0644, dir, &cfg->paged);
+	debugfs_create_u32("ul_ifindex", 0644, dir, &cfg->ul_ifindex);
+
+	debugfs_create_file("dl_run", 0200, dir, bench,
+			    &rmnet_bench_dl_run_fops);
+	debugfs_create_file("ul_run", 0200, dir, bench,
+			    &rmnet_bench_ul_run_fops);
+	debugfs_create_file("reset", 0200, dir, bench,
+			    &rmnet_bench_reset_fops);
+	debugfs_create_file("stats", 0444, dir, bench,
+			    &rmnet_bench_stats_fops);
+}
+
+static int __init rmnet_bench_init(void)
+{
+	struct rmnet_bench *bench = &rmnet_bench;
+	struct net_device *dev;
+	int rc;
+
+	mutex_init(&bench->lock);
+	spin_lock_init(&bench->sink_lock);
+
+	dev = alloc_netdev(0, devname, NET_NAME_UNKNOWN, rmnet_bench_setup);
+	if (!dev)
+		return -ENOMEM;
+
+	rc = register_netdev(dev);
+	if (rc) {
+		free_netdev(dev);
+		return rc;
+	}
+
+	bench->dev = dev;
+	rmnet_bench_dbgfs_init(bench);
+	return 0;
+}
+
+static void __exit rmnet_bench_exit(void)
+{
+	struct rmnet_bench *bench = &rmnet_bench;
+
+	debugfs_remove_recursive(bench->dbgfs_dir);
+	unregister_netdev(bench->dev);
+}
+
+module_init(rmnet_bench_init);
+module_exit(rmnet_bench_exit);
+MODULE_DESCRIPTION("RmNet synthetic traffic generator");
+MODULE_LICENSE("GPL v2");
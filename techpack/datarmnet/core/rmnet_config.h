@@ -15,6 +15,7 @@
  */
 
 #include <linux/skbuff.h>
+#include <linux/ptr_ring.h>
 #include <net/gro_cells.h>
 
 #ifndef _RMNET_CONFIG_H_
@@ -66,6 +67,7 @@ struct rmnet_ip_route_endpoint {
 struct rmnet_agg_stats {
 	u64 ul_agg_reuse;
 	u64 ul_agg_alloc;
+	u64 ul_agg_bypass;
 };
 
 struct rmnet_port_priv_stats {
@@ -100,12 +102,31 @@ enum {
 	RMNET_MAX_AGG_STATE,
 };
 
+#define RMNET_AGG_POOL_PAGES 512
+#define RMNET_AGG_PAGE_CACHE 8
+
+/* Recycled pages known to be free, for use by one CPU */
+struct rmnet_agg_page_cache {
+	unsigned int count;
+	struct page *pages[RMNET_AGG_PAGE_CACHE];
+};
+
+/* Aggregation pages are recycled once the driver has dropped its reference.
+ * The ring holds every page of the pool which is not in a CPU cache, oldest
+ * handed out first.
+ */
+struct rmnet_agg_page_pool {
+	struct ptr_ring ring;
+	struct rmnet_agg_page_cache __percpu *cache;
+};
+
 struct rmnet_aggregation_state {
 	struct rmnet_egress_agg_params params;
-	struct timespec64 agg_time;
-	struct timespec64 agg_last;
+	ktime_t agg_time;
+	ktime_t agg_last;
+	/* Average gap between UL packets in ns, scaled by 8 */
+	u64 agg_gap;
 	struct hrtimer hrtimer;
-	struct work_struct agg_wq;
 	/* Protect aggregation related elements */
 	spinlock_t agg_lock;
 	struct sk_buff *agg_skb;
@@ -113,18 +134,11 @@ struct rmnet_aggregation_state {
 	int agg_state;
 	u8 agg_count;
 	u8 agg_size_order;
-	struct list_head agg_list;
-	struct rmnet_agg_page *agg_head;
+	struct rmnet_agg_page_pool pool;
 	struct rmnet_agg_stats *stats;
 };
 
 
-struct rmnet_agg_page {
-	struct list_head list;
-	struct page *page;
-};
-
-
 /* One instance of this structure is instantiated for each real_dev associated
  * with rmnet.
  */
@@ -152,6 +166,8 @@ struct rmnet_port {
 	/* Descriptor pool */
 	spinlock_t desc_pool_lock;
 	struct rmnet_frag_descriptor_pool *frag_desc_pool;
+	/* Coalesced segments held back for the next frame of the flow */
+	struct rmnet_frag_descriptor *gro_desc;
 };
 
 extern struct rtnl_link_ops rmnet_link_ops;
@@ -196,6 +212,8 @@ struct rmnet_coal_stats {
 	u64 coal_tcp_bytes;
 	u64 coal_udp;
 	u64 coal_udp_bytes;
+	u64 coal_tail_merge;
+	u64 coal_frame_merge;
 };
 
 struct rmnet_priv_stats {
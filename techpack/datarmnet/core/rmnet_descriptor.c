@@ -1068,14 +1068,220 @@ void rmnet_frag_deliver(struct rmnet_frag_descriptor *frag_desc,
 }
 EXPORT_SYMBOL(rmnet_frag_deliver);
 
+/* Largest IP packet a merged descriptor may grow to. The length has to fit
+ * in the IP header once the skb is built.
+ */
+#define RMNET_FRAG_GRO_MAX_LEN 0xFFFF
+#define RMNET_FRAG_GRO_MAX_HDR (sizeof(struct ipv6hdr) + 60)
+
+static __be32 rmnet_frag_tcp_flag_word(struct rmnet_frag_descriptor *frag_desc,
+				       struct tcphdr *th)
+{
+	__be32 flag_word = tcp_flag_word(th);
+
+	if (frag_desc->tcp_flags_set)
+		*((__be16 *)&flag_word) = frag_desc->tcp_flags;
+
+	return flag_word;
+}
+
+/* Whether the descriptor ends with a segment shorter than gso_size, after
+ * which no more data can be added.
+ */
+static bool rmnet_frag_gro_has_tail(struct rmnet_frag_descriptor *frag_desc)
+{
+	u32 dlen = frag_desc->len - frag_desc->ip_len - frag_desc->trans_len;
+
+	return dlen != frag_desc->gso_size * frag_desc->gso_segs;
+}
+
+/* Only coalesced segments with known-good checksums and no IP options or
+ * extension headers are held back.
+ */
+static bool rmnet_frag_gro_eligible(struct rmnet_frag_descriptor *frag_desc)
+{
+	u16 ip_len = (frag_desc->ip_proto == 4) ? sizeof(struct iphdr) :
+						  sizeof(struct ipv6hdr);
+
+	return (frag_desc->dev->features & NETIF_F_GRO_HW) &&
+	       frag_desc->hdrs_valid && frag_desc->csum_valid &&
+	       frag_desc->gso_size && frag_desc->gso_segs &&
+	       frag_desc->ip_len == ip_len &&
+	       !rmnet_frag_gro_has_tail(frag_desc);
+}
+
+/* Check that frag_desc carries the next segments of the held flow, under the
+ * same rules GRO uses. On success, *flush says whether the merged descriptor
+ * must be delivered right away.
+ */
+static bool rmnet_frag_gro_match(struct rmnet_frag_descriptor *held,
+				 struct rmnet_frag_descriptor *frag_desc,
+				 bool *flush)
+{
+	u8 __held_hdr[RMNET_FRAG_GRO_MAX_HDR], __hdr[RMNET_FRAG_GRO_MAX_HDR];
+	u32 hlen = held->ip_len + held->trans_len;
+	u8 *held_hdr, *hdr;
+
+	if (frag_desc->dev != held->dev ||
+	    !frag_desc->hdrs_valid || !frag_desc->csum_valid ||
+	    frag_desc->ip_proto != held->ip_proto ||
+	    frag_desc->trans_proto != held->trans_proto ||
+	    frag_desc->ip_len != held->ip_len ||
+	    frag_desc->trans_len != held->trans_len ||
+	    frag_desc->gso_size != held->gso_size ||
+	    frag_desc->len <= hlen ||
+	    held->len + frag_desc->len - hlen > RMNET_FRAG_GRO_MAX_LEN)
+		return false;
+
+	held_hdr = rmnet_frag_header_ptr(held, 0, hlen, __held_hdr);
+	hdr = rmnet_frag_header_ptr(frag_desc, 0, hlen, __hdr);
+	if (!held_hdr || !hdr)
+		return false;
+
+	if (held->ip_proto == 4) {
+		struct iphdr *iph1 = (struct iphdr *)held_hdr;
+		struct iphdr *iph2 = (struct iphdr *)hdr;
+
+		if (iph1->saddr != iph2->saddr || iph1->daddr != iph2->daddr ||
+		    iph1->tos != iph2->tos || iph1->ttl != iph2->ttl)
+			return false;
+	} else {
+		struct ipv6hdr *ip6h1 = (struct ipv6hdr *)held_hdr;
+		struct ipv6hdr *ip6h2 = (struct ipv6hdr *)hdr;
+
+		/* Version, traffic class and flow label */
+		if (*(__be32 *)ip6h1 != *(__be32 *)ip6h2 ||
+		    ip6h1->hop_limit != ip6h2->hop_limit ||
+		    ipv6_addr_cmp(&ip6h1->saddr, &ip6h2->saddr) ||
+		    ipv6_addr_cmp(&ip6h1->daddr, &ip6h2->daddr))
+			return false;
+	}
+
+	if (held->trans_proto == IPPROTO_TCP) {
+		struct tcphdr *th1 = (struct tcphdr *)(held_hdr + held->ip_len);
+		struct tcphdr *th2 = (struct tcphdr *)(hdr + held->ip_len);
+		__be32 flags1 = rmnet_frag_tcp_flag_word(held, th1);
+		__be32 flags2 = rmnet_frag_tcp_flag_word(frag_desc, th2);
+		__be32 seq1 = held->tcp_seq_set ? held->tcp_seq : th1->seq;
+		__be32 seq2 = frag_desc->tcp_seq_set ? frag_desc->tcp_seq :
+						       th2->seq;
+
+		if (th1->source != th2->source || th1->dest != th2->dest ||
+		    th1->ack_seq != th2->ack_seq ||
+		    ntohl(seq1) + held->len - hlen != ntohl(seq2))
+			return false;
+
+		/* Same window and flags, only the last segment may push */
+		if ((flags1 ^ flags2) & ~TCP_FLAG_PSH ||
+		    flags1 & (TCP_FLAG_PSH | TCP_FLAG_FIN | TCP_FLAG_SYN |
+			      TCP_FLAG_RST | TCP_FLAG_URG | TCP_FLAG_CWR))
+			return false;
+
+		if (memcmp(th1 + 1, th2 + 1, held->trans_len - sizeof(*th1)))
+			return false;
+
+		*flush = !!(flags2 & TCP_FLAG_PSH);
+	} else {
+		struct udphdr *uh1 = (struct udphdr *)(held_hdr + held->ip_len);
+		struct udphdr *uh2 = (struct udphdr *)(hdr + held->ip_len);
+
+		if (uh1->source != uh2->source || uh1->dest != uh2->dest)
+			return false;
+
+		*flush = false;
+	}
+
+	*flush |= rmnet_frag_gro_has_tail(frag_desc);
+	return true;
+}
+
+/* Move the payload of frag_desc to the end of the held descriptor */
+static void rmnet_frag_gro_merge(struct rmnet_frag_descriptor *held,
+				 struct rmnet_frag_descriptor *frag_desc,
+				 struct rmnet_port *port)
+{
+	struct rmnet_priv *priv = netdev_priv(held->dev);
+	struct tcphdr *th, __th;
+	__be32 flag_word;
+
+	/* The last segment decides whether the merged one pushes */
+	if (held->trans_proto == IPPROTO_TCP) {
+		th = rmnet_frag_header_ptr(frag_desc, frag_desc->ip_len,
+					   sizeof(*th), &__th);
+		if (th) {
+			flag_word = rmnet_frag_tcp_flag_word(frag_desc, th);
+			held->tcp_flags_set = 1;
+			held->tcp_flags = *((__be16 *)&flag_word);
+		}
+	}
+
+	/* Can't fail, rmnet_frag_gro_match() made sure there is payload */
+	rmnet_frag_pull(frag_desc, port, held->ip_len + held->trans_len);
+	list_splice_tail_init(&frag_desc->frags, &held->frags);
+	held->len += frag_desc->len;
+	held->gso_segs += frag_desc->gso_segs;
+	held->coal_bytes += frag_desc->coal_bytes;
+	held->coal_bufsize += frag_desc->coal_bufsize;
+
+	priv->stats.coal.coal_frame_merge++;
+	rmnet_recycle_frag_descriptor(frag_desc, port);
+}
+
+static void rmnet_frag_gro_flush(struct rmnet_port *port)
+{
+	struct rmnet_frag_descriptor *held = port->gro_desc;
+
+	if (!held)
+		return;
+
+	port->gro_desc = NULL;
+	rmnet_frag_deliver(held, port);
+}
+
+/* Deliver a descriptor, unless it can be merged with the segments held from
+ * the previous coalesced frame, or can hold the ones of the next. The modem
+ * closes coalesced frames on size and time limits, so a bulk flow usually
+ * shows up as several of them in a row, each of which would otherwise become
+ * its own skb. At most one descriptor is held, so ordering is preserved, and
+ * it is flushed at the end of every chain.
+ */
+static void rmnet_frag_gro_receive(struct rmnet_frag_descriptor *frag_desc,
+				   struct rmnet_port *port)
+{
+	struct rmnet_frag_descriptor *held = port->gro_desc;
+	bool flush;
+
+	if (held) {
+		if (rmnet_frag_gro_match(held, frag_desc, &flush)) {
+			rmnet_frag_gro_merge(held, frag_desc, port);
+			if (flush)
+				rmnet_frag_gro_flush(port);
+			return;
+		}
+
+		rmnet_frag_gro_flush(port);
+	}
+
+	if (rmnet_frag_gro_eligible(frag_desc)) {
+		port->gro_desc = frag_desc;
+		return;
+	}
+
+	rmnet_frag_deliver(frag_desc, port);
+}
+
+/* Segment out the next gso_segs packets of the coalesced frame. If tail_len
+ * is set, the last of them is that long instead of gso_size.
+ */
 static void __rmnet_frag_segment_data(struct rmnet_frag_descriptor *coal_desc,
 				      struct rmnet_port *port,
 				      struct list_head *list, u8 pkt_id,
-				      bool csum_valid)
+				      bool csum_valid, u16 tail_len)
 {
 	struct rmnet_priv *priv = netdev_priv(coal_desc->dev);
 	struct rmnet_frag_descriptor *new_desc;
-	u32 dlen = coal_desc->gso_size * coal_desc->gso_segs;
+	u32 dlen = coal_desc->gso_size * (coal_desc->gso_segs - !!tail_len) +
+		   tail_len;
 	u32 hlen = coal_desc->ip_len + coal_desc->trans_len;
 	u32 offset = hlen + coal_desc->data_offset;
 	int rc;
@@ -1219,8 +1425,8 @@ rmnet_frag_segment_coal_data(struct rmnet_frag_descriptor *coal_desc,
 	struct rmnet_map_v5_coal_header coal_hdr;
 	struct rmnet_fragment *frag;
 	u8 *version;
-	u16 pkt_len;
-	u8 pkt, total_pkt = 0;
+	u16 pkt_len, tail_len;
+	u8 pkt, total_pkt = 0, first = 0;
 	u8 nlo;
 	bool gro = coal_desc->dev->features & NETIF_F_GRO_HW;
 	bool zero_csum = false;
@@ -1379,7 +1585,7 @@ rmnet_frag_segment_coal_data(struct rmnet_frag_descriptor *coal_desc,
 		pkt_len = ntohs(coal_hdr.nl_pairs[nlo].pkt_len);
 		pkt_len -= coal_desc->ip_len + coal_desc->trans_len;
 		coal_desc->gso_size = pkt_len;
-		for (pkt = 0; pkt < coal_hdr.nl_pairs[nlo].num_packets;
+		for (pkt = first; pkt < coal_hdr.nl_pairs[nlo].num_packets;
 		     pkt++, total_pkt++, nlo_err_mask >>= 1) {
 			bool csum_err = nlo_err_mask & 1;
 
@@ -1393,7 +1599,7 @@ rmnet_frag_segment_coal_data(struct rmnet_frag_descriptor *coal_desc,
 
 				__rmnet_frag_segment_data(coal_desc, port,
 							  list, total_pkt,
-							  !csum_err);
+							  !csum_err, 0);
 				continue;
 			}
 
@@ -1406,13 +1612,13 @@ rmnet_frag_segment_coal_data(struct rmnet_frag_descriptor *coal_desc,
 								  port,
 								  list,
 								  total_pkt,
-								  true);
+								  true, 0);
 
 				/* Segment out the bad checksum */
 				coal_desc->gso_segs = 1;
 				__rmnet_frag_segment_data(coal_desc, port,
 							  list, total_pkt,
-							  false);
+							  false, 0);
 			} else {
 				coal_desc->gso_segs++;
 			}
@@ -1420,11 +1626,31 @@ rmnet_frag_segment_coal_data(struct rmnet_frag_descriptor *coal_desc,
 
 		/* If we're switching NLOs, we need to send out everything from
 		 * the previous one, if we haven't done so. NLOs only switch
-		 * when the packet length changes.
+		 * when the packet length changes. If the first packet of the
+		 * next NLO is shorter, it can still end this one, just like
+		 * GRO would have let it.
 		 */
+		first = 0;
+		tail_len = 0;
+		if (gro && coal_desc->gso_segs && nlo + 1 < coal_hdr.num_nlos &&
+		    coal_hdr.nl_pairs[nlo + 1].num_packets &&
+		    !(nlo_err_mask & 1)) {
+			tail_len = ntohs(coal_hdr.nl_pairs[nlo + 1].pkt_len);
+			tail_len -= coal_desc->ip_len + coal_desc->trans_len;
+			if (tail_len && tail_len < coal_desc->gso_size) {
+				coal_desc->gso_segs++;
+				total_pkt++;
+				nlo_err_mask >>= 1;
+				first = 1;
+				priv->stats.coal.coal_tail_merge++;
+			} else {
+				tail_len = 0;
+			}
+		}
+
 		if (coal_desc->gso_segs)
 			__rmnet_frag_segment_data(coal_desc, port, list,
-						  total_pkt, true);
+						  total_pkt, true, tail_len);
 	}
 }
 
@@ -1778,6 +2004,8 @@ __rmnet_frag_ingress_handler(struct rmnet_frag_descriptor *frag_desc,
 	len = ntohs(qmap->pkt_len) - pad;
 
 	if (qmap->cd_bit) {
+		/* Commands apply to everything received before them */
+		rmnet_frag_gro_flush(port);
 		qmi_rmnet_set_dl_msg_active(port);
 		if (port->data_format & RMNET_INGRESS_FORMAT_DL_MARKER) {
 			rmnet_frag_flow_command(frag_desc, port, len);
@@ -1826,6 +2054,7 @@ __rmnet_frag_ingress_handler(struct rmnet_frag_descriptor *frag_desc,
 	rcu_read_lock();
 	rmnet_perf_ingress = rcu_dereference(rmnet_perf_desc_entry);
 	if (rmnet_perf_ingress) {
+		rmnet_frag_gro_flush(port);
 		list_for_each_entry_safe(frag, tmp, &segs, list) {
 			list_del_init(&frag->list);
 			rmnet_perf_ingress(frag, port);
@@ -1838,7 +2067,7 @@ __rmnet_frag_ingress_handler(struct rmnet_frag_descriptor *frag_desc,
 no_perf:
 	list_for_each_entry_safe(frag, tmp, &segs, list) {
 		list_del_init(&frag->list);
-		rmnet_frag_deliver(frag, port);
+		rmnet_frag_gro_receive(frag, port);
 	}
 	return;
 
@@ -1920,6 +2149,7 @@ void rmnet_frag_ingress_handler(struct sk_buff *skb,
 		skb = skb_frag;
 	}
 
+	rmnet_frag_gro_flush(port);
 	rmnet_descriptor_classify_chain_count(chain_count, port);
 
 	if (skip_perf)
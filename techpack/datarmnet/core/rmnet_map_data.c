@@ -1230,6 +1230,7 @@ int rmnet_map_process_next_hdr_packet(struct sk_buff *skb,
 
 long rmnet_agg_time_limit __read_mostly = 1000000L;
 long rmnet_agg_bypass_time __read_mostly = 10000000L;
+long rmnet_agg_idle_min __read_mostly = 100000L;
 
 int rmnet_map_tx_agg_skip(struct sk_buff *skb, int offset)
 {
@@ -1259,38 +1260,83 @@ int rmnet_map_tx_agg_skip(struct sk_buff *skb, int offset)
 	return is_icmp;
 }
 
-static void rmnet_map_flush_tx_packet_work(struct work_struct *work)
+/* Fold the time since the previous UL packet into the average gap. Idle
+ * periods count as rmnet_agg_bypass_time, so a single one doesn't hold
+ * back the aggregation of the burst that follows it for long.
+ */
+static void rmnet_map_agg_gap_update(struct rmnet_aggregation_state *state,
+				     s64 gap)
+{
+	gap = clamp_t(s64, gap, 0, rmnet_agg_bypass_time);
+	state->agg_gap += gap - (state->agg_gap >> 3);
+}
+
+/* An aggregate is flushed once no packet has come in for about twice the
+ * average gap, or when it is older than the configured time. Bulk flows keep
+ * filling their aggregates, while sparse ones don't wait for packets which
+ * are not coming.
+ */
+static u64 rmnet_map_agg_idle_time(struct rmnet_aggregation_state *state)
+{
+	return clamp_t(u64, (state->agg_gap >> 3) * 2, rmnet_agg_idle_min,
+		       state->params.agg_time);
+}
+
+/* Flows too sparse for a second packet to come in before the flush gain
+ * nothing from aggregation.
+ */
+static bool rmnet_map_agg_bypass(struct rmnet_aggregation_state *state)
+{
+	return (state->agg_gap >> 3) * 2 > state->params.agg_time;
+}
+
+static enum hrtimer_restart
+rmnet_map_flush_tx_packet_queue(struct hrtimer *t)
 {
-	struct sk_buff *skb = NULL;
 	struct rmnet_aggregation_state *state;
+	enum hrtimer_restart rc = HRTIMER_NORESTART;
+	struct sk_buff *skb = NULL;
+	s64 idle, age, idle_time, next;
+	ktime_t now;
+
+	state = container_of(t, struct rmnet_aggregation_state, hrtimer);
 
-	state = container_of(work, struct rmnet_aggregation_state, agg_wq);
+	spin_lock(&state->agg_lock);
+	/* Rearmed for a new aggregate while waiting for the lock */
+	if (hrtimer_is_queued(t))
+		goto out;
 
-	spin_lock_bh(&state->agg_lock);
 	if (likely(state->agg_state == -EINPROGRESS)) {
+		now = ktime_get();
+		idle = ktime_to_ns(ktime_sub(now, state->agg_last));
+		age = ktime_to_ns(ktime_sub(now, state->agg_time));
+		idle_time = rmnet_map_agg_idle_time(state);
+
+		/* Packets are still coming in, keep aggregating */
+		if (state->agg_skb && idle < idle_time &&
+		    age < state->params.agg_time) {
+			next = min_t(s64, idle_time - idle,
+				     state->params.agg_time - age);
+			hrtimer_forward_now(t, ns_to_ktime(next));
+			rc = HRTIMER_RESTART;
+			goto out;
+		}
+
 		/* Buffer may have already been shipped out */
 		if (likely(state->agg_skb)) {
 			skb = state->agg_skb;
 			state->agg_skb = NULL;
 			state->agg_count = 0;
-			memset(&state->agg_time, 0, sizeof(state->agg_time));
+			state->agg_time = 0;
 		}
 		state->agg_state = 0;
 	}
 
 	if (skb)
 		state->send_agg_skb(skb);
-	spin_unlock_bh(&state->agg_lock);
-}
-
-enum hrtimer_restart rmnet_map_flush_tx_packet_queue(struct hrtimer *t)
-{
-	struct rmnet_aggregation_state *state;
-
-	state = container_of(t, struct rmnet_aggregation_state, hrtimer);
-
-	schedule_work(&state->agg_wq);
-	return HRTIMER_NORESTART;
+out:
+	spin_unlock(&state->agg_lock);
+	return rc;
 }
 
 static void rmnet_map_linearize_copy(struct sk_buff *dst, struct sk_buff *src)
@@ -1328,43 +1374,86 @@ static void rmnet_map_linearize_copy(struct sk_buff *dst, struct sk_buff *src)
 
 static void rmnet_free_agg_pages(struct rmnet_aggregation_state *state)
 {
-	struct rmnet_agg_page *agg_page, *idx;
+	struct rmnet_agg_page_pool *pool = &state->pool;
+	struct page *page;
+	int cpu;
+
+	if (pool->cache) {
+		for_each_possible_cpu(cpu) {
+			struct rmnet_agg_page_cache *cache;
 
-	list_for_each_entry_safe(agg_page, idx, &state->agg_list, list) {
-		list_del(&agg_page->list);
-		put_page(agg_page->page);
-		kfree(agg_page);
+			cache = per_cpu_ptr(pool->cache, cpu);
+			while (cache->count)
+				put_page(cache->pages[--cache->count]);
+		}
+
+		free_percpu(pool->cache);
+		pool->cache = NULL;
 	}
 
-	state->agg_head = NULL;
+	/* Pages still in flight are freed by whoever holds them */
+	while ((page = __ptr_ring_consume(&pool->ring)))
+		put_page(page);
+
+	ptr_ring_cleanup(&pool->ring, NULL);
+	memset(&pool->ring, 0, sizeof(pool->ring));
 }
 
-static struct page *rmnet_get_agg_pages(struct rmnet_aggregation_state *state)
+/* Keep a reference to a page handed out, to find it again once it is free.
+ * The ring has room for twice the pages of the pool, as consumed slots are
+ * only released in batches.
+ */
+static void rmnet_agg_pool_track(struct rmnet_agg_page_pool *pool,
+				 struct page *page)
 {
-	struct rmnet_agg_page *agg_page;
-	struct page *page = NULL;
-	int i = 0;
+	if (__ptr_ring_produce(&pool->ring, page))
+		put_page(page);
+}
 
-	if (!(state->params.agg_features & RMNET_PAGE_RECYCLE))
-		goto alloc;
+/* Move pages the driver is done with from the ring to this CPU's cache.
+ * Pages are handed out in ring order and usually come back in the same
+ * order, so only the head of the ring is checked.
+ */
+static void rmnet_agg_pool_refill(struct rmnet_agg_page_pool *pool,
+				  struct rmnet_agg_page_cache *cache)
+{
+	struct page *page;
+	int i;
 
-	do {
-		agg_page = state->agg_head;
-		if (unlikely(!agg_page))
+	for (i = 0; i < 2 * RMNET_AGG_PAGE_CACHE; i++) {
+		page = __ptr_ring_consume(&pool->ring);
+		if (!page)
 			break;
 
-		if (page_ref_count(agg_page->page) == 1) {
-			page = agg_page->page;
-			page_ref_inc(agg_page->page);
-
-			state->stats->ul_agg_reuse++;
-			state->agg_head = list_next_entry(agg_page, list);
-			break;
+		if (page_ref_count(page) == 1) {
+			cache->pages[cache->count++] = page;
+			if (cache->count == RMNET_AGG_PAGE_CACHE)
+				break;
+		} else {
+			rmnet_agg_pool_track(pool, page);
 		}
+	}
+}
+
+static struct page *rmnet_get_agg_pages(struct rmnet_aggregation_state *state)
+{
+	struct rmnet_agg_page_pool *pool = &state->pool;
+	struct rmnet_agg_page_cache *cache;
+	struct page *page = NULL;
 
-		state->agg_head = list_next_entry(agg_page, list);
-		i++;
-	} while (i <= 5);
+	if (!(state->params.agg_features & RMNET_PAGE_RECYCLE) || !pool->cache)
+		goto alloc;
+
+	cache = this_cpu_ptr(pool->cache);
+	if (!cache->count)
+		rmnet_agg_pool_refill(pool, cache);
+
+	if (cache->count) {
+		page = cache->pages[--cache->count];
+		page_ref_inc(page);
+		rmnet_agg_pool_track(pool, page);
+		state->stats->ul_agg_reuse++;
+	}
 
 alloc:
 	if (!page) {
@@ -1375,42 +1464,26 @@ static struct page *rmnet_get_agg_pages(struct rmnet_aggregation_state *state)
 	return page;
 }
 
-static struct rmnet_agg_page *
-__rmnet_alloc_agg_pages(struct rmnet_aggregation_state *state)
+static void rmnet_alloc_agg_pages(struct rmnet_aggregation_state *state)
 {
-	struct rmnet_agg_page *agg_page;
+	struct rmnet_agg_page_pool *pool = &state->pool;
 	struct page *page;
+	int i = 0;
 
-	agg_page = kzalloc(sizeof(*agg_page), GFP_ATOMIC);
-	if (!agg_page)
-		return NULL;
-
-	page = __dev_alloc_pages(GFP_ATOMIC, state->agg_size_order);
-	if (!page) {
-		kfree(agg_page);
-		return NULL;
-	}
-
-	agg_page->page = page;
-	INIT_LIST_HEAD(&agg_page->list);
-
-	return agg_page;
-}
+	if (ptr_ring_init(&pool->ring, 2 * RMNET_AGG_POOL_PAGES, GFP_ATOMIC))
+		return;
 
-static void rmnet_alloc_agg_pages(struct rmnet_aggregation_state *state)
-{
-	struct rmnet_agg_page *agg_page = NULL;
-	int i = 0;
+	pool->cache = alloc_percpu_gfp(struct rmnet_agg_page_cache,
+				       GFP_ATOMIC);
+	if (!pool->cache)
+		return;
 
-	for (i = 0; i < 512; i++) {
-		agg_page = __rmnet_alloc_agg_pages(state);
+	for (i = 0; i < RMNET_AGG_POOL_PAGES; i++) {
+		page = __dev_alloc_pages(GFP_ATOMIC, state->agg_size_order);
 
-		if (agg_page)
-			list_add_tail(&agg_page->list, &state->agg_list);
+		if (page)
+			rmnet_agg_pool_track(pool, page);
 	}
-
-	state->agg_head = list_first_entry_or_null(&state->agg_list,
-						   struct rmnet_agg_page, list);
 }
 
 static struct sk_buff *
@@ -1450,7 +1523,7 @@ void rmnet_map_send_agg_skb(struct rmnet_aggregation_state *state)
 	/* Reset the aggregation state */
 	state->agg_skb = NULL;
 	state->agg_count = 0;
-	memset(&state->agg_time, 0, sizeof(state->agg_time));
+	state->agg_time = 0;
 	state->agg_state = 0;
 	state->send_agg_skb(agg_skb);
 	spin_unlock_bh(&state->agg_lock);
@@ -1461,16 +1534,18 @@ void rmnet_map_tx_aggregate(struct sk_buff *skb, struct rmnet_port *port,
 			    bool low_latency)
 {
 	struct rmnet_aggregation_state *state;
-	struct timespec64 diff, last;
+	ktime_t last;
+	s64 diff;
 	int size;
 
 	state = &port->agg_state[(low_latency) ? RMNET_LL_AGG_STATE :
 						 RMNET_DEFAULT_AGG_STATE];
 
-new_packet:
 	spin_lock_bh(&state->agg_lock);
-	memcpy(&last, &state->agg_last, sizeof(last));
-	ktime_get_real_ts64(&state->agg_last);
+	last = state->agg_last;
+	state->agg_last = ktime_get();
+	diff = ktime_to_ns(ktime_sub(state->agg_last, last));
+	rmnet_map_agg_gap_update(state, diff);
 
 	if ((port->data_format & RMNET_EGRESS_FORMAT_PRIORITY) &&
 	    (RMNET_LLM(skb->priority) || RMNET_APS_LLB(skb->priority))) {
@@ -1482,15 +1557,18 @@ void rmnet_map_tx_aggregate(struct sk_buff *skb, struct rmnet_port *port,
 		return;
 	}
 
+new_packet:
 	if (!state->agg_skb) {
 		/* Check to see if we should agg first. If the traffic is very
-		 * sparse, don't aggregate. We will need to tune this later
+		 * sparse, don't aggregate.
 		 */
-		diff = timespec64_sub(state->agg_last, last);
 		size = state->params.agg_size - skb->len;
 
-		if (diff.tv_sec > 0 || diff.tv_nsec > rmnet_agg_bypass_time ||
-		    size <= 0) {
+		if (diff > rmnet_agg_bypass_time ||
+		    rmnet_map_agg_bypass(state) || size <= 0) {
+			if (size > 0)
+				state->stats->ul_agg_bypass++;
+
 			skb->protocol = htons(ETH_P_MAP);
 			state->send_agg_skb(skb);
 			spin_unlock_bh(&state->agg_lock);
@@ -1501,7 +1579,7 @@ void rmnet_map_tx_aggregate(struct sk_buff *skb, struct rmnet_port *port,
 		if (!state->agg_skb) {
 			state->agg_skb = NULL;
 			state->agg_count = 0;
-			memset(&state->agg_time, 0, sizeof(state->agg_time));
+			state->agg_time = 0;
 			skb->protocol = htons(ETH_P_MAP);
 			state->send_agg_skb(skb);
 			spin_unlock_bh(&state->agg_lock);
@@ -1512,17 +1590,18 @@ void rmnet_map_tx_aggregate(struct sk_buff *skb, struct rmnet_port *port,
 		state->agg_skb->dev = skb->dev;
 		state->agg_skb->protocol = htons(ETH_P_MAP);
 		state->agg_count = 1;
-		ktime_get_real_ts64(&state->agg_time);
+		state->agg_time = state->agg_last;
 		dev_kfree_skb_any(skb);
 		goto schedule;
 	}
-	diff = timespec64_sub(state->agg_last, state->agg_time);
 	size = skb_tailroom(state->agg_skb);
 
 	if (skb->len > size ||
 	    state->agg_count >= state->params.agg_count ||
-	    diff.tv_sec > 0 || diff.tv_nsec > rmnet_agg_time_limit) {
+	    ktime_to_ns(ktime_sub(state->agg_last, state->agg_time)) >
+	    rmnet_agg_time_limit) {
 		rmnet_map_send_agg_skb(state);
+		spin_lock_bh(&state->agg_lock);
 		goto new_packet;
 	}
 
@@ -1534,8 +1613,8 @@ void rmnet_map_tx_aggregate(struct sk_buff *skb, struct rmnet_port *port,
 	if (state->agg_state != -EINPROGRESS) {
 		state->agg_state = -EINPROGRESS;
 		hrtimer_start(&state->hrtimer,
-			      ns_to_ktime(state->params.agg_time),
-			      HRTIMER_MODE_REL);
+			      ns_to_ktime(rmnet_map_agg_idle_time(state)),
+			      HRTIMER_MODE_REL_SOFT);
 	}
 	spin_unlock_bh(&state->agg_lock);
 }
@@ -1579,11 +1658,9 @@ void rmnet_map_tx_aggregate_init(struct rmnet_port *port)
 		struct rmnet_aggregation_state *state = &port->agg_state[i];
 
 		spin_lock_init(&state->agg_lock);
-		INIT_LIST_HEAD(&state->agg_list);
 		hrtimer_init(&state->hrtimer, CLOCK_MONOTONIC,
-			     HRTIMER_MODE_REL);
+			     HRTIMER_MODE_REL_SOFT);
 		state->hrtimer.function = rmnet_map_flush_tx_packet_queue;
-		INIT_WORK(&state->agg_wq, rmnet_map_flush_tx_packet_work);
 		state->stats = &port->stats.agg;
 
 		/* Since PAGE_SIZE - 1 is specified here, no pages are
@@ -1608,7 +1685,6 @@ void rmnet_map_tx_aggregate_exit(struct rmnet_port *port)
 		struct rmnet_aggregation_state *state = &port->agg_state[i];
 
 		hrtimer_cancel(&state->hrtimer);
-		cancel_work_sync(&state->agg_wq);
 	}
 
 	for (i = RMNET_DEFAULT_AGG_STATE; i < RMNET_MAX_AGG_STATE; i++) {
@@ -1620,8 +1696,7 @@ void rmnet_map_tx_aggregate_exit(struct rmnet_port *port)
 				kfree_skb(state->agg_skb);
 				state->agg_skb = NULL;
 				state->agg_count = 0;
-				memset(&state->agg_time, 0,
-				       sizeof(state->agg_time));
+				state->agg_time = 0;
 			}
 
 			state->agg_state = 0;
@@ -1659,7 +1734,7 @@ void rmnet_map_tx_qmap_cmd(struct sk_buff *qmap_skb, u8 ch, bool flush)
 		agg_skb = state->agg_skb;
 		state->agg_skb = NULL;
 		state->agg_count = 0;
-		memset(&state->agg_time, 0, sizeof(state->agg_time));
+		state->agg_time = 0;
 		state->agg_state = 0;
 		state->send_agg_skb(agg_skb);
 		spin_unlock_bh(&state->agg_lock);
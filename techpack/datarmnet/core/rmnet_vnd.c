@@ -495,6 +495,8 @@ static const char rmnet_gstrings_stats[][ETH_GSTRING_LEN] = {
 	"Coalescing TCP bytes",
 	"Coalescing UDP frames",
 	"Coalescing UDP bytes",
+	"Coalescing tail segments merged",
+	"Coalescing frames merged",
 	"Uplink priority packets",
 	"TSO packets",
 	"TSO packets arriving incorrectly",
@@ -521,6 +523,7 @@ static const char rmnet_port_gstrings_stats[][ETH_GSTRING_LEN] = {
 	"DL trailer pkts received",
 	"UL agg reuse",
 	"UL agg alloc",
+	"UL agg bypass",
 	"DL chaining [0-10)",
 	"DL chaining [10-20)",
 	"DL chaining [20-30)",
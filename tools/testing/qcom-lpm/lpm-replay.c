@@ -0,0 +1,483 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Trace replay harness for the qcom-lpm CPU idle prediction.
+ *
+ * The cpu_predict(), find_deviation(), update_cpu_history() and
+ * start_prediction_timer() helpers are extracted from the governor at build
+ * time and driven with a mock cpuidle driver and device, the same way
+ * lpm_select() drives them, for each idle period of a trace.
+ *
+ * A trace has one idle period per line:
+ *
+ *	<sleep length us> <idle duration us> [t|i|d]
+ *
+ * where the sleep length is the time till the next timer at idle entry, the
+ * idle duration is how long the CPU actually stayed idle and the optional
+ * last field tells whether the CPU was woken up by a timer, an IPI or
+ * another device interrupt. Lines starting with '#' are ignored. Synthetic
+ * traces can be generated with -g instead.
+ *
+ * Every trace is replayed with and without the prediction, and the harness
+ * reports how often the energy optimal state was selected, the energy lost
+ * to mis-selections according to a simple power model of the idle states
+ * and the cost of the prediction itself.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lpm.h"
+
+#define REASON_DEVICE	'd'
+#define REASON_IPI	'i'
+#define REASON_TIMER	't'
+
+bool prediction_disabled;
+bool sleep_disabled;
+
+struct idle_period {
+	uint32_t sleep_us;
+	uint32_t idle_us;
+	char reason;
+};
+
+struct trace {
+	const char *name;
+	struct idle_period *periods;
+	size_t count;
+	size_t size;
+};
+
+/* Idle state power model, indexed like the mock driver states */
+struct state_power {
+	double power_mw;
+	double transition_uj;
+};
+
+struct result {
+	size_t hits;
+	size_t shallow;
+	size_t deep;
+	size_t htmr_wakeups;
+	size_t pred_type[LPM_PRED_IPI_PATTERN + 1];
+	double energy_uj;
+	double ideal_uj;
+	u64 predict_ns;
+	size_t predict_calls;
+	u64 history_ns;
+	size_t history_calls;
+};
+
+static struct cpuidle_driver drv;
+static struct cpuidle_device dev;
+static struct lpm_cpu cpu_gov;
+static struct state_power power[CPUIDLE_STATE_MAX];
+
+/* Simulated time and prediction timer state */
+static ktime_t now_ns;
+static ktime_t last_ipi_ns;
+static uint32_t histtimer_us;
+
+/* WFI, retention and power collapse of a little core */
+static const char *default_states[] = {
+	"wfi:1:1:40:0",
+	"ret:100:500:15:2",
+	"pc:909:3934:2:40",
+};
+
+void histtimer_start(uint32_t time_us)
+{
+	histtimer_us = time_us;
+}
+
+static u64 clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int add_state(const char *desc)
+{
+	struct cpuidle_state *s = &drv.states[drv.state_count];
+	struct state_power *p = &power[drv.state_count];
+	char name[CPUIDLE_NAME_LEN];
+	unsigned int exit_us, residency_us;
+
+	if (drv.state_count >= CPUIDLE_STATE_MAX)
+		return -ENOSPC;
+
+	if (sscanf(desc, "%15[^:]:%u:%u:%lf:%lf", name, &exit_us,
+		   &residency_us, &p->power_mw, &p->transition_uj) != 5)
+		return -EINVAL;
+
+	strcpy(s->name, name);
+	s->exit_latency = exit_us;
+	s->target_residency = residency_us;
+	s->exit_latency_ns = exit_us * NSEC_PER_USEC;
+	s->target_residency_ns = residency_us * NSEC_PER_USEC;
+	drv.state_count++;
+
+	return 0;
+}
+
+static double state_energy(int idx, uint32_t us)
+{
+	return power[idx].power_mw * us / 1000.0 + power[idx].transition_uj;
+}
+
+static int ideal_state(uint32_t us)
+{
+	int i, best = 0;
+
+	for (i = 1; i < drv.state_count; i++)
+		if (state_energy(i, us) < state_energy(best, us))
+			best = i;
+
+	return best;
+}
+
+static int trace_add(struct trace *t, uint32_t sleep_us, uint32_t idle_us,
+		     char reason)
+{
+	struct idle_period *p;
+
+	if (t->count == t->size) {
+		t->size = t->size ? 2 * t->size : 1024;
+		p = realloc(t->periods, t->size * sizeof(*p));
+		if (!p)
+			return -ENOMEM;
+		t->periods = p;
+	}
+
+	if (idle_us > sleep_us)
+		idle_us = sleep_us;
+	if (!reason)
+		reason = idle_us == sleep_us ? REASON_TIMER : REASON_DEVICE;
+
+	p = &t->periods[t->count++];
+	p->sleep_us = sleep_us;
+	p->idle_us = idle_us;
+	p->reason = reason;
+
+	return 0;
+}
+
+static int trace_load(struct trace *t, const char *path)
+{
+	unsigned int sleep_us, idle_us;
+	char line[256], reason;
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+
+	t->name = path;
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		reason = 0;
+		if (sscanf(line, "%u %u %c", &sleep_us, &idle_us, &reason) < 2) {
+			ret = -EINVAL;
+			break;
+		}
+
+		ret = trace_add(t, sleep_us, idle_us, reason);
+		if (ret)
+			break;
+	}
+
+	fclose(f);
+
+	return ret;
+}
+
+static uint32_t jitter(uint32_t us, uint32_t pct)
+{
+	uint32_t range = us * pct / 100;
+
+	return range ? us - range + random() % (2 * range + 1) : us;
+}
+
+static int trace_generate(struct trace *t, const char *pattern, size_t count)
+{
+	size_t i;
+	int ret = 0;
+
+	t->name = pattern;
+	for (i = 0; i < count && !ret; i++) {
+		if (!strcmp(pattern, "periodic")) {
+			/* Device interrupt every 2ms, next timer far away */
+			ret = trace_add(t, 16000, jitter(2000, 5), REASON_DEVICE);
+		} else if (!strcmp(pattern, "bursty")) {
+			/* Bursts of short idle periods, then a timer wakeup */
+			if (i % 5 == 4)
+				ret = trace_add(t, jitter(8000, 10), 8000,
+						REASON_TIMER);
+			else
+				ret = trace_add(t, 8000, jitter(300, 20),
+						REASON_DEVICE);
+		} else if (!strcmp(pattern, "ipi")) {
+			/* Regular IPIs from another CPU */
+			ret = trace_add(t, 12000, jitter(1500, 3), REASON_IPI);
+		} else if (!strcmp(pattern, "random")) {
+			uint32_t sleep_us = 500 + random() % 20000;
+
+			ret = trace_add(t, sleep_us, 50 + random() % sleep_us, 0);
+		} else {
+			return -EINVAL;
+		}
+	}
+
+	return ret;
+}
+
+static void sim_reset(bool predict)
+{
+	memset(&cpu_gov, 0, sizeof(cpu_gov));
+	memset(&dev, 0, sizeof(dev));
+	cpu_gov.drv = &drv;
+	cpu_gov.dev = &dev;
+	cpu_gov.last_idx = -1;
+	cpu_gov.enable = true;
+	prediction_disabled = !predict;
+	now_ns = last_ipi_ns = 0;
+}
+
+/* Mirror of lpm_select() for an unconstrained, active CPU */
+static int sim_select(uint32_t sleep_us, struct result *r)
+{
+	u64 duration_ns = (u64)sleep_us * NSEC_PER_USEC;
+	u64 start;
+	int i;
+
+	cpu_gov.predicted = 0;
+	cpu_gov.predict_started = false;
+	cpu_gov.now = now_ns;
+
+	start = clock_ns();
+	update_cpu_history(&cpu_gov);
+	r->history_ns += clock_ns() - start;
+	r->history_calls++;
+
+	for (i = drv.state_count - 1; i > 0; i--) {
+		struct cpuidle_state *s = &drv.states[i];
+
+		if (s->target_residency_ns > duration_ns)
+			continue;
+
+		if (!cpu_gov.predict_started) {
+			start = clock_ns();
+			cpu_predict(&cpu_gov, duration_ns);
+			r->predict_ns += clock_ns() - start;
+			r->predict_calls++;
+			cpu_gov.predict_started = true;
+		}
+
+		if (cpu_gov.predicted &&
+		    s->target_residency > cpu_gov.predicted)
+			continue;
+		break;
+	}
+
+	if (cpu_gov.predicted)
+		r->pred_type[cpu_gov.pred_type]++;
+
+	cpu_gov.last_idx = i;
+	cpu_gov.next_wakeup = ktime_add_us(cpu_gov.now, sleep_us);
+	histtimer_us = 0;
+	start_prediction_timer(&cpu_gov, sleep_us);
+
+	return i;
+}
+
+static void sim_idle(int idx, uint32_t us, struct result *r)
+{
+	r->energy_uj += state_energy(idx, us);
+	/* The residency measured by cpuidle includes the exit latency. */
+	dev.last_residency_ns = ((s64)us + drv.states[idx].exit_latency) *
+				NSEC_PER_USEC;
+	now_ns += (s64)us * NSEC_PER_USEC;
+}
+
+static void replay(struct trace *t, bool predict, struct result *r)
+{
+	size_t i;
+
+	memset(r, 0, sizeof(*r));
+	sim_reset(predict);
+
+	for (i = 0; i < t->count; i++) {
+		struct idle_period *p = &t->periods[i];
+		uint32_t sleep_us = p->sleep_us, idle_us = p->idle_us;
+		int ideal = ideal_state(idle_us);
+		bool split = false;
+		int idx;
+
+		r->ideal_uj += state_energy(ideal, idle_us);
+
+		/*
+		 * The prediction timer wakes the CPU up from a shallow state
+		 * if it stays idle for longer than predicted, in which case
+		 * it selects a state again for the rest of the idle period.
+		 */
+		for (;;) {
+			idx = sim_select(sleep_us, r);
+			if (!histtimer_us || histtimer_us >= idle_us)
+				break;
+
+			sim_idle(idx, histtimer_us, r);
+			cpu_gov.history_invalid = 1;
+			sleep_us -= histtimer_us;
+			idle_us -= histtimer_us;
+			r->htmr_wakeups++;
+			split = true;
+		}
+		sim_idle(idx, idle_us, r);
+
+		if (p->reason == REASON_IPI) {
+			struct history_ipi *h = &cpu_gov.ipi_history;
+
+			h->interval[h->current_ptr] =
+				ktime_to_us(now_ns - last_ipi_ns);
+			if (++h->current_ptr >= MAXSAMPLES)
+				h->current_ptr = 0;
+			last_ipi_ns = now_ns;
+		}
+
+		if (!split && idx == ideal)
+			r->hits++;
+		else if (idx < ideal)
+			r->shallow++;
+		else if (idx > ideal)
+			r->deep++;
+	}
+}
+
+static double pct(double n, double total)
+{
+	return total ? 100.0 * n / total : 0;
+}
+
+static void report(struct trace *t, struct result *pred, struct result *base)
+{
+	printf("trace %s: %zu idle periods\n", t->name, t->count);
+	printf("  %-28s %14s %14s\n", "", "prediction", "sleep length");
+	printf("  %-28s %13.1f%% %13.1f%%\n", "hit rate",
+	       pct(pred->hits, t->count), pct(base->hits, t->count));
+	printf("  %-28s %13.1f%% %13.1f%%\n", "too shallow",
+	       pct(pred->shallow, t->count), pct(base->shallow, t->count));
+	printf("  %-28s %13.1f%% %13.1f%%\n", "too deep",
+	       pct(pred->deep, t->count), pct(base->deep, t->count));
+	printf("  %-28s %14.0f %14.0f\n", "mis-selection cost (uJ)",
+	       pred->energy_uj - pred->ideal_uj,
+	       base->energy_uj - base->ideal_uj);
+	printf("  %-28s %13.1f%% %13.1f%%\n", "energy over ideal",
+	       pct(pred->energy_uj - pred->ideal_uj, pred->ideal_uj),
+	       pct(base->energy_uj - base->ideal_uj, base->ideal_uj));
+	printf("  %-28s %14zu\n", "prediction timer wakeups",
+	       pred->htmr_wakeups);
+	printf("  %-28s %14zu %14zu %14zu\n",
+	       "residency/premature/ipi", pred->pred_type[LPM_PRED_RESIDENCY_PATTERN],
+	       pred->pred_type[LPM_PRED_PREMATURE_EXITS],
+	       pred->pred_type[LPM_PRED_IPI_PATTERN]);
+	printf("  %-28s %14.1f\n", "cpu_predict() ns/call",
+	       pred->predict_calls ?
+	       (double)pred->predict_ns / pred->predict_calls : 0);
+	printf("  %-28s %14.1f\n", "update_cpu_history() ns/call",
+	       pred->history_calls ?
+	       (double)pred->history_ns / pred->history_calls : 0);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-s name:exit_us:residency_us:power_mw:transition_uj]...\n"
+		"          [-g periodic|bursty|ipi|random] [-n count] [-S seed] [trace]...\n",
+		prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct result pred, base;
+	const char *pattern = NULL;
+	size_t count = 10000;
+	unsigned int seed = 1;
+	struct trace t;
+	int opt, i, ret;
+
+	while ((opt = getopt(argc, argv, "g:n:s:S:h")) != -1) {
+		switch (opt) {
+		case 'g':
+			pattern = optarg;
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			if (add_state(optarg))
+				usage(argv[0]);
+			break;
+		case 'S':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!drv.state_count)
+		for (i = 0; i < sizeof(default_states) / sizeof(default_states[0]); i++)
+			add_state(default_states[i]);
+
+	if (!pattern && optind == argc)
+		pattern = "periodic,bursty,ipi,random";
+
+	srandom(seed);
+
+	if (pattern) {
+		char *patterns = strdup(pattern), *p, *save;
+
+		for (p = strtok_r(patterns, ",", &save); p;
+		     p = strtok_r(NULL, ",", &save)) {
+			memset(&t, 0, sizeof(t));
+			ret = trace_generate(&t, p, count);
+			if (ret) {
+				fprintf(stderr, "%s: %s\n", p, strerror(-ret));
+				return EXIT_FAILURE;
+			}
+			t.name = p;
+			replay(&t, true, &pred);
+			replay(&t, false, &base);
+			report(&t, &pred, &base);
+			free(t.periods);
+		}
+		free(patterns);
+	}
+
+	for (i = optind; i < argc; i++) {
+		memset(&t, 0, sizeof(t));
+		ret = trace_load(&t, argv[i]);
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", argv[i], strerror(-ret));
+			return EXIT_FAILURE;
+		}
+		replay(&t, true, &pred);
+		replay(&t, false, &base);
+		report(&t, &pred, &base);
+		free(t.periods);
+	}
+
+	return EXIT_SUCCESS;
+}
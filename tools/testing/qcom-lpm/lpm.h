@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Just enough of the kernel environment to build the prediction code of
+ * drivers/cpuidle/governors/qcom-lpm.c in userspace.
+ */
+#ifndef _LPM_H
+#define _LPM_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t s64;
+typedef s64 ktime_t;
+typedef int spinlock_t;
+
+#define NSEC_PER_USEC		1000L
+#define CPUIDLE_STATE_MAX	10
+#define CPUIDLE_NAME_LEN	16
+
+#define BIT(nr)			(1UL << (nr))
+
+#define do_div(n, base) ({					\
+	uint32_t __base = (base);				\
+	uint32_t __rem = (n) % __base;				\
+	(n) /= __base;						\
+	__rem;							\
+})
+
+static inline s64 ktime_to_us(ktime_t kt)
+{
+	return kt / NSEC_PER_USEC;
+}
+
+static inline ktime_t ktime_add_us(ktime_t kt, u64 usec)
+{
+	return kt + usec * NSEC_PER_USEC;
+}
+
+static inline unsigned long int_sqrt(unsigned long x)
+{
+	unsigned long b, m, y = 0;
+
+	if (x <= 1)
+		return x;
+
+	m = 1UL << ((sizeof(x) * 8 - 2) & ~1UL);
+	while (m > x)
+		m >>= 2;
+
+	while (m) {
+		b = y + m;
+		y >>= 1;
+		if (x >= b) {
+			x -= b;
+			y += m;
+		}
+		m >>= 2;
+	}
+
+	return y;
+}
+
+struct cpuidle_state {
+	char		name[CPUIDLE_NAME_LEN];
+	s64		exit_latency_ns;
+	s64		target_residency_ns;
+	unsigned int	exit_latency;
+	unsigned int	target_residency;
+};
+
+struct cpuidle_state_usage {
+	unsigned long long	disable;
+};
+
+struct cpuidle_driver {
+	struct cpuidle_state	states[CPUIDLE_STATE_MAX];
+	int			state_count;
+};
+
+struct cpuidle_device {
+	unsigned int			cpu;
+	s64				last_residency_ns;
+	struct cpuidle_state_usage	states_usage[CPUIDLE_STATE_MAX];
+};
+
+struct hrtimer { int unused; };
+struct notifier_block { int unused; };
+struct kobj_attribute { int unused; };
+struct work_struct { int unused; };
+struct list_head { struct list_head *next, *prev; };
+
+struct attribute;
+struct attribute_group;
+struct device;
+struct generic_pm_domain;
+struct kobject;
+
+#define DECLARE_PER_CPU(type, name)	extern type name
+
+#define trace_gov_pred_hist(idx, resi, tmr)	do { } while (0)
+
+/* Provided by the harness in place of the per CPU prediction hrtimer */
+void histtimer_start(uint32_t time_us);
+
+#include "qcom-lpm.h"
+
+/* Extracted from qcom-lpm.c */
+uint64_t find_deviation(struct lpm_cpu *cpu_gov, int *samples_history,
+			u64 duration_ns);
+void cpu_predict(struct lpm_cpu *cpu_gov, u64 duration_ns);
+void update_cpu_history(struct lpm_cpu *cpu_gov);
+int start_prediction_timer(struct lpm_cpu *cpu_gov, int duration_us);
+
+#endif /* _LPM_H */
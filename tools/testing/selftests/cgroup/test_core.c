@@ -837,6 +837,146 @@ static int test_cgcore_lesser_ns_open(const char *root)
 	return ret;
 }
 
+static int cpu_hog_noexit(const char *cgroup, void *arg)
+{
+	int ppid = getppid();
+
+	while (getppid() == ppid)
+		;
+
+	return 0;
+}
+
+struct rstat_reader {
+	pthread_t thread;
+	const char *cgroup;
+	volatile int *stop;
+	long reads;
+	int err;
+};
+
+static void *rstat_reader_fn(void *arg)
+{
+	struct rstat_reader *reader = arg;
+	long usage, prev = 0;
+
+	while (!*reader->stop) {
+		usage = cg_read_key_long(reader->cgroup, "cpu.stat",
+					 "usage_usec");
+		if (usage < prev) {
+			reader->err = 1;
+			break;
+		}
+		prev = usage;
+		reader->reads++;
+	}
+
+	return NULL;
+}
+
+/*
+ * Test that reading the base cpu stats of sibling cgroups from many threads
+ * in parallel, which flushes their rstat subtrees concurrently, gives
+ * monotonic per-cgroup usage and a parent usage covering the sum of its
+ * children's.  The achieved read rate is reported for comparison.
+ */
+static int test_cgcore_rstat_parallel_readers(const char *root)
+{
+	int ret = KSFT_FAIL;
+	int c, r, n_children = 4, n_readers = 4 * (n_children + 1);
+	int pids[n_children];
+	char *parent = NULL, *children[n_children];
+	struct rstat_reader readers[n_readers];
+	volatile int stop = 0;
+	long usage, sum = 0, reads = 0;
+	int c_readers = 0;
+
+	memset(pids, 0, sizeof(pids));
+	memset(children, 0, sizeof(children));
+
+	parent = cg_name(root, "cg_rstat");
+	if (!parent || cg_create(parent))
+		goto cleanup;
+
+	for (c = 0; c < n_children; c++) {
+		children[c] = cg_name_indexed(parent, "child", c);
+		if (!children[c] || cg_create(children[c]))
+			goto cleanup;
+
+		pids[c] = cg_run_nowait(children[c], cpu_hog_noexit, NULL);
+		if (pids[c] < 0)
+			goto cleanup;
+	}
+
+	for (c_readers = 0; c_readers < n_readers; c_readers++) {
+		struct rstat_reader *reader = &readers[c_readers];
+
+		memset(reader, 0, sizeof(*reader));
+		reader->cgroup = c_readers % (n_children + 1) == n_children ?
+			parent : children[c_readers % (n_children + 1)];
+		reader->stop = &stop;
+		if (pthread_create(&reader->thread, NULL, rstat_reader_fn,
+				   reader))
+			goto cleanup;
+	}
+
+	sleep(1);
+	stop = 1;
+
+	for (r = 0; r < c_readers; r++) {
+		pthread_join(readers[r].thread, NULL);
+		if (readers[r].err)
+			goto cleanup;
+		reads += readers[r].reads;
+	}
+	c_readers = 0;
+
+	ksft_print_msg("%d readers: %ld cpu.stat reads/s\n", n_readers, reads);
+
+	for (c = 0; c < n_children; c++) {
+		if (cg_killall(children[c]))
+			goto cleanup;
+		if (waitpid(pids[c], NULL, 0) < 0)
+			goto cleanup;
+		pids[c] = 0;
+	}
+
+	/* let reads past the coalescing window see the final usage */
+	usleep(100000);
+
+	for (c = 0; c < n_children; c++) {
+		usage = cg_read_key_long(children[c], "cpu.stat", "usage_usec");
+		if (usage <= 0)
+			goto cleanup;
+		sum += usage;
+	}
+
+	usage = cg_read_key_long(parent, "cpu.stat", "usage_usec");
+	if (usage < sum)
+		goto cleanup;
+
+	ret = KSFT_PASS;
+
+cleanup:
+	stop = 1;
+	for (r = 0; r < c_readers; r++)
+		pthread_join(readers[r].thread, NULL);
+
+	for (c = 0; c < n_children; c++) {
+		if (pids[c] > 0) {
+			kill(pids[c], SIGKILL);
+			waitpid(pids[c], NULL, 0);
+		}
+		if (children[c])
+			cg_destroy(children[c]);
+		free(children[c]);
+	}
+	if (parent)
+		cg_destroy(parent);
+	free(parent);
+	return ret;
+}
+
 #define T(x) { x, #x }
 struct corecg_test {
 	int (*fn)(const char *root);
@@ -854,6 +994,7 @@ struct corecg_test {
 	T(test_cgcore_destroy),
 	T(test_cgcore_lesser_euid_open),
 	T(test_cgcore_lesser_ns_open),
+	T(test_cgcore_rstat_parallel_readers),
 };
 #undef T
 
@@ -35,6 +35,12 @@ extern int optind;
 #ifndef TCP_ULP
 #define TCP_ULP 31
 #endif
+#ifndef SOL_MPTCP
+#define SOL_MPTCP 284
+#endif
+#ifndef MPTCP_SCHEDULER
+#define MPTCP_SCHEDULER 1
+#endif
 
 static int  poll_timeout = 10 * 1000;
 static bool listen_mode;
@@ -57,11 +63,12 @@ static int cfg_rcvbuf;
 static bool cfg_join;
 static bool cfg_remove;
 static int cfg_wait;
+static const char *cfg_sched;
 
 static void die_usage(void)
 {
 	fprintf(stderr, "Usage: mptcp_connect [-6] [-u] [-s MPTCP|TCP] [-p port] [-m mode]"
-		"[-l] [-w sec] connect_address\n");
+		"[-l] [-w sec] [-c sched] connect_address\n");
 	fprintf(stderr, "\t-6 use ipv6\n");
 	fprintf(stderr, "\t-t num -- set poll timeout to num\n");
 	fprintf(stderr, "\t-S num -- set SO_SNDBUF to num\n");
@@ -71,6 +78,7 @@ static void die_usage(void)
 	fprintf(stderr, "\t-m [poll|mmap|sendfile] -- use poll(default)/mmap+write/sendfile\n");
 	fprintf(stderr, "\t-u -- check mptcp ulp\n");
 	fprintf(stderr, "\t-w num -- wait num sec before closing the socket\n");
+	fprintf(stderr, "\t-c name -- use the named mptcp packet scheduler\n");
 	exit(1);
 }
 
@@ -140,6 +148,17 @@ static void set_sndbuf(int fd, unsigned int size)
 	}
 }
 
+static void set_sched(int fd, const char *name)
+{
+	int err;
+
+	err = setsockopt(fd, SOL_MPTCP, MPTCP_SCHEDULER, name, strlen(name));
+	if (err) {
+		perror("set MPTCP_SCHEDULER");
+		exit(1);
+	}
+}
+
 static int sock_listen_mptcp(const char * const listenaddr,
 			     const char * const port)
 {
@@ -760,6 +779,8 @@ int main_loop(void)
 		set_rcvbuf(fd, cfg_rcvbuf);
 	if (cfg_sndbuf)
 		set_sndbuf(fd, cfg_sndbuf);
+	if (cfg_sched)
+		set_sched(fd, cfg_sched);
 
 	return copyfd_io(0, fd, 1);
 }
@@ -826,7 +847,7 @@ static void parse_opts(int argc, char **argv)
 {
 	int c;
 
-	while ((c = getopt(argc, argv, "6jrlp:s:hut:m:S:R:w:")) != -1) {
+	while ((c = getopt(argc, argv, "6jrlp:s:hut:m:S:R:w:c:")) != -1) {
 		switch (c) {
 		case 'j':
 			cfg_join = true;
@@ -873,6 +894,9 @@ static void parse_opts(int argc, char **argv)
 		case 'w':
 			cfg_wait = atoi(optarg)*1000000;
 			break;
+		case 'c':
+			cfg_sched = optarg;
+			break;
 		}
 	}
 
@@ -904,6 +928,8 @@ int main(int argc, char *argv[])
 			set_rcvbuf(fd, cfg_rcvbuf);
 		if (cfg_sndbuf)
 			set_sndbuf(fd, cfg_sndbuf);
+		if (cfg_sched)
+			set_sched(fd, cfg_sched);
 
 		return main_loop_s(fd);
 	}
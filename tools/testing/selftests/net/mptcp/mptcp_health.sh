@@ -0,0 +1,125 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+
+. "$(dirname "${0}")/mptcp_lib.sh"
+
+rndh=$(printf %x $sec)-$(mktemp -u XXXXXX)
+ns1="ns1-$rndh"
+ns2="ns2-$rndh"
+ns3="ns3-$rndh"
+ksft_skip=4
+timeout=60
+test_cnt=1
+ret=0
+
+mptcp_lib_check_mptcp
+
+if ! mptcp_lib_has_file "/proc/sys/net/mptcp/health_check"; then
+	echo "SKIP: MPTCP subflow health check is not available"
+	exit $ksft_skip
+fi
+
+ip -Version > /dev/null 2>&1
+if [ $? -ne 0 ];then
+	echo "SKIP: Could not run test without ip tool"
+	exit $ksft_skip
+fi
+
+# Three paths from ns1 to the ns2 router, see mptcp_lib_paths_init()
+setup()
+{
+	local dev
+
+	mptcp_lib_paths_init 8192 1024 1 2 4
+
+	# one subflow at a time: the second endpoint is only used as a
+	# replacement for the first one
+	ip netns exec "$ns1" ./pm_nl_ctl limits 0 1
+	ip netns exec "$ns3" ./pm_nl_ctl limits 0 4
+
+	for dev in ns1eth1 ns1eth2 ns1eth4; do
+		tc -n $ns1 qdisc add dev $dev root netem rate 10mbit delay 1ms
+	done
+	for dev in ns2eth1 ns2eth2 ns2eth4; do
+		tc -n $ns2 qdisc add dev $dev root netem rate 10mbit delay 1ms
+	done
+}
+
+# $1: netem options for the second path, both directions
+set_path2()
+{
+	tc -n $ns1 qdisc change dev ns1eth2 root netem $*
+	tc -n $ns2 qdisc change dev ns2eth2 root netem $*
+}
+
+# $1: 1 if the second path should get demoted and replaced
+do_transfer()
+{
+	local expect=$1
+	local port
+	port=$((10000+$test_cnt))
+	test_cnt=$((test_cnt+1))
+
+	local demote replace
+	demote=$(mptcp_lib_get_counter $ns1 MPTcpExtSubflowDemote)
+	replace=$(mptcp_lib_get_counter $ns1 MPTcpExtSubflowReplace)
+
+	mptcp_lib_transfer_start $port
+
+	# the Wi-Fi goes bad while the transfer is in progress
+	sleep 1
+	set_path2 rate 10mbit delay 100ms loss 40%
+
+	mptcp_lib_transfer_wait
+	local rc=$?
+
+	set_path2 rate 10mbit delay 1ms
+
+	demote=$(( $(mptcp_lib_get_counter $ns1 MPTcpExtSubflowDemote) - demote ))
+	replace=$(( $(mptcp_lib_get_counter $ns1 MPTcpExtSubflowReplace) - replace ))
+	local health_ok=0
+	if [ $expect -eq 1 ]; then
+		[ $demote -gt 0 ] && [ $replace -gt 0 ] || health_ok=1
+	else
+		[ $demote -eq 0 ] && [ $replace -eq 0 ] || health_ok=1
+	fi
+
+	if [ $rc -eq 0 ] && [ $health_ok -eq 0 ]; then
+		echo "[ OK ]"
+		return 0
+	fi
+
+	echo "[ fail ]"
+	echo "demoted $demote, replaced $replace" 1>&2
+	mptcp_lib_transfer_dump
+	return 1
+}
+
+# $1: health_check sysctl value, $2: expect demotion
+run_test()
+{
+	local health=$1
+	local expect=$2
+	shift 2
+	local msg=$*
+
+	ip netns exec $ns1 sysctl -q net.mptcp.health_check=$health
+
+	printf "%-50s" "$msg"
+	do_transfer $expect || ret=1
+}
+
+setup
+
+printf "%-50s" "sysctl health check disabled by default"
+if [ "$(ip netns exec $ns1 sysctl -n net.mptcp.health_check)" = "0" ]; then
+	echo "[ OK ]"
+else
+	echo "[ fail ]"
+	ret=1
+fi
+
+run_test 0 0 "degraded path, no health check"
+run_test 1 1 "degraded path demoted and replaced"
+
+exit $ret
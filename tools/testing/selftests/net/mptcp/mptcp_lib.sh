@@ -102,3 +102,136 @@ mptcp_lib_kversion_ge() {
 
 	mptcp_lib_fail_if_expected_feature "kernel version ${1} lower than ${v}"
 }
+
+# $1: ns, $2: port
+mptcp_lib_wait_local_port_listen() {
+	local listener_ns="${1}"
+	local port="${2}"
+
+	local port_hex i
+
+	port_hex="$(printf "%04X" "${port}")"
+	for i in $(seq 10); do
+		ip netns exec "${listener_ns}" cat /proc/net/tcp* | \
+			awk "BEGIN {rc=1} {if (\$2 ~ /:${port_hex}\$/ && \$4 ~ /0A/) {rc=0; exit}} END {exit rc}" &&
+			break
+		sleep 0.1
+	done
+}
+
+# $1: ns, $2: MIB counter
+mptcp_lib_get_counter() {
+	ip netns exec "${1}" nstat -asz "${2}" | \
+		awk -v name="${2}" '$1 == name {print $2}'
+}
+
+# The helpers below set up a client in $ns1 talking to a server in $ns3
+# through a router in $ns2, with one veth pair per path of the client:
+#
+#  ns1                  ns2                    ns3
+#     ns1eth<i>  ns2eth<i>    ns2eth3      ns3eth1
+#     10.0.<i>.1 10.0.<i>.2   10.0.3.2     10.0.3.3
+#
+# They use the ns1, ns2, ns3, cin, cout, sin, sout and timeout variables
+# of the caller.
+
+mptcp_lib_paths_cleanup() {
+	rm -f "${cin}" "${cout}" "${sin}" "${sout}"
+
+	local netns
+	for netns in "${ns1}" "${ns2}" "${ns3}"; do
+		ip netns del "${netns}"
+	done
+}
+
+# $1: client file size in KB, $2: server file size in KB, $3..: client
+# paths, 3 excluded. The first path carries the default route, each other
+# one gets a subflow endpoint.
+mptcp_lib_paths_init() {
+	local csize="${1}"
+	local ssize="${2}"
+	shift 2
+	local first="${1}"
+	local i
+
+	cin=$(mktemp)
+	cout=$(mktemp)
+	sin=$(mktemp)
+	sout=$(mktemp)
+	dd if=/dev/urandom of="${cin}" bs=1024 count="${csize}" >/dev/null 2>&1
+	dd if=/dev/urandom of="${sin}" bs=1024 count="${ssize}" >/dev/null 2>&1
+
+	trap mptcp_lib_paths_cleanup EXIT
+
+	for i in "${ns1}" "${ns2}" "${ns3}"; do
+		ip netns add "${i}" || exit ${KSFT_SKIP}
+		ip -net "${i}" link set lo up
+	done
+
+	for i in "${@}"; do
+		ip link add ns1eth${i} netns "${ns1}" type veth \
+			peer name ns2eth${i} netns "${ns2}"
+
+		ip -net "${ns1}" addr add 10.0.${i}.1/24 dev ns1eth${i}
+		ip -net "${ns1}" link set ns1eth${i} up mtu 1500
+		ip -net "${ns2}" addr add 10.0.${i}.2/24 dev ns2eth${i}
+		ip -net "${ns2}" link set ns2eth${i} up mtu 1500
+
+		if [ "${i}" -eq "${first}" ]; then
+			ip -net "${ns1}" route add default via 10.0.${i}.2
+		else
+			ip -net "${ns1}" route add default via 10.0.${i}.2 \
+				metric $((100 + i))
+			ip netns exec "${ns1}" ./pm_nl_ctl add 10.0.${i}.1 \
+				dev ns1eth${i} flags subflow
+		fi
+	done
+	ip netns exec "${ns1}" sysctl -q net.ipv4.conf.all.rp_filter=0
+
+	ip link add ns2eth3 netns "${ns2}" type veth peer name ns3eth1 netns "${ns3}"
+
+	ip -net "${ns2}" addr add 10.0.3.2/24 dev ns2eth3
+	ip -net "${ns2}" link set ns2eth3 up mtu 1500
+	ip netns exec "${ns2}" sysctl -q net.ipv4.ip_forward=1
+
+	ip -net "${ns3}" addr add 10.0.3.3/24 dev ns3eth1
+	ip -net "${ns3}" link set ns3eth1 up mtu 1500
+	ip -net "${ns3}" route add default via 10.0.3.2
+}
+
+# $1: port, $2..: client options. Start sending $cin from the client and
+# $sin from the server, mptcp_lib_transfer_wait() collects the result.
+mptcp_lib_transfer_start() {
+	local port="${1}"
+	shift
+
+	:> "${cout}"
+	:> "${sout}"
+
+	ip netns exec "${ns3}" ./mptcp_connect -jt "${timeout}" -l -p "${port}" \
+		0.0.0.0 < "${sin}" > "${sout}" &
+	mptcp_lib_spid=$!
+
+	mptcp_lib_wait_local_port_listen "${ns3}" "${port}"
+
+	ip netns exec "${ns1}" ./mptcp_connect -jt "${timeout}" "${@}" \
+		-p "${port}" 10.0.3.3 < "${cin}" > "${cout}" &
+	mptcp_lib_cpid=$!
+}
+
+# Succeeds if both ends exited cleanly and got the other's data intact
+mptcp_lib_transfer_wait() {
+	wait "${mptcp_lib_cpid}"
+	mptcp_lib_retc=$?
+	wait "${mptcp_lib_spid}"
+	mptcp_lib_rets=$?
+
+	[ "${mptcp_lib_retc}" -eq 0 ] && [ "${mptcp_lib_rets}" -eq 0 ] &&
+		cmp -s "${sin}" "${cout}" && cmp -s "${cin}" "${sout}"
+}
+
+mptcp_lib_transfer_dump() {
+	echo "client exit code ${mptcp_lib_retc}, server ${mptcp_lib_rets}" 1>&2
+	ls -l "${sin}" "${cout}"
+	ls -l "${cin}" "${sout}"
+}
@@ -0,0 +1,138 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+
+. "$(dirname "${0}")/mptcp_lib.sh"
+
+rndh=$(printf %x $sec)-$(mktemp -u XXXXXX)
+ns1="ns1-$rndh"
+ns2="ns2-$rndh"
+ns3="ns3-$rndh"
+ksft_skip=4
+timeout=30
+test_cnt=1
+ret=0
+
+mptcp_lib_check_mptcp
+
+if ! mptcp_lib_has_file "/proc/sys/net/mptcp/scheduler"; then
+	echo "SKIP: MPTCP packet schedulers are not available"
+	exit $ksft_skip
+fi
+
+ip -Version > /dev/null 2>&1
+if [ $? -ne 0 ];then
+	echo "SKIP: Could not run test without ip tool"
+	exit $ksft_skip
+fi
+
+# Two paths from ns1 to the ns2 router, see mptcp_lib_paths_init()
+setup()
+{
+	mptcp_lib_paths_init 512 512 1 2
+
+	ip netns exec "$ns1" ./pm_nl_ctl limits 1 1
+	ip netns exec "$ns3" ./pm_nl_ctl limits 1 1
+
+	# a fast and a slow path, like Wi-Fi and cellular
+	tc -n $ns1 qdisc add dev ns1eth1 root netem rate 20mbit delay 1ms
+	tc -n $ns1 qdisc add dev ns1eth2 root netem rate 20mbit delay 50ms
+	tc -n $ns2 qdisc add dev ns2eth1 root netem rate 20mbit delay 1ms
+	tc -n $ns2 qdisc add dev ns2eth2 root netem rate 20mbit delay 50ms
+}
+
+# $1: ns
+get_dup_data()
+{
+	mptcp_lib_get_counter $1 MPTcpExtDuplicateData
+}
+
+# $1: scheduler option for the client, $2: expect duplicate data
+do_transfer()
+{
+	local copt=$1
+	local expect_dup=$2
+	local port
+	port=$((10000+$test_cnt))
+	test_cnt=$((test_cnt+1))
+
+	local dup_s dup_c
+	dup_s=$(get_dup_data $ns3)
+	dup_c=$(get_dup_data $ns1)
+
+	mptcp_lib_transfer_start $port $copt
+	mptcp_lib_transfer_wait
+	local rc=$?
+
+	# MPTCP-level retransmissions can duplicate data with any
+	# scheduler, so only its presence is checked
+	local dup=$(( $(get_dup_data $ns3) - dup_s + $(get_dup_data $ns1) - dup_c ))
+	local dup_ok=0
+	if [ $expect_dup -eq 1 ] && [ $dup -eq 0 ]; then
+		dup_ok=1
+	fi
+
+	if [ $rc -eq 0 ] && [ $dup_ok -eq 0 ]; then
+		echo "[ OK ]"
+		return 0
+	fi
+
+	echo "[ fail ]"
+	echo "duplicate data $dup" 1>&2
+	mptcp_lib_transfer_dump
+	return 1
+}
+
+# $1: sysctl value, $2: 0 if the write should succeed
+check_sysctl()
+{
+	local val=$1
+	local expect=$2
+	local rc=0
+
+	printf "%-50s" "sysctl scheduler=$val"
+	ip netns exec $ns1 sysctl -q net.mptcp.scheduler=$val > /dev/null 2>&1 || rc=1
+	if [ $rc -eq $expect ]; then
+		echo "[ OK ]"
+	else
+		echo "[ fail ]"
+		ret=1
+	fi
+}
+
+# $1: netns default scheduler, $2: client option, $3: expect dup data
+run_test()
+{
+	local sched=$1
+	local copt=$2
+	local expect_dup=$3
+	shift 3
+	local msg=$*
+	local ns
+
+	for ns in $ns1 $ns3; do
+		ip netns exec $ns sysctl -q net.mptcp.scheduler=$sched
+	done
+
+	printf "%-50s" "$msg"
+	do_transfer "$copt" $expect_dup || ret=1
+}
+
+setup
+
+printf "%-50s" "sysctl default scheduler"
+if [ "$(ip netns exec $ns1 sysctl -n net.mptcp.scheduler)" = "default" ]; then
+	echo "[ OK ]"
+else
+	echo "[ fail ]"
+	ret=1
+fi
+check_sysctl redundant 0
+check_sysctl nonexistent 1
+check_sysctl default 0
+
+run_test default "" 0 "default scheduler"
+run_test redundant "" 1 "redundant scheduler"
+run_test default "-c redundant" 1 "redundant scheduler on the client socket"
+run_test redundant "-c default" 1 "default scheduler on the client socket"
+
+exit $ret
@@ -0,0 +1,289 @@
+// SPDX-License-Identifier: GPL-2.0
+/* TPACKET_V3 rx ring with one block queue per CPU (PACKET_RX_RING_PERCPU)
+ *
+ * Send tagged UDP datagrams over loopback from each online CPU in turn.
+ * Loopback receives a packet on the CPU which sent it, so every copy the
+ * packet socket sees must land in the slice of blocks of that CPU. The
+ * blocks are never filled, so they only reach user space through the
+ * retire timer of each per-CPU queue.
+ *
+ * Usage: psock_tpacket_percpu [-n packets per CPU]
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <error.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include "../kselftest.h"
+
+#ifndef PACKET_RX_RING_PERCPU
+#define PACKET_RX_RING_PERCPU	24
+#endif
+
+#define BLOCK_SIZE		(1 << 16)
+#define FRAME_SIZE		2048
+#define BLOCKS_PER_CPU		4
+#define RETIRE_TOV_MS		10
+#define UDP_PORT		9000
+#define MAGIC			0x70637075	/* "pcpu" */
+
+struct tag {
+	uint32_t magic;
+	uint32_t cpu;
+	uint32_t seq;
+};
+
+static int cfg_num_pkts = 32;
+
+static int nr_queues;
+static unsigned int blocks_per_queue;
+static uint8_t *ring;
+static unsigned int block_nr;
+static long *seen;
+
+static int pfsock_open(void)
+{
+	struct tpacket_req3 req = {};
+	struct sockaddr_ll addr = {};
+	int fd, val, ret;
+	socklen_t len;
+
+	fd = socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+	if (fd < 0) {
+		if (errno == EPERM) {
+			fprintf(stderr, "SKIP: need CAP_NET_RAW\n");
+			exit(KSFT_SKIP);
+		}
+		error(1, errno, "socket");
+	}
+
+	val = TPACKET_V3;
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &val, sizeof(val)))
+		error(1, errno, "setsockopt PACKET_VERSION");
+
+	val = 1;
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING_PERCPU, &val,
+		       sizeof(val))) {
+		if (errno == ENOPROTOOPT) {
+			fprintf(stderr, "SKIP: no PACKET_RX_RING_PERCPU\n");
+			exit(KSFT_SKIP);
+		}
+		error(1, errno, "setsockopt PACKET_RX_RING_PERCPU");
+	}
+
+	len = sizeof(nr_queues);
+	if (getsockopt(fd, SOL_PACKET, PACKET_RX_RING_PERCPU, &nr_queues,
+		       &len))
+		error(1, errno, "getsockopt PACKET_RX_RING_PERCPU");
+	if (nr_queues < 1)
+		error(1, 0, "bad number of queues %d", nr_queues);
+
+	req.tp_block_size = BLOCK_SIZE;
+	req.tp_frame_size = FRAME_SIZE;
+	req.tp_retire_blk_tov = RETIRE_TOV_MS;
+
+	/* The ring must split evenly over the queues */
+	if (nr_queues > 1) {
+		req.tp_block_nr = nr_queues * BLOCKS_PER_CPU + 1;
+		req.tp_frame_nr = req.tp_block_nr * (BLOCK_SIZE / FRAME_SIZE);
+		ret = setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req,
+				 sizeof(req));
+		if (ret != -1 || errno != EINVAL)
+			error(1, errno, "uneven ring accepted");
+	}
+
+	block_nr = nr_queues * BLOCKS_PER_CPU;
+	blocks_per_queue = BLOCKS_PER_CPU;
+	req.tp_block_nr = block_nr;
+	req.tp_frame_nr = block_nr * (BLOCK_SIZE / FRAME_SIZE);
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)))
+		error(1, errno, "setsockopt PACKET_RX_RING");
+
+	/* The layout can't change once the ring is set up */
+	val = 0;
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING_PERCPU, &val,
+		       sizeof(val)) != -1 || errno != EBUSY)
+		error(1, errno, "PACKET_RX_RING_PERCPU changed with a ring");
+
+	ring = mmap(NULL, (size_t)block_nr * BLOCK_SIZE,
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, fd, 0);
+	if (ring == MAP_FAILED)
+		error(1, errno, "mmap");
+
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(ETH_P_IP);
+	addr.sll_ifindex = if_nametoindex("lo");
+	if (!addr.sll_ifindex)
+		error(1, errno, "if_nametoindex lo");
+	if (bind(fd, (void *)&addr, sizeof(addr)))
+		error(1, errno, "bind");
+
+	return fd;
+}
+
+static int udp_open(struct sockaddr_in *dst)
+{
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		error(1, errno, "socket udp");
+
+	dst->sin_family = AF_INET;
+	dst->sin_port = htons(UDP_PORT);
+	dst->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (void *)dst, sizeof(*dst)))
+		error(1, errno, "bind udp");
+
+	return fd;
+}
+
+static void send_from(int cpu, int fd, struct sockaddr_in *dst)
+{
+	struct tag tag = { .magic = MAGIC, .cpu = cpu };
+	char buf[64];
+	cpu_set_t set;
+	int i;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		error(1, errno, "sched_setaffinity %d", cpu);
+
+	for (i = 0; i < cfg_num_pkts; i++) {
+		tag.seq = i;
+		if (sendto(fd, &tag, sizeof(tag), 0, (void *)dst,
+			   sizeof(*dst)) != sizeof(tag))
+			error(1, errno, "sendto");
+		/* keep the socket from filling up */
+		recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+	}
+}
+
+/* Check every tagged packet of a block against the queue owning it */
+static int walk_block(unsigned int blk)
+{
+	struct tpacket_block_desc *pbd;
+	struct tpacket3_hdr *hdr;
+	unsigned int i, queue = blk / blocks_per_queue;
+	int errors = 0;
+
+	pbd = (void *)(ring + (size_t)blk * BLOCK_SIZE);
+	if (!(pbd->hdr.bh1.block_status & TP_STATUS_USER))
+		return 0;
+
+	hdr = (void *)((uint8_t *)pbd + pbd->hdr.bh1.offset_to_first_pkt);
+	for (i = 0; i < pbd->hdr.bh1.num_pkts; i++) {
+		struct iphdr *iph = (void *)((uint8_t *)hdr + hdr->tp_net);
+		struct udphdr *uh = (void *)(iph + 1);
+		struct tag *tag = (void *)(uh + 1);
+
+		if (iph->protocol == IPPROTO_UDP &&
+		    uh->dest == htons(UDP_PORT) && tag->magic == MAGIC) {
+			if (tag->cpu != queue) {
+				fprintf(stderr,
+					"packet from cpu %u in block %u of queue %u\n",
+					tag->cpu, blk, queue);
+				errors++;
+			} else {
+				seen[queue]++;
+			}
+		}
+
+		hdr = (void *)((uint8_t *)hdr + hdr->tp_next_offset);
+	}
+
+	__sync_synchronize();
+	pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	return errors;
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		switch (c) {
+		case 'n':
+			cfg_num_pkts = strtol(optarg, NULL, 0);
+			break;
+		default:
+			error(1, 0, "usage: %s [-n packets per CPU]", argv[0]);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct tpacket_stats_v3 st;
+	struct sockaddr_in dst = {};
+	int pfd, ufd, cpu, errors = 0;
+	unsigned int blk;
+	socklen_t len;
+	cpu_set_t online;
+
+	parse_opts(argc, argv);
+
+	if (sched_getaffinity(0, sizeof(online), &online))
+		error(1, errno, "sched_getaffinity");
+
+	pfd = pfsock_open();
+	ufd = udp_open(&dst);
+
+	seen = calloc(nr_queues, sizeof(*seen));
+	if (!seen)
+		error(1, errno, "calloc");
+
+	for (cpu = 0; cpu < nr_queues && cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &online))
+			continue;
+
+		send_from(cpu, ufd, &dst);
+
+		/* Let the retire timer of the queue close its block */
+		usleep(RETIRE_TOV_MS * 10 * 1000);
+
+		for (blk = 0; blk < block_nr; blk++)
+			errors += walk_block(blk);
+
+		/* Outgoing and incoming copies */
+		if (seen[cpu] < 2 * cfg_num_pkts) {
+			fprintf(stderr, "cpu %d: %ld of %d packets seen\n",
+				cpu, seen[cpu], 2 * cfg_num_pkts);
+			errors++;
+		}
+	}
+
+	len = sizeof(st);
+	if (getsockopt(pfd, SOL_PACKET, PACKET_STATISTICS, &st, &len))
+		error(1, errno, "getsockopt PACKET_STATISTICS");
+	if (st.tp_drops) {
+		fprintf(stderr, "%u packets dropped\n", st.tp_drops);
+		errors++;
+	}
+
+	munmap(ring, (size_t)block_nr * BLOCK_SIZE);
+	close(ufd);
+	close(pfd);
+
+	fprintf(stderr, "%s: %d queues\n", errors ? "FAIL" : "OK", nr_queues);
+	return errors ? KSFT_FAIL : KSFT_PASS;
+}
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Garbage collection of AF_UNIX sockets only referenced by in-flight fds
+ *
+ * Each socket is the receiving end of a stream socketpair, and an edge
+ * X -> Y queues the fd of X on Y through the sending end of Y. The cycle
+ * is built so that depth first search leaves members of the same strongly
+ * connected component with different lowlinks:
+ *
+ *	r -> a, a -> b, a -> c, b -> a, c -> r
+ *
+ * Once the receiving ends are closed, the collector must drop the queued
+ * fds, which the test sees as EOF on the sending ends. While one extra fd
+ * of the cycle is kept open, nothing may be collected.
+ *
+ * Usage: unix_gc
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <error.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+enum { R, A, B, C, NR_SOCKS };
+
+static const int edges[][2] = {
+	{ R, A }, { A, B }, { A, C }, { B, A }, { C, R },
+};
+
+static int rx[NR_SOCKS], tx[NR_SOCKS];
+
+/* Queue @fd on the socket connected to @via */
+static void send_fd(int fd, int via)
+{
+	char cmsgbuf[CMSG_SPACE(sizeof(int))] = {};
+	struct iovec iov = { .iov_base = "x", .iov_len = 1 };
+	struct msghdr msg = {};
+	struct cmsghdr *cm;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf;
+	msg.msg_controllen = sizeof(cmsgbuf);
+
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+
+	if (sendmsg(via, &msg, 0) != 1)
+		error(1, errno, "sendmsg");
+}
+
+/* Sending fds and releasing AF_UNIX sockets while fds are in flight both
+ * run the GC, leave it a self-referencing socket to collect on the way.
+ */
+static void trigger_gc(void)
+{
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+		error(1, errno, "socketpair");
+	send_fd(fds[0], fds[1]);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+/* Wait for the receiving ends to be released, or give up after @ms */
+static int nr_collected(int ms)
+{
+	struct pollfd pfd[NR_SOCKS];
+	int i, n = 0;
+
+	for (; ms > 0; ms -= 100) {
+		trigger_gc();
+
+		for (i = 0; i < NR_SOCKS; i++)
+			pfd[i] = (struct pollfd) { .fd = tx[i] };
+
+		/* The GC runs from a work item */
+		usleep(100 * 1000);
+
+		if (poll(pfd, NR_SOCKS, 0) < 0)
+			error(1, errno, "poll");
+
+		n = 0;
+		for (i = 0; i < NR_SOCKS; i++)
+			n += !!(pfd[i].revents & (POLLHUP | POLLRDHUP));
+		if (n == NR_SOCKS)
+			break;
+	}
+
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	int i, extra, n, fds[2];
+
+	for (i = 0; i < NR_SOCKS; i++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+			error(1, errno, "socketpair");
+		rx[i] = fds[0];
+		tx[i] = fds[1];
+	}
+
+	for (i = 0; i < sizeof(edges) / sizeof(edges[0]); i++)
+		send_fd(rx[edges[i][0]], tx[edges[i][1]]);
+
+	extra = dup(rx[B]);
+	if (extra < 0)
+		error(1, errno, "dup");
+
+	for (i = 0; i < NR_SOCKS; i++)
+		close(rx[i]);
+
+	n = nr_collected(500);
+	if (n) {
+		fprintf(stderr, "FAIL: %d sockets collected while referenced\n", n);
+		return 1;
+	}
+
+	close(extra);
+
+	n = nr_collected(5000);
+	if (n != NR_SOCKS) {
+		fprintf(stderr, "FAIL: %d of %d sockets collected\n", n, NR_SOCKS);
+		return 1;
+	}
+
+	fprintf(stderr, "OK. All tests passed\n");
+	return 0;
+}
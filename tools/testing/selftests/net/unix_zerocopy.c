@@ -0,0 +1,253 @@
+// SPDX-License-Identifier: GPL-2.0
+/* Throughput of an AF_UNIX stream socketpair, with and without MSG_ZEROCOPY
+ *
+ * The parent sends for a fixed time, the child reads everything back.
+ * With -z, the sender waits for its zerocopy completions on the error
+ * queue before reusing the buffer, like a real user would have to.
+ *
+ * Usage: unix_zerocopy [-z] [-s size] [-t seconds]
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <error.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/errqueue.h>
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY		5
+#endif
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY	60
+#endif
+
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED	1
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY	0x4000000
+#endif
+
+static bool cfg_zerocopy;
+static int cfg_payload_len = 1 << 20;
+static int cfg_runtime_ms = 4200;
+
+static uint32_t next_completion;
+static long packets, bytes, completions, expected_completions;
+static long zerocopied = -1;
+
+static unsigned long gettimeofday_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+}
+
+static bool do_recv_completion(int fd)
+{
+	struct sock_extended_err *serr;
+	struct msghdr msg = {};
+	struct cmsghdr *cm;
+	uint32_t hi, lo, range;
+	char control[100];
+	int ret;
+
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ret = recvmsg(fd, &msg, MSG_ERRQUEUE);
+	if (ret == -1 && errno == EAGAIN)
+		return false;
+	if (ret == -1)
+		error(1, errno, "recvmsg notification");
+	if (msg.msg_flags & MSG_CTRUNC)
+		error(1, 0, "recvmsg notification: truncated");
+
+	cm = CMSG_FIRSTHDR(&msg);
+	if (!cm)
+		error(1, 0, "cmsg: no cmsg");
+	if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SO_ZEROCOPY)
+		error(1, 0, "cmsg: wrong type: %d.%d",
+		      cm->cmsg_level, cm->cmsg_type);
+
+	serr = (void *)CMSG_DATA(cm);
+	if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+		error(1, 0, "serr: wrong origin: %u", serr->ee_origin);
+	if (serr->ee_errno != 0)
+		error(1, 0, "serr: wrong error code: %u", serr->ee_errno);
+
+	hi = serr->ee_data;
+	lo = serr->ee_info;
+	range = hi - lo + 1;
+
+	if (lo != next_completion)
+		fprintf(stderr, "gap: %u..%u does not append to %u\n",
+			lo, hi, next_completion);
+	next_completion = hi + 1;
+
+	if (zerocopied == -1)
+		zerocopied = !(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+	else if (zerocopied != !(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED))
+		fprintf(stderr, "serr: inconsistent zerocopy mode\n");
+
+	completions += range;
+	return true;
+}
+
+/* The buffer is only free again once the kernel let go of the pages */
+static void do_recv_completions(int fd)
+{
+	struct pollfd pfd = { .fd = fd };
+
+	while (completions < expected_completions) {
+		if (do_recv_completion(fd))
+			continue;
+		if (poll(&pfd, 1, 1000) != 1 || !(pfd.revents & POLLERR))
+			error(1, 0, "poll: no completion");
+	}
+}
+
+static void do_tx(int fd)
+{
+	unsigned long tstop, tstart;
+	char *buf;
+	int flags = 0;
+	int val = 1;
+
+	buf = malloc(cfg_payload_len);
+	if (!buf)
+		error(1, errno, "malloc");
+	memset(buf, 'a', cfg_payload_len);
+
+	if (cfg_zerocopy) {
+		if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val)))
+			error(1, errno, "setsockopt zerocopy");
+		flags = MSG_ZEROCOPY;
+	}
+
+	tstart = gettimeofday_ms();
+	tstop = tstart + cfg_runtime_ms;
+	do {
+		ssize_t ret;
+
+		ret = send(fd, buf, cfg_payload_len, flags);
+		if (ret == -1)
+			error(1, errno, "send");
+		if (ret != cfg_payload_len)
+			error(1, 0, "send: short %zd < %d",
+			      ret, cfg_payload_len);
+
+		packets++;
+		bytes += ret;
+
+		if (cfg_zerocopy) {
+			expected_completions++;
+			do_recv_completions(fd);
+		}
+	} while (gettimeofday_ms() < tstop);
+
+	if (shutdown(fd, SHUT_WR))
+		error(1, errno, "shutdown");
+
+	tstop = gettimeofday_ms() - tstart;
+	fprintf(stderr, "tx=%lu (%lu MB) txc=%lu zc=%c %lu MB/s\n",
+		packets, bytes >> 20, completions,
+		zerocopied == 1 ? 'y' : 'n',
+		(bytes >> 20) * 1000 / (tstop ? : 1));
+
+	free(buf);
+}
+
+static void do_rx(int fd)
+{
+	static char buf[1 << 16];
+	long rx = 0;
+	ssize_t ret;
+
+	while ((ret = recv(fd, buf, sizeof(buf), 0)) > 0)
+		rx += ret;
+	if (ret == -1)
+		error(1, errno, "recv");
+
+	fprintf(stderr, "rx=%lu MB\n", rx >> 20);
+}
+
+static void usage(const char *filepath)
+{
+	error(1, 0, "Usage: %s [-z] [-s size] [-t seconds]", filepath);
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "s:t:z")) != -1) {
+		switch (c) {
+		case 's':
+			cfg_payload_len = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			cfg_runtime_ms = strtoul(optarg, NULL, 0) * 1000;
+			break;
+		case 'z':
+			cfg_zerocopy = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (cfg_payload_len <= 0)
+		usage(argv[0]);
+}
+
+int main(int argc, char **argv)
+{
+	int fds[2], status;
+	pid_t pid;
+
+	parse_opts(argc, argv);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+		error(1, errno, "socketpair");
+
+	pid = fork();
+	if (pid == -1)
+		error(1, errno, "fork");
+
+	if (!pid) {
+		close(fds[0]);
+		do_rx(fds[1]);
+		exit(0);
+	}
+
+	close(fds[1]);
+	do_tx(fds[0]);
+	close(fds[0]);
+
+	if (waitpid(pid, &status, 0) == -1)
+		error(1, errno, "waitpid");
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		error(1, 0, "receiver failed");
+
+	if (cfg_zerocopy && zerocopied != 1)
+		error(1, 0, "no zerocopy completion");
+
+	fprintf(stderr, "OK. All tests passed\n");
+	return 0;
+}
@@ -0,0 +1,129 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+#
+# This script tests that consecutive ciphertexts for a peer leave as UDP GSO
+# packets, segmented either by the stack or by the (veth) NIC, and reports
+# the throughput of both. The iperf3 client runs in $ns0 and is routed
+# through $ns1, so that the only packets $ns1 builds itself are the outer
+# UDP ones:
+#
+#    $ns0 namespace         $ns1 namespace                      $ns2 namespace
+#
+#                           wg0 192.168.241.1/24  <- tunnel ->   wg0 192.168.241.2/24
+#    veth0 192.168.1.100/24 <-> veth0 192.168.1.1/24
+#                           veth1 10.0.0.1/24     <-- veth -->   veth2 10.0.0.2/24
+
+set -e
+shopt -s extglob
+
+exec 3>&1
+export LANG=C
+export WG_HIDE_KEYS=never
+ns0="wg-gso-$$-0"
+ns1="wg-gso-$$-1"
+ns2="wg-gso-$$-2"
+pretty() { echo -e "\x1b[32m\x1b[1m[+] ${1:+NS$1: }${2}\x1b[0m" >&3; }
+pp() { pretty "" "$*"; "$@"; }
+maybe_exec() { if [[ $BASHPID -eq $$ ]]; then "$@"; else exec "$@"; fi; }
+n0() { pretty 0 "$*"; maybe_exec ip netns exec $ns0 "$@"; }
+n1() { pretty 1 "$*"; maybe_exec ip netns exec $ns1 "$@"; }
+n2() { pretty 2 "$*"; maybe_exec ip netns exec $ns2 "$@"; }
+ip0() { pretty 0 "ip $*"; ip -n $ns0 "$@"; }
+ip1() { pretty 1 "ip $*"; ip -n $ns1 "$@"; }
+ip2() { pretty 2 "ip $*"; ip -n $ns2 "$@"; }
+sleep() { read -t "$1" -N 1 || true; }
+waitiperf() { pretty "${1//*-}" "wait for iperf:5201 pid $2"; while [[ $(ss -N "$1" -tlpH 'sport = 5201') != *\"iperf3\",pid=$2,fd=* ]]; do sleep 0.1; done; }
+
+cleanup() {
+	set +e
+	exec 2>/dev/null
+	local to_kill="$(ip netns pids $ns0) $(ip netns pids $ns1) $(ip netns pids $ns2)"
+	[[ -n $to_kill ]] && kill $to_kill
+	pp ip netns del $ns0
+	pp ip netns del $ns1
+	pp ip netns del $ns2
+	exit
+}
+
+for tool in wg iperf3 ss; do
+	if ! command -v $tool >/dev/null; then
+		echo "SKIP: $tool not found"
+		exit 4
+	fi
+done
+
+trap cleanup EXIT
+
+pp ip netns add $ns0
+pp ip netns add $ns1
+pp ip netns add $ns2
+ip0 link set up dev lo
+ip1 link set up dev lo
+ip2 link set up dev lo
+
+ip0 link add veth0 type veth peer name veth0 netns $ns1
+ip0 addr add 192.168.1.100/24 dev veth0
+ip1 addr add 192.168.1.1/24 dev veth0
+ip0 link set veth0 up
+ip1 link set veth0 up
+ip0 route add default via 192.168.1.1
+n1 sysctl -q net.ipv4.ip_forward=1
+
+ip1 link add veth1 type veth peer name veth2 netns $ns2
+ip1 addr add 10.0.0.1/24 dev veth1
+ip2 addr add 10.0.0.2/24 dev veth2
+ip1 link set veth1 up
+ip2 link set veth2 up
+
+key1="$(pp wg genkey)"
+key2="$(pp wg genkey)"
+pub1="$(pp wg pubkey <<<"$key1")"
+pub2="$(pp wg pubkey <<<"$key2")"
+
+ip1 link add dev wg0 type wireguard
+ip2 link add dev wg0 type wireguard
+n1 wg set wg0 private-key <(echo "$key1") listen-port 1 \
+	peer "$pub2" allowed-ips 192.168.241.2/32 endpoint 10.0.0.2:2
+n2 wg set wg0 private-key <(echo "$key2") listen-port 2 \
+	peer "$pub1" allowed-ips 192.168.241.1/32,192.168.1.0/24 endpoint 10.0.0.1:1
+ip1 addr add 192.168.241.1/24 dev wg0
+ip2 addr add 192.168.241.2/24 dev wg0
+ip1 link set up dev wg0
+ip2 link set up dev wg0
+ip2 route add 192.168.1.0/24 dev wg0
+
+n2 ping -c 2 -f -W 1 192.168.241.1
+n0 ping -c 2 -f -W 1 192.168.241.2
+
+# Ip: OutRequests counts a GSO packet once, the veth counts every segment.
+# ip_output() also counts the inner TCP that $ns1 forwards into wg0, so take
+# ForwDatagrams off to be left with the outer UDP sends.
+out_requests() { ip netns exec $ns1 awk '/^Ip: [0-9]/ { print $11 - $7 }' /proc/net/snmp; }
+tx_packets() { ip netns exec $ns1 cat /sys/class/net/veth1/statistics/tx_packets; }
+
+# $1: description
+run_iperf() {
+	local req pkts
+
+	req=$(out_requests)
+	pkts=$(tx_packets)
+	n2 iperf3 -s -1 -B 192.168.241.2 &
+	waitiperf $ns2 $!
+	n0 iperf3 -Z -t 3 -c 192.168.241.2 -f g | awk '/sender/ { print "'"$1"': " $7 " " $8 }' >&3
+	req=$(( $(out_requests) - req ))
+	pkts=$(( $(tx_packets) - pkts ))
+
+	pretty "" "$1: $req outer packets built for $pkts sent"
+	if (( req * 2 > pkts )); then
+		echo "FAIL: ciphertexts were not coalesced" >&3
+		exit 1
+	fi
+}
+
+run_iperf "segmented by veth"
+if command -v ethtool >/dev/null; then
+	n1 ethtool -K veth1 tx-udp-segmentation off
+	run_iperf "segmented by the stack"
+fi
+
+echo "OK" >&3